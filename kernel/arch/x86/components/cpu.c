@@ -167,6 +167,7 @@ ArchProcessorInitialize(
 
     // Enable cpu features
     CpuInitializeFeatures();
+    CpuInitializeMemoryOperations();
 
     // Initialize cpu systems, only do this for primary processor
     // @todo
@@ -0,0 +1,173 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * x86 Kernel Memory Operations
+ * - Kernel memcpy and memset. Small blocks use rep movsb/stosb on cpus with the
+ *   enhanced string instructions, page-sized and larger blocks are streamed with
+ *   non-temporal SSE stores so they do not evict the cache.
+ */
+#define __MODULE "CSTR"
+
+#include <arch/interrupts.h>
+#include <arch/thread.h>
+#include <component/cpu.h>
+#include <internal/_string.h>
+#include <machine.h>
+#include <debug.h>
+#include <cpu.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define __get_cpuid_count(Function, Registers) __cpuidex(Registers, Function, 0);
+#else
+#include <cpuid.h>
+#define __get_cpuid_count(Function, Registers) __cpuid_count(Function, 0, Registers[0], Registers[1], Registers[2], Registers[3]);
+#endif
+
+#define CPUID_FEAT_EBX7_ERMS     (1 << 9)
+#define STRING_ERMS_THRESHOLD    128
+#define STRING_STREAM_THRESHOLD  0x1000
+
+extern OsStatus_t ThreadingFpuException(MCoreThread_t *Thread);
+extern int  get_ts(void);
+extern void clear_ts(void);
+extern void save_xmm(uintptr_t* buffer);
+extern void load_xmm(uintptr_t* buffer);
+extern void stream_copy(void* destination, const void* source, size_t blocks);
+extern void stream_set(void* destination, uint32_t pattern, size_t blocks);
+
+static void* (*SmallCopy)(void*, const void*, size_t) = memcpy_base;
+static void* (*SmallSet)(void*, int, size_t)          = memset_base;
+
+/* StreamEnter
+ * Prepares the xmm registers for use by the kernel. If the fpu state of the current
+ * thread is not loaded, it is loaded the same way as if the thread itself had used the
+ * fpu, so it will be saved and restored if we are preempted while streaming. The
+ * registers the streaming functions use are then saved on the stack. */
+static void
+StreamEnter(
+    _In_ uintptr_t* Registers)
+{
+    SystemCpuCore_t* Core            = GetCurrentProcessorCore();
+    IntStatus_t      InterruptStatus = InterruptDisable();
+
+    if (get_ts()) {
+        if (Core->CurrentThread != NULL) {
+            ThreadingFpuException(Core->CurrentThread);
+        }
+        else {
+            clear_ts();
+        }
+    }
+    save_xmm(Registers);
+    InterruptRestoreState(InterruptStatus);
+}
+
+static void
+StreamLeave(
+    _In_ uintptr_t* Registers)
+{
+    load_xmm(Registers);
+}
+
+static void*
+KernelMemoryCopy(
+    _In_ void*       Destination,
+    _In_ const void* Source,
+    _In_ size_t      Count)
+{
+    uint8_t*       Destination8 = (uint8_t*)Destination;
+    const uint8_t* Source8      = (const uint8_t*)Source;
+    uintptr_t      Registers[64 / sizeof(uintptr_t)];
+    size_t         Head;
+
+    if (Count < STRING_STREAM_THRESHOLD) {
+        return (Count >= STRING_ERMS_THRESHOLD) ?
+            SmallCopy(Destination, Source, Count) : memcpy_base(Destination, Source, Count);
+    }
+
+    // Align the destination for the streaming stores
+    Head = (16 - ((uintptr_t)Destination8 & 15)) & 15;
+    memcpy_base(Destination8, Source8, Head);
+    Destination8 += Head;
+    Source8      += Head;
+    Count        -= Head;
+
+    StreamEnter(&Registers[0]);
+    stream_copy(Destination8, Source8, Count / 64);
+    StreamLeave(&Registers[0]);
+
+    memcpy_base(Destination8 + (Count & ~(size_t)63), Source8 + (Count & ~(size_t)63), Count & 63);
+    return Destination;
+}
+
+static void*
+KernelMemorySet(
+    _In_ void*  Destination,
+    _In_ int    Value,
+    _In_ size_t Count)
+{
+    uint8_t*  Destination8 = (uint8_t*)Destination;
+    uintptr_t Registers[64 / sizeof(uintptr_t)];
+    size_t    Head;
+
+    if (Count < STRING_STREAM_THRESHOLD) {
+        return (Count >= STRING_ERMS_THRESHOLD) ?
+            SmallSet(Destination, Value, Count) : memset_base(Destination, Value, Count);
+    }
+
+    Head = (16 - ((uintptr_t)Destination8 & 15)) & 15;
+    memset_base(Destination8, Value, Head);
+    Destination8 += Head;
+    Count        -= Head;
+
+    StreamEnter(&Registers[0]);
+    stream_set(Destination8, (Value & 0xFF) * 0x01010101U, Count / 64);
+    StreamLeave(&Registers[0]);
+
+    memset_base(Destination8 + (Count & ~(size_t)63), Value, Count & 63);
+    return Destination;
+}
+
+void
+CpuInitializeMemoryOperations(void)
+{
+    SystemCpu_t* Processor       = &GetMachine()->Processor;
+    uint32_t     CpuRegisters[4] = { 0 };
+
+    if (Processor->Data[CPU_DATA_MAXLEVEL] >= 7) {
+        __get_cpuid_count(7, CpuRegisters);
+        if (CpuRegisters[1] & CPUID_FEAT_EBX7_ERMS) {
+            SmallCopy = memcpy_erms;
+            SmallSet  = memset_erms;
+        }
+    }
+
+    // The streaming functions require SSE2, which every 64 bit cpu has
+    if (CpuHasFeatures(0, CPUID_FEAT_EDX_SSE2) == OsSuccess) {
+        __string_ops.memcpy = KernelMemoryCopy;
+        __string_ops.memset = KernelMemorySet;
+    }
+    else {
+        __string_ops.memcpy = SmallCopy;
+        __string_ops.memset = SmallSet;
+    }
+    TRACE("[cpu] [string] erms %s, sse2 %s", (SmallCopy == memcpy_erms) ? "yes" : "no",
+        (__string_ops.memcpy == KernelMemoryCopy) ? "yes" : "no");
+}
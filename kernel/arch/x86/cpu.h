@@ -129,6 +129,12 @@ enum CpuFeatures {
 KERNELAPI void KERNELABI
 CpuInitializeFeatures(void);
 
+/* CpuInitializeMemoryOperations
+ * Installs the kernel memcpy and memset implementations that are best suited for
+ * the features of the boot processor. Must be called after CpuInitializeFeatures. */
+KERNELAPI void KERNELABI
+CpuInitializeMemoryOperations(void);
+
 /* CpuHasFeatures
  * Determines if the cpu has the requested features */
 KERNELAPI OsStatus_t KERNELABI
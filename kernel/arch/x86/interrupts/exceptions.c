@@ -33,6 +33,7 @@
 #include <interrupts.h>
 #include <modules/manager.h>
 #include <memoryspace.h>
+#include <os/mollenos.h>
 #include <threading.h>
 
 #define PAGE_FAULT_PRESENT 0x1
@@ -185,7 +186,13 @@ ExceptionEntry(
             else if (Registers->ErrorCode & PAGE_FAULT_WRITE) {
                 // Write access, so lets verify that write attributes are set, if they
                 // are not, then the thread tried to write to read-only memory
-                if (attributes & MAPPING_READONLY) {
+                if ((attributes & MAPPING_READONLY) &&
+                    DebugMemorySpaceHandler(Registers, Address, MEMORY_WRITE) == OsSuccess) {
+                    // Read-only pages of memory handlers are made writable by the process
+                    // itself on the first write, so it can track which pages are modified
+                    IssueFixed = 1;
+                }
+                else if (attributes & MAPPING_READONLY) {
                     // If it was a user-process, kill it, otherwise fall through to kernel crash
                     ERROR("%s: WRITE_ACCESS_VIOLATION: 0x%" PRIxIN ", 0x%" PRIxIN ", 0x%" PRIxIN "", 
                         Core->CurrentThread != NULL ? Core->CurrentThread->Name : "None", 
@@ -0,0 +1,96 @@
+; MollenOS
+;
+; Copyright 2020, Philip Meulengracht
+;
+; This program is free software: you can redistribute it and/or modify
+; it under the terms of the GNU General Public License as published by
+; the Free Software Foundation?, either version 3 of the License, or
+; (at your option) any later version.
+;
+; This program is distributed in the hope that it will be useful,
+; but WITHOUT ANY WARRANTY; without even the implied warranty of
+; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+; GNU General Public License for more details.
+;
+; You should have received a copy of the GNU General Public License
+; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;
+;
+; MollenOS x86-32 Streaming Memory Functions
+; - These use xmm0-xmm3, and may only be called between save_xmm and load_xmm
+;
+bits 32
+segment .text
+
+;Functions in this asm
+global _save_xmm
+global _load_xmm
+global _stream_copy
+global _stream_set
+
+; void save_xmm(uintptr_t *buffer)
+; Saves the xmm registers used by the streaming functions
+_save_xmm:
+	mov eax, [esp + 4]
+	movdqu [eax], xmm0
+	movdqu [eax + 16], xmm1
+	movdqu [eax + 32], xmm2
+	movdqu [eax + 48], xmm3
+	ret
+
+; void load_xmm(uintptr_t *buffer)
+; Restores the xmm registers used by the streaming functions
+_load_xmm:
+	mov eax, [esp + 4]
+	movdqu xmm0, [eax]
+	movdqu xmm1, [eax + 16]
+	movdqu xmm2, [eax + 32]
+	movdqu xmm3, [eax + 48]
+	ret
+
+; void stream_copy(void *destination, const void *source, size_t blocks)
+; Copies blocks of 64 bytes with non-temporal stores, destination must be 16 byte aligned
+_stream_copy:
+	mov eax, [esp + 4]
+	mov edx, [esp + 8]
+	mov ecx, [esp + 12]
+	test ecx, ecx
+	jz .done
+.loop:
+	prefetchnta [edx + 256]
+	movdqu xmm0, [edx]
+	movdqu xmm1, [edx + 16]
+	movdqu xmm2, [edx + 32]
+	movdqu xmm3, [edx + 48]
+	movntdq [eax], xmm0
+	movntdq [eax + 16], xmm1
+	movntdq [eax + 32], xmm2
+	movntdq [eax + 48], xmm3
+	add edx, 64
+	add eax, 64
+	dec ecx
+	jnz .loop
+	sfence
+.done:
+	ret
+
+; void stream_set(void *destination, uint32_t pattern, size_t blocks)
+; Fills blocks of 64 bytes with non-temporal stores, destination must be 16 byte aligned
+_stream_set:
+	mov eax, [esp + 4]
+	mov ecx, [esp + 12]
+	test ecx, ecx
+	jz .done
+	movd xmm0, [esp + 8]
+	pshufd xmm0, xmm0, 0
+.loop:
+	movntdq [eax], xmm0
+	movntdq [eax + 16], xmm0
+	movntdq [eax + 32], xmm0
+	movntdq [eax + 48], xmm0
+	add eax, 64
+	dec ecx
+	jnz .loop
+	sfence
+.done:
+	ret
@@ -29,6 +29,7 @@ global _load_fpu
 global _load_fpu_extended
 global _clear_ts
 global _set_ts
+global _get_ts
 global __rdtsc
 global __rdmsr
 global __yield
@@ -81,6 +82,14 @@ _set_ts:
 	pop eax
 	ret 
 
+; int get_ts()
+; Returns 1 if the Task-Switch bit is set
+_get_ts:
+	mov eax, cr0
+	shr eax, 3
+	and eax, 1
+	ret
+
 ; void clear_ts()
 ; Clears the Task-Switch register
 _clear_ts:
@@ -0,0 +1,89 @@
+; MollenOS
+;
+; Copyright 2020, Philip Meulengracht
+;
+; This program is free software: you can redistribute it and/or modify
+; it under the terms of the GNU General Public License as published by
+; the Free Software Foundation?, either version 3 of the License, or
+; (at your option) any later version.
+;
+; This program is distributed in the hope that it will be useful,
+; but WITHOUT ANY WARRANTY; without even the implied warranty of
+; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+; GNU General Public License for more details.
+;
+; You should have received a copy of the GNU General Public License
+; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+;
+;
+; MollenOS x86-64 Streaming Memory Functions
+; - These use xmm0-xmm3, and may only be called between save_xmm and load_xmm
+;
+bits 64
+segment .text
+
+;Functions in this asm
+global save_xmm
+global load_xmm
+global stream_copy
+global stream_set
+
+; void save_xmm(uintptr_t *buffer)
+; Saves the xmm registers used by the streaming functions
+save_xmm:
+    movdqu [rcx], xmm0
+    movdqu [rcx + 16], xmm1
+    movdqu [rcx + 32], xmm2
+    movdqu [rcx + 48], xmm3
+    ret
+
+; void load_xmm(uintptr_t *buffer)
+; Restores the xmm registers used by the streaming functions
+load_xmm:
+    movdqu xmm0, [rcx]
+    movdqu xmm1, [rcx + 16]
+    movdqu xmm2, [rcx + 32]
+    movdqu xmm3, [rcx + 48]
+    ret
+
+; void stream_copy(void *destination <rcx>, const void *source <rdx>, size_t blocks <r8>)
+; Copies blocks of 64 bytes with non-temporal stores, destination must be 16 byte aligned
+stream_copy:
+    test r8, r8
+    jz .done
+.loop:
+    prefetchnta [rdx + 256]
+    movdqu xmm0, [rdx]
+    movdqu xmm1, [rdx + 16]
+    movdqu xmm2, [rdx + 32]
+    movdqu xmm3, [rdx + 48]
+    movntdq [rcx], xmm0
+    movntdq [rcx + 16], xmm1
+    movntdq [rcx + 32], xmm2
+    movntdq [rcx + 48], xmm3
+    add rdx, 64
+    add rcx, 64
+    dec r8
+    jnz .loop
+    sfence
+.done:
+    ret
+
+; void stream_set(void *destination <rcx>, uint32_t pattern <rdx>, size_t blocks <r8>)
+; Fills blocks of 64 bytes with non-temporal stores, destination must be 16 byte aligned
+stream_set:
+    test r8, r8
+    jz .done
+    movd xmm0, edx
+    pshufd xmm0, xmm0, 0
+.loop:
+    movntdq [rcx], xmm0
+    movntdq [rcx + 16], xmm0
+    movntdq [rcx + 32], xmm0
+    movntdq [rcx + 48], xmm0
+    add rcx, 64
+    dec r8
+    jnz .loop
+    sfence
+.done:
+    ret
@@ -29,6 +29,7 @@ global load_fpu
 global load_fpu_extended
 global clear_ts
 global set_ts
+global get_ts
 global _rdtsc
 global _rdmsr
 global _yield
@@ -77,6 +78,14 @@ set_ts:
     pop rax
     ret 
 
+; int get_ts()
+; Returns 1 if the Task-Switch bit is set
+get_ts:
+    mov rax, cr0
+    shr rax, 3
+    and rax, 1
+    ret
+
 ; void clear_ts()
 ; Clears the Task-Switch register
 clear_ts:
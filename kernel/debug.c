@@ -34,25 +34,36 @@
 #include <stdio.h>
 #include <debug.h>
 #include <heap.h>
+#include <threading.h>
 
-static OsStatus_t
-DebugPageMemorySpaceHandlers(
-    _In_ Context_t* Context,
-    _In_ uintptr_t  Address)
+OsStatus_t
+DebugMemorySpaceHandler(
+    _In_ Context_t*   Context,
+    _In_ uintptr_t    Address,
+    _In_ unsigned int Access)
 {
     SystemMemorySpace_t* Space  = GetCurrentMemorySpace();
-    OsStatus_t           Status = OsError;
+    OsStatus_t           Status = OsDoesNotExist;
 
     if (Space->Context != NULL) {
         foreach(i, Space->Context->MemoryHandlers) {
             SystemMemoryMappingHandler_t* Handler = (SystemMemoryMappingHandler_t*)i->value;
             if (ISINRANGE(Address, Handler->Address, (Handler->Address + Handler->Length) - 1)) {
-                ERROR("Implement support for MemorySpaceHandlers");
-                for(;;);
-                //SignalQueue(__FILEMANAGER_TARGET, SIGINT, Handler->Handle, (void*)Address);
-                // @todo manually switch to next thread
-                // ThreadingAdvance();
-                // ContextLoad();
+                if ((Handler->Flags & Access) != Access) {
+                    Status = OsError;
+                    break;
+                }
+
+                // The process resolves the fault itself from the signal handler, and the
+                // faulting instruction is retried when it returns. The kernel can't wait
+                // for the process in its own code, so those accesses are invalid.
+                if (IS_KERNEL_CODE(&GetMachine()->MemoryMap, CONTEXT_IP(Context))) {
+                    Status = OsError;
+                }
+                else {
+                    SignalExecuteLocalThreadTrap(Context, SIGSEGV, (void*)Address);
+                    Status = OsSuccess;
+                }
                 break;
             }
         }
@@ -90,12 +101,12 @@ DebugPageFault(
     TRACE("DebugPageFault(IP 0x%" PRIxIN ", Address 0x%" PRIxIN ")", 
         CONTEXT_IP(Context), Address);
 
-    if (Space->Context != NULL) {
-        if (DebugPageMemorySpaceHandlers(Context, Address) == OsSuccess) {
-            return OsSuccess;
-        }
+    // Addresses that are covered by a memory handler are never committed
+    Status = DebugMemorySpaceHandler(Context, Address, MEMORY_READ);
+    if (Status != OsDoesNotExist) {
+        return Status;
     }
-    
+
     Status = MemorySpaceCommit(Space, Address, &PhysicalAddress, 
         GetMemorySpacePageSize(), 0);
     if (Status == OsExists) {
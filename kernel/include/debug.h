@@ -82,6 +82,17 @@ DebugPageFault(
     _In_ Context_t* Context,
     _In_ uintptr_t  Address);
 
+/* DebugMemorySpaceHandler
+ * Checks whether the address is covered by a memory handler of the current memory space,
+ * and if so, queues the fault to the process as a SIGSEGV trap with the address as argument.
+ * <Access> is the MEMORY_READ/MEMORY_WRITE access that faulted, and must be allowed by the
+ * handler. Returns OsDoesNotExist if no handler covers the address */
+KERNELAPI OsStatus_t KERNELABI
+DebugMemorySpaceHandler(
+    _In_ Context_t*   Context,
+    _In_ uintptr_t    Address,
+    _In_ unsigned int Access);
+
 /* DebugPanic
  * Kernel panic function - Call this to enter panic mode
  * and disrupt normal functioning. This function does not return again */
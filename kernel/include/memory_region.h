@@ -28,6 +28,7 @@
 #include <os/osdefs.h>
 
 struct dma_sg;
+struct SystemMemorySpace;
 
 /**
  * MemoryRegionCreate
@@ -197,4 +198,25 @@ MemoryRegionGetKernelMapping(
         _In_  UUId_t handle,
         _Out_ void** bufferOut);
 
+/**
+ * MemoryRegionMapFixed
+ * * Maps a part of the memory region at a fixed address in the given memory space. The
+ * * pages are shared with the region and are not freed when the mapping is removed, the
+ * * caller must stay attached to the region while the mapping exists.
+ * @param MemorySpace [In] The memory space to create the mapping in.
+ * @param Handle      [In] The handle of the memory region.
+ * @param Offset      [In] The page aligned offset into the region.
+ * @param Address     [In] The page aligned virtual address to map the pages at.
+ * @param Length      [In] The number of bytes to map.
+ * @param Flags       [In] Additional MAPPING_* flags for the mapping.
+ */
+KERNELAPI OsStatus_t KERNELABI
+MemoryRegionMapFixed(
+    _In_ struct SystemMemorySpace* MemorySpace,
+    _In_ UUId_t                    Handle,
+    _In_ size_t                    Offset,
+    _In_ uintptr_t                 Address,
+    _In_ size_t                    Length,
+    _In_ unsigned int              Flags);
+
 #endif //!__MEMORY_REGION_H__
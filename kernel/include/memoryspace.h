@@ -59,10 +59,11 @@
 #define MAPPING_VIRTUAL_MASK            0x0000000EU
 
 typedef struct SystemMemoryMappingHandler {
-    element_t Header;
-    UUId_t    Handle;
-    uintptr_t Address;
-    size_t    Length;
+    element_t    Header;
+    UUId_t       Handle;
+    unsigned int Flags;
+    uintptr_t    Address;
+    size_t       Length;
 } SystemMemoryMappingHandler_t;
 
 typedef struct SystemMemorySpaceContext {
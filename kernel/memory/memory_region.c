@@ -539,3 +539,41 @@ MemoryRegionGetKernelMapping(
     *bufferOut = (void*)region->KernelMapping;
     return OsSuccess;
 }
+
+OsStatus_t
+MemoryRegionMapFixed(
+    _In_ SystemMemorySpace_t* MemorySpace,
+    _In_ UUId_t               Handle,
+    _In_ size_t               Offset,
+    _In_ uintptr_t            Address,
+    _In_ size_t               Length,
+    _In_ unsigned int         Flags)
+{
+    MemoryRegion_t* Region;
+    size_t          PageSize = GetMemorySpacePageSize();
+    uintptr_t       VirtualBase = Address;
+    OsStatus_t      Status;
+    TRACE("MemoryRegionMapFixed(0x%x, 0x%x)", Handle, LODWORD(Offset));
+
+    if ((Offset % PageSize) || (Address % PageSize) || !Length) {
+        return OsInvalidParameters;
+    }
+
+    Region = (MemoryRegion_t*)LookupHandleOfType(Handle, HandleTypeMemoryRegion);
+    if (!Region) {
+        return OsDoesNotExist;
+    }
+
+    MutexLock(&Region->SyncObject);
+    if (Offset + Length > Region->Length) {
+        MutexUnlock(&Region->SyncObject);
+        return OsInvalidParameters;
+    }
+
+    // The pages stay owned by the region, so the mapping must be persistent
+    Status = MemorySpaceMap(MemorySpace, &VirtualBase, &Region->Pages[Offset / PageSize],
+        Length, MAPPING_COMMIT | MAPPING_USERSPACE | MAPPING_PERSISTENT | Flags,
+        MAPPING_PHYSICAL_FIXED | MAPPING_VIRTUAL_FIXED);
+    MutexUnlock(&Region->SyncObject);
+    return Status;
+}
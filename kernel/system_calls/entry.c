@@ -65,6 +65,7 @@ extern OsStatus_t ScGetAssemblyDirectory(char* PathBuffer, size_t MaxLength);
 extern OsStatus_t ScCreateMemorySpace(unsigned int Flags, UUId_t* Handle);
 extern OsStatus_t ScGetThreadMemorySpaceHandle(UUId_t ThreadHandle, UUId_t* Handle);
 extern OsStatus_t ScCreateMemorySpaceMapping(UUId_t Handle, struct MemoryMappingParameters* Parameters, void** AddressOut);
+extern OsStatus_t ScCreateMemorySpaceRegionMapping(UUId_t Handle, struct MemoryMappingParameters* Parameters, UUId_t RegionHandle, size_t RegionOffset);
 
 // Driver system calls
 extern OsStatus_t ScAcpiQueryStatus(AcpiDescriptor_t* AcpiDescriptor);
@@ -132,6 +133,7 @@ extern OsStatus_t ScListenHandleSet(UUId_t, HandleSetWaitParameters_t*, int*);
 extern OsStatus_t ScInstallSignalHandler(uintptr_t Handler);
 extern OsStatus_t ScCreateMemoryHandler(unsigned int Flags, size_t Length, UUId_t* HandleOut, uintptr_t* AddressBaseOut);
 extern OsStatus_t ScDestroyMemoryHandler(UUId_t Handle);
+extern OsStatus_t ScMapMemoryHandler(UUId_t Handle, size_t Offset, UUId_t RegionHandle, size_t RegionOffset, size_t Length);
 extern OsStatus_t ScFlushHardwareCache(int Cache, void* Start, size_t Length);
 extern OsStatus_t ScSystemQuery(SystemDescriptor_t* Descriptor);
 extern OsStatus_t ScSystemTime(SystemTime_t* SystemTime);
@@ -139,7 +141,7 @@ extern OsStatus_t ScSystemTick(int TickBase, LargeUInteger_t* Tick);
 extern OsStatus_t ScPerformanceFrequency(LargeInteger_t *Frequency);
 extern OsStatus_t ScPerformanceTick(LargeInteger_t *Value);
 
-#define SYSTEM_CALL_COUNT 75
+#define SYSTEM_CALL_COUNT 77
 
 typedef size_t(*SystemCallHandlerFn)(void*,void*,void*,void*,void*);
 
@@ -253,7 +255,9 @@ static struct SystemCallDescriptor {
     DefineSyscall(71, ScSystemTick),
     DefineSyscall(72, ScPerformanceFrequency),
     DefineSyscall(73, ScPerformanceTick),
-    DefineSyscall(74, ScSystemTime)
+    DefineSyscall(74, ScSystemTime),
+    DefineSyscall(75, ScMapMemoryHandler),
+    DefineSyscall(76, ScCreateMemorySpaceRegionMapping)
 };
 
 Context_t*
@@ -399,3 +399,40 @@ ScCreateMemorySpaceMapping(
     *AddressOut = (void*)CopyPlacement;
     return Status;
 }
+
+OsStatus_t
+ScCreateMemorySpaceRegionMapping(
+    _In_ UUId_t                          Handle,
+    _In_ struct MemoryMappingParameters* Parameters,
+    _In_ UUId_t                          RegionHandle,
+    _In_ size_t                          RegionOffset)
+{
+    SystemModule_t*      Module        = GetCurrentModule();
+    SystemMemorySpace_t* MemorySpace   = (SystemMemorySpace_t*)LookupHandleOfType(Handle, HandleTypeMemorySpace);
+    unsigned int         RequiredFlags = 0;
+
+    if (Parameters == NULL || Module == NULL) {
+        if (Module == NULL) {
+            return OsDoesNotExist;
+        }
+        return OsInvalidParameters;
+    }
+
+    TRACE("[sc_map_region] target address 0x%" PRIxIN ", flags 0x%x, length 0x%" PRIxIN,
+        Parameters->VirtualAddress, Parameters->Flags, Parameters->Length);
+
+    if (MemorySpace == NULL) {
+        return OsDoesNotExist;
+    }
+
+    if (Parameters->Flags & MEMORY_EXECUTABLE) {
+        RequiredFlags |= MAPPING_EXECUTABLE;
+    }
+    if (!(Parameters->Flags & MEMORY_WRITE)) {
+        RequiredFlags |= MAPPING_READONLY;
+    }
+
+    // The pages are owned by the memory region, so they outlive the memory space
+    return MemoryRegionMapFixed(MemorySpace, RegionHandle, RegionOffset,
+        Parameters->VirtualAddress, Parameters->Length, RequiredFlags);
+}
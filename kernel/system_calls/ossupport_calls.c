@@ -27,6 +27,8 @@
 #include <heap.h>
 #include <internal/_utils.h>
 #include <memoryspace.h>
+#include <memory_region.h>
+#include <os/mollenos.h>
 #include <threading.h>
 
 OsStatus_t
@@ -53,6 +55,7 @@ ScCreateMemoryHandler(
         kfree(Handler);
         return OsOutOfMemory;
     }
+    Handler->Flags   = Flags;
     Handler->Length  = Length;
     
     *HandleOut       = Handler->Handle;
@@ -61,6 +64,40 @@ ScCreateMemoryHandler(
     return OsSuccess;
 }
 
+OsStatus_t
+ScMapMemoryHandler(
+    _In_ UUId_t Handle,
+    _In_ size_t Offset,
+    _In_ UUId_t RegionHandle,
+    _In_ size_t RegionOffset,
+    _In_ size_t Length)
+{
+    SystemMemoryMappingHandler_t* Handler = NULL;
+    SystemMemorySpace_t*          Space   = GetCurrentMemorySpace();
+    assert(Space->Context != NULL);
+
+    // Only handlers of the calling memory space may be mapped into
+    foreach(i, Space->Context->MemoryHandlers) {
+        if (((SystemMemoryMappingHandler_t*)i->value)->Handle == Handle) {
+            Handler = (SystemMemoryMappingHandler_t*)i->value;
+            break;
+        }
+    }
+
+    if (!Handler) {
+        return OsDoesNotExist;
+    }
+
+    if (Offset >= Handler->Length || Length > (Handler->Length - Offset)) {
+        return OsInvalidParameters;
+    }
+
+    // Pages are always mapped read-only, the owner of the handler receives the
+    // first write to a page and decides whether it may be made writable
+    return MemoryRegionMapFixed(Space, RegionHandle, RegionOffset, Handler->Address + Offset, Length,
+        MAPPING_READONLY | ((Handler->Flags & MEMORY_EXECUTABLE) ? MAPPING_EXECUTABLE : 0));
+}
+
 OsStatus_t
 ScDestroyMemoryHandler(
     _In_ UUId_t Handle)
@@ -71,6 +108,7 @@ ScDestroyMemoryHandler(
 
     if (Space->Context->MemoryHandlers != NULL && Handler != NULL) {
         list_remove(Space->Context->MemoryHandlers, &Handler->Header);
+        MemorySpaceUnmap(Space, Handler->Address, Handler->Length);
         DynamicMemoryPoolFree(&Space->Context->Heap, Handler->Address);
         DestroyHandle(Handle);
         kfree(Handler);
@@ -25,12 +25,18 @@
 #include <threading.h>
 #include <debug.h>
 
+extern void TestMemoryOperations(void);
+
 void
 StartTestingPhase(void)
 {
     //UUId_t CurrentTest;
     TRACE("StartTestingPhase()");
 
+    // Run memory operation tests
+    TRACE(" > Running memory operation tests");
+    TestMemoryOperations();
+
     // Run data-structure tests
     //TRACE(" > Running data structure tests");
     //CurrentTest = CreateThread("TestDataStructures", TestDataStructures, NULL, 0);
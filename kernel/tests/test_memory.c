@@ -0,0 +1,169 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * OS Testing Suite
+ *  - Memory operation tests, verifies the kernel memcpy/memset and measures their
+ *    throughput against the portable implementations.
+ */
+#define __MODULE "TEST"
+#define __TRACE
+
+#include <debug.h>
+#include <heap.h>
+#include <internal/_string.h>
+#include <string.h>
+#include <timers.h>
+
+#define TEST_BUFFER_SIZE  0x10000
+#define TEST_PAGE_SIZE    0x1000
+#define TEST_DURATION_MS  250
+
+typedef void (*MemoryTestFunction_t)(uint8_t*, uint8_t*, int);
+
+static void
+ZeroPages(
+    _In_ uint8_t* Destination,
+    _In_ uint8_t* Source,
+    _In_ int      Portable)
+{
+    size_t i;
+    _CRT_UNUSED(Source);
+
+    for (i = 0; i < TEST_BUFFER_SIZE; i += TEST_PAGE_SIZE) {
+        if (Portable) {
+            memset_base(Destination + i, 0, TEST_PAGE_SIZE);
+        }
+        else {
+            memset(Destination + i, 0, TEST_PAGE_SIZE);
+        }
+    }
+}
+
+static void
+CopyBlock(
+    _In_ uint8_t* Destination,
+    _In_ uint8_t* Source,
+    _In_ int      Portable)
+{
+    if (Portable) {
+        memcpy_base(Destination, Source, TEST_BUFFER_SIZE);
+    }
+    else {
+        memcpy(Destination, Source, TEST_BUFFER_SIZE);
+    }
+}
+
+/* MeasureThroughput
+ * Runs the function for a fixed duration and reports the throughput in MB/s. */
+static size_t
+MeasureThroughput(
+    _In_ MemoryTestFunction_t Function,
+    _In_ uint8_t*             Destination,
+    _In_ uint8_t*             Source,
+    _In_ int                  Portable)
+{
+    clock_t Start;
+    clock_t Current;
+    size_t  Bytes = 0;
+
+    if (TimersGetSystemTick(&Start) != OsSuccess) {
+        return 0;
+    }
+
+    do {
+        Function(Destination, Source, Portable);
+        Bytes += TEST_BUFFER_SIZE;
+        TimersGetSystemTick(&Current);
+    } while ((Current - Start) < TEST_DURATION_MS);
+    return (Bytes / 1000) / (size_t)(Current - Start);
+}
+
+static void
+ReportThroughput(
+    _In_ const char* Name,
+    _In_ size_t      Portable,
+    _In_ size_t      Kernel)
+{
+    TRACE(" > %s: portable %u.%02u GB/s, kernel %u.%02u GB/s", Name,
+        (unsigned int)(Portable / 1000), (unsigned int)((Portable % 1000) / 10),
+        (unsigned int)(Kernel / 1000), (unsigned int)((Kernel % 1000) / 10));
+}
+
+/* TestMemoryOperations
+ * Verifies the kernel memory operations for a range of alignments and sizes around the
+ * thresholds where the implementation changes, then measures page zeroing and
+ * 64 KiB copies. */
+void
+TestMemoryOperations(void)
+{
+    uint8_t* Source      = (uint8_t*)kmalloc(TEST_BUFFER_SIZE + 64);
+    uint8_t* Destination = (uint8_t*)kmalloc(TEST_BUFFER_SIZE + 64);
+    size_t   Sizes[]     = { 1, 63, 127, 128, 129, 4095, 4096, 4097, 8191, 65536 };
+    size_t   i, j, k;
+    int      Failures = 0;
+
+    TRACE("TestMemoryOperations()");
+    if (!Source || !Destination) {
+        ERROR(" > failed to allocate test buffers");
+        goto Cleanup;
+    }
+
+    for (i = 0; i < TEST_BUFFER_SIZE + 64; i++) {
+        Source[i] = (uint8_t)((i * 7) + 1);
+    }
+
+    for (i = 0; i < sizeof(Sizes) / sizeof(Sizes[0]); i++) {
+        for (j = 0; j < 16; j += 5) {
+            memset_base(Destination, 0xCC, TEST_BUFFER_SIZE + 64);
+            memcpy(Destination + j, Source + 3, Sizes[i]);
+            if (memcmp_base(Destination + j, Source + 3, Sizes[i]) ||
+                Destination[j + Sizes[i]] != 0xCC) {
+                ERROR(" > memcpy failed for size %u, alignment %u", Sizes[i], j);
+                Failures++;
+            }
+
+            memset(Destination + j, 0x5A, Sizes[i]);
+            for (k = 0; k < Sizes[i]; k++) {
+                if (Destination[j + k] != 0x5A) {
+                    break;
+                }
+            }
+            if (k != Sizes[i] || Destination[j + Sizes[i]] != 0xCC) {
+                ERROR(" > memset failed for size %u, alignment %u", Sizes[i], j);
+                Failures++;
+            }
+        }
+    }
+    TRACE(" > verification %s", Failures ? "failed" : "passed");
+
+    ReportThroughput("page zeroing",
+        MeasureThroughput(ZeroPages, Destination, Source, 1),
+        MeasureThroughput(ZeroPages, Destination, Source, 0));
+    ReportThroughput("64 KiB copies",
+        MeasureThroughput(CopyBlock, Destination, Source, 1),
+        MeasureThroughput(CopyBlock, Destination, Source, 0));
+
+Cleanup:
+    if (Source) {
+        kfree(Source);
+    }
+    if (Destination) {
+        kfree(Destination);
+    }
+}
@@ -26,6 +26,7 @@
 #define	__INET_SOCKET_H__
 
 #include <os/osdefs.h>
+#include <sys/uio.h>
 
 #ifndef	_SOCKLEN_T_DEFINED_
 #define	_SOCKLEN_T_DEFINED_
@@ -128,11 +129,6 @@ struct sockaddr_storage {
 // Maximum queue length specifiable by listen(2).
 #define	SOMAXCONN	128
 
-struct iovec {
-   void*  iov_base;    /* Starting address */
-   size_t iov_len;     /* Number of bytes to transfer */
-};
-
 // Message header for recvmsg and sendmsg calls.
 // Used value-result for recvmsg, value only for sendmsg.
 struct msghdr {
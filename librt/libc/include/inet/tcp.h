@@ -0,0 +1,33 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * TCP Support Definitions
+ * - This header describes the socket options of the TCP protocol, they are set
+ *   with setsockopt at the IPPROTO_TCP level.
+ */
+ 
+#ifndef __INET_TCP_H__
+#define __INET_TCP_H__
+
+#include <inet/internet.h>
+
+#define TCP_NODELAY  1  // Disables the Nagle algorithm, small segments are sent immediately
+#define TCP_QUICKACK 12 // Disables delayed acknowledgements
+
+#endif //!__INET_TCP_H__
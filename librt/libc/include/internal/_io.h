@@ -32,7 +32,8 @@
 #define WX_PERSISTANT       0x1000U
 
 #define INTERNAL_BUFSIZ     4096
-#define INTERNAL_MAXFILES   1024
+#define INTERNAL_MAXBUFSIZ  0x8000
+#define INTERNAL_MAXFILES   0x10000
 
 #define STDIO_HANDLE_INVALID    0
 #define STDIO_HANDLE_PIPE       1
@@ -43,6 +44,8 @@
 #define STDIO_HANDLE_EVENT      6
 
 typedef struct stdio_handle stdio_handle_t;
+struct file_stream;
+struct iovec;
 
 // Inheritable handle that is shared with child processes
 // should contain only portable information
@@ -83,13 +86,14 @@ typedef struct stdio_ops {
 // Local to application handle that also handles state, stream and buffer
 // support for a handle.
 typedef struct stdio_handle {
-    int            fd;
-    spinlock_t     lock;
-    stdio_object_t object;
-    stdio_ops_t    ops;
-    unsigned short wxflag;
-    char           lookahead[3];
-    FILE*          buffered_stream;
+    int                 fd;
+    spinlock_t          lock;
+    stdio_object_t      object;
+    stdio_ops_t         ops;
+    unsigned short      wxflag;
+    char                lookahead[3];
+    FILE*               buffered_stream;
+    struct file_stream* file_stream;
 } stdio_handle_t;
 
 typedef struct stdio_inheritation_block {
@@ -105,10 +109,12 @@ extern int             stdio_handle_set_buffered(stdio_handle_t*, FILE*, unsigne
 extern int             stdio_handle_destroy(stdio_handle_t*, int);
 extern int             stdio_handle_activity(stdio_handle_t*, int);
 extern stdio_handle_t* stdio_handle_get(int iod);
+extern stdio_handle_t* stdio_handle_next(int iod);
 
 // io-buffer interface
 extern OsStatus_t os_alloc_buffer(FILE* file);
 extern OsStatus_t os_flush_buffer(FILE* file);
+extern void       os_grow_buffer(FILE* file);
 extern int        os_flush_all_buffers(int mask);
 extern OsStatus_t add_std_buffer(FILE* file);
 extern void       remove_std_buffer(FILE* file);
@@ -122,6 +128,12 @@ extern void stdio_get_ipc_operations(stdio_ops_t* ops);
 extern void stdio_get_set_operations(stdio_ops_t* ops);
 extern void stdio_get_evt_operations(stdio_ops_t* ops);
 
+// io-file interface
+extern void       stdio_file_exports_invalidate(void* memory, size_t length);
+extern OsStatus_t stdio_file_stream_sync(stdio_handle_t* handle);
+extern OsStatus_t stdio_file_transfer_vector(stdio_handle_t* handle, int direction, long long offset,
+    const struct iovec* iov, int iovcnt, size_t* bytesTransferredOut);
+
 // helpers
 extern int  stdio_bitmap_initialize(void);
 extern int  stdio_bitmap_allocate(int fd);
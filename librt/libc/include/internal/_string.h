@@ -1,6 +1,8 @@
 #ifndef __INTERNAL_STRING_INC__
 #define __INTERNAL_STRING_INC__
 
+#include <stddef.h>
+
 /* Nonzero if either X or Y is not aligned on a "long" boundary.  */
 #define UNALIGNED(X, Y) \
 	(((long)X & (sizeof (long) - 1)) | ((long)Y & (sizeof (long) - 1)))
@@ -14,4 +16,60 @@
 /* Threshhold for punting to the byte copier.  */
 #define TOO_SMALL(LEN)  ((LEN) < BIGBLOCKSIZE)
 
+/* Copies of at least this size bypass the cache with non-temporal stores.  */
+#define MEMCPY_NONTEMPORAL_THRESHOLD (512 * 1024)
+
+/* The memory and string routines are called through a table, which is filled
+   at process start with the best implementations the cpu supports. Until then
+   the portable implementations are used. The kernel installs its own memcpy
+   and memset during boot.  */
+struct string_ops {
+	void*  (*memcpy)(void*, const void*, size_t);
+	void*  (*memset)(void*, int, size_t);
+	void*  (*memchr)(const void*, int, size_t);
+	int    (*memcmp)(const void*, const void*, size_t);
+	size_t (*strlen)(const char*);
+	char*  (*strchr)(const char*, int);
+	int    (*strcmp)(const char*, const char*);
+};
+
+extern struct string_ops __string_ops;
+extern void StdStringInitialize(void);
+
+/* Portable implementations.  */
+extern void*  memcpy_base(void*, const void*, size_t);
+extern void*  memset_base(void*, int, size_t);
+extern void*  memchr_base(const void*, int, size_t);
+extern int    memcmp_base(const void*, const void*, size_t);
+extern size_t strlen_base(const char*);
+extern char*  strchr_base(const char*, int);
+extern int    strcmp_base(const char*, const char*);
+
+/* Implementations for cpus with enhanced rep movsb/stosb, these do not touch
+   any vector registers and are safe to use in the kernel.  */
+extern void*  memcpy_erms(void*, const void*, size_t);
+extern void*  memset_erms(void*, int, size_t);
+
+/* Legacy implementations for i386 cpus without SSE2.  */
+extern void*  memcpy_sse(void*, const void*, size_t);
+extern void*  memcpy_mmx(void*, const void*, size_t);
+
+/* SSE2 implementations.  */
+extern void*  memcpy_sse2(void*, const void*, size_t);
+extern void*  memset_sse2(void*, int, size_t);
+extern void*  memchr_sse2(const void*, int, size_t);
+extern int    memcmp_sse2(const void*, const void*, size_t);
+extern size_t strlen_sse2(const char*);
+extern char*  strchr_sse2(const char*, int);
+extern int    strcmp_sse2(const char*, const char*);
+
+/* AVX2 implementations.  */
+extern void*  memcpy_avx2(void*, const void*, size_t);
+extern void*  memset_avx2(void*, int, size_t);
+extern void*  memchr_avx2(const void*, int, size_t);
+extern int    memcmp_avx2(const void*, const void*, size_t);
+extern size_t strlen_avx2(const char*);
+extern char*  strchr_avx2(const char*, int);
+extern int    strcmp_avx2(const char*, const char*);
+
 #endif
\ No newline at end of file
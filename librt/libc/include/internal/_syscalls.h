@@ -40,6 +40,7 @@ _CODE_END
 #define Syscall_CreateMemorySpace(Flags, HandleOut)                                          (OsStatus_t)syscall2(13, SCPARAM(Flags), SCPARAM(HandleOut))
 #define Syscall_GetMemorySpaceForThread(ThreadHandle, HandleOut)                             (OsStatus_t)syscall2(14, SCPARAM(ThreadHandle), SCPARAM(HandleOut))
 #define Syscall_CreateMemorySpaceMapping(Handle, Parameters, AddressOut)                     (OsStatus_t)syscall3(15, SCPARAM(Handle), SCPARAM(Parameters), SCPARAM(AddressOut))
+#define Syscall_CreateMemorySpaceRegionMapping(Handle, Parameters, Region, RegionOffset)    (OsStatus_t)syscall4(76, SCPARAM(Handle), SCPARAM(Parameters), SCPARAM(Region), SCPARAM(RegionOffset))
 
 #define Syscall_AcpiQuery(Descriptor)                                                        (OsStatus_t)syscall1(16, SCPARAM(Descriptor))
 #define Syscall_AcpiGetHeader(Signature, Header)                                             (OsStatus_t)syscall2(17, SCPARAM(Signature), SCPARAM(Header))
@@ -104,6 +105,7 @@ _CODE_END
 #define Syscall_InstallSignalHandler(HandlerAddress)                       (OsStatus_t)syscall1(66, SCPARAM(HandlerAddress))
 #define Syscall_CreateMemoryHandler(Flags, Length, HandleOut, AddressOut)  (OsStatus_t)syscall4(67, SCPARAM(Flags), SCPARAM(Length), SCPARAM(HandleOut), SCPARAM(AddressOut))
 #define Syscall_DestroyMemoryHandler(Handle)                               (OsStatus_t)syscall1(68, SCPARAM(Handle))
+#define Syscall_MapMemoryHandler(Handle, Offset, Region, RegionOffset, Length) (OsStatus_t)syscall5(75, SCPARAM(Handle), SCPARAM(Offset), SCPARAM(Region), SCPARAM(RegionOffset), SCPARAM(Length))
 #define Syscall_FlushHardwareCache(CacheType, AddressStart, Length)        (OsStatus_t)syscall3(69, SCPARAM(CacheType), SCPARAM(AddressStart), SCPARAM(Length))
 #define Syscall_SystemQuery(SystemInformation)                             (OsStatus_t)syscall1(70, SCPARAM(SystemInformation))
 #define Syscall_SystemTick(Base, Tick)                                     (OsStatus_t)syscall2(71, SCPARAM(Base), SCPARAM(Tick))
@@ -88,6 +88,8 @@ CRTDECL(int,        open(const char *file, int flags, ...));
 CRTDECL(int,        close(int fd));
 CRTDECL(int,        read(int fd, void *buffer, unsigned int len));
 CRTDECL(int,        write(int fd, const void *buffer, unsigned int length));
+CRTDECL(int,        pread(int fd, void *buffer, unsigned int length, long long offset));
+CRTDECL(int,        pwrite(int fd, const void *buffer, unsigned int length, long long offset));
 CRTDECL(long,       lseek(int fd, long offset, int whence));
 CRTDECL(long long,  lseeki64(int fd, long long offset, int whence));
 CRTDECL(long,       tell(int fd));
@@ -128,6 +128,7 @@ CRTDECL(OsStatus_t, GetFileSystemInformationFromFd(int FileDescriptor, OsFileSys
 CRTDECL(OsStatus_t, GetFileInformationFromPath(const char *Path, OsFileDescriptor_t *Information));
 CRTDECL(OsStatus_t, GetFileInformationFromFd(int FileDescriptor, OsFileDescriptor_t *Information));
 CRTDECL(OsStatus_t, CreateFileMapping(int FileDescriptor, int Flags, uint64_t Offset, size_t Length, void **MemoryPointer, UUId_t* Handle));
+CRTDECL(OsStatus_t, FlushFileMapping(UUId_t Handle));
 CRTDECL(OsStatus_t, DestroyFileMapping(UUId_t Handle));
 
 _CODE_END
@@ -70,6 +70,24 @@ typedef struct {
 #define FILE_PERMISSION_WRITE   0x00000002
 #define FILE_PERMISSION_EXECUTE 0x00000004
 
+// svc_file_transfer_async offset, when both halves of the offset are set to this value
+// the transfer is done at the current position of the handle instead.
+#define FILE_POSITION_CURRENT   0xFFFFFFFF
+
+// svc_file_transfer_vector entries, each entry describes a part of a dma buffer the
+// parts are transferred to or from in order. FILE_VECTOR_MAX limits a single request.
+#define FILE_VECTOR_MAX         32
+
+PACKED_TYPESTRUCT(FileVector, {
+    UUId_t BufferHandle;
+    size_t BufferOffset;
+    size_t Length;
+});
+
+// svc_file_get_mapping shares the cached pages of a file in chunks, the chunks start at
+// file offsets that are multiples of FILE_MAPPING_CHUNK_SIZE.
+#define FILE_MAPPING_CHUNK_SIZE 0x10000
+
 PACKED_TYPESTRUCT(FileMappingParameters, {
     UUId_t    MemoryHandle;
     unsigned int   Flags;
@@ -0,0 +1,44 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * POSIX Vectored IO
+ *   - Scatter/gather reads and writes. File descriptors transfer all parts
+ *     with a single request to the file manager.
+ */
+
+#ifndef __SYS_UIO_H__
+#define __SYS_UIO_H__
+
+#include <os/osdefs.h>
+#include <sys/types.h>
+
+// Maximum number of parts in a single readv/writev call
+#define IOV_MAX 1024
+
+struct iovec {
+   void*  iov_base;    /* Starting address */
+   size_t iov_len;     /* Number of bytes to transfer */
+};
+
+_CODE_BEGIN
+CRTDECL(ssize_t, readv(int fd, const struct iovec* iov, int iovcnt));
+CRTDECL(ssize_t, writev(int fd, const struct iovec* iov, int iovcnt));
+_CODE_END
+
+#endif //!__SYS_UIO_H__
@@ -68,7 +68,7 @@ QUICKREF
    to fill (long)MASK. */
 #define DETECTCHAR(X,MASK) (DETECTNULL(X ^ MASK))
 
-void* memchr(const void* src_void, int c, size_t length)
+void* memchr_base(const void* src_void, int c, size_t length)
 {
 	const unsigned char *src = (const unsigned char *)src_void;
 	unsigned char d = (unsigned char)c;
@@ -47,11 +47,7 @@ QUICKREF
 /* Threshhold for punting to the byte copier.  */
 #define TOO_SMALL(LEN)  ((LEN) < LBLOCKSIZE)
 
-#if defined(_MSC_VER) && !defined(__clang__)
-#pragma function(memcmp)
-#endif
-
-int memcmp(const void* ptr1, const void* ptr2, size_t num)
+int memcmp_base(const void* ptr1, const void* ptr2, size_t num)
 {
 	unsigned char *s1 = (unsigned char *) ptr1;
 	unsigned char *s2 = (unsigned char *) ptr2;
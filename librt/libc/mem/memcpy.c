@@ -24,9 +24,6 @@
 #include <internal/_string.h>
 #include <stddef.h>
 
-#define CPUID_FEAT_EDX_MMX      1 << 23
-#define CPUID_FEAT_EDX_SSE		1 << 25
-#define CPUID_FEAT_EDX_SSE2     1 << 26
 #define MEMCPY_ACCEL_THRESHOLD	10      // Must be worth the extra overhead
 
 /* memcpy_base
@@ -75,56 +72,29 @@ memcpy_base(
 	return Destination;
 }
 
-// Don't use SSE/MMX instructions in kernel environment
-// it's way to fragile on task-switches as we can heavily use memcpy
-#ifdef LIBC_KERNEL
-#if defined(_MSC_VER) && !defined(__clang__)
-#pragma function(memcpy)
-#endif
-void* memcpy(void *destination, const void *source, size_t count) {
-	return memcpy_base(destination, source, count);
-}
-#elif defined(__amd64__) || defined(amd64)
-// Use the sse2 by default as all 64 bit cpus support sse
-extern void asm_memcpy_sse2(void *Dest, const void *Source, int Loops, int RemainingBytes);
-void *memcpy(void *destination, const void *source, size_t count) {
-	int Loops        = count / 128;
-	int Remaining    = count % 128;
-	if (Loops < MEMCPY_ACCEL_THRESHOLD) {
-		return memcpy_base(destination, source, count);
-	}
-	asm_memcpy_sse2(destination, source, Loops, Remaining);
-	return destination;
+/* memcpy_erms
+ * Copies the buffer with rep movsb, which is the fastest way of copying memory without
+ * using vector registers on cpus that have the enhanced rep movsb/stosb feature. */
+void*
+memcpy_erms(
+    _In_ void *Destination,
+    _In_ const void *Source,
+    _In_ size_t Count)
+{
+	void *dst = Destination;
+	__asm__ __volatile__("rep movsb" : "+D"(dst), "+S"(Source), "+c"(Count) : : "memory");
+	return Destination;
 }
-#else
-#if defined(_MSC_VER) && !defined(__clang__)
-#include <intrin.h>
-#else
-#include <cpuid.h>
-#endif
-typedef void *(*MemCpyTemplate)(void *Destination, const void *Source, size_t Count);
-void *memcpy_select(void *Destination, const void *Source, size_t Count);
+
+// The accelerated copies are selected at process start by StdStringInitialize,
+// the kernel never uses SSE/MMX instructions as it's way to fragile on task-switches
+#if !defined(LIBC_KERNEL) && !defined(__amd64__) && !defined(amd64)
 extern void asm_memcpy_mmx(void *Dest, const void *Source, int Loops, int RemainingBytes);
 extern void asm_memcpy_sse(void *Dest, const void *Source, int Loops, int RemainingBytes);
-extern void asm_memcpy_sse2(void *Dest, const void *Source, int Loops, int RemainingBytes);
-static MemCpyTemplate __GlbMemCpyInstance = memcpy_select;
-
-/* This is the SSE2 optimized version of memcpy, but there is a fallback
- * to the normal one, in case there isn't enough loops for overhead to be
- * worth it. */
-void *memcpy_sse2(void *Destination, const void *Source, size_t Count) {
-	int Loops        = Count / 128;
-	int Remaining    = Count % 128;
-	if (Loops < MEMCPY_ACCEL_THRESHOLD) {
-		return memcpy_base(Destination, Source, Count);
-	}
-	asm_memcpy_sse2(Destination, Source, Loops, Remaining);
-	return Destination;
-}
 
 /* This is the SSE optimized version of memcpy, but there is a fallback
  * to the normal one, in case there isn't enough loops for overhead to be
- * worth it. */
+ * worth it. Used on cpus without SSE2. */
 void *memcpy_sse(void *Destination, const void *Source, size_t Count) {
 	int Loops        = Count / 128;
 	int Remaining    = Count % 128;
@@ -147,48 +117,4 @@ void *memcpy_mmx(void *Destination, const void *Source, size_t Count) {
 	asm_memcpy_mmx(Destination, Source, MmxLoops, mBytes);
 	return Destination;
 }
-
-/* MemCpySelect
- * This is the default, initial routine, it selects the best
- * optimized memcpy for this system. It can be either SSE or MMX
- * or just the byte copier */
-void *memcpy_select(void *Destination, const void *Source, size_t Count) {
-	// Variables
-	int CpuRegisters[4] = { 0 };
-	int CpuFeatEcx = 0;
-	int CpuFeatEdx = 0;
-
-	// Now extract the cpu information 
-	// so we can select a memcpy
-#if defined(_MSC_VER) && !defined(__clang__)
-	__cpuid(CpuRegisters, 1);
-#else
-    __cpuid(1, CpuRegisters[0], CpuRegisters[1], CpuRegisters[2], CpuRegisters[3]);
-#endif
-    // Features are in ecx/edx
-    CpuFeatEcx = CpuRegisters[2];
-    CpuFeatEdx = CpuRegisters[3];
-
-    // Choose between SSE2, SSE, MMX and base
-    if (CpuFeatEdx & CPUID_FEAT_EDX_SSE2) {
-		__GlbMemCpyInstance = memcpy_sse2;
-	}
-	else if (CpuFeatEdx & CPUID_FEAT_EDX_SSE) {
-		__GlbMemCpyInstance = memcpy_sse;
-	}
-	else if (CpuFeatEdx & CPUID_FEAT_EDX_MMX) {
-		__GlbMemCpyInstance = memcpy_mmx;
-	}
-	else {
-		__GlbMemCpyInstance = memcpy_base;
-	}
-	return __GlbMemCpyInstance(Destination, Source, Count);
-}
-
-#if defined(_MSC_VER) && !defined(__clang__)
-#pragma function(memcpy)
-#endif
-void *memcpy(void *destination, const void *source, size_t count) {
-	return __GlbMemCpyInstance(destination, source, count);
-}
 #endif
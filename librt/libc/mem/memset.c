@@ -9,11 +9,7 @@
 #define UNALIGNED(X)   ((long)X & (LBLOCKSIZE - 1))
 #define TOO_SMALL(LEN) ((LEN) < LBLOCKSIZE)
 
-#if defined(_MSC_VER) && !defined(__clang__)
-#pragma function(memset)
-#endif
-
-void *memset(void *dest, int c, size_t count)
+void* memset_base(void *dest, int c, size_t count)
 {
 	char *s = (char *)dest;
 	int i;
@@ -65,4 +61,14 @@ void *memset(void *dest, int c, size_t count)
 		*s++ = (char) c;
 
 	return dest;
-}
\ No newline at end of file
+}
+
+/* memset_erms
+ * Fills the buffer with rep stosb, which is the fastest way of filling memory without
+ * using vector registers on cpus that have the enhanced rep movsb/stosb feature. */
+void* memset_erms(void *dest, int c, size_t count)
+{
+	void *s = dest;
+	__asm__ __volatile__("rep stosb" : "+D"(s), "+c"(count) : "a"(c) : "memory");
+	return dest;
+}
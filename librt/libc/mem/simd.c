@@ -0,0 +1,171 @@
+/* MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * MollenOS - Memory and string routine selection
+ * - The public memory and string routines call through a table of implementations,
+ *   which is filled once at process startup based on the features of the cpu. In
+ *   the kernel the table is filled during boot by the architecture layer.
+ */
+
+#include <string.h>
+#include <internal/_string.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma function(memcpy)
+#pragma function(memset)
+#pragma function(memcmp)
+#pragma function(strlen)
+#pragma function(strcmp)
+#endif
+
+struct string_ops __string_ops = {
+	memcpy_base,
+	memset_base,
+	memchr_base,
+	memcmp_base,
+	strlen_base,
+	strchr_base,
+	strcmp_base
+};
+
+// Don't use SSE/MMX instructions in kernel environment, the kernel installs
+// its own memcpy and memset that safely handles the cpu state
+#ifndef LIBC_KERNEL
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void
+StdStringCpuid(
+	_In_  unsigned int  Leaf,
+	_Out_ unsigned int* Registers)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	__cpuidex((int*)Registers, (int)Leaf, 0);
+#else
+	__cpuid_count(Leaf, 0, Registers[0], Registers[1], Registers[2], Registers[3]);
+#endif
+}
+
+/* StdStringHasAvx2
+ * AVX2 can only be used if the cpu supports it and the OS saves the YMM state
+ * on context switches, which is reported through XCR0. */
+static int
+StdStringHasAvx2(
+	_In_ unsigned int FeaturesEcx)
+{
+	unsigned int Registers[4] = { 0 };
+	unsigned int Xcr0;
+
+	if ((FeaturesEcx & (bit_OSXSAVE | bit_AVX)) != (bit_OSXSAVE | bit_AVX)) {
+		return 0;
+	}
+
+#if defined(_MSC_VER) && !defined(__clang__)
+	Xcr0 = (unsigned int)_xgetbv(0);
+#else
+	{
+		unsigned int Xcr0High;
+		__asm__ __volatile__("xgetbv" : "=a"(Xcr0), "=d"(Xcr0High) : "c"(0));
+		(void)Xcr0High;
+	}
+#endif
+	if ((Xcr0 & 0x6) != 0x6) {
+		return 0;
+	}
+
+	StdStringCpuid(0, &Registers[0]);
+	if (Registers[0] < 7) {
+		return 0;
+	}
+	StdStringCpuid(7, &Registers[0]);
+	return (Registers[1] & bit_AVX2) ? 1 : 0;
+}
+
+/* StdStringInitialize
+ * Selects the best memory and string routines for this cpu. Must be called before
+ * any threads are created. */
+void
+StdStringInitialize(void)
+{
+	unsigned int Registers[4] = { 0 };
+	unsigned int FeaturesEcx;
+	unsigned int FeaturesEdx;
+
+	StdStringCpuid(1, &Registers[0]);
+	FeaturesEcx = Registers[2];
+	FeaturesEdx = Registers[3];
+
+	if (StdStringHasAvx2(FeaturesEcx)) {
+		__string_ops.memcpy = memcpy_avx2;
+		__string_ops.memset = memset_avx2;
+		__string_ops.memchr = memchr_avx2;
+		__string_ops.memcmp = memcmp_avx2;
+		__string_ops.strlen = strlen_avx2;
+		__string_ops.strchr = strchr_avx2;
+		__string_ops.strcmp = strcmp_avx2;
+	}
+	else if (FeaturesEdx & bit_SSE2) {
+		__string_ops.memcpy = memcpy_sse2;
+		__string_ops.memset = memset_sse2;
+		__string_ops.memchr = memchr_sse2;
+		__string_ops.memcmp = memcmp_sse2;
+		__string_ops.strlen = strlen_sse2;
+		__string_ops.strchr = strchr_sse2;
+		__string_ops.strcmp = strcmp_sse2;
+	}
+#if !defined(__amd64__) && !defined(amd64)
+	else if (FeaturesEdx & bit_SSE) {
+		__string_ops.memcpy = memcpy_sse;
+	}
+	else if (FeaturesEdx & bit_MMX) {
+		__string_ops.memcpy = memcpy_mmx;
+	}
+#endif
+}
+#endif
+
+void* memcpy(void* destination, const void* source, size_t count) {
+	return __string_ops.memcpy(destination, source, count);
+}
+
+void* memset(void* destination, int value, size_t count) {
+	return __string_ops.memset(destination, value, count);
+}
+
+void* memchr(const void* source, int value, size_t count) {
+	return __string_ops.memchr(source, value, count);
+}
+
+int memcmp(const void* ptr1, const void* ptr2, size_t count) {
+	return __string_ops.memcmp(ptr1, ptr2, count);
+}
+
+size_t strlen(const char* str) {
+	return __string_ops.strlen(str);
+}
+
+char* strchr(const char* str, int value) {
+	return __string_ops.strchr(str, value);
+}
+
+int strcmp(const char* str1, const char* str2) {
+	return __string_ops.strcmp(str1, str2);
+}
@@ -0,0 +1,368 @@
+/* MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * MollenOS - AVX2 memory and string routines
+ * - Same structure as the SSE2 routines, but working on 32 byte blocks.
+ */
+
+#ifndef LIBC_KERNEL
+#include <immintrin.h>
+#include <internal/_string.h>
+#include <stdint.h>
+
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#define AVX2_ALIGN(Pointer) ((const unsigned char*)((uintptr_t)(Pointer) & ~(uintptr_t)31))
+#define PAGE_OFFSET(Pointer) ((uintptr_t)(Pointer) & 4095)
+
+extern void asm_memcpy_sse2(void *Dest, const void *Source, int Loops, int RemainingBytes);
+
+AVX2_FUNCTION void*
+memcpy_avx2(
+    _In_ void*       Destination,
+    _In_ const void* Source,
+    _In_ size_t      Count)
+{
+    unsigned char*       dst = (unsigned char*)Destination;
+    const unsigned char* src = (const unsigned char*)Source;
+    __m256i              tail[4];
+    size_t               skew;
+
+    if (Count < 8) {
+        while (Count--) {
+            *dst++ = *src++;
+        }
+        return Destination;
+    }
+
+    // Small copies are done with two overlapping moves from either end
+    if (Count <= 16) {
+        __m128i head  = _mm_loadl_epi64((const __m128i*)src);
+        __m128i small = _mm_loadl_epi64((const __m128i*)(src + Count - 8));
+        _mm_storel_epi64((__m128i*)dst, head);
+        _mm_storel_epi64((__m128i*)(dst + Count - 8), small);
+        return Destination;
+    }
+
+    if (Count <= 32) {
+        __m128i head  = _mm_loadu_si128((const __m128i*)src);
+        __m128i small = _mm_loadu_si128((const __m128i*)(src + Count - 16));
+        _mm_storeu_si128((__m128i*)dst, head);
+        _mm_storeu_si128((__m128i*)(dst + Count - 16), small);
+        return Destination;
+    }
+
+    if (Count <= 64) {
+        __m256i head = _mm256_loadu_si256((const __m256i*)src);
+        tail[0]      = _mm256_loadu_si256((const __m256i*)(src + Count - 32));
+        _mm256_storeu_si256((__m256i*)dst, head);
+        _mm256_storeu_si256((__m256i*)(dst + Count - 32), tail[0]);
+        return Destination;
+    }
+
+    if (Count <= 128) {
+        __m256i head0 = _mm256_loadu_si256((const __m256i*)src);
+        __m256i head1 = _mm256_loadu_si256((const __m256i*)(src + 32));
+        tail[0]       = _mm256_loadu_si256((const __m256i*)(src + Count - 64));
+        tail[1]       = _mm256_loadu_si256((const __m256i*)(src + Count - 32));
+        _mm256_storeu_si256((__m256i*)dst, head0);
+        _mm256_storeu_si256((__m256i*)(dst + 32), head1);
+        _mm256_storeu_si256((__m256i*)(dst + Count - 64), tail[0]);
+        _mm256_storeu_si256((__m256i*)(dst + Count - 32), tail[1]);
+        return Destination;
+    }
+
+    // Large copies would only evict the working set, stream them past the cache instead
+    if (Count >= MEMCPY_NONTEMPORAL_THRESHOLD) {
+        asm_memcpy_sse2(Destination, Source, (int)(Count / 128), (int)(Count % 128));
+        _mm_sfence();
+        return Destination;
+    }
+
+    // Copy the last 128 bytes up front, then align the destination and copy the
+    // bulk in blocks of 128 bytes. The overlap with the tail is harmless.
+    tail[0] = _mm256_loadu_si256((const __m256i*)(src + Count - 128));
+    tail[1] = _mm256_loadu_si256((const __m256i*)(src + Count - 96));
+    tail[2] = _mm256_loadu_si256((const __m256i*)(src + Count - 64));
+    tail[3] = _mm256_loadu_si256((const __m256i*)(src + Count - 32));
+    _mm256_storeu_si256((__m256i*)(dst + Count - 128), tail[0]);
+    _mm256_storeu_si256((__m256i*)(dst + Count - 96), tail[1]);
+    _mm256_storeu_si256((__m256i*)(dst + Count - 64), tail[2]);
+    _mm256_storeu_si256((__m256i*)(dst + Count - 32), tail[3]);
+
+    _mm256_storeu_si256((__m256i*)dst, _mm256_loadu_si256((const __m256i*)src));
+    skew   = 32 - ((uintptr_t)dst & 31);
+    dst   += skew;
+    src   += skew;
+    Count -= skew;
+
+    while (Count > 128) {
+        __m256i block0 = _mm256_loadu_si256((const __m256i*)src);
+        __m256i block1 = _mm256_loadu_si256((const __m256i*)(src + 32));
+        __m256i block2 = _mm256_loadu_si256((const __m256i*)(src + 64));
+        __m256i block3 = _mm256_loadu_si256((const __m256i*)(src + 96));
+        _mm256_store_si256((__m256i*)dst, block0);
+        _mm256_store_si256((__m256i*)(dst + 32), block1);
+        _mm256_store_si256((__m256i*)(dst + 64), block2);
+        _mm256_store_si256((__m256i*)(dst + 96), block3);
+        dst   += 128;
+        src   += 128;
+        Count -= 128;
+    }
+    return Destination;
+}
+
+AVX2_FUNCTION void*
+memset_avx2(
+    _In_ void*  Destination,
+    _In_ int    Value,
+    _In_ size_t Count)
+{
+    unsigned char* dst    = (unsigned char*)Destination;
+    __m256i        vvalue = _mm256_set1_epi8((char)Value);
+    unsigned char* end;
+
+    if (Count < 8) {
+        while (Count--) {
+            *dst++ = (unsigned char)Value;
+        }
+        return Destination;
+    }
+
+    if (Count <= 16) {
+        _mm_storel_epi64((__m128i*)dst, _mm256_castsi256_si128(vvalue));
+        _mm_storel_epi64((__m128i*)(dst + Count - 8), _mm256_castsi256_si128(vvalue));
+        return Destination;
+    }
+
+    if (Count <= 32) {
+        _mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(vvalue));
+        _mm_storeu_si128((__m128i*)(dst + Count - 16), _mm256_castsi256_si128(vvalue));
+        return Destination;
+    }
+
+    if (Count <= 64) {
+        _mm256_storeu_si256((__m256i*)dst, vvalue);
+        _mm256_storeu_si256((__m256i*)(dst + Count - 32), vvalue);
+        return Destination;
+    }
+
+    // Fill both unaligned ends, and the aligned blocks in between
+    end = dst + Count;
+    _mm256_storeu_si256((__m256i*)dst, vvalue);
+    _mm256_storeu_si256((__m256i*)(end - 64), vvalue);
+    _mm256_storeu_si256((__m256i*)(end - 32), vvalue);
+
+    dst = (unsigned char*)(((uintptr_t)dst + 32) & ~(uintptr_t)31);
+    while ((size_t)(end - dst) > 128) {
+        _mm256_store_si256((__m256i*)dst, vvalue);
+        _mm256_store_si256((__m256i*)(dst + 32), vvalue);
+        _mm256_store_si256((__m256i*)(dst + 64), vvalue);
+        _mm256_store_si256((__m256i*)(dst + 96), vvalue);
+        dst += 128;
+    }
+    while ((size_t)(end - dst) > 64) {
+        _mm256_store_si256((__m256i*)dst, vvalue);
+        dst += 32;
+    }
+    return Destination;
+}
+
+AVX2_FUNCTION void*
+memchr_avx2(
+    _In_ const void* Source,
+    _In_ int         Value,
+    _In_ size_t      Count)
+{
+    const unsigned char* src    = (const unsigned char*)Source;
+    const unsigned char* block  = AVX2_ALIGN(src);
+    __m256i              vvalue = _mm256_set1_epi8((char)Value);
+    size_t               offset = (size_t)(src - block);
+    size_t               available;
+    unsigned int         mask;
+
+    if (!Count) {
+        return NULL;
+    }
+
+    // The first block is masked to ignore the bytes in front of the buffer
+    mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_load_si256((const __m256i*)block), vvalue)) >> offset;
+    if (mask) {
+        size_t index = (size_t)__builtin_ctz(mask);
+        return index < Count ? (void*)(src + index) : NULL;
+    }
+
+    available = 32 - offset;
+    if (Count <= available) {
+        return NULL;
+    }
+    Count -= available;
+    block += 32;
+
+    for (;;) {
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_load_si256((const __m256i*)block), vvalue));
+        if (mask) {
+            size_t index = (size_t)__builtin_ctz(mask);
+            return index < Count ? (void*)(block + index) : NULL;
+        }
+        if (Count <= 32) {
+            return NULL;
+        }
+        Count -= 32;
+        block += 32;
+    }
+}
+
+AVX2_FUNCTION int
+memcmp_avx2(
+    _In_ const void* Buffer1,
+    _In_ const void* Buffer2,
+    _In_ size_t      Count)
+{
+    const unsigned char* s1 = (const unsigned char*)Buffer1;
+    const unsigned char* s2 = (const unsigned char*)Buffer2;
+    unsigned int         mask;
+    size_t               index;
+
+    if (Count < 32) {
+        while (Count--) {
+            if (*s1 != *s2) {
+                return *s1 - *s2;
+            }
+            s1++;
+            s2++;
+        }
+        return 0;
+    }
+
+    while (Count >= 32) {
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*)s1), _mm256_loadu_si256((const __m256i*)s2)));
+        if (mask != 0xFFFFFFFF) {
+            index = (size_t)__builtin_ctz(~mask);
+            return s1[index] - s2[index];
+        }
+        s1    += 32;
+        s2    += 32;
+        Count -= 32;
+    }
+
+    // Compare the remainder by overlapping with the bytes already known to be equal
+    if (Count) {
+        s1 -= 32 - Count;
+        s2 -= 32 - Count;
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*)s1), _mm256_loadu_si256((const __m256i*)s2)));
+        if (mask != 0xFFFFFFFF) {
+            index = (size_t)__builtin_ctz(~mask);
+            return s1[index] - s2[index];
+        }
+    }
+    return 0;
+}
+
+AVX2_FUNCTION size_t
+strlen_avx2(
+    _In_ const char* String)
+{
+    const unsigned char* block = AVX2_ALIGN(String);
+    __m256i              zero  = _mm256_setzero_si256();
+    unsigned int         mask;
+
+    mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_load_si256((const __m256i*)block), zero)) >> ((const unsigned char*)String - block);
+    if (mask) {
+        return (size_t)__builtin_ctz(mask);
+    }
+
+    for (;;) {
+        block += 32;
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_load_si256((const __m256i*)block), zero));
+        if (mask) {
+            return (size_t)((block + __builtin_ctz(mask)) - (const unsigned char*)String);
+        }
+    }
+}
+
+AVX2_FUNCTION char*
+strchr_avx2(
+    _In_ const char* String,
+    _In_ int         Value)
+{
+    const unsigned char* block  = AVX2_ALIGN(String);
+    __m256i              vvalue = _mm256_set1_epi8((char)Value);
+    __m256i              zero   = _mm256_setzero_si256();
+    __m256i              data   = _mm256_load_si256((const __m256i*)block);
+    unsigned int         mask;
+
+    // Stop at the first byte that is either the value or the terminator
+    mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(data, vvalue), _mm256_cmpeq_epi8(data, zero)));
+    mask >>= ((const unsigned char*)String - block);
+    if (mask) {
+        const char* found = String + __builtin_ctz(mask);
+        return (*found == (char)Value) ? (char*)found : NULL;
+    }
+
+    for (;;) {
+        block += 32;
+        data   = _mm256_load_si256((const __m256i*)block);
+        mask   = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(data, vvalue), _mm256_cmpeq_epi8(data, zero)));
+        if (mask) {
+            const char* found = (const char*)block + __builtin_ctz(mask);
+            return (*found == (char)Value) ? (char*)found : NULL;
+        }
+    }
+}
+
+AVX2_FUNCTION int
+strcmp_avx2(
+    _In_ const char* String1,
+    _In_ const char* String2)
+{
+    const unsigned char* s1   = (const unsigned char*)String1;
+    const unsigned char* s2   = (const unsigned char*)String2;
+    __m256i              zero = _mm256_setzero_si256();
+
+    for (;;) {
+        // Unaligned loads are only safe while neither string is near the end of a page
+        if (PAGE_OFFSET(s1) <= 4096 - 32 && PAGE_OFFSET(s2) <= 4096 - 32) {
+            __m256i      data1 = _mm256_loadu_si256((const __m256i*)s1);
+            __m256i      data2 = _mm256_loadu_si256((const __m256i*)s2);
+            unsigned int mask  = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(data1, data2)) |
+                (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(data1, zero));
+            if (mask) {
+                size_t index = (size_t)__builtin_ctz(mask);
+                return s1[index] - s2[index];
+            }
+            s1 += 32;
+            s2 += 32;
+        }
+        else {
+            if (*s1 != *s2 || *s1 == '\0') {
+                return *s1 - *s2;
+            }
+            s1++;
+            s2++;
+        }
+    }
+}
+#endif
@@ -0,0 +1,362 @@
+/* MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * MollenOS - SSE2 memory and string routines
+ * - The searching routines only ever load aligned 16 byte blocks, which can never
+ *   cross into a page that the string itself does not touch.
+ */
+
+#ifndef LIBC_KERNEL
+#include <emmintrin.h>
+#include <internal/_string.h>
+#include <stdint.h>
+
+#define SSE2_FUNCTION __attribute__((target("sse2")))
+#define SSE2_ALIGN(Pointer) ((const unsigned char*)((uintptr_t)(Pointer) & ~(uintptr_t)15))
+#define PAGE_OFFSET(Pointer) ((uintptr_t)(Pointer) & 4095)
+
+extern void asm_memcpy_sse2(void *Dest, const void *Source, int Loops, int RemainingBytes);
+
+SSE2_FUNCTION void*
+memcpy_sse2(
+    _In_ void*       Destination,
+    _In_ const void* Source,
+    _In_ size_t      Count)
+{
+    unsigned char*       dst = (unsigned char*)Destination;
+    const unsigned char* src = (const unsigned char*)Source;
+    __m128i              tail[4];
+    size_t               skew;
+
+    if (Count < 8) {
+        while (Count--) {
+            *dst++ = *src++;
+        }
+        return Destination;
+    }
+
+    // Small copies are done with two overlapping moves from either end
+    if (Count <= 16) {
+        __m128i head = _mm_loadl_epi64((const __m128i*)src);
+        tail[0]      = _mm_loadl_epi64((const __m128i*)(src + Count - 8));
+        _mm_storel_epi64((__m128i*)dst, head);
+        _mm_storel_epi64((__m128i*)(dst + Count - 8), tail[0]);
+        return Destination;
+    }
+
+    if (Count <= 32) {
+        __m128i head = _mm_loadu_si128((const __m128i*)src);
+        tail[0]      = _mm_loadu_si128((const __m128i*)(src + Count - 16));
+        _mm_storeu_si128((__m128i*)dst, head);
+        _mm_storeu_si128((__m128i*)(dst + Count - 16), tail[0]);
+        return Destination;
+    }
+
+    if (Count <= 64) {
+        __m128i head0 = _mm_loadu_si128((const __m128i*)src);
+        __m128i head1 = _mm_loadu_si128((const __m128i*)(src + 16));
+        tail[0]       = _mm_loadu_si128((const __m128i*)(src + Count - 32));
+        tail[1]       = _mm_loadu_si128((const __m128i*)(src + Count - 16));
+        _mm_storeu_si128((__m128i*)dst, head0);
+        _mm_storeu_si128((__m128i*)(dst + 16), head1);
+        _mm_storeu_si128((__m128i*)(dst + Count - 32), tail[0]);
+        _mm_storeu_si128((__m128i*)(dst + Count - 16), tail[1]);
+        return Destination;
+    }
+
+    // Large copies would only evict the working set, stream them past the cache instead
+    if (Count >= MEMCPY_NONTEMPORAL_THRESHOLD) {
+        asm_memcpy_sse2(Destination, Source, (int)(Count / 128), (int)(Count % 128));
+        _mm_sfence();
+        return Destination;
+    }
+
+    // Copy the last 64 bytes up front, then align the destination and copy the
+    // bulk in blocks of 64 bytes. The overlap with the tail is harmless.
+    tail[0] = _mm_loadu_si128((const __m128i*)(src + Count - 64));
+    tail[1] = _mm_loadu_si128((const __m128i*)(src + Count - 48));
+    tail[2] = _mm_loadu_si128((const __m128i*)(src + Count - 32));
+    tail[3] = _mm_loadu_si128((const __m128i*)(src + Count - 16));
+    _mm_storeu_si128((__m128i*)(dst + Count - 64), tail[0]);
+    _mm_storeu_si128((__m128i*)(dst + Count - 48), tail[1]);
+    _mm_storeu_si128((__m128i*)(dst + Count - 32), tail[2]);
+    _mm_storeu_si128((__m128i*)(dst + Count - 16), tail[3]);
+
+    _mm_storeu_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+    skew   = 16 - ((uintptr_t)dst & 15);
+    dst   += skew;
+    src   += skew;
+    Count -= skew;
+
+    while (Count > 64) {
+        __m128i block0 = _mm_loadu_si128((const __m128i*)src);
+        __m128i block1 = _mm_loadu_si128((const __m128i*)(src + 16));
+        __m128i block2 = _mm_loadu_si128((const __m128i*)(src + 32));
+        __m128i block3 = _mm_loadu_si128((const __m128i*)(src + 48));
+        _mm_store_si128((__m128i*)dst, block0);
+        _mm_store_si128((__m128i*)(dst + 16), block1);
+        _mm_store_si128((__m128i*)(dst + 32), block2);
+        _mm_store_si128((__m128i*)(dst + 48), block3);
+        dst   += 64;
+        src   += 64;
+        Count -= 64;
+    }
+    return Destination;
+}
+
+SSE2_FUNCTION void*
+memset_sse2(
+    _In_ void*  Destination,
+    _In_ int    Value,
+    _In_ size_t Count)
+{
+    unsigned char* dst    = (unsigned char*)Destination;
+    __m128i        vvalue = _mm_set1_epi8((char)Value);
+    unsigned char* end;
+
+    if (Count < 8) {
+        while (Count--) {
+            *dst++ = (unsigned char)Value;
+        }
+        return Destination;
+    }
+
+    if (Count <= 16) {
+        _mm_storel_epi64((__m128i*)dst, vvalue);
+        _mm_storel_epi64((__m128i*)(dst + Count - 8), vvalue);
+        return Destination;
+    }
+
+    if (Count <= 32) {
+        _mm_storeu_si128((__m128i*)dst, vvalue);
+        _mm_storeu_si128((__m128i*)(dst + Count - 16), vvalue);
+        return Destination;
+    }
+
+    if (Count <= 64) {
+        _mm_storeu_si128((__m128i*)dst, vvalue);
+        _mm_storeu_si128((__m128i*)(dst + 16), vvalue);
+        _mm_storeu_si128((__m128i*)(dst + Count - 32), vvalue);
+        _mm_storeu_si128((__m128i*)(dst + Count - 16), vvalue);
+        return Destination;
+    }
+
+    // Fill both unaligned ends, and the aligned blocks in between
+    end = dst + Count;
+    _mm_storeu_si128((__m128i*)dst, vvalue);
+    _mm_storeu_si128((__m128i*)(end - 64), vvalue);
+    _mm_storeu_si128((__m128i*)(end - 48), vvalue);
+    _mm_storeu_si128((__m128i*)(end - 32), vvalue);
+    _mm_storeu_si128((__m128i*)(end - 16), vvalue);
+
+    dst = (unsigned char*)(((uintptr_t)dst + 16) & ~(uintptr_t)15);
+    while ((size_t)(end - dst) > 64) {
+        _mm_store_si128((__m128i*)dst, vvalue);
+        _mm_store_si128((__m128i*)(dst + 16), vvalue);
+        _mm_store_si128((__m128i*)(dst + 32), vvalue);
+        _mm_store_si128((__m128i*)(dst + 48), vvalue);
+        dst += 64;
+    }
+    return Destination;
+}
+
+SSE2_FUNCTION void*
+memchr_sse2(
+    _In_ const void* Source,
+    _In_ int         Value,
+    _In_ size_t      Count)
+{
+    const unsigned char* src    = (const unsigned char*)Source;
+    const unsigned char* block  = SSE2_ALIGN(src);
+    __m128i              vvalue = _mm_set1_epi8((char)Value);
+    size_t               offset = (size_t)(src - block);
+    size_t               available;
+    unsigned int         mask;
+
+    if (!Count) {
+        return NULL;
+    }
+
+    // The first block is masked to ignore the bytes in front of the buffer
+    mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_load_si128((const __m128i*)block), vvalue)) >> offset;
+    if (mask) {
+        size_t index = (size_t)__builtin_ctz(mask);
+        return index < Count ? (void*)(src + index) : NULL;
+    }
+
+    available = 16 - offset;
+    if (Count <= available) {
+        return NULL;
+    }
+    Count -= available;
+    block += 16;
+
+    for (;;) {
+        mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_load_si128((const __m128i*)block), vvalue));
+        if (mask) {
+            size_t index = (size_t)__builtin_ctz(mask);
+            return index < Count ? (void*)(block + index) : NULL;
+        }
+        if (Count <= 16) {
+            return NULL;
+        }
+        Count -= 16;
+        block += 16;
+    }
+}
+
+SSE2_FUNCTION int
+memcmp_sse2(
+    _In_ const void* Buffer1,
+    _In_ const void* Buffer2,
+    _In_ size_t      Count)
+{
+    const unsigned char* s1 = (const unsigned char*)Buffer1;
+    const unsigned char* s2 = (const unsigned char*)Buffer2;
+    unsigned int         mask;
+    size_t               index;
+
+    if (Count < 16) {
+        while (Count--) {
+            if (*s1 != *s2) {
+                return *s1 - *s2;
+            }
+            s1++;
+            s2++;
+        }
+        return 0;
+    }
+
+    while (Count >= 16) {
+        mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)s1), _mm_loadu_si128((const __m128i*)s2)));
+        if (mask != 0xFFFF) {
+            index = (size_t)__builtin_ctz(~mask);
+            return s1[index] - s2[index];
+        }
+        s1    += 16;
+        s2    += 16;
+        Count -= 16;
+    }
+
+    // Compare the remainder by overlapping with the bytes already known to be equal
+    if (Count) {
+        s1 -= 16 - Count;
+        s2 -= 16 - Count;
+        mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)s1), _mm_loadu_si128((const __m128i*)s2)));
+        if (mask != 0xFFFF) {
+            index = (size_t)__builtin_ctz(~mask);
+            return s1[index] - s2[index];
+        }
+    }
+    return 0;
+}
+
+SSE2_FUNCTION size_t
+strlen_sse2(
+    _In_ const char* String)
+{
+    const unsigned char* block = SSE2_ALIGN(String);
+    __m128i              zero  = _mm_setzero_si128();
+    unsigned int         mask;
+
+    mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_load_si128((const __m128i*)block), zero)) >> ((const unsigned char*)String - block);
+    if (mask) {
+        return (size_t)__builtin_ctz(mask);
+    }
+
+    for (;;) {
+        block += 16;
+        mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_load_si128((const __m128i*)block), zero));
+        if (mask) {
+            return (size_t)((block + __builtin_ctz(mask)) - (const unsigned char*)String);
+        }
+    }
+}
+
+SSE2_FUNCTION char*
+strchr_sse2(
+    _In_ const char* String,
+    _In_ int         Value)
+{
+    const unsigned char* block  = SSE2_ALIGN(String);
+    __m128i              vvalue = _mm_set1_epi8((char)Value);
+    __m128i              zero   = _mm_setzero_si128();
+    __m128i              data   = _mm_load_si128((const __m128i*)block);
+    unsigned int         mask;
+
+    // Stop at the first byte that is either the value or the terminator
+    mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(data, vvalue), _mm_cmpeq_epi8(data, zero)));
+    mask >>= ((const unsigned char*)String - block);
+    if (mask) {
+        const char* found = String + __builtin_ctz(mask);
+        return (*found == (char)Value) ? (char*)found : NULL;
+    }
+
+    for (;;) {
+        block += 16;
+        data   = _mm_load_si128((const __m128i*)block);
+        mask   = (unsigned int)_mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(data, vvalue), _mm_cmpeq_epi8(data, zero)));
+        if (mask) {
+            const char* found = (const char*)block + __builtin_ctz(mask);
+            return (*found == (char)Value) ? (char*)found : NULL;
+        }
+    }
+}
+
+SSE2_FUNCTION int
+strcmp_sse2(
+    _In_ const char* String1,
+    _In_ const char* String2)
+{
+    const unsigned char* s1   = (const unsigned char*)String1;
+    const unsigned char* s2   = (const unsigned char*)String2;
+    __m128i              zero = _mm_setzero_si128();
+
+    for (;;) {
+        // Unaligned loads are only safe while neither string is near the end of a page
+        if (PAGE_OFFSET(s1) <= 4096 - 16 && PAGE_OFFSET(s2) <= 4096 - 16) {
+            __m128i      data1 = _mm_loadu_si128((const __m128i*)s1);
+            __m128i      data2 = _mm_loadu_si128((const __m128i*)s2);
+            unsigned int mask  = ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(data1, data2)) |
+                (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(data1, zero));
+            mask &= 0xFFFF;
+            if (mask) {
+                size_t index = (size_t)__builtin_ctz(mask);
+                return s1[index] - s2[index];
+            }
+            s1 += 16;
+            s2 += 16;
+        }
+        else {
+            if (*s1 != *s2 || *s1 == '\0') {
+                return *s1 - *s2;
+            }
+            s1++;
+            s2++;
+        }
+    }
+}
+#endif
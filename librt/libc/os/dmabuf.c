@@ -22,6 +22,7 @@
  *   and functionality, refer to the individual things for descriptions
  */
 
+#include <internal/_io.h>
 #include <internal/_syscalls.h>
 #include <os/dmabuf.h>
 #include <stdlib.h>
@@ -78,6 +79,11 @@ dma_attachment_resize(
     if (!attachment) {
         return OsInvalidParameters;
     }
+    
+    // The mapping may move or shrink, exports of the old range are no longer valid
+    if (attachment->buffer) {
+        stdio_file_exports_invalidate(attachment->buffer, attachment->length);
+    }
     return Syscall_DmaAttachmentResize(attachment, length);
 }
 
@@ -98,6 +104,11 @@ dma_attachment_unmap(
     if (!attachment) {
         return OsInvalidParameters;
     }
+    
+    // Exports of the mapped memory for file transfers are no longer valid
+    if (attachment->buffer) {
+        stdio_file_exports_invalidate(attachment->buffer, attachment->length);
+    }
     return Syscall_DmaAttachmentUnmap(attachment);
 }
 
@@ -108,6 +119,11 @@ dma_detach(
     if (!attachment) {
         return OsInvalidParameters;
     }
+    
+    // Detaching releases a mapping that is still in place
+    if (attachment->buffer) {
+        stdio_file_exports_invalidate(attachment->buffer, attachment->length);
+    }
     return Syscall_DmaDetach(attachment);
 }
 
@@ -166,46 +166,3 @@ GetFileInformationFromFd(
     svc_file_fstat_result(GetGrachtClient(), &msg.base, &status, Information);
     return status;
 }
-
-OsStatus_t
-CreateFileMapping(
-    _In_  int      FileDescriptor,
-    _In_  int      Flags,
-    _In_  uint64_t Offset,
-    _In_  size_t   Length,
-    _Out_ void**   MemoryPointer,
-    _Out_ UUId_t*  Handle)
-{
-    FileMappingParameters_t Parameters;
-    stdio_handle_t*         handle = stdio_handle_get(FileDescriptor);
-    OsStatus_t              Status;
-
-    // Sanitize that the descritor is valid
-    if (handle == NULL || handle->object.type != STDIO_HANDLE_FILE) {
-        return OsInvalidParameters;
-    }
-
-    // Start out by allocating a memory handler handle
-    Status = Syscall_CreateMemoryHandler(Flags, Length, Handle, MemoryPointer);
-    if (Status == OsSuccess) {
-        // Tell the file manager that it now has to handle this as-well
-        Parameters.MemoryHandle   = *Handle;
-        Parameters.Flags          = Flags;
-        Parameters.FileOffset     = Offset;
-        Parameters.VirtualAddress = (uintptr_t)*MemoryPointer;
-        Parameters.Length         = Length;
-        // Status = RegisterFileMapping(object->handle.InheritationHandle, &FileMappingParameters);
-    }
-    return Status;
-}
-
-OsStatus_t
-DestroyFileMapping(
-    _In_ UUId_t Handle)
-{
-    OsStatus_t Status = Syscall_DestroyMemoryHandler(Handle);
-    if (Status == OsSuccess) {
-        // Status = UnregisterFileMapping(Handle);
-    }
-    return Status;
-}
@@ -0,0 +1,379 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * File Mappings
+ * - File mappings are memory handlers that are filled on demand. The first access to
+ *   a page is trapped by the kernel and resolved from the signal handler, which maps the
+ *   chunk of the file that the filemanager caches for the page. Chunks are shared between
+ *   all processes that map the same file. Pages of writable mappings are made writable on
+ *   their first write, which marks them dirty until they are written back to the file.
+ */
+
+#include <internal/_io.h>
+#include <internal/_ipc.h>
+#include <internal/_syscalls.h>
+#include <os/dmabuf.h>
+#include <os/mollenos.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <threads.h>
+
+struct file_mapping {
+    struct file_mapping*   link;
+    UUId_t                 handle;
+    unsigned int           flags;
+    int                    iod;
+    UUId_t                 file_handle;
+    uintptr_t              address;
+    uint64_t               offset;
+    size_t                 length;
+    int                    page_count;
+    int                    slot_count;
+    struct dma_attachment* slots;
+    uint8_t*               dirty;
+};
+
+static struct file_mapping* mappings = NULL;
+static mtx_t                mappings_lock;
+static size_t               page_size = 0;
+
+void
+StdFileMappingsInitialize(void)
+{
+    SystemDescriptor_t descriptor;
+
+    mtx_init(&mappings_lock, mtx_plain);
+    if (SystemQuery(&descriptor) == OsSuccess) {
+        page_size = descriptor.PageSizeBytes;
+    }
+}
+
+static struct file_mapping*
+mapping_find(
+    _In_ uintptr_t address,
+    _In_ UUId_t    handle)
+{
+    struct file_mapping* mapping = mappings;
+    while (mapping) {
+        if (handle != UUID_INVALID) {
+            if (mapping->handle == handle) {
+                break;
+            }
+        }
+        else if (address >= mapping->address && address < (mapping->address + mapping->length)) {
+            break;
+        }
+        mapping = mapping->link;
+    }
+    return mapping;
+}
+
+static stdio_handle_t*
+mapping_get_file(
+    _In_ struct file_mapping* mapping)
+{
+    // The descriptor may have been closed and reused since the mapping was created
+    stdio_handle_t* handle = stdio_handle_get(mapping->iod);
+    if (!handle || handle->object.type != STDIO_HANDLE_FILE ||
+        handle->object.handle != mapping->file_handle) {
+        return NULL;
+    }
+    return handle;
+}
+
+/* mapping_map_slot
+ * Maps the part of the mapping that lies in chunk <slot> of the file. The chunk is
+ * retrieved from the filemanager, and we stay attached to it until the mapping is
+ * destroyed, so its pages stay alive even if the filemanager releases it. */
+static OsStatus_t
+mapping_map_slot(
+    _In_ struct file_mapping* mapping,
+    _In_ int                  slot)
+{
+    struct vali_link_message msg        = VALI_MSG_INIT_HANDLE(GetFileService());
+    uint64_t                 chunkStart = ((mapping->offset / FILE_MAPPING_CHUNK_SIZE) + slot) * FILE_MAPPING_CHUNK_SIZE;
+    uint64_t                 start      = MAX(chunkStart, mapping->offset);
+    uint64_t                 end        = MIN(chunkStart + FILE_MAPPING_CHUNK_SIZE, mapping->offset + mapping->length);
+    UUId_t                   regionHandle;
+    size_t                   regionOffset;
+    size_t                   length;
+    OsStatus_t               status;
+
+    svc_file_get_mapping(GetGrachtClient(), &msg.base, *GetInternalProcessId(), mapping->file_handle,
+        (uint32_t)(start & 0xFFFFFFFF), (uint32_t)((start >> 32) & 0xFFFFFFFF));
+    gracht_client_wait_message(GetGrachtClient(), &msg.base, GetGrachtBuffer(), GRACHT_WAIT_BLOCK);
+    svc_file_get_mapping_result(GetGrachtClient(), &msg.base, &status, &regionHandle, &regionOffset, &length);
+    if (status != OsSuccess) {
+        return status;
+    }
+
+    status = dma_attach(regionHandle, &mapping->slots[slot]);
+    if (status != OsSuccess) {
+        mapping->slots[slot].handle = UUID_INVALID;
+        return status;
+    }
+
+    length = MIN(length, (size_t)(end - start));
+    length = (length + (page_size - 1)) & ~(page_size - 1);
+    status = Syscall_MapMemoryHandler(mapping->handle, (size_t)(start - mapping->offset),
+        regionHandle, regionOffset, length);
+    if (status != OsSuccess) {
+        dma_detach(&mapping->slots[slot]);
+        mapping->slots[slot].handle = UUID_INVALID;
+    }
+    return status;
+}
+
+/* mapping_flush
+ * Writes the dirty pages of the mapping back to the file. The pages are made read-only
+ * again before they are written, so writes that happen during the flush dirty them again. */
+static OsStatus_t
+mapping_flush(
+    _In_ struct file_mapping* mapping)
+{
+    struct vali_link_message msg = VALI_MSG_INIT_HANDLE(GetFileService());
+    stdio_handle_t*          handle;
+    OsStatus_t               status;
+    uint64_t                 fileSize;
+    unsigned int             sizeLo;
+    unsigned int             sizeHi;
+    unsigned int             previous;
+    int                      i = 0;
+
+    if (!(mapping->flags & FILE_MAPPING_WRITE)) {
+        return OsSuccess;
+    }
+
+    handle = mapping_get_file(mapping);
+    if (!handle) {
+        return OsDoesNotExist;
+    }
+
+    // Pages beyond the end of the file are not written back, the file is never extended
+    svc_file_get_size(GetGrachtClient(), &msg.base, *GetInternalProcessId(), mapping->file_handle);
+    gracht_client_wait_message(GetGrachtClient(), &msg.base, GetGrachtBuffer(), GRACHT_WAIT_BLOCK);
+    svc_file_get_size_result(GetGrachtClient(), &msg.base, &status, &sizeLo, &sizeHi);
+    if (status != OsSuccess) {
+        return status;
+    }
+    fileSize = ((uint64_t)sizeHi << 32) | sizeLo;
+
+    while (i < mapping->page_count) {
+        struct iovec iov;
+        uint64_t     start;
+        size_t       written;
+        int          count = 0;
+
+        if (!(mapping->dirty[i / 8] & (1 << (i % 8)))) {
+            i++;
+            continue;
+        }
+
+        while ((i + count) < mapping->page_count &&
+               (mapping->dirty[(i + count) / 8] & (1 << ((i + count) % 8)))) {
+            mapping->dirty[(i + count) / 8] &= ~(1 << ((i + count) % 8));
+            count++;
+        }
+
+        iov.iov_base = (void*)(mapping->address + (i * page_size));
+        iov.iov_len  = count * page_size;
+        start        = mapping->offset + (i * page_size);
+        i           += count;
+
+        MemoryProtect(iov.iov_base, iov.iov_len, MEMORY_READ, &previous);
+        if (start >= fileSize) {
+            continue;
+        }
+
+        iov.iov_len = (size_t)MIN((uint64_t)iov.iov_len, fileSize - start);
+        status      = stdio_file_transfer_vector(handle, 1, (long long)start, &iov, 1, &written);
+        if (status != OsSuccess) {
+            return status;
+        }
+    }
+    return OsSuccess;
+}
+
+/* StdFileMappingFault
+ * Invoked by the signal handler for faults that the kernel traps for memory handlers.
+ * Returns OsSuccess if the fault was resolved and the instruction can be retried. */
+OsStatus_t
+StdFileMappingFault(
+    _In_ void* address)
+{
+    struct file_mapping* mapping;
+    OsStatus_t           status = OsSuccess;
+    unsigned int         previous;
+    uintptr_t            pageAddress;
+    int                  page;
+    int                  slot;
+
+    mtx_lock(&mappings_lock);
+    mapping = mapping_find((uintptr_t)address, UUID_INVALID);
+    if (!mapping) {
+        mtx_unlock(&mappings_lock);
+        return OsDoesNotExist;
+    }
+
+    page        = (int)(((uintptr_t)address - mapping->address) / page_size);
+    pageAddress = mapping->address + (page * page_size);
+    slot        = (int)(((mapping->offset + (page * page_size)) / FILE_MAPPING_CHUNK_SIZE) -
+        (mapping->offset / FILE_MAPPING_CHUNK_SIZE));
+
+    if (mapping->slots[slot].handle == UUID_INVALID) {
+        status = mapping_map_slot(mapping, slot);
+    }
+    else if (mapping->flags & FILE_MAPPING_WRITE) {
+        // The page is present, so this is the first write to it. The kernel only traps
+        // writes for mappings that were created writable.
+        status = MemoryProtect((void*)pageAddress, page_size, MEMORY_READ | MEMORY_WRITE, &previous);
+        if (status == OsSuccess) {
+            mapping->dirty[page / 8] |= (1 << (page % 8));
+        }
+    }
+    // Otherwise another thread mapped the page while we waited for the lock
+    mtx_unlock(&mappings_lock);
+    return status;
+}
+
+OsStatus_t
+CreateFileMapping(
+    _In_  int      FileDescriptor,
+    _In_  int      Flags,
+    _In_  uint64_t Offset,
+    _In_  size_t   Length,
+    _Out_ void**   MemoryPointer,
+    _Out_ UUId_t*  Handle)
+{
+    stdio_handle_t*      handle = stdio_handle_get(FileDescriptor);
+    struct file_mapping* mapping;
+    unsigned int         access = MEMORY_READ;
+    OsStatus_t           status;
+    int                  i;
+
+    if (!handle || handle->object.type != STDIO_HANDLE_FILE || !Length ||
+        !MemoryPointer || !Handle || !page_size || (Offset % page_size)) {
+        return OsInvalidParameters;
+    }
+
+    if (Flags & FILE_MAPPING_WRITE) {
+        access |= MEMORY_WRITE;
+    }
+    if (Flags & FILE_MAPPING_EXECUTE) {
+        access |= MEMORY_EXECUTABLE;
+    }
+
+    mapping = (struct file_mapping*)calloc(1, sizeof(struct file_mapping));
+    if (!mapping) {
+        return OsOutOfMemory;
+    }
+
+    mapping->flags       = (unsigned int)Flags;
+    mapping->iod         = FileDescriptor;
+    mapping->file_handle = handle->object.handle;
+    mapping->offset      = Offset;
+    mapping->page_count  = (int)DIVUP(Length, page_size);
+    mapping->length      = mapping->page_count * page_size;
+    mapping->slot_count  = (int)(((Offset + mapping->length - 1) / FILE_MAPPING_CHUNK_SIZE) -
+        (Offset / FILE_MAPPING_CHUNK_SIZE)) + 1;
+    mapping->slots       = (struct dma_attachment*)malloc(mapping->slot_count * sizeof(struct dma_attachment));
+    if (Flags & FILE_MAPPING_WRITE) {
+        mapping->dirty = (uint8_t*)calloc(DIVUP(mapping->page_count, 8), 1);
+    }
+
+    if (!mapping->slots || ((Flags & FILE_MAPPING_WRITE) && !mapping->dirty)) {
+        status = OsOutOfMemory;
+        goto error;
+    }
+
+    for (i = 0; i < mapping->slot_count; i++) {
+        mapping->slots[i].handle = UUID_INVALID;
+    }
+
+    status = Syscall_CreateMemoryHandler(access, mapping->length, &mapping->handle, (void**)&mapping->address);
+    if (status != OsSuccess) {
+        goto error;
+    }
+
+    mtx_lock(&mappings_lock);
+    mapping->link = mappings;
+    mappings      = mapping;
+    mtx_unlock(&mappings_lock);
+
+    *MemoryPointer = (void*)mapping->address;
+    *Handle        = mapping->handle;
+    return OsSuccess;
+
+error:
+    free(mapping->slots);
+    free(mapping->dirty);
+    free(mapping);
+    return status;
+}
+
+OsStatus_t
+FlushFileMapping(
+    _In_ UUId_t Handle)
+{
+    struct file_mapping* mapping;
+    OsStatus_t           status;
+
+    mtx_lock(&mappings_lock);
+    mapping = mapping_find(0, Handle);
+    status  = mapping ? mapping_flush(mapping) : OsDoesNotExist;
+    mtx_unlock(&mappings_lock);
+    return status;
+}
+
+OsStatus_t
+DestroyFileMapping(
+    _In_ UUId_t Handle)
+{
+    struct file_mapping*  mapping;
+    struct file_mapping** link;
+    OsStatus_t            status;
+    int                   i;
+
+    mtx_lock(&mappings_lock);
+    for (link = &mappings; *link && (*link)->handle != Handle; link = &(*link)->link);
+    mapping = *link;
+    if (!mapping) {
+        mtx_unlock(&mappings_lock);
+        return OsDoesNotExist;
+    }
+
+    // Write back changes before the pages are unmapped, a failed write back is
+    // reported but the mapping is still destroyed
+    status = mapping_flush(mapping);
+    *link  = mapping->link;
+    mtx_unlock(&mappings_lock);
+
+    Syscall_DestroyMemoryHandler(mapping->handle);
+    for (i = 0; i < mapping->slot_count; i++) {
+        if (mapping->slots[i].handle != UUID_INVALID) {
+            dma_detach(&mapping->slots[i]);
+        }
+    }
+
+    free(mapping->slots);
+    free(mapping->dirty);
+    free(mapping);
+    return status;
+}
@@ -30,10 +30,12 @@
 #include <stdlib.h>
 #include <threads.h>
 
+extern void StdStringInitialize(void);
 extern void StdioInitialize(void);
 extern void StdioConfigureStandardHandles(void* inheritanceBlock);
 extern void StdSignalInitialize(void);
 extern void StdSoInitialize(void);
+extern void StdFileMappingsInitialize(void);
 
 // The default inbuilt client for rpc communication. In general this should only be used
 // internally for calls to services and modules.
@@ -56,12 +58,16 @@ void InitializeProcess(int IsModule, ProcessStartupInformation_t* StartupInforma
     __CrtIsModule = IsModule;
 
     // Initialize the standard C library
+    TRACE("[InitializeProcess] initializing stdstring");
+    StdStringInitialize();
     TRACE("[InitializeProcess] initializing stdio");
     StdioInitialize();
     TRACE("[InitializeProcess] initializing stdsig");
     StdSignalInitialize();
     TRACE("[InitializeProcess] initializing so");
     StdSoInitialize();
+    TRACE("[InitializeProcess] initializing file mappings");
+    StdFileMappingsInitialize();
 
     // Create the ipc client
     TRACE("[InitializeProcess] creating rpc link");
@@ -21,8 +21,9 @@
  *   and functionality, refer to the individual things for descriptions
  */
 
-#include <os/mollenos.h>
+#include <internal/_io.h>
 #include <internal/_syscalls.h>
+#include <os/mollenos.h>
 
 OsStatus_t
 MemoryAllocate(
@@ -45,6 +46,9 @@ MemoryFree(
 	if (!Length || !Memory) {
 		return OsInvalidParameters;
 	}
+	
+	// Exports of the memory for file transfers are no longer valid
+	stdio_file_exports_invalidate(Memory, Length);
 	return Syscall_MemoryFree(Memory, Length);
 }
 
@@ -37,6 +37,9 @@ typedef void (*__sa_process_t)(int, void*);
 // by the stack system in the kernel
 extern void __signalentry(void);
 
+// Resolves faults of file mappings, these are delivered as hardware traps
+extern OsStatus_t StdFileMappingFault(void* address);
+
 // The consequences of recieving the different signals
 char signal_fatality[NUMSIGNALS] = {
 	0, /* 0? */
@@ -125,6 +128,13 @@ StdInvokeSignal(
     int          fatal = signal_fatality[Signal] || (Flags & SIGNAL_HARDWARE_TRAP);
     int          i;
     
+    // Accesses to pages of file mappings that are not mapped yet, or the first write
+    // to them, are resolved here and the faulting instruction is retried
+    if (Signal == SIGSEGV && (Flags & SIGNAL_HARDWARE_TRAP) && Argument != NULL &&
+        StdFileMappingFault(Argument) == OsSuccess) {
+        return;
+    }
+
     for (i = 0; i < sizeof(signal_list) / sizeof(signal_list[0]); i++) {
         if (signal_list[i].signal == Signal) {
             sig = &signal_list[i];
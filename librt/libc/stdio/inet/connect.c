@@ -60,8 +60,11 @@ int connect(int iod, const struct sockaddr* address, socklen_t address_length)
         return -1;
     }
     
+    // Internet datagram sockets are connected in the network service as well, as it
+    // filters the datagrams that are received
     if (handle->object.data.socket.type == SOCK_STREAM ||
-        handle->object.data.socket.type == SOCK_SEQPACKET) {
+        handle->object.data.socket.type == SOCK_SEQPACKET ||
+        handle->object.data.socket.domain == AF_INET) {
         svc_socket_connect(GetGrachtClient(), &msg.base, handle->object.handle, address);
         gracht_client_wait_message(GetGrachtClient(), &msg.base, GetGrachtBuffer(), GRACHT_WAIT_BLOCK);
         svc_socket_connect_result(GetGrachtClient(), &msg.base, &status);
@@ -70,7 +73,9 @@ int connect(int iod, const struct sockaddr* address, socklen_t address_length)
             return -1;
         }
     }
-    else {
+    
+    if (handle->object.data.socket.type != SOCK_STREAM &&
+        handle->object.data.socket.type != SOCK_SEQPACKET) {
         memcpy(&handle->object.data.socket.default_address, address, address_length);
     }
     return 0;
@@ -86,10 +86,14 @@ static intmax_t perform_recv_stream(streambuffer_t* stream, struct msghdr* msg,
     for (i = 0; i < msg->msg_iovlen; i++) {
         struct iovec* iov = &msg->msg_iov[i];
         TRACE("[libc] [socket] [recv] reading %" PRIuIN "bytes", iov->iov_len);
-        numbytes += streambuffer_stream_in(stream, iov->iov_base, iov->iov_len, sb_options);
-        TRACE("[libc] [socket] [recv] read %i bytes", numbytes);
-        if (numbytes < iov->iov_len) {
-            if (!(flags & MSG_DONTWAIT)) {
+        size_t bytes_read = streambuffer_stream_in(stream, iov->iov_base, iov->iov_len, sb_options);
+        TRACE("[libc] [socket] [recv] read %" PRIuIN " bytes", bytes_read);
+        numbytes += bytes_read;
+        
+        // A partial read is a normal outcome for stream sockets, but a blocking read
+        // that returns nothing means the stream has been shut down
+        if (bytes_read < iov->iov_len) {
+            if (!numbytes && !(flags & MSG_DONTWAIT)) {
                 _set_errno(EPIPE);
                 numbytes = -1;
             }
@@ -251,6 +255,14 @@ intmax_t recvmsg(int iod, struct msghdr* msg_hdr, int flags)
     
     numbytes = perform_recv(handle, msg_hdr, flags);
     
+    // Internet stream sockets advertise the free space of the receive stream to the
+    // peer, so the network service must know when data has been consumed
+    if (numbytes > 0 && !(flags & MSG_PEEK) &&
+        handle->object.data.socket.domain == AF_INET &&
+        handle->object.data.socket.type == SOCK_STREAM) {
+        stdio_handle_activity(handle, IOSETSYN);
+    }
+    
     // Fill in the source address if one was provided already, and overwrite
     // the one provided by the packet.
     if (numbytes > 0 && msg_hdr->msg_name != NULL) {
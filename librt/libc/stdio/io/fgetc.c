@@ -72,7 +72,8 @@ int _filbuf(
 		return c;
 	}
 	else {
-		// Now actually fill the buffer
+		// Now actually fill the buffer, grow it first if the previous one was used up
+		os_grow_buffer(file);
 		file->_cnt = read(file->_fd, file->_base, file->_bufsiz);
 
 		// If it failed, we are either at end of file or encounted
@@ -56,6 +56,9 @@ _flsbuf(
             written = 0;
 
         /* Reset buffer and put the char into it */
+        if (written == count) {
+            os_grow_buffer(stream);
+        }
         stream->_ptr = stream->_base + sizeof(TCHAR);
         stream->_cnt = stream->_bufsiz - sizeof(TCHAR);
         *(TCHAR*)stream->_base = ch;
@@ -485,6 +485,7 @@ size_t fread(void *vptr, size_t size, size_t count, FILE *stream)
 	while (rcnt > 0) {
 		int i;
 		if (!stream->_cnt && rcnt < BUFSIZ && (stream->_flag & (_IOMYBUF | _USERBUF))) {
+			os_grow_buffer(stream);
 			stream->_cnt = read(stream->_fd, stream->_base, stream->_bufsiz);
 			stream->_ptr = stream->_base;
 			i = (stream->_cnt < rcnt) ? stream->_cnt : rcnt;
@@ -0,0 +1,95 @@
+/* MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Standard C Library 
+ *   - Positional reads and writes on io handles, the position of the
+ *     handle is not changed by these.
+ */
+
+#include <errno.h>
+#include <internal/_io.h>
+#include <io.h>
+#include <os/mollenos.h>
+#include <sys/uio.h>
+
+static stdio_handle_t*
+get_positional_handle(int fd, long long offset)
+{
+    stdio_handle_t* handle = stdio_handle_get(fd);
+    if (!handle) {
+        _set_errno(EBADFD);
+        return NULL;
+    }
+
+    if (handle->object.type != STDIO_HANDLE_FILE) {
+        _set_errno(ESPIPE);
+        return NULL;
+    }
+
+    if (offset < 0) {
+        _set_errno(EINVAL);
+        return NULL;
+    }
+    return handle;
+}
+
+int pread(int fd, void* buffer, unsigned int length, long long offset)
+{
+    stdio_handle_t* handle = get_positional_handle(fd, offset);
+    struct iovec    iov    = { .iov_base = buffer, .iov_len = length };
+    size_t          bytesRead;
+    OsStatus_t      status;
+
+    if (!handle) {
+        return -1;
+    }
+
+    if (!length) {
+        return 0;
+    }
+
+    status = stdio_file_transfer_vector(handle, 0, offset, &iov, 1, &bytesRead);
+    if (status != OsSuccess) {
+        OsStatusToErrno(status);
+        return -1;
+    }
+    return (int)bytesRead;
+}
+
+int pwrite(int fd, const void* buffer, unsigned int length, long long offset)
+{
+    stdio_handle_t* handle = get_positional_handle(fd, offset);
+    struct iovec    iov    = { .iov_base = (void*)buffer, .iov_len = length };
+    size_t          bytesWritten;
+    OsStatus_t      status;
+
+    if (!handle) {
+        return -1;
+    }
+
+    if (!length) {
+        return 0;
+    }
+
+    status = stdio_file_transfer_vector(handle, 1, offset, &iov, 1, &bytesWritten);
+    if (status != OsSuccess) {
+        OsStatusToErrno(status);
+        return -1;
+    }
+    return (int)bytesWritten;
+}
@@ -0,0 +1,142 @@
+/* MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Standard C Library 
+ *   - Vectored reads and writes on io handles
+ */
+
+#include <errno.h>
+#include <internal/_io.h>
+#include <io.h>
+#include <os/mollenos.h>
+#include <sys/uio.h>
+
+// Raw file handles transfer all parts in one go, everything else goes through
+// read and write part by part so text processing and other handle types work.
+static int
+is_vectored_handle(stdio_handle_t* handle)
+{
+    return handle->object.type == STDIO_HANDLE_FILE &&
+        !(handle->wxflag & WX_TEXT) && handle->lookahead[0] == '\n';
+}
+
+static int
+validate_iovec(const struct iovec* iov, int iovcnt)
+{
+    if (!iov || iovcnt < 0 || iovcnt > IOV_MAX) {
+        _set_errno(EINVAL);
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t readv(int fd, const struct iovec* iov, int iovcnt)
+{
+    stdio_handle_t* handle    = stdio_handle_get(fd);
+    size_t          bytesRead = 0;
+    OsStatus_t      status;
+    int             i;
+
+    if (!handle) {
+        _set_errno(EBADFD);
+        return -1;
+    }
+
+    if (validate_iovec(iov, iovcnt)) {
+        return -1;
+    }
+
+    if (!is_vectored_handle(handle)) {
+        for (i = 0; i < iovcnt; i++) {
+            int partRead = read(fd, iov[i].iov_base, (unsigned int)iov[i].iov_len);
+            if (partRead < 0) {
+                return bytesRead ? (ssize_t)bytesRead : -1;
+            }
+
+            bytesRead += (size_t)partRead;
+            if ((size_t)partRead != iov[i].iov_len) {
+                break;
+            }
+        }
+        return (ssize_t)bytesRead;
+    }
+
+    if (handle->wxflag & WX_ATEOF) {
+        return 0;
+    }
+
+    status = stdio_file_transfer_vector(handle, 0, -1, iov, iovcnt, &bytesRead);
+    if (status != OsSuccess) {
+        OsStatusToErrno(status);
+        return -1;
+    }
+
+    if (!bytesRead) {
+        for (i = 0; i < iovcnt; i++) {
+            if (iov[i].iov_len) {
+                handle->wxflag |= WX_ATEOF;
+                break;
+            }
+        }
+    }
+    return (ssize_t)bytesRead;
+}
+
+ssize_t writev(int fd, const struct iovec* iov, int iovcnt)
+{
+    stdio_handle_t* handle       = stdio_handle_get(fd);
+    size_t          bytesWritten = 0;
+    OsStatus_t      status;
+    int             i;
+
+    if (!handle) {
+        _set_errno(EBADFD);
+        return -1;
+    }
+
+    if (validate_iovec(iov, iovcnt)) {
+        return -1;
+    }
+
+    if (!is_vectored_handle(handle)) {
+        for (i = 0; i < iovcnt; i++) {
+            int partWritten = write(fd, iov[i].iov_base, (unsigned int)iov[i].iov_len);
+            if (partWritten < 0) {
+                return bytesWritten ? (ssize_t)bytesWritten : -1;
+            }
+
+            bytesWritten += (size_t)partWritten;
+            if ((size_t)partWritten != iov[i].iov_len) {
+                break;
+            }
+        }
+        return (ssize_t)bytesWritten;
+    }
+
+    // If appending, go to EOF
+    if (handle->wxflag & WX_APPEND) {
+        lseek(fd, 0, SEEK_END);
+    }
+
+    status = stdio_file_transfer_vector(handle, 1, -1, iov, iovcnt, &bytesWritten);
+    if (status != OsSuccess) {
+        OsStatusToErrno(status);
+        return -1;
+    }
+    return (ssize_t)bytesWritten;
+}
@@ -85,7 +85,6 @@ thrd_t thrd_current(void) {
 #include <assert.h>
 #include <ddk/handle.h>
 #include <ddk/utils.h>
-#include <ds/collection.h>
 #include <errno.h>
 #include <internal/_syscalls.h>
 #include <internal/_io.h>
@@ -93,12 +92,21 @@ thrd_t thrd_current(void) {
 #include <ctt_input_protocol.h>
 #include <os/keycodes.h>
 #include <os/mollenos.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static Collection_t stdio_objects = COLLECTION_INIT(KeyInteger); // TODO hashtable
-static FILE         __GlbStdout = { 0 }, __GlbStdin = { 0 }, __GlbStderr = { 0 };
+// Handles are stored in a two-level table indexed by their descriptor. The blocks of
+// the table are allocated on demand and never freed, so lookups need no locking.
+#define STDIO_TABLE_BLOCK_SHIFT 8
+#define STDIO_TABLE_BLOCK_SIZE  (1 << STDIO_TABLE_BLOCK_SHIFT)
+#define STDIO_TABLE_BLOCKS      (INTERNAL_MAXFILES / STDIO_TABLE_BLOCK_SIZE)
+
+typedef _Atomic(stdio_handle_t*) stdio_table_block_t[STDIO_TABLE_BLOCK_SIZE];
+
+static _Atomic(stdio_table_block_t*) stdio_table[STDIO_TABLE_BLOCKS] = { 0 };
+static FILE                          __GlbStdout = { 0 }, __GlbStdin = { 0 }, __GlbStderr = { 0 };
 
 /* StdioIsHandleInheritable
  * Returns whether or not the handle should be inheritted by sub-processes based on the requested
@@ -142,10 +150,13 @@ static size_t
 StdioGetNumberOfInheritableHandles(
     _In_ ProcessConfiguration_t* Configuration)
 {
-    size_t NumberOfFiles = 0;
+    stdio_handle_t* Object;
+    size_t          NumberOfFiles = 0;
+    int             fd            = -1;
+    
     LOCK_FILES();
-    foreach(Node, &stdio_objects) {
-        stdio_handle_t* Object = (stdio_handle_t*)Node->Data;
+    while ((Object = stdio_handle_next(fd)) != NULL) {
+        fd = Object->fd;
         if (StdioIsHandleInheritable(Configuration, Object) == OsSuccess) {
             NumberOfFiles++;
         }
@@ -161,8 +172,10 @@ StdioCreateInheritanceBlock(
     _Out_ size_t*                 InheritationBlockLengthOut)
 {
     stdio_inheritation_block_t* InheritationBlock;
+    stdio_handle_t*             Object;
     size_t                      NumberOfObjects;
-    int                         i = 0;
+    int                         fd = -1;
+    int                         i  = 0;
 
     assert(Configuration != NULL);
 
@@ -183,8 +196,8 @@ StdioCreateInheritanceBlock(
         InheritationBlock->handle_count = NumberOfObjects;
         
         LOCK_FILES();
-        foreach(Node, &stdio_objects) {
-            stdio_handle_t* Object = (stdio_handle_t*)Node->Data;
+        while ((Object = stdio_handle_next(fd)) != NULL) {
+            fd = Object->fd;
             if (StdioIsHandleInheritable(Configuration, Object) == OsSuccess) {
                 memcpy(&InheritationBlock->handles[i], Object, sizeof(stdio_handle_t));
                 
@@ -287,11 +300,11 @@ stdio_close_all_handles(void)
 {
     stdio_handle_t* handle;
     int             files_closed = 0;
+    int             fd           = -1;
     
     LOCK_FILES();
-    while (CollectionBegin(&stdio_objects) != NULL) {
-        CollectionItem_t* Node = CollectionBegin(&stdio_objects);
-        handle = (stdio_handle_t*)Node->Data;
+    while ((handle = stdio_handle_next(fd)) != NULL) {
+        fd = handle->fd;
         
         // Is it a buffered stream or raw?
         if (handle->buffered_stream) {
@@ -317,12 +330,43 @@ StdioCleanup(void)
     // Flush all file buffers and close handles
     os_flush_all_buffers(_IOWRT | _IOREAD);
     stdio_close_all_handles();
+    
+    // Release the cached exports of buffers used for file transfers
+    stdio_file_exports_invalidate(NULL, SIZE_MAX);
+}
+
+static int
+stdio_table_set(int fd, stdio_handle_t* handle)
+{
+    _Atomic(stdio_table_block_t*)* slot  = &stdio_table[fd >> STDIO_TABLE_BLOCK_SHIFT];
+    stdio_table_block_t*           block = atomic_load(slot);
+    
+    // Install a new block if this is the first descriptor in it, another thread
+    // might beat us to it in which case its block is used
+    if (!block) {
+        stdio_table_block_t* expected = NULL;
+        if (!handle) {
+            return 0;
+        }
+        
+        block = calloc(1, sizeof(stdio_table_block_t));
+        if (!block) {
+            return -1;
+        }
+        
+        if (!atomic_compare_exchange_strong(slot, &expected, block)) {
+            free(block);
+            block = expected;
+        }
+    }
+    
+    atomic_store(&(*block)[fd & (STDIO_TABLE_BLOCK_SIZE - 1)], handle);
+    return 0;
 }
 
 int stdio_handle_create(int fd, int flags, stdio_handle_t** handle_out)
 {
     stdio_handle_t* handle;
-    DataKey_t       key;
     int             updated_fd;
 
     // the bitmap allocator handles both cases if we want to allocate a specific
@@ -335,6 +379,7 @@ int stdio_handle_create(int fd, int flags, stdio_handle_t** handle_out)
 
     handle = (stdio_handle_t*)malloc(sizeof(stdio_handle_t));
     if (!handle) {
+        stdio_bitmap_free(updated_fd);
         _set_errno(ENOMEM);
         return -1;
     }
@@ -351,8 +396,12 @@ int stdio_handle_create(int fd, int flags, stdio_handle_t** handle_out)
     spinlock_init(&handle->lock, spinlock_recursive);
     stdio_get_null_operations(&handle->ops);
 
-    key.Value.Integer = updated_fd;
-    CollectionAppend(&stdio_objects, CollectionCreateNode(key, handle));
+    if (stdio_table_set(updated_fd, handle)) {
+        stdio_bitmap_free(updated_fd);
+        free(handle);
+        _set_errno(ENOMEM);
+        return -1;
+    }
     TRACE("[stdio_handle_create] success %i", updated_fd);
     
     *handle_out = handle;
@@ -430,14 +479,11 @@ int stdio_handle_set_buffered(stdio_handle_t* handle, FILE* stream, unsigned int
 
 int stdio_handle_destroy(stdio_handle_t* handle, int flags)
 {
-    DataKey_t key;
-    
     if (!handle) {
         return EBADF;
     }
     
-    key.Value.Integer = handle->fd;
-    CollectionRemoveByKey(&stdio_objects, key);
+    stdio_table_set(handle->fd, NULL);
     stdio_bitmap_free(handle->fd);
     free(handle);
     return EOK;
@@ -455,8 +501,38 @@ int stdio_handle_activity(stdio_handle_t* handle , int activity)
 
 stdio_handle_t* stdio_handle_get(int iod)
 {
-    DataKey_t Key = { .Value.Integer = iod };
-    return (stdio_handle_t*)CollectionGetDataByKey(&stdio_objects, Key, 0);
+    stdio_table_block_t* block;
+    
+    if (iod < 0 || iod >= INTERNAL_MAXFILES) {
+        return NULL;
+    }
+    
+    block = atomic_load(&stdio_table[iod >> STDIO_TABLE_BLOCK_SHIFT]);
+    if (!block) {
+        return NULL;
+    }
+    return atomic_load(&(*block)[iod & (STDIO_TABLE_BLOCK_SIZE - 1)]);
+}
+
+stdio_handle_t* stdio_handle_next(int iod)
+{
+    int i = (iod < 0) ? 0 : iod + 1;
+    
+    while (i < INTERNAL_MAXFILES) {
+        stdio_table_block_t* block = atomic_load(&stdio_table[i >> STDIO_TABLE_BLOCK_SHIFT]);
+        if (!block) {
+            i = (i | (STDIO_TABLE_BLOCK_SIZE - 1)) + 1;
+            continue;
+        }
+        
+        do {
+            stdio_handle_t* handle = atomic_load(&(*block)[i & (STDIO_TABLE_BLOCK_SIZE - 1)]);
+            if (handle) {
+                return handle;
+            }
+        } while (++i & (STDIO_TABLE_BLOCK_SIZE - 1));
+    }
+    return NULL;
 }
 
 FILE* stdio_get_std(int n)
@@ -486,10 +562,6 @@ int isatty(int fd)
     return handle->wxflag & WX_TTY;
 }
 
-Collection_t* stdio_get_handles(void)
-{
-    return &stdio_objects;
-}
 
 
 UUId_t GetNativeHandle(int iod)
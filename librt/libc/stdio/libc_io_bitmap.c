@@ -28,7 +28,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define STDIO_BITMAP_BITS  (8 * sizeof(int))
+#define STDIO_BITMAP_WORDS DIVUP(INTERNAL_MAXFILES, STDIO_BITMAP_BITS)
+
 static int*       stdio_fd_bitmap = NULL;
+static int        stdio_fd_hint   = 0; // words before this are full
 static spinlock_t stdio_fd_lock   = _SPN_INITIALIZER_NP(spinlock_plain);
 
 int stdio_bitmap_initialize(void)
@@ -68,9 +72,15 @@ int stdio_bitmap_allocate(int fd)
     else {
         // due to initialization might try to allocate fd's before parsing the inheritation
         // we would like to reserve some of the lower fds for STDOUT, STDERR, STDIN
-        j = 3;
+        i = stdio_fd_hint;
+        j = (i == 0) ? 3 : 0;
 
-        for (i = 0; i < DIVUP(INTERNAL_MAXFILES, (8 * sizeof(int))); i++) {
+        for (; i < STDIO_BITMAP_WORDS; i++) {
+            if (stdio_fd_bitmap[i] == -1) {
+                j = 0;
+                continue;
+            }
+            
             for (; j < (8 * sizeof(int)); j++) {
                 if (!(stdio_fd_bitmap[i] & (1 << j))) {
                     stdio_fd_bitmap[i] |= (1 << j);
@@ -85,6 +95,7 @@ int stdio_bitmap_allocate(int fd)
             }
             j = 0;
         }
+        stdio_fd_hint = i;
     }
     spinlock_release(&stdio_fd_lock);
     return result;
@@ -104,6 +115,9 @@ void stdio_bitmap_free(int fd)
         // Set the given fd index to free
         spinlock_acquire(&stdio_fd_lock);
         stdio_fd_bitmap[block] &= ~(1 << offset);
+        if (block < stdio_fd_hint) {
+            stdio_fd_hint = block;
+        }
         spinlock_release(&stdio_fd_lock);
     }
 }
@@ -23,13 +23,10 @@
 
 #include <assert.h>
 #include <ddk/utils.h>
-#include <ds/collection.h>
 #include <internal/_io.h>
 #include <io.h>
 #include <stdlib.h>
 
-extern Collection_t* stdio_get_handles(void);
-
 /* os_alloc_buffer
  * Allocates a transfer buffer for a stdio file stream */
 OsStatus_t
@@ -59,6 +56,30 @@ os_alloc_buffer(
     return OsSuccess;
 }
 
+/* os_grow_buffer
+ * Doubles the buffer of a stream that used its entire buffer since the last refill or
+ * flush, so sequential access needs fewer transfers. The buffer must not hold any data. */
+void
+os_grow_buffer(
+    _In_ FILE* file)
+{
+    char* buffer;
+
+    if (!(file->_flag & _IOMYBUF) || file->_bufsiz >= INTERNAL_MAXBUFSIZ ||
+        file->_ptr != (file->_base + file->_bufsiz)) {
+        return;
+    }
+
+    buffer = malloc(file->_bufsiz * 2);
+    if (buffer) {
+        free(file->_base);
+        file->_base   = buffer;
+        file->_bufsiz *= 2;
+        file->_ptr    = buffer;
+        file->_cnt    = 0;
+    }
+}
+
 /* add_std_buffer
  * Allocate temporary buffer for stdout and stderr */
 OsStatus_t
@@ -105,7 +126,8 @@ os_flush_buffer(
 {
     if ((file->_flag & (_IOREAD | _IOWRT)) == _IOWRT && 
         file->_flag & (_IOMYBUF | _USERBUF)) {
-        int cnt = file->_ptr - file->_base;
+        stdio_handle_t* handle = stdio_handle_get(file->_fd);
+        int             cnt    = file->_ptr - file->_base;
 
         // Flush them
         if (cnt > 0 && write(file->_fd, file->_base, cnt) != cnt) {
@@ -113,6 +135,13 @@ os_flush_buffer(
             return OsError;
         }
 
+        // Wait for the data to reach the file, writes may complete in the background
+        if (handle && handle->object.type == STDIO_HANDLE_FILE &&
+            stdio_file_stream_sync(handle) != OsSuccess) {
+            file->_flag |= _IOERR;
+            return OsError;
+        }
+
         // If it's rw, clear the write flag
         if (file->_flag & _IORW) {
             file->_flag &= ~_IOWRT;
@@ -129,14 +158,15 @@ int
 os_flush_all_buffers(
     _In_ int mask)
 {
-    stdio_handle_t*  Object;
+    stdio_handle_t* Object;
     int             FilesFlushes = 0;
+    int             fd           = -1;
     FILE*           File;
 
     LOCK_FILES();
-    foreach(Node, stdio_get_handles()) {
-        Object  = (stdio_handle_t*)Node->Data;
-        File    = Object->buffered_stream;
+    while ((Object = stdio_handle_next(fd)) != NULL) {
+        fd   = Object->fd;
+        File = Object->buffered_stream;
         if (File != NULL && (File->_flag & mask)) {
             fflush(File);
             FilesFlushes++;
@@ -26,13 +26,149 @@
 #include <errno.h>
 #include <internal/_io.h>
 #include <internal/_ipc.h>
+#include <internal/_syscalls.h>
 #include <io.h>
 #include <os/mollenos.h>
+#include <os/types/file.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <threads.h>
 #include "../threads/tls.h"
 
+// Transfers larger than a single chunk are split up and pipelined as asynchronous
+// transfers, so the file manager always has the next chunk queued when one completes.
+// The caller still waits for the last chunk, read and write must return the number of
+// bytes that were actually transferred.
+#define FILE_TRANSFER_CHUNK_SIZE  0x10000
+#define FILE_TRANSFER_MAX_PENDING 4
+
+// Each chunk is a request of its own, and the response is waited for on the context of
+// that request. Any thread that receives the response on the shared client completes it.
+struct file_transfer {
+    struct vali_link_message msg;
+    size_t                   length;
+    OsStatus_t               status;
+    size_t                   bytes_transferred;
+};
+
+// Exports of caller buffers are kept, so repeated transfers through the same buffer
+// do not export the memory again. They are released when evicted, or when the memory
+// they cover is freed.
+#define FILE_EXPORT_CACHE_SIZE    4
+
+struct file_export {
+    void*                 buffer;
+    size_t                length;
+    int                   references;
+    int                   stale;
+    unsigned int          last_use;
+    struct dma_attachment attachment;
+};
+
+static struct file_export g_exports[FILE_EXPORT_CACHE_SIZE] = { { 0 } };
+static unsigned int       g_exportClock = 0;
+static mtx_t              g_exportsLock = MUTEX_INIT(mtx_plain);
+
+// Exports of caller memory are detached without invalidating the export cache, the
+// memory itself stays in place. This is also called with the exports lock held.
+static inline void
+export_detach(struct dma_attachment* attachment)
+{
+    Syscall_DmaDetach(attachment);
+}
+
+static OsStatus_t
+queue_transfer(UUId_t file_handle, UUId_t buffer_handle, int direction,
+    size_t offset, size_t length, struct file_transfer* transfer)
+{
+    struct vali_link_message msg = VALI_MSG_INIT_HANDLE(GetFileService());
+    
+    transfer->msg               = msg;
+    transfer->length            = length;
+    transfer->status            = OsSuccess;
+    transfer->bytes_transferred = 0;
+    
+    // The transfers are executed in order at the current position of the handle
+    if (svc_file_transfer_async(GetGrachtClient(), &transfer->msg.base, *GetInternalProcessId(),
+            file_handle, FILE_POSITION_CURRENT, FILE_POSITION_CURRENT, direction,
+            buffer_handle, offset, length)) {
+        // Release the context of the request that failed to send
+        svc_file_transfer_async_result(GetGrachtClient(), &transfer->msg.base,
+            &transfer->status, &transfer->bytes_transferred);
+        return OsError;
+    }
+    return OsSuccess;
+}
+
+static void
+wait_transfer(struct file_transfer* transfer)
+{
+    // If another thread is receiving on the client, the wait turns into an await on
+    // this context instead, so keep going until the response has been stored
+    while (svc_file_transfer_async_result(GetGrachtClient(), &transfer->msg.base,
+            &transfer->status, &transfer->bytes_transferred) == GRACHT_MESSAGE_INPROGRESS) {
+        gracht_client_wait_message(GetGrachtClient(), &transfer->msg.base, GetGrachtBuffer(), GRACHT_WAIT_BLOCK);
+    }
+}
+
+static OsStatus_t
+perform_transfer_async(UUId_t file_handle, UUId_t buffer_handle, int direction,
+    size_t length, size_t* bytesTransferredOut)
+{
+    struct file_transfer transfers[FILE_TRANSFER_MAX_PENDING];
+    size_t               chunkCount       = DIVUP(length, FILE_TRANSFER_CHUNK_SIZE);
+    size_t               issued           = 0;
+    size_t               completed        = 0;
+    size_t               bytesTransferred = 0;
+    OsStatus_t           status           = OsSuccess;
+    int                  stop             = 0;
+    TRACE("[libc] [file-io] [perform_transfer_async] length %" PRIuIN, length);
+    
+    while (completed < issued || (!stop && issued < chunkCount)) {
+        struct file_transfer* transfer;
+        
+        // Keep the pipeline filled, but stop issuing once any transfer came up short
+        while (!stop && issued < chunkCount && (issued - completed) < FILE_TRANSFER_MAX_PENDING) {
+            size_t offset = issued * FILE_TRANSFER_CHUNK_SIZE;
+            
+            transfer = &transfers[issued % FILE_TRANSFER_MAX_PENDING];
+            status   = queue_transfer(file_handle, buffer_handle, direction, offset,
+                MIN(FILE_TRANSFER_CHUNK_SIZE, length - offset), transfer);
+            if (status != OsSuccess) {
+                stop = 1;
+                break;
+            }
+            issued++;
+        }
+        
+        if (completed == issued) {
+            break;
+        }
+        
+        transfer = &transfers[completed % FILE_TRANSFER_MAX_PENDING];
+        wait_transfer(transfer);
+        completed++;
+        
+        if (!stop) {
+            if (transfer->status != OsSuccess) {
+                status = transfer->status;
+                stop   = 1;
+            }
+            else {
+                bytesTransferred += transfer->bytes_transferred;
+                if (transfer->bytes_transferred != transfer->length) {
+                    stop = 1;
+                }
+            }
+        }
+    }
+    
+    *bytesTransferredOut = bytesTransferred;
+    return (bytesTransferred != 0) ? OsSuccess : status;
+}
+
 static inline OsStatus_t
 perform_transfer(UUId_t file_handle, UUId_t buffer_handle, int direction, 
     size_t chunkSize, off_t offset, size_t length, size_t* bytesTransferreOut)
@@ -68,21 +204,116 @@ perform_transfer(UUId_t file_handle, UUId_t buffer_handle, int direction,
     return status;
 }
 
-OsStatus_t stdio_file_op_read(stdio_handle_t* handle, void* buffer, size_t length, size_t* bytesReadOut)
+static struct file_export*
+acquire_export(void* buffer, size_t length)
 {
-    UUId_t     builtinHandle = tls_current()->transfer_buffer.handle;
-    size_t     builtinLength = tls_current()->transfer_buffer.length;
-    size_t     bytesRead;
-    OsStatus_t status;
+    struct file_export*    victim = NULL;
+    struct dma_buffer_info info;
+    int                    i;
     
-    // There is a time when reading more than a couple of times is considerably slower
-    // than just reading the entire thing at once. 
-    if (length >= builtinLength) {
-        struct dma_buffer_info info;
-        struct dma_attachment  attachment;
+    mtx_lock(&g_exportsLock);
+    for (i = 0; i < FILE_EXPORT_CACHE_SIZE; i++) {
+        struct file_export* export = &g_exports[i];
+        if (export->buffer == buffer && export->length >= length) {
+            export->references++;
+            export->last_use = ++g_exportClock;
+            mtx_unlock(&g_exportsLock);
+            return export;
+        }
         
-        // enforce dword alignment on the buffer
-        assert(((uintptr_t)buffer % 0x4) == 0);
+        // Prefer free slots, then the least recently used export that is not in use
+        if (!export->references && (!victim || !export->buffer ||
+                (victim->buffer && export->last_use < victim->last_use))) {
+            victim = export;
+        }
+    }
+    
+    if (!victim) {
+        mtx_unlock(&g_exportsLock);
+        return NULL;
+    }
+    
+    if (victim->buffer) {
+        export_detach(&victim->attachment);
+        victim->buffer = NULL;
+    }
+    
+    info.name     = "stdio_transfer";
+    info.length   = length;
+    info.capacity = length;
+    info.flags    = DMA_PERSISTANT;
+    if (dma_export(buffer, &info, &victim->attachment) != OsSuccess) {
+        mtx_unlock(&g_exportsLock);
+        return NULL;
+    }
+    
+    victim->buffer     = buffer;
+    victim->length     = length;
+    victim->references = 1;
+    victim->last_use   = ++g_exportClock;
+    mtx_unlock(&g_exportsLock);
+    return victim;
+}
+
+static void
+release_export(struct file_export* export)
+{
+    mtx_lock(&g_exportsLock);
+    export->references--;
+    
+    // The memory was freed while the export was in use, it must not be reused
+    if (!export->references && export->stale) {
+        export_detach(&export->attachment);
+        export->stale = 0;
+    }
+    mtx_unlock(&g_exportsLock);
+}
+
+void stdio_file_exports_invalidate(void* memory, size_t length)
+{
+    uintptr_t start = (uintptr_t)memory;
+    int       i;
+    
+    mtx_lock(&g_exportsLock);
+    for (i = 0; i < FILE_EXPORT_CACHE_SIZE; i++) {
+        struct file_export* export = &g_exports[i];
+        uintptr_t           exportStart = (uintptr_t)export->buffer;
+        if (!export->buffer || exportStart >= (start + length) ||
+            (exportStart + export->length) <= start) {
+            continue;
+        }
+        
+        export->buffer = NULL;
+        if (export->references) {
+            export->stale = 1;
+        }
+        else {
+            export_detach(&export->attachment);
+        }
+    }
+    mtx_unlock(&g_exportsLock);
+}
+
+static OsStatus_t
+perform_transfer_direct(UUId_t file_handle, void* buffer, int direction,
+    size_t length, size_t* bytesTransferredOut)
+{
+    struct file_export*   export;
+    struct dma_attachment attachment;
+    UUId_t                buffer_handle;
+    OsStatus_t            status;
+    
+    // enforce dword alignment on the buffer
+    assert(((uintptr_t)buffer % 0x4) == 0);
+    
+    // Reuse the export of the buffer if we have one, and only fall back to a
+    // temporary export if all cached exports are in use.
+    export = acquire_export(buffer, length);
+    if (export) {
+        buffer_handle = export->attachment.handle;
+    }
+    else {
+        struct dma_buffer_info info;
         
         info.name     = "stdio_transfer";
         info.length   = length;
@@ -93,14 +324,428 @@ OsStatus_t stdio_file_op_read(stdio_handle_t* handle, void* buffer, size_t lengt
         if (status != OsSuccess) {
             return status;
         }
+        buffer_handle = attachment.handle;
+    }
+    
+    // Pass the callers pointer directly here
+    if (length > FILE_TRANSFER_CHUNK_SIZE) {
+        status = perform_transfer_async(file_handle, buffer_handle,
+            direction, length, bytesTransferredOut);
+    }
+    else {
+        status = perform_transfer(file_handle, buffer_handle,
+            direction, length, 0, length, bytesTransferredOut);
+    }
+    
+    if (export) {
+        release_export(export);
+    }
+    else {
+        export_detach(&attachment);
+    }
+    return status;
+}
+
+// Handles that are read or written sequentially get a pair of buffers. Reads are served
+// from one buffer while the next part of the file is transferred into the other, and the
+// size of the read-ahead doubles for every refill. Writes are copied into the buffers and
+// complete in the background, a failure is reported by the next operation on the handle.
+// The stream state is shared by all threads using the handle, and is only touched with
+// the lock of the stream held.
+#define FILE_STREAM_BUFFER_SIZE   FILE_TRANSFER_CHUNK_SIZE
+#define FILE_STREAM_WINDOW_MIN    0x4000
+#define FILE_STREAM_SEQUENTIAL    2
+
+#define FILE_STREAM_IDLE  0
+#define FILE_STREAM_READ  1
+#define FILE_STREAM_WRITE 2
+
+struct file_stream_buffer {
+    struct file_transfer transfer;
+    int                  pending;
+    size_t               offset;
+    size_t               index;
+    size_t               length;
+};
+
+struct file_stream {
+    mtx_t                     lock;
+    struct dma_attachment     attachment;
+    struct file_stream_buffer buffers[2];
+    int                       current;
+    int                       mode;
+    int                       sequential;
+    int                       eof;
+    size_t                    window;
+    OsStatus_t                status;
+};
+
+static void
+file_stream_reset(struct file_stream* stream)
+{
+    int i;
+    
+    for (i = 0; i < 2; i++) {
+        stream->buffers[i].pending = 0;
+        stream->buffers[i].offset  = i * FILE_STREAM_BUFFER_SIZE;
+        stream->buffers[i].index   = 0;
+        stream->buffers[i].length  = 0;
+    }
+    stream->current = 0;
+    stream->mode    = FILE_STREAM_IDLE;
+    stream->eof     = 0;
+    stream->window  = FILE_STREAM_WINDOW_MIN;
+}
+
+/* file_stream_get
+ * Returns the stream of the handle, which is created by the first transfer. Threads
+ * racing to create it agree on the one that is installed first. */
+static struct file_stream*
+file_stream_get(stdio_handle_t* handle)
+{
+    struct file_stream* stream = handle->file_stream;
+    
+    if (stream) {
+        return stream;
+    }
+    
+    stream = calloc(1, sizeof(struct file_stream));
+    if (!stream) {
+        return NULL;
+    }
+    mtx_init(&stream->lock, mtx_plain);
+    file_stream_reset(stream);
+    
+    spinlock_acquire(&handle->lock);
+    if (!handle->file_stream) {
+        handle->file_stream = stream;
+        stream              = NULL;
+    }
+    spinlock_release(&handle->lock);
+    
+    if (stream) {
+        mtx_destroy(&stream->lock);
+        free(stream);
+    }
+    return handle->file_stream;
+}
+
+static void
+file_stream_wait(struct file_stream* stream, struct file_stream_buffer* buffer)
+{
+    struct file_transfer* transfer = &buffer->transfer;
+    
+    wait_transfer(transfer);
+    
+    buffer->pending = 0;
+    buffer->index   = 0;
+    buffer->length  = 0;
+    if (transfer->status != OsSuccess) {
+        stream->status = transfer->status;
+    }
+    else if (stream->mode == FILE_STREAM_READ) {
+        buffer->length = transfer->bytes_transferred;
+        if (transfer->bytes_transferred != transfer->length) {
+            stream->eof = 1;
+        }
+    }
+    else if (transfer->bytes_transferred != transfer->length) {
+        stream->status = OsError;
+    }
+}
+
+static void
+file_stream_fill(stdio_handle_t* handle, struct file_stream* stream,
+    struct file_stream_buffer* buffer)
+{
+    if (stream->eof || stream->status != OsSuccess) {
+        return;
+    }
+    
+    if (queue_transfer(handle->object.handle, stream->attachment.handle, 0,
+            buffer->offset, stream->window, &buffer->transfer) != OsSuccess) {
+        stream->status = OsError;
+        return;
+    }
+    
+    buffer->pending = 1;
+    buffer->index   = 0;
+    buffer->length  = 0;
+    stream->window  = MIN(stream->window << 1, FILE_STREAM_BUFFER_SIZE);
+}
+
+static inline int
+file_stream_drained(struct file_stream_buffer* buffer)
+{
+    return !buffer->pending && buffer->index == buffer->length;
+}
+
+/* file_stream_sync
+ * Waits for all transfers in flight and returns the handle to the position the caller
+ * sees, which is behind the file position if read-ahead data was not consumed. */
+static OsStatus_t
+file_stream_sync(stdio_handle_t* handle, struct file_stream* stream)
+{
+    struct vali_link_message msg        = VALI_MSG_INIT_HANDLE(GetFileService());
+    size_t                   unconsumed = 0;
+    OsStatus_t               status;
+    int                      i;
+    
+    for (i = 0; i < 2; i++) {
+        struct file_stream_buffer* buffer = &stream->buffers[(stream->current + i) & 1];
+        if (buffer->pending) {
+            file_stream_wait(stream, buffer);
+        }
+        unconsumed += buffer->length - buffer->index;
+    }
+    
+    status = stream->status;
+    if (stream->mode == FILE_STREAM_READ && unconsumed) {
+        LargeInteger_t position;
+        OsStatus_t     seekStatus;
         
-        // Pass the callers pointer directly here
-        status = perform_transfer(handle->object.handle, attachment.handle,
-            0, length, 0, length, bytesReadOut);
-        dma_detach(&attachment);
+        svc_file_get_position(GetGrachtClient(), &msg.base, *GetInternalProcessId(), handle->object.handle);
+        gracht_client_wait_message(GetGrachtClient(), &msg.base, GetGrachtBuffer(), GRACHT_WAIT_BLOCK);
+        svc_file_get_position_result(GetGrachtClient(), &msg.base, &seekStatus,
+            &position.u.LowPart, &position.u.HighPart);
+        if (seekStatus == OsSuccess) {
+            position.QuadPart -= unconsumed;
+            svc_file_seek(GetGrachtClient(), &msg.base, *GetInternalProcessId(),
+                handle->object.handle, position.u.LowPart, position.u.HighPart);
+            gracht_client_wait_message(GetGrachtClient(), &msg.base, GetGrachtBuffer(), GRACHT_WAIT_BLOCK);
+            svc_file_seek_result(GetGrachtClient(), &msg.base, &seekStatus);
+        }
+        
+        // Read errors were already reported to the reader, so only the seek counts
+        status = seekStatus;
+    }
+    
+    stream->status = OsSuccess;
+    file_stream_reset(stream);
+    return status;
+}
+
+/* file_stream_prepare
+ * Tracks the access pattern of the handle and returns the stream to use for the
+ * operation, or NULL if the operation should be performed directly. Called with the
+ * lock of the stream held. */
+static OsStatus_t
+file_stream_prepare(stdio_handle_t* handle, struct file_stream* stream, int mode, size_t length,
+    struct file_stream** streamOut)
+{
+    OsStatus_t status = OsSuccess;
+    
+    *streamOut = NULL;
+    if (!stream) {
+        return OsSuccess;
+    }
+    
+    // The buffers only hold data for one direction
+    if (stream->mode != FILE_STREAM_IDLE && stream->mode != mode) {
+        status = file_stream_sync(handle, stream);
+        if (status != OsSuccess) {
+            return status;
+        }
+    }
+    
+    // Large writes are not copied, but must be ordered after the writes in flight. Large
+    // reads first consume the buffered data, which the stream takes care of.
+    if (mode == FILE_STREAM_WRITE && length >= FILE_STREAM_BUFFER_SIZE) {
+        return (stream->mode != FILE_STREAM_IDLE) ? file_stream_sync(handle, stream) : OsSuccess;
+    }
+    
+    if (stream->mode == FILE_STREAM_IDLE) {
+        if (++stream->sequential <= FILE_STREAM_SEQUENTIAL) {
+            return OsSuccess;
+        }
+        
+        if (!stream->attachment.buffer) {
+            struct dma_buffer_info info;
+            
+            info.name     = "stdio_stream";
+            info.length   = 2 * FILE_STREAM_BUFFER_SIZE;
+            info.capacity = 2 * FILE_STREAM_BUFFER_SIZE;
+            info.flags    = 0;
+            if (dma_create(&info, &stream->attachment) != OsSuccess) {
+                stream->attachment.buffer = NULL;
+                return OsSuccess;
+            }
+        }
+        stream->mode   = mode;
+        stream->window = MAX(FILE_STREAM_WINDOW_MIN, MIN(length, FILE_STREAM_BUFFER_SIZE));
+    }
+    
+    *streamOut = stream;
+    return OsSuccess;
+}
+
+static OsStatus_t
+file_stream_read(stdio_handle_t* handle, struct file_stream* stream, void* buffer,
+    size_t length, size_t* bytesReadOut)
+{
+    char*      data      = (char*)stream->attachment.buffer;
+    char*      cursor    = (char*)buffer;
+    size_t     bytesRead = 0;
+    OsStatus_t status;
+    
+    while (bytesRead < length) {
+        struct file_stream_buffer* current = &stream->buffers[stream->current];
+        struct file_stream_buffer* next    = &stream->buffers[stream->current ^ 1];
+        size_t                     count;
+        
+        if (current->pending) {
+            file_stream_wait(stream, current);
+        }
+        
+        count = MIN(length - bytesRead, current->length - current->index);
+        if (count) {
+            memcpy(cursor + bytesRead, data + current->offset + current->index, count);
+            current->index += count;
+            bytesRead      += count;
+            continue;
+        }
+        
+        // Nothing is buffered or in flight anymore. Large requests are transferred
+        // directly into the callers buffer from here.
+        if (file_stream_drained(next)) {
+            if (stream->eof || stream->status != OsSuccess) {
+                break;
+            }
+            
+            if ((length - bytesRead) >= FILE_STREAM_BUFFER_SIZE &&
+                !((uintptr_t)(cursor + bytesRead) & 0x3)) {
+                size_t bytesTransferred;
+                
+                status = perform_transfer_direct(handle->object.handle, cursor + bytesRead, 0,
+                    length - bytesRead, &bytesTransferred);
+                bytesRead += bytesTransferred;
+                if (status != OsSuccess) {
+                    stream->status = status;
+                }
+                else if (bytesRead != length) {
+                    stream->eof = 1;
+                }
+                break;
+            }
+            file_stream_fill(handle, stream, next);
+        }
+        
+        // Refill the drained buffer behind the next one
+        file_stream_fill(handle, stream, current);
+        stream->current ^= 1;
+    }
+    
+    // Keep the read-ahead going while the caller consumes what was read
+    if (file_stream_drained(&stream->buffers[stream->current])) {
+        file_stream_fill(handle, stream, &stream->buffers[stream->current]);
+        if (stream->buffers[stream->current].pending) {
+            stream->current ^= 1;
+        }
+    }
+    
+    // Once everything up to the end of file or an error has been handed out, start over
+    // with the next read so a file that grows is read again. Errors are reported by the
+    // first read that returns no data.
+    status = stream->status;
+    if (file_stream_drained(&stream->buffers[0]) && file_stream_drained(&stream->buffers[1]) &&
+        (stream->eof || (status != OsSuccess && bytesRead == 0))) {
+        stream->status = OsSuccess;
+        file_stream_reset(stream);
+    }
+    
+    *bytesReadOut = bytesRead;
+    return (bytesRead != 0) ? OsSuccess : status;
+}
+
+static OsStatus_t
+file_stream_write(stdio_handle_t* handle, struct file_stream* stream, const void* buffer,
+    size_t length, size_t* bytesWrittenOut)
+{
+    struct file_stream_buffer* current = &stream->buffers[stream->current];
+    OsStatus_t                 status;
+    
+    if (current->pending) {
+        file_stream_wait(stream, current);
+    }
+    
+    // Report the failure of an earlier write
+    if (stream->status != OsSuccess) {
+        return file_stream_sync(handle, stream);
+    }
+    
+    memcpy((char*)stream->attachment.buffer + current->offset, buffer, length);
+    status = queue_transfer(handle->object.handle, stream->attachment.handle, 1,
+        current->offset, length, &current->transfer);
+    if (status != OsSuccess) {
         return status;
     }
     
+    current->pending = 1;
+    stream->current ^= 1;
+    *bytesWrittenOut = length;
+    return OsSuccess;
+}
+
+static inline OsStatus_t
+file_stream_flush(stdio_handle_t* handle, struct file_stream* stream)
+{
+    if (!stream || stream->mode == FILE_STREAM_IDLE) {
+        return OsSuccess;
+    }
+    return file_stream_sync(handle, stream);
+}
+
+static inline void
+file_stream_lock(struct file_stream* stream)
+{
+    if (stream) {
+        mtx_lock(&stream->lock);
+    }
+}
+
+static inline void
+file_stream_unlock(struct file_stream* stream)
+{
+    if (stream) {
+        mtx_unlock(&stream->lock);
+    }
+}
+
+OsStatus_t stdio_file_stream_sync(stdio_handle_t* handle)
+{
+    struct file_stream* stream = handle->file_stream;
+    OsStatus_t          status;
+    
+    file_stream_lock(stream);
+    status = file_stream_flush(handle, stream);
+    file_stream_unlock(stream);
+    return status;
+}
+
+static OsStatus_t
+file_read(stdio_handle_t* handle, struct file_stream* stream, void* buffer, size_t length,
+    size_t* bytesReadOut)
+{
+    UUId_t     builtinHandle = tls_current()->transfer_buffer.handle;
+    size_t     builtinLength = tls_current()->transfer_buffer.length;
+    size_t     bytesRead;
+    OsStatus_t status;
+    
+    status = file_stream_prepare(handle, stream, FILE_STREAM_READ, length, &stream);
+    if (status != OsSuccess) {
+        return status;
+    }
+    
+    if (stream) {
+        return file_stream_read(handle, stream, buffer, length, bytesReadOut);
+    }
+    
+    // There is a time when reading more than a couple of times is considerably slower
+    // than just reading the entire thing at once. 
+    if (length >= builtinLength) {
+        return perform_transfer_direct(handle->object.handle, buffer, 0, length, bytesReadOut);
+    }
+    
     status = perform_transfer(handle->object.handle, builtinHandle, 0,
         builtinLength, 0, length, &bytesRead);
     if (status == OsSuccess && bytesRead > 0) {
@@ -111,35 +756,27 @@ OsStatus_t stdio_file_op_read(stdio_handle_t* handle, void* buffer, size_t lengt
     return status;
 }
 
-OsStatus_t stdio_file_op_write(stdio_handle_t* handle, const void* buffer,
+static OsStatus_t
+file_write(stdio_handle_t* handle, struct file_stream* stream, const void* buffer,
     size_t length, size_t* bytesWrittenOut)
 {
     UUId_t     builtinHandle = tls_current()->transfer_buffer.handle;
     size_t     builtinLength = tls_current()->transfer_buffer.length;
     OsStatus_t status;
     
+    status = file_stream_prepare(handle, stream, FILE_STREAM_WRITE, length, &stream);
+    if (status != OsSuccess) {
+        return status;
+    }
+    
+    if (stream) {
+        return file_stream_write(handle, stream, buffer, length, bytesWrittenOut);
+    }
+    
     // There is a time when reading more than a couple of times is considerably slower
     // than just reading the entire thing at once. 
     if (length >= builtinLength) {
-        struct dma_buffer_info info;
-        struct dma_attachment  attachment;
-        
-        // enforce dword alignment on the buffer
-        assert(((uintptr_t)buffer % 0x4) == 0);
-        
-        info.length   = length;
-        info.capacity = length;
-        info.flags    = DMA_PERSISTANT;
-        
-        status = dma_export((void*)buffer, &info, &attachment);
-        if (status != OsSuccess) {
-            return status;
-        }
-        
-        status = perform_transfer(handle->object.handle, attachment.handle,
-            1, length, 0, length, bytesWrittenOut);
-        dma_detach(&attachment);
-        return status;
+        return perform_transfer_direct(handle->object.handle, (void*)buffer, 1, length, bytesWrittenOut);
     }
     
     memcpy(tls_current()->transfer_buffer.buffer, buffer, length);
@@ -148,47 +785,320 @@ OsStatus_t stdio_file_op_write(stdio_handle_t* handle, const void* buffer,
     return status;
 }
 
-OsStatus_t stdio_file_op_seek(stdio_handle_t* handle, int origin, off64_t offset, long long* position_out)
+// Direct transfers are done with the lock held as well, so they stay ordered with the
+// transfers of the stream.
+OsStatus_t stdio_file_op_read(stdio_handle_t* handle, void* buffer, size_t length, size_t* bytesReadOut)
 {
-    struct vali_link_message msg = VALI_MSG_INIT_HANDLE(GetFileService());
-    OsStatus_t               status;
-    LargeInteger_t           SeekFinal;
+    struct file_stream* stream = file_stream_get(handle);
+    OsStatus_t          status;
+    
+    file_stream_lock(stream);
+    status = file_read(handle, stream, buffer, length, bytesReadOut);
+    file_stream_unlock(stream);
+    return status;
+}
 
-    // If we search from SEEK_SET, just build offset directly
-    if (origin != SEEK_SET) {
-        LargeInteger_t FileInitial;
+OsStatus_t stdio_file_op_write(stdio_handle_t* handle, const void* buffer,
+    size_t length, size_t* bytesWrittenOut)
+{
+    struct file_stream* stream = file_stream_get(handle);
+    OsStatus_t          status;
+    
+    file_stream_lock(stream);
+    status = file_write(handle, stream, buffer, length, bytesWrittenOut);
+    file_stream_unlock(stream);
+    return status;
+}
 
-        // Adjust for seek origin
-        if (origin == SEEK_CUR) {
-            svc_file_get_position(GetGrachtClient(), &msg.base, *GetInternalProcessId(), handle->object.handle);
-            gracht_client_wait_message(GetGrachtClient(), &msg.base, GetGrachtBuffer(), GRACHT_WAIT_BLOCK);
-            svc_file_get_position_result(GetGrachtClient(), &msg.base, &status, &FileInitial.u.LowPart, &FileInitial.u.HighPart);
-            if (status != OsSuccess) {
-                ERROR("failed to get file position");
-                return status;
+// Vectored transfers gather small parts in the transfer buffer of the thread, and parts
+// that are larger than the transfer buffer are exported and transferred in place.
+struct file_vector_part {
+    const struct iovec*   iov;
+    int                   staged;
+    int                   temporary;
+    struct file_export*   export;
+    struct dma_attachment attachment;
+};
+
+static void
+file_vector_release(struct file_vector_part* parts, int count)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        if (parts[i].export) {
+            release_export(parts[i].export);
+        }
+        else if (parts[i].temporary) {
+            export_detach(&parts[i].attachment);
+        }
+    }
+}
+
+/* file_vector_prepare
+ * Builds the next request of a vectored transfer, starting at the given part of the
+ * iovec. The request ends when it is full, or when the transfer buffer runs out. */
+static OsStatus_t
+file_vector_prepare(const struct iovec* iov, int iovcnt, int direction, FileVector_t* vectors,
+    struct file_vector_part* parts, int* countOut, int* consumedOut, size_t* lengthOut)
+{
+    struct dma_attachment* builtin = &tls_current()->transfer_buffer;
+    size_t                 staged  = 0;
+    size_t                 length  = 0;
+    int                    count   = 0;
+    int                    i;
+
+    for (i = 0; i < iovcnt && count < FILE_VECTOR_MAX; i++) {
+        struct file_vector_part* part       = &parts[count];
+        FileVector_t*            vector     = &vectors[count];
+        size_t                   partLength = iov[i].iov_len;
+
+        if (!partLength) {
+            continue;
+        }
+
+        memset(part, 0, sizeof(struct file_vector_part));
+        part->iov = &iov[i];
+
+        // Parts that fit in the remaining transfer buffer are staged in it
+        if (partLength <= (builtin->length - staged)) {
+            if (direction) {
+                memcpy((char*)builtin->buffer + staged, iov[i].iov_base, partLength);
             }
+            vector->BufferHandle = builtin->handle;
+            vector->BufferOffset = staged;
+            part->staged         = 1;
+            staged              += partLength;
+        }
+        else if (partLength >= builtin->length) {
+            // Exports must be dword aligned, so unaligned parts start inside the export
+            size_t misalignment = (uintptr_t)iov[i].iov_base % 0x4;
+            void*  exportBase   = (char*)iov[i].iov_base - misalignment;
+            size_t exportLength = partLength + misalignment;
 
-            // Sanitize for overflow
-            if ((size_t)FileInitial.QuadPart != FileInitial.QuadPart) {
-                ERROR("file-offset-overflow");
-                _set_errno(EOVERFLOW);
-                return OsError;
+            part->export = acquire_export(exportBase, exportLength);
+            if (!part->export) {
+                struct dma_buffer_info info;
+
+                info.name     = "stdio_transfer";
+                info.length   = exportLength;
+                info.capacity = exportLength;
+                info.flags    = DMA_PERSISTANT;
+                if (dma_export(exportBase, &info, &part->attachment) != OsSuccess) {
+                    break;
+                }
+                part->temporary = 1;
             }
+            vector->BufferHandle = part->export ? part->export->attachment.handle : part->attachment.handle;
+            vector->BufferOffset = misalignment;
         }
         else {
-            svc_file_get_size(GetGrachtClient(), &msg.base, *GetInternalProcessId(), handle->object.handle);
+            // Small part that does not fit anymore, it goes in the next request
+            break;
+        }
+
+        vector->Length = partLength;
+        length        += partLength;
+        count++;
+    }
+
+    if (!count && i < iovcnt) {
+        // The part could neither be staged nor exported
+        return OsOutOfMemory;
+    }
+
+    *countOut    = count;
+    *consumedOut = i;
+    *lengthOut   = length;
+    return OsSuccess;
+}
+
+/* stdio_file_transfer_vector
+ * Reads or writes the parts of the iovec with as few requests as possible. A negative
+ * offset transfers at the current position of the handle, otherwise the transfer is done
+ * at the given offset and the position is not changed. */
+OsStatus_t stdio_file_transfer_vector(stdio_handle_t* handle, int direction, long long offset,
+    const struct iovec* iov, int iovcnt, size_t* bytesTransferredOut)
+{
+    struct vali_link_message msg = VALI_MSG_INIT_HANDLE(GetFileService());
+    struct file_stream*      stream = handle->file_stream;
+    FileVector_t             vectors[FILE_VECTOR_MAX];
+    struct file_vector_part  parts[FILE_VECTOR_MAX];
+    size_t                   bytesTotal = 0;
+    OsStatus_t               status;
+    TRACE("[libc] [file-io] [transfer_vector] count %i, offset %lli", iovcnt, offset);
+
+    // Outstanding read-ahead and write-behind must be settled before the request, and
+    // the stream stays locked until the request is done
+    file_stream_lock(stream);
+    status = file_stream_flush(handle, stream);
+    if (status != OsSuccess) {
+        file_stream_unlock(stream);
+        return status;
+    }
+
+    while (iovcnt > 0) {
+        size_t   bytesTransferred = 0;
+        size_t   length;
+        uint32_t offsetLo = FILE_POSITION_CURRENT;
+        uint32_t offsetHi = FILE_POSITION_CURRENT;
+        int      consumed;
+        int      count;
+        int      i;
+
+        status = file_vector_prepare(iov, iovcnt, direction, &vectors[0], &parts[0],
+            &count, &consumed, &length);
+        if (status != OsSuccess) {
+            break;
+        }
+
+        if (count) {
+            if (offset >= 0) {
+                offsetLo = (uint32_t)((unsigned long long)(offset + bytesTotal) & 0xFFFFFFFF);
+                offsetHi = (uint32_t)(((unsigned long long)(offset + bytesTotal) >> 32) & 0xFFFFFFFF);
+            }
+
+            svc_file_transfer_vector(GetGrachtClient(), &msg.base, *GetInternalProcessId(),
+                handle->object.handle, direction, offsetLo, offsetHi, &vectors[0],
+                count * sizeof(FileVector_t), count);
             gracht_client_wait_message(GetGrachtClient(), &msg.base, GetGrachtBuffer(), GRACHT_WAIT_BLOCK);
-            svc_file_get_size_result(GetGrachtClient(), &msg.base, &status, &FileInitial.u.LowPart, &FileInitial.u.HighPart);
-            if (status != OsSuccess) {
-                ERROR("failed to get file size");
-                return status;
+            svc_file_transfer_vector_result(GetGrachtClient(), &msg.base, &status, &bytesTransferred);
+
+            // Scatter the staged parts back to the caller
+            if (!direction) {
+                size_t remaining = bytesTransferred;
+                for (i = 0; i < count && remaining; i++) {
+                    size_t partLength = MIN(remaining, vectors[i].Length);
+                    if (parts[i].staged) {
+                        memcpy(parts[i].iov->iov_base, (char*)tls_current()->transfer_buffer.buffer +
+                            vectors[i].BufferOffset, partLength);
+                    }
+                    remaining -= partLength;
+                }
             }
+            file_vector_release(&parts[0], count);
+        }
+
+        bytesTotal += bytesTransferred;
+        iov        += consumed;
+        iovcnt     -= consumed;
+        if (status != OsSuccess || bytesTransferred != length) {
+            break;
         }
-        SeekFinal.QuadPart = FileInitial.QuadPart + offset;
     }
-    else {
+
+    file_stream_unlock(stream);
+    *bytesTransferredOut = bytesTotal;
+    return (bytesTotal != 0) ? OsSuccess : status;
+}
+
+/* file_seek
+ * Read-ahead moves the file position past the position the caller sees. The read-ahead is
+ * kept when the new position is inside of it, so position queries and short seeks are
+ * served from the stream. Called with the lock of the stream held. */
+static OsStatus_t
+file_seek(stdio_handle_t* handle, struct file_stream* stream, int origin, off64_t offset,
+    long long* position_out)
+{
+    struct vali_link_message msg        = VALI_MSG_INIT_HANDLE(GetFileService());
+    size_t                   unconsumed = 0;
+    int                      buffered   = 0;
+    OsStatus_t               status;
+    LargeInteger_t           FileInitial;
+    LargeInteger_t           Position;
+    LargeInteger_t           SeekFinal;
+    int                      i;
+
+    if (stream && stream->mode == FILE_STREAM_READ) {
+        for (i = 0; i < 2; i++) {
+            struct file_stream_buffer* buffer = &stream->buffers[(stream->current + i) & 1];
+            if (buffer->pending) {
+                file_stream_wait(stream, buffer);
+            }
+            unconsumed += buffer->length - buffer->index;
+        }
+        buffered = (stream->status == OsSuccess);
+    }
+
+    // Write-behind must complete before the position is used, and a read-ahead that
+    // failed is dropped
+    if (!buffered) {
+        status = file_stream_flush(handle, stream);
+        if (status != OsSuccess) {
+            return status;
+        }
+    }
+
+    Position.QuadPart = 0;
+    if (origin == SEEK_CUR || buffered) {
+        svc_file_get_position(GetGrachtClient(), &msg.base, *GetInternalProcessId(), handle->object.handle);
+        gracht_client_wait_message(GetGrachtClient(), &msg.base, GetGrachtBuffer(), GRACHT_WAIT_BLOCK);
+        svc_file_get_position_result(GetGrachtClient(), &msg.base, &status, &FileInitial.u.LowPart, &FileInitial.u.HighPart);
+        if (status != OsSuccess) {
+            ERROR("failed to get file position");
+            return status;
+        }
+
+        // Sanitize for overflow
+        if ((size_t)FileInitial.QuadPart != FileInitial.QuadPart) {
+            ERROR("file-offset-overflow");
+            _set_errno(EOVERFLOW);
+            return OsError;
+        }
+        Position.QuadPart = FileInitial.QuadPart - (int64_t)unconsumed;
+    }
+
+    // Adjust for seek origin
+    if (origin == SEEK_SET) {
         SeekFinal.QuadPart = offset;
     }
+    else if (origin == SEEK_CUR) {
+        SeekFinal.QuadPart = Position.QuadPart + offset;
+    }
+    else {
+        LargeInteger_t FileSize;
+
+        svc_file_get_size(GetGrachtClient(), &msg.base, *GetInternalProcessId(), handle->object.handle);
+        gracht_client_wait_message(GetGrachtClient(), &msg.base, GetGrachtBuffer(), GRACHT_WAIT_BLOCK);
+        svc_file_get_size_result(GetGrachtClient(), &msg.base, &status, &FileSize.u.LowPart, &FileSize.u.HighPart);
+        if (status != OsSuccess) {
+            ERROR("failed to get file size");
+            return status;
+        }
+        SeekFinal.QuadPart = FileSize.QuadPart + offset;
+    }
+
+    // The buffered data covers everything from the start of the current buffer up to the
+    // file position, in file order
+    if (buffered) {
+        struct file_stream_buffer* current   = &stream->buffers[stream->current];
+        struct file_stream_buffer* next      = &stream->buffers[stream->current ^ 1];
+        int64_t                    remaining = (int64_t)(current->length - current->index);
+        int64_t                    distance  = SeekFinal.QuadPart - Position.QuadPart;
+
+        if (distance >= -(int64_t)current->index && SeekFinal.QuadPart <= FileInitial.QuadPart) {
+            if (distance <= remaining) {
+                current->index = (size_t)((int64_t)current->index + distance);
+            }
+            else {
+                current->index = current->length;
+                next->index   += (size_t)(distance - remaining);
+            }
+            *position_out = SeekFinal.QuadPart;
+            return OsSuccess;
+        }
+
+        // The file position is moved below, which leaves the read-ahead behind
+        file_stream_reset(stream);
+    }
+
+    // Only a seek that moves the position breaks the sequential access pattern
+    if (origin == SEEK_CUR && offset == 0) {
+        *position_out = Position.QuadPart;
+        return OsSuccess;
+    }
+    if (stream) {
+        stream->sequential = 0;
+    }
 
     // Now perform the seek
     svc_file_seek(GetGrachtClient(), &msg.base, *GetInternalProcessId(),
@@ -203,21 +1113,61 @@ OsStatus_t stdio_file_op_seek(stdio_handle_t* handle, int origin, off64_t offset
     return status;
 }
 
+OsStatus_t stdio_file_op_seek(stdio_handle_t* handle, int origin, off64_t offset, long long* position_out)
+{
+    struct file_stream* stream = handle->file_stream;
+    OsStatus_t          status;
+
+    file_stream_lock(stream);
+    status = file_seek(handle, stream, origin, offset, position_out);
+    file_stream_unlock(stream);
+    return status;
+}
+
 OsStatus_t stdio_file_op_resize(stdio_handle_t* handle, long long resize_by)
 {
+    struct file_stream* stream = handle->file_stream;
+    OsStatus_t          status;
+
+    // Writes in flight must land before the size of the file is changed
+    file_stream_lock(stream);
+    status = file_stream_flush(handle, stream);
+    file_stream_unlock(stream);
+    if (status != OsSuccess) {
+        return status;
+    }
     return OsNotSupported;
 }
 
 OsStatus_t stdio_file_op_close(stdio_handle_t* handle, int options)
 {
     struct vali_link_message msg    = VALI_MSG_INIT_HANDLE(GetFileService());
-	OsStatus_t               status = OsSuccess;
-	
-	if (options & STDIO_CLOSE_FULL) {
+    struct file_stream*      stream = handle->file_stream;
+    OsStatus_t               status = OsSuccess;
+    
+    // Writes in flight must complete before the handle is closed
+    if (stream) {
+        mtx_lock(&stream->lock);
+        status = file_stream_flush(handle, stream);
+        if (stream->attachment.buffer) {
+            dma_detach(&stream->attachment);
+        }
+        handle->file_stream = NULL;
+        mtx_unlock(&stream->lock);
+        mtx_destroy(&stream->lock);
+        free(stream);
+    }
+    
+    if (options & STDIO_CLOSE_FULL) {
+        OsStatus_t closeStatus;
+        
         svc_file_close(GetGrachtClient(), &msg.base, *GetInternalProcessId(), handle->object.handle);
         gracht_client_wait_message(GetGrachtClient(), &msg.base, GetGrachtBuffer(), GRACHT_WAIT_BLOCK);
-        svc_file_close_result(GetGrachtClient(), &msg.base, &status);
-	}
+        svc_file_close_result(GetGrachtClient(), &msg.base, &closeStatus);
+        if (status == OsSuccess) {
+            status = closeStatus;
+        }
+    }
     return status;
 }
 
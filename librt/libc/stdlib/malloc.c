@@ -3185,7 +3185,13 @@ static void* tmalloc_small(mstate m, size_t nb) {
 #define __TRACE
 #include <ddk/utils.h>
 
-void* dlmalloc(size_t bytes) {
+#ifdef MOLLENOS
+static void* heap_cache_get(size_t bytes);
+static int   heap_cache_put(void* mem);
+#endif /* MOLLENOS */
+
+/* Allocates from the global heap, the caller must hold the heap lock */
+static void* heap_malloc(size_t bytes) {
   /*
      Basic algorithm:
      If a small request (< 256 bytes minus per-chunk overhead):
@@ -3209,11 +3215,7 @@ void* dlmalloc(size_t bytes) {
      The ugly goto's here ensure that postaction occurs along all paths.
   */
 
-#if USE_LOCKS
-  ensure_initialization(); /* initialize in sys_alloc if not using locks */
-#endif
-
-  if (!PREACTION(gm)) {
+  {
     void* mem;
     size_t nb;
     if (bytes <= MAX_SMALL_REQUEST) {
@@ -3314,10 +3316,28 @@ void* dlmalloc(size_t bytes) {
     mem = sys_alloc(gm, nb);
 
   postaction:
-    POSTACTION(gm);
     return mem;
   }
+}
 
+void* dlmalloc(size_t bytes) {
+#if USE_LOCKS
+  ensure_initialization(); /* initialize in sys_alloc if not using locks */
+#endif
+
+#ifdef MOLLENOS
+  {
+    void* mem = heap_cache_get(bytes);
+    if (mem != 0)
+      return mem;
+  }
+#endif /* MOLLENOS */
+
+  if (!PREACTION(gm)) {
+    void* mem = heap_malloc(bytes);
+    POSTACTION(gm);
+    return mem;
+  }
   return 0;
 }
 
@@ -3329,6 +3349,10 @@ void dlfree(void* mem) {
      free chunks, if they exist, and then place in a bin.  Intermixed
      with special cases for top, dv, mmapped chunks, and usage errors.
   */
+#ifdef MOLLENOS
+  if (heap_cache_put(mem))
+    return;
+#endif /* MOLLENOS */
   if (mem != 0) {
     mchunkptr p  = mem2chunk(mem);
 #if FOOTERS
@@ -3960,6 +3984,126 @@ size_t dlbulk_free(void* array[], size_t nelem) {
   return internal_bulk_free(gm, array, nelem);
 }
 
+/* ------------------------- Per-thread caches --------------------------- */
+
+/*
+  Small chunks freed by a thread are kept in a cache in the tls of the
+  thread, and are handed out again by malloc without taking the heap lock.
+  Cached chunks stay in use as far as the heap is concerned, so any thread
+  may cache a chunk no matter which thread allocated it, and realloc or
+  malloc_usable_size work on them as usual. A miss refills the size class
+  with a batch of chunks, and a full size class returns half of its chunks
+  to the heap, both under a single acquisition of the heap lock.
+*/
+#ifdef MOLLENOS
+#include "../threads/tls.h"
+
+#define HEAP_CACHE_MAX_CHUNK   (MIN_CHUNK_SIZE + ((TLS_HEAP_CACHE_CLASSES - 1) * MALLOC_ALIGNMENT))
+#define HEAP_CACHE_MAX_REQUEST (HEAP_CACHE_MAX_CHUNK - CHUNK_OVERHEAD)
+#define HEAP_CACHE_COUNT       16 /* Chunks kept per size class */
+#define HEAP_CACHE_FILL        8  /* Chunks allocated per refill */
+#define heap_cache_index(s)    (((s) - MIN_CHUNK_SIZE) / MALLOC_ALIGNMENT)
+#define heap_cache_next(mem)   (*(void**)(mem))
+
+static struct tls_heap_cache* heap_cache_current(void) {
+  thread_storage_t* tls = tls_current();
+  if (tls == 0 || tls->heap_cache.disabled)
+    return 0;
+  return &tls->heap_cache;
+}
+
+static void* heap_cache_get(size_t bytes) {
+  struct tls_heap_cache* cache;
+  size_t nb;
+  size_t idx;
+  void* mem;
+
+  if (bytes > HEAP_CACHE_MAX_REQUEST || (cache = heap_cache_current()) == 0)
+    return 0;
+
+  nb  = (bytes < MIN_REQUEST)? MIN_CHUNK_SIZE : pad_request(bytes);
+  idx = heap_cache_index(nb);
+  if (cache->counts[idx] == 0) {
+    size_t i;
+    if (PREACTION(gm))
+      return 0;
+    for (i = 0; i < HEAP_CACHE_FILL; i++) {
+      mem = heap_malloc(nb - CHUNK_OVERHEAD);
+      if (mem == 0)
+        break;
+      heap_cache_next(mem) = cache->bins[idx];
+      cache->bins[idx] = mem;
+      cache->counts[idx]++;
+    }
+    POSTACTION(gm);
+    if (cache->counts[idx] == 0)
+      return 0;
+  }
+
+  mem = cache->bins[idx];
+  cache->bins[idx] = heap_cache_next(mem);
+  cache->counts[idx]--;
+  return mem;
+}
+
+/* Returns the given number of chunks of a size class to the heap */
+static void heap_cache_release(struct tls_heap_cache* cache, size_t idx, size_t count) {
+  void* chunks[HEAP_CACHE_COUNT];
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    chunks[i] = cache->bins[idx];
+    cache->bins[idx] = heap_cache_next(chunks[i]);
+  }
+  cache->counts[idx] -= count;
+  internal_bulk_free(gm, chunks, count);
+}
+
+static int heap_cache_put(void* mem) {
+  struct tls_heap_cache* cache;
+  mchunkptr p;
+  size_t psize;
+  size_t idx;
+
+  if (mem == 0 || (cache = heap_cache_current()) == 0)
+    return 0;
+
+  /* Anything unusual is left to free, which also reports usage errors */
+  p = mem2chunk(mem);
+  psize = chunksize(p);
+  if (is_mmapped(p) || !cinuse(p) || psize > HEAP_CACHE_MAX_CHUNK)
+    return 0;
+#if FOOTERS
+  if (!ok_magic(get_mstate_for(p)) || get_mstate_for(p) != gm)
+    return 0;
+#endif /* FOOTERS */
+
+  idx = heap_cache_index(psize);
+  if (cache->counts[idx] == HEAP_CACHE_COUNT)
+    heap_cache_release(cache, idx, HEAP_CACHE_COUNT / 2);
+  heap_cache_next(mem) = cache->bins[idx];
+  cache->bins[idx] = mem;
+  cache->counts[idx]++;
+  return 1;
+}
+
+void malloc_cache_flush(void) {
+  struct tls_heap_cache* cache = heap_cache_current();
+  size_t i;
+
+  if (cache == 0)
+    return;
+
+  cache->disabled = 1;
+  for (i = 0; i < TLS_HEAP_CACHE_CLASSES; i++) {
+    while (cache->counts[i] != 0) {
+      size_t count = cache->counts[i];
+      heap_cache_release(cache, i, (count < HEAP_CACHE_COUNT)? count : HEAP_CACHE_COUNT);
+    }
+  }
+}
+#endif /* MOLLENOS */
+
 #if MALLOC_INSPECT_ALL
 void dlmalloc_inspect_all(void(*handler)(void *start,
                                          void *end,
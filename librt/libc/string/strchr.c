@@ -58,7 +58,7 @@ QUICKREF
    to fill (long)MASK. */
 #define DETECTCHAR(X,MASK) (DETECTNULL(X ^ MASK))
 
-char *strchr(const char *s1, int i)
+char *strchr_base(const char *s1, int i)
 {
 	const unsigned char *s = (const unsigned char *)s1;
 	unsigned char c = (unsigned char)i;
@@ -18,11 +18,7 @@
 #endif
 #endif
 
-#if defined(_MSC_VER) && !defined(__clang__)
-#pragma function(strcmp)
-#endif
-
-int strcmp(const char* str1, const char* str2)
+int strcmp_base(const char* str1, const char* str2)
 {
 	unsigned long *a1;
 	unsigned long *a2;
@@ -25,11 +25,7 @@
 #error long int is not a 32bit or 64bit byte
 #endif
 
-#if defined(_MSC_VER) && !defined(__clang__)
-#pragma function(strlen)
-#endif
-
-size_t strlen(const char *str)
+size_t strlen_base(const char *str)
 {
 	const char *start = str;
 	unsigned long *aligned_addr;
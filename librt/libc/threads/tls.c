@@ -123,7 +123,11 @@ tls_destroy(
     if (Tls->transfer_buffer.buffer != NULL) {
         dma_detach(&Tls->transfer_buffer);
         free(Tls->transfer_buffer.buffer);
+        Tls->transfer_buffer.buffer = NULL;
     }
+    
+    // Hand the chunks cached by this thread back to the heap
+    malloc_cache_flush();
     return OsSuccess;
 }
 
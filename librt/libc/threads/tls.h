@@ -32,6 +32,15 @@
 // Number of tls entries
 #define TLS_NUMBER_ENTRIES 64
 
+// Number of small chunk sizes the allocator caches per thread
+#define TLS_HEAP_CACHE_CLASSES 32
+
+struct tls_heap_cache {
+    int    disabled;
+    void*  bins[TLS_HEAP_CACHE_CLASSES];
+    size_t counts[TLS_HEAP_CACHE_CLASSES];
+};
+
 PACKED_TYPESTRUCT(thread_storage, {
     thrd_t                thr_id;
     void*                 handle;
@@ -43,6 +52,7 @@ PACKED_TYPESTRUCT(thread_storage, {
     struct tm             tm_buffer;
     char                  asc_buffer[26];
     struct dma_attachment transfer_buffer;
+    struct tls_heap_cache heap_cache;
     uintptr_t             tls_array[TLS_NUMBER_ENTRIES];
 });
 
@@ -65,6 +75,11 @@ CRTDECL(OsStatus_t, tls_destroy(thread_storage_t *Tls));
  * by freeing resources and calling c11 destructors. */
 CRTDECL(void, tls_cleanup(thrd_t thr, void* DsoHandle, int ExitCode));
 CRTDECL(void, tls_cleanup_quick(thrd_t thr, void* DsoHandle, int ExitCode));
+
+/* malloc_cache_flush
+ * Returns all chunks cached by the calling thread to the global heap, and disables
+ * the cache for the rest of the thread's lifetime. Implemented by the allocator. */
+CRTDECL(void, malloc_cache_flush(void));
 _CODE_END
 
 #endif //!__STDC_TLS__
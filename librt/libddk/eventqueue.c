@@ -22,7 +22,8 @@
  */
 
 #include <ddk/eventqueue.h>
-#include <ds/collection.h>
+#include <ds/hash_sip.h>
+#include <ds/hashtable.h>
 #include <os/mollenos.h>
 #include <threads.h>
 #include <stdlib.h>
@@ -30,66 +31,108 @@
 #include <string.h>
 
 #define EVENT_QUEUED    0
-#define EVENT_EXECUTED  1
+#define EVENT_EXECUTING 1
 #define EVENT_CANCELLED 2
 
+#define EVENT_HEAP_INITIAL_CAPACITY 32
+#define EVENT_DEFAULT_SLACK_MS      1
+
+// Events are ordered by their deadline in a binary min-heap, each event knows its
+// position in the heap so it can be removed without searching for it
 typedef struct EventQueueEvent {
-    CollectionItem_t   Header;
+    UUId_t             Id;
     EventQueueFunction Function;
     void*              Context;
-    size_t             Timeout;
+    uint64_t           Deadline;
     size_t             Interval;
     int                State;
+    size_t             HeapIndex;
 } EventQueueEvent_t;
 
+struct EventIndex {
+    UUId_t             Id;
+    EventQueueEvent_t* Event;
+};
+
 typedef struct EventQueue {
-    int           IsRunning;
-    UUId_t        NextEventId;
-    thrd_t        EventThread;
-    mtx_t         EventLock;
-    cnd_t         EventCondition;
-    Collection_t* Events;
+    int                 IsRunning;
+    UUId_t              NextEventId;
+    thrd_t              EventThread;
+    mtx_t               EventLock;
+    cnd_t               EventCondition;
+    size_t              SlackMs;
+    EventQueueEvent_t** Heap;
+    size_t              HeapCount;
+    size_t              HeapCapacity;
+    hashtable_t         Events;
 } EventQueue_t;
 
-static UUId_t AddToEventQueue(EventQueue_t* EventQueue, EventQueueFunction Function, void* Context, size_t TimeoutMs, size_t IntervalMs);
-static int    EventQueueWorker(void* Context);
+static UUId_t   AddToEventQueue(EventQueue_t* EventQueue, EventQueueFunction Function, void* Context, size_t TimeoutMs, size_t IntervalMs);
+static int      EventQueueWorker(void* Context);
+static uint64_t EventHash(const void* Element);
+static int      EventCompare(const void* Element1, const void* Element2);
+
+static uint8_t HashKey[16] = { 62, 193, 27, 144, 8, 215, 99, 170, 53, 236, 121, 4, 188, 75, 160, 31 };
 
 void CreateEventQueue(EventQueue_t** EventQueueOut)
 {
     EventQueue_t* EventQueue = malloc(sizeof(EventQueue_t));
     assert(EventQueue != NULL);
+    memset(EventQueue, 0, sizeof(EventQueue_t));
     
-    EventQueue->Events       = CollectionCreate(KeyId);
     EventQueue->IsRunning    = 1;
     EventQueue->NextEventId  = 1;
+    EventQueue->SlackMs      = EVENT_DEFAULT_SLACK_MS;
+    EventQueue->HeapCapacity = EVENT_HEAP_INITIAL_CAPACITY;
+    EventQueue->Heap         = malloc(sizeof(EventQueueEvent_t*) * EventQueue->HeapCapacity);
+    assert(EventQueue->Heap != NULL);
+    
+    if (hashtable_construct(&EventQueue->Events, 0, sizeof(struct EventIndex), EventHash, EventCompare)) {
+        assert(0);
+    }
     
+    // The worker uses the lock immediately, so it must be ready before the thread starts
+    mtx_init(&EventQueue->EventLock, mtx_plain);
+    cnd_init(&EventQueue->EventCondition);
     if (thrd_create(&EventQueue->EventThread, EventQueueWorker, EventQueue) != thrd_success) {
         EventQueue->EventThread = UUID_INVALID;
         DestroyEventQueue(EventQueue);
         return;
     }
-    
-    mtx_init(&EventQueue->EventLock, mtx_plain);
-    cnd_init(&EventQueue->EventCondition);
     *EventQueueOut = EventQueue;
 }
 
 void DestroyEventQueue(EventQueue_t* EventQueue)
 {
-    int Unused;
+    size_t i;
+    int    Unused;
 
     // Kill the thread, then cleanup resources
     if (EventQueue->EventThread != UUID_INVALID) {
+        mtx_lock(&EventQueue->EventLock);
         EventQueue->IsRunning = 0;
         cnd_signal(&EventQueue->EventCondition);
+        mtx_unlock(&EventQueue->EventLock);
         thrd_join(EventQueue->EventThread, &Unused);
-        mtx_destroy(&EventQueue->EventLock);
-        cnd_destroy(&EventQueue->EventCondition);
     }
-    CollectionDestroy(EventQueue->Events);
+    mtx_destroy(&EventQueue->EventLock);
+    cnd_destroy(&EventQueue->EventCondition);
+    
+    for (i = 0; i < EventQueue->HeapCount; i++) {
+        free(EventQueue->Heap[i]);
+    }
+    hashtable_destroy(&EventQueue->Events);
+    free(EventQueue->Heap);
     free(EventQueue);
 }
 
+void SetEventQueueSlack(EventQueue_t* EventQueue, size_t SlackMs)
+{
+    mtx_lock(&EventQueue->EventLock);
+    EventQueue->SlackMs = SlackMs;
+    mtx_unlock(&EventQueue->EventLock);
+}
+
 void QueueEvent(EventQueue_t* EventQueue, EventQueueFunction Callback, void* Context)
 {
     AddToEventQueue(EventQueue, Callback, Context, 0, 0);
@@ -108,17 +151,108 @@ UUId_t QueuePeriodicEvent(EventQueue_t* EventQueue, EventQueueFunction Callback,
     return AddToEventQueue(EventQueue, Callback, Context, IntervalMs, IntervalMs);
 }
 
+static uint64_t GetTimestamp(void)
+{
+    struct timespec Now;
+    timespec_get(&Now, TIME_UTC);
+    return ((uint64_t)Now.tv_sec * MSEC_PER_SEC) + ((uint64_t)Now.tv_nsec / NSEC_PER_MSEC);
+}
+
+static void HeapSwap(EventQueue_t* EventQueue, size_t Index1, size_t Index2)
+{
+    EventQueueEvent_t* Event = EventQueue->Heap[Index1];
+    EventQueue->Heap[Index1] = EventQueue->Heap[Index2];
+    EventQueue->Heap[Index2] = Event;
+    EventQueue->Heap[Index1]->HeapIndex = Index1;
+    EventQueue->Heap[Index2]->HeapIndex = Index2;
+}
+
+static void HeapSiftUp(EventQueue_t* EventQueue, size_t Index)
+{
+    while (Index) {
+        size_t Parent = (Index - 1) / 2;
+        if (EventQueue->Heap[Parent]->Deadline <= EventQueue->Heap[Index]->Deadline) {
+            break;
+        }
+        HeapSwap(EventQueue, Parent, Index);
+        Index = Parent;
+    }
+}
+
+static void HeapSiftDown(EventQueue_t* EventQueue, size_t Index)
+{
+    while (1) {
+        size_t Left     = (Index * 2) + 1;
+        size_t Right    = Left + 1;
+        size_t Smallest = Index;
+        
+        if (Left < EventQueue->HeapCount &&
+            EventQueue->Heap[Left]->Deadline < EventQueue->Heap[Smallest]->Deadline) {
+            Smallest = Left;
+        }
+        if (Right < EventQueue->HeapCount &&
+            EventQueue->Heap[Right]->Deadline < EventQueue->Heap[Smallest]->Deadline) {
+            Smallest = Right;
+        }
+        
+        if (Smallest == Index) {
+            break;
+        }
+        HeapSwap(EventQueue, Smallest, Index);
+        Index = Smallest;
+    }
+}
+
+static void HeapInsert(EventQueue_t* EventQueue, EventQueueEvent_t* Event)
+{
+    if (EventQueue->HeapCount == EventQueue->HeapCapacity) {
+        EventQueueEvent_t** Heap = realloc(EventQueue->Heap,
+            sizeof(EventQueueEvent_t*) * EventQueue->HeapCapacity * 2);
+        assert(Heap != NULL);
+        EventQueue->Heap          = Heap;
+        EventQueue->HeapCapacity *= 2;
+    }
+    
+    Event->HeapIndex = EventQueue->HeapCount++;
+    EventQueue->Heap[Event->HeapIndex] = Event;
+    HeapSiftUp(EventQueue, Event->HeapIndex);
+}
+
+static void HeapRemove(EventQueue_t* EventQueue, EventQueueEvent_t* Event)
+{
+    size_t Index = Event->HeapIndex;
+    
+    EventQueue->HeapCount--;
+    if (Index != EventQueue->HeapCount) {
+        EventQueue->Heap[Index] = EventQueue->Heap[EventQueue->HeapCount];
+        EventQueue->Heap[Index]->HeapIndex = Index;
+        HeapSiftUp(EventQueue, Index);
+        HeapSiftDown(EventQueue, EventQueue->Heap[Index]->HeapIndex);
+    }
+}
+
 OsStatus_t CancelEvent(EventQueue_t* EventQueue, UUId_t EventHandle)
 {
-    DataKey_t          Key = { .Value.Id = EventHandle };
+    struct EventIndex* Index;
     EventQueueEvent_t* Event;
     OsStatus_t         Status = OsDoesNotExist;
     
     mtx_lock(&EventQueue->EventLock);
-    Event = (EventQueueEvent_t*)CollectionGetNodeByKey(EventQueue->Events, Key, 0);
-    if (Event != NULL && Event->State != EVENT_EXECUTED) {
-        Event->State = EVENT_CANCELLED;
-        Status = OsSuccess;
+    Index = hashtable_get(&EventQueue->Events, &(struct EventIndex) { .Id = EventHandle });
+    if (Index != NULL) {
+        Event = Index->Event;
+        if (Event->State == EVENT_QUEUED) {
+            // Not in progress, it can be removed right away
+            HeapRemove(EventQueue, Event);
+            hashtable_remove(&EventQueue->Events, &(struct EventIndex) { .Id = EventHandle });
+            free(Event);
+            Status = OsSuccess;
+        }
+        else if (Event->State == EVENT_EXECUTING && Event->Interval) {
+            // Periodic events are cleaned up by the worker when they return
+            Event->State = EVENT_CANCELLED;
+            Status = OsSuccess;
+        }
     }
     mtx_unlock(&EventQueue->EventLock);
     return Status;
@@ -127,102 +261,96 @@ OsStatus_t CancelEvent(EventQueue_t* EventQueue, UUId_t EventHandle)
 static UUId_t AddToEventQueue(EventQueue_t* EventQueue, EventQueueFunction Function, void* Context, size_t TimeoutMs, size_t IntervalMs)
 {
     EventQueueEvent_t* Event = (EventQueueEvent_t*)malloc(sizeof(EventQueueEvent_t));
+    UUId_t             Id;
     assert(Event != NULL);
     
     assert(EventQueue != NULL);
     assert(Function != NULL);
 
     memset(Event, 0, sizeof(EventQueueEvent_t));
-    Event->Header.Key.Value.Id = EventQueue->NextEventId++;
-
     Event->Function = Function;
     Event->Context  = Context;
-    Event->Timeout  = TimeoutMs;
+    Event->Deadline = GetTimestamp() + TimeoutMs;
     Event->Interval = IntervalMs;
+    Event->State    = EVENT_QUEUED;
     
     mtx_lock(&EventQueue->EventLock);
-    CollectionAppend(EventQueue->Events, &Event->Header);
-    mtx_unlock(&EventQueue->EventLock);
-    cnd_signal(&EventQueue->EventCondition);
-    return Event->Header.Key.Value.Id;
-}
-
-static EventQueueEvent_t* GetNearestEventQueueDeadline(EventQueue_t* EventQueue)
-{
-    EventQueueEvent_t* Nearest = NULL;
-    foreach(Node, EventQueue->Events) {
-        EventQueueEvent_t* Event = (EventQueueEvent_t*)Node;
-        if (Nearest == NULL) {
-            Nearest = Event;
-        }
-        else {
-            if (Event->Timeout < Nearest->Timeout) {
-                Nearest = Event;
-            }
-        }
+    Event->Id = Id = EventQueue->NextEventId++;
+    hashtable_set(&EventQueue->Events, &(struct EventIndex) { .Id = Event->Id, .Event = Event });
+    HeapInsert(EventQueue, Event);
+    
+    // The worker only needs to know if the nearest deadline changed
+    if (Event->HeapIndex == 0) {
+        cnd_signal(&EventQueue->EventCondition);
     }
-    return Nearest;
+    mtx_unlock(&EventQueue->EventLock);
+    return Id;
 }
 
 static int EventQueueWorker(void* Context)
 {
     EventQueueEvent_t* Event;
-    EventQueue_t*   EventQueue = (EventQueue_t*)Context;
-    struct timespec TimePoint;
-    struct timespec InterruptedAt;
-    struct timespec TimeSpent;
+    EventQueue_t*      EventQueue = (EventQueue_t*)Context;
+    struct timespec    TimePoint;
+    uint64_t           Now;
     SetCurrentThreadName("event-pump");
 
     mtx_lock(&EventQueue->EventLock);
     while (EventQueue->IsRunning) {
-        Event = GetNearestEventQueueDeadline(EventQueue);
-        if (Event != NULL) {
-            timespec_get(&TimePoint, TIME_UTC);
-            TimePoint.tv_nsec += Event->Timeout * NSEC_PER_MSEC;
-            if (TimePoint.tv_nsec > NSEC_PER_SEC) {
-                TimePoint.tv_nsec -= NSEC_PER_SEC;
-                TimePoint.tv_sec++;
-            }
-
-            if (cnd_timedwait(&EventQueue->EventCondition, &EventQueue->EventLock, &TimePoint) == thrd_timedout) {
-                // We timedout, or in other words successfully waited
-                if (Event->State != EVENT_CANCELLED) {
-                    Event->State = EVENT_EXECUTED;
-                    
-                    mtx_unlock(&EventQueue->EventLock);
-                    Event->Function(Event->Context);
-                    mtx_lock(&EventQueue->EventLock);
-                    if (Event->Interval != 0) {
-                        Event->Timeout = Event->Interval;
-                    }
-                }
-                if (Event->State == EVENT_CANCELLED || !Event->Interval) {
-                    CollectionRemoveByNode(EventQueue->Events, &Event->Header);
-                    CollectionDestroyNode(EventQueue->Events, &Event->Header);
-                }
-            }
-            else {
-                if (Event->State != EVENT_CANCELLED) {
-                    // We were interrupted due to added events, calculate sleep time and subtract. Then
-                    // start over
-                    timespec_get(&InterruptedAt, TIME_UTC);
-                    timespec_diff(&InterruptedAt, &TimePoint, &TimeSpent);
-                    size_t Milliseconds = TimeSpent.tv_sec * MSEC_PER_SEC;
-                    Milliseconds       += TimeSpent.tv_nsec / NSEC_PER_MSEC;
-                    Event->Timeout     -= Milliseconds;
-                }
-                else {
-                    CollectionRemoveByNode(EventQueue->Events, &Event->Header);
-                    CollectionDestroyNode(EventQueue->Events, &Event->Header);
-                }
-                continue;
-            }
-        }
-        else {
+        if (!EventQueue->HeapCount) {
             // Wait for event to be added
             cnd_wait(&EventQueue->EventCondition, &EventQueue->EventLock);
+            continue;
+        }
+        
+        // Events that expire within the slack of the nearest deadline are executed in
+        // the same wake-up, instead of sleeping for each of them
+        Event = EventQueue->Heap[0];
+        Now   = GetTimestamp();
+        if (Event->Deadline > Now + EventQueue->SlackMs) {
+            TimePoint.tv_sec  = (time_t)(Event->Deadline / MSEC_PER_SEC);
+            TimePoint.tv_nsec = (long)((Event->Deadline % MSEC_PER_SEC) * NSEC_PER_MSEC);
+            
+            // Whether we timed out or were interrupted by a new event, the heap is
+            // evaluated again
+            cnd_timedwait(&EventQueue->EventCondition, &EventQueue->EventLock, &TimePoint);
+            continue;
+        }
+        
+        HeapRemove(EventQueue, Event);
+        Event->State = EVENT_EXECUTING;
+        
+        mtx_unlock(&EventQueue->EventLock);
+        Event->Function(Event->Context);
+        mtx_lock(&EventQueue->EventLock);
+        
+        if (Event->State == EVENT_CANCELLED || !Event->Interval) {
+            hashtable_remove(&EventQueue->Events, &(struct EventIndex) { .Id = Event->Id });
+            free(Event);
+        }
+        else {
+            // Keep periodic events on their schedule, unless we have fallen behind
+            Event->State     = EVENT_QUEUED;
+            Event->Deadline += Event->Interval;
+            if (Event->Deadline < Now) {
+                Event->Deadline = Now + Event->Interval;
+            }
+            HeapInsert(EventQueue, Event);
         }
     }
     mtx_unlock(&EventQueue->EventLock);
     return 0;
 }
+
+static uint64_t EventHash(const void* Element)
+{
+    const struct EventIndex* Index = Element;
+    return siphash_64((const uint8_t*)&Index->Id, sizeof(UUId_t), &HashKey[0]);
+}
+
+static int EventCompare(const void* Element1, const void* Element2)
+{
+    const struct EventIndex* Index1 = Element1;
+    const struct EventIndex* Index2 = Element2;
+    return Index1->Id == Index2->Id ? 0 : 1;
+}
@@ -37,6 +37,11 @@ CRTDECL(void, CreateEventQueue(EventQueue_t** EventQueueOut));
  * Stops the event queue handler, and cleans up resources. */
 CRTDECL(void, DestroyEventQueue(EventQueue_t* EventQueue));
 
+/* SetEventQueueSlack
+ * Events that expire within the slack of the nearest deadline are executed together, which
+ * reduces the number of wake-ups when many timers expire close to each other. The default is 1ms. */
+CRTDECL(void, SetEventQueueSlack(EventQueue_t* EventQueue, size_t SlackMs));
+
 /* QueueEvent
  * Queue up a single shot event that should fire as immediate as possible */
 CRTDECL(void, QueueEvent(EventQueue_t* EventQueue, EventQueueFunction Callback, void* Context));
@@ -93,6 +93,16 @@ PACKED_TYPESTRUCT(FileSystemEntryHandle, {
     size_t              OutBufferPosition;
 });
 
+/* The vector entry structure
+ * Describes a single part of a vectored transfer, the buffer is the mapping of the
+ * dma buffer in the filemanager and the part starts at the given buffer offset */
+PACKED_TYPESTRUCT(FileSystemVector, {
+    UUId_t BufferHandle;
+    void*  Buffer;
+    size_t BufferOffset;
+    size_t Length;
+});
+
 /* FsInitialize 
  * Initializes a new instance of the file system
  * and allocates resources for the given descriptor */
@@ -189,6 +199,37 @@ __FSDECL(FsWriteEntry)(
     _In_  size_t                    UnitCount,
     _Out_ size_t*                   UnitsWritten);
 
+/* FsReadEntryVector
+ * Reads the parts of the vector in order, starting at the current position of the entry
+ * handle. The transfer stops at the first part that could not be filled completely. This
+ * function is optional for filesystems, the position is updated by the caller. */
+__FSAPI OsStatus_t
+__FSDECL(FsReadEntryVector)(
+    _In_  FileSystemDescriptor_t*   FileSystem,
+    _In_  FileSystemEntryHandle_t*  BaseHandle,
+    _In_  FileSystemVector_t*       Vectors,
+    _In_  int                       VectorCount,
+    _Out_ size_t*                   UnitsRead);
+
+/* FsWriteEntryVector
+ * Writes the parts of the vector in order, starting at the current position of the entry
+ * handle. This function is optional for filesystems, the position is updated by the caller. */
+__FSAPI OsStatus_t
+__FSDECL(FsWriteEntryVector)(
+    _In_  FileSystemDescriptor_t*   FileSystem,
+    _In_  FileSystemEntryHandle_t*  BaseHandle,
+    _In_  FileSystemVector_t*       Vectors,
+    _In_  int                       VectorCount,
+    _Out_ size_t*                   UnitsWritten);
+
+/* FsFlushEntry
+ * Writes any data the filesystem has buffered for the given entry handle
+ * to the underlying storage. This function is optional for filesystems. */
+__FSAPI OsStatus_t
+__FSDECL(FsFlushEntry)(
+    _In_ FileSystemDescriptor_t*    FileSystem,
+    _In_ FileSystemEntryHandle_t*   BaseHandle);
+
 /* FsSeekInEntry 
  * Seeks in the given entry-handle to the absolute position
  * given, must be within boundaries otherwise a seek won't take a place */
@@ -55,4 +55,14 @@ CreateMemoryMapping(
     _In_  struct MemoryMappingParameters* Parameters,
     _Out_ void**                          AddressOut));
 
+/* CreateMemoryRegionMapping
+ * Maps the pages of a memory region into the memory space at the address given in the
+ * parameters. The pages are shared with the region, and stay owned by it. */
+DDKDECL(OsStatus_t,
+CreateMemoryRegionMapping(
+    _In_ UUId_t                          Handle,
+    _In_ struct MemoryMappingParameters* Parameters,
+    _In_ UUId_t                          RegionHandle,
+    _In_ size_t                          RegionOffset));
+
 #endif //!__MEMORY_INTERFACE__
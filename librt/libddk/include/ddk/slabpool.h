@@ -0,0 +1,80 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * DMA Slab Pool Support Definitions & Structures
+ * - Sub-allocates small fixed-size objects, like transfer descriptors, from a dma
+ *   buffer. Objects are grouped in size classes, and each size class is carved from
+ *   whole slabs of physically contiguous memory.
+ */
+
+#ifndef __DMA_SLAB_POOL_H__
+#define __DMA_SLAB_POOL_H__
+
+#include <ddk/ddkdefs.h>
+
+#define DMA_SLAB_MIN_SIZE 16
+
+struct dma_attachment;
+struct dma_slab_pool;
+
+_CODE_BEGIN
+/* dma_slab_pool_create
+ * Creates a new slab pool on top of the given dma attachment. The slab size is the page
+ * size, and slabs that are not physically contiguous are never used. */
+DDKDECL(OsStatus_t,
+dma_slab_pool_create(
+    _In_  struct dma_attachment* attachment,
+    _Out_ struct dma_slab_pool** pool_out));
+
+/* dma_slab_pool_destroy
+ * Cleans up the slab pool, this does not destroy the dma attachment. */
+DDKDECL(OsStatus_t,
+dma_slab_pool_destroy(
+    _In_ struct dma_slab_pool* pool));
+
+/* dma_slab_pool_allocate
+ * Allocates an object of at least the given length. The length is rounded up to the
+ * nearest power of two, and the object is aligned to that size. Objects never cross
+ * a slab boundary, so they are always physically contiguous. The dma address of the
+ * object is optionally returned. */
+DDKDECL(OsStatus_t,
+dma_slab_pool_allocate(
+    _In_      struct dma_slab_pool* pool,
+    _In_      size_t                length,
+    _Out_     void**                address_out,
+    _Out_Opt_ uintptr_t*            dma_out));
+
+/* dma_slab_pool_free
+ * Releases an object previously allocated from the slab pool. */
+DDKDECL(OsStatus_t,
+dma_slab_pool_free(
+    _In_ struct dma_slab_pool* pool,
+    _In_ void*                 address));
+
+DDKDECL(UUId_t,
+dma_slab_pool_handle(
+    _In_ struct dma_slab_pool* pool));
+
+DDKDECL(size_t,
+dma_slab_pool_offset(
+    _In_ struct dma_slab_pool* pool,
+    _In_ void*                 address));
+_CODE_END
+
+#endif //!__DMA_SLAB_POOL_H__
@@ -29,6 +29,7 @@
 
 typedef struct ThreadPool ThreadPool_t;
 #define THREADPOOL_DEFAULT_WORKERS -1 // Call this to initialize with default number of workers
+#define THREADPOOL_ANY_WORKER      -1 // Let the pool decide which worker queue receives the job
 
 _CODE_BEGIN
 /* ThreadPoolInitialize 
@@ -48,6 +49,27 @@ ThreadPoolAddWork(
     _In_ thrd_start_t  Function,
     _In_ void*         Argument));
 
+/* ThreadPoolAddWorkEx
+ * Adds a job to the queue of a specific worker, the worker is given by its index modulo
+ * the number of workers. Jobs that touch the same data can be kept on the same worker,
+ * idle workers will still steal the job if the worker is busy. */
+CRTDECL(OsStatus_t,
+ThreadPoolAddWorkEx(
+    _In_ ThreadPool_t* ThreadPool,
+    _In_ thrd_start_t  Function,
+    _In_ void*         Argument,
+    _In_ int           Worker));
+
+/* ThreadPoolAddWorkBatch
+ * Adds a job for each of the given arguments, that all execute the same function. This
+ * is cheaper than adding the jobs one at the time. */
+CRTDECL(OsStatus_t,
+ThreadPoolAddWorkBatch(
+    _In_ ThreadPool_t* ThreadPool,
+    _In_ thrd_start_t  Function,
+    _In_ void**        Arguments,
+    _In_ size_t        Count));
+
 /* ThreadPoolWait
  * Will wait for all jobs - both queued and currently running to finish.
  * Once the queue is empty and all work has completed, the calling thread
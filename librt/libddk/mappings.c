@@ -57,3 +57,16 @@ CreateMemoryMapping(
     }
     return Syscall_CreateMemorySpaceMapping(Handle, Parameters, AddressOut);
 }
+
+OsStatus_t
+CreateMemoryRegionMapping(
+    _In_ UUId_t                          Handle,
+    _In_ struct MemoryMappingParameters* Parameters,
+    _In_ UUId_t                          RegionHandle,
+    _In_ size_t                          RegionOffset)
+{
+    if (Parameters == NULL) {
+        return OsError;
+    }
+    return Syscall_CreateMemorySpaceRegionMapping(Handle, Parameters, RegionHandle, RegionOffset);
+}
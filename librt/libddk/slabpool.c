@@ -0,0 +1,414 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * DMA Slab Pool Support Definitions & Structures
+ * - Size-class allocator for dma buffers. The buffer is divided into slabs of a page
+ *   each, and a slab is given to a single size class when that class runs out of
+ *   objects. Free objects are linked through their own memory. Every thread keeps a
+ *   small cache of objects for each class, so most allocations do not take the lock.
+ */
+//#define __TRACE
+
+#include <ddk/slabpool.h>
+#include <ddk/utils.h>
+#include <os/dmabuf.h>
+#include <os/mollenos.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#define DMA_SLAB_MAX_CLASSES 16
+#define DMA_SLAB_CACHE_SIZE  16
+#define DMA_SLAB_UNUSED      0xFF
+#define DMA_SLAB_INVALID     0xFE
+
+struct dma_slab_object {
+    struct dma_slab_object* next;
+};
+
+struct dma_slab_class {
+    struct dma_slab_object* free_list;
+    size_t                  size;
+};
+
+struct dma_slab_cache {
+    struct dma_slab_cache* next;
+    struct dma_slab_cache* previous;
+    struct dma_slab_pool*  pool;
+    int                    count[DMA_SLAB_MAX_CLASSES];
+    void*                  objects[DMA_SLAB_MAX_CLASSES][DMA_SLAB_CACHE_SIZE];
+};
+
+struct dma_slab_pool {
+    struct dma_attachment* attachment;
+    struct dma_sg_table    table;
+    mtx_t                  lock;
+    tss_t                  cache_key;
+    size_t                 slab_size;
+    size_t                 slab_count;
+    size_t                 next_slab;
+    uint8_t*               slab_classes;
+    int                    class_count;
+    struct dma_slab_class  classes[DMA_SLAB_MAX_CLASSES];
+    struct dma_slab_cache* caches;
+};
+
+static void dma_slab_cache_destroy(void* cache);
+
+// A slab is only usable if it is backed by a single physically contiguous region
+static int
+dma_slab_is_contiguous(
+    _In_ struct dma_slab_pool* pool,
+    _In_ size_t                offset)
+{
+    int    first_index, last_index;
+    size_t sg_offset;
+
+    if (dma_sg_table_offset(&pool->table, offset, &first_index, &sg_offset) != OsSuccess ||
+        dma_sg_table_offset(&pool->table, offset + pool->slab_size - 1, &last_index, &sg_offset) != OsSuccess) {
+        return 0;
+    }
+    return first_index == last_index;
+}
+
+OsStatus_t
+dma_slab_pool_create(
+    _In_  struct dma_attachment* attachment,
+    _Out_ struct dma_slab_pool** pool_out)
+{
+    struct dma_slab_pool* pool;
+    SystemDescriptor_t    descriptor;
+    OsStatus_t            status;
+    size_t                size;
+    
+    if (!attachment || !pool_out || !attachment->buffer) {
+        return OsInvalidParameters;
+    }
+    
+    pool = (struct dma_slab_pool*)malloc(sizeof(struct dma_slab_pool));
+    if (!pool) {
+        return OsOutOfMemory;
+    }
+    memset(pool, 0, sizeof(struct dma_slab_pool));
+    
+    status = SystemQuery(&descriptor);
+    if (status != OsSuccess) {
+        free(pool);
+        return status;
+    }
+    
+    status = dma_get_sg_table(attachment, &pool->table, -1);
+    if (status != OsSuccess) {
+        free(pool);
+        return status;
+    }
+    
+    pool->attachment = attachment;
+    pool->slab_size  = descriptor.PageSizeBytes;
+    pool->slab_count = attachment->length / pool->slab_size;
+    
+    // The dma buffer starts at a page boundary, so every object is naturally aligned
+    // to its size when the class sizes are powers of two
+    for (size = DMA_SLAB_MIN_SIZE; size <= pool->slab_size && pool->class_count < DMA_SLAB_MAX_CLASSES; size <<= 1) {
+        pool->classes[pool->class_count++].size = size;
+    }
+    
+    pool->slab_classes = (uint8_t*)malloc(pool->slab_count);
+    if (!pool->slab_classes) {
+        free(pool->table.entries);
+        free(pool);
+        return OsOutOfMemory;
+    }
+    memset(pool->slab_classes, DMA_SLAB_UNUSED, pool->slab_count);
+    
+    if (tss_create(&pool->cache_key, dma_slab_cache_destroy) != thrd_success) {
+        free(pool->slab_classes);
+        free(pool->table.entries);
+        free(pool);
+        return OsError;
+    }
+    mtx_init(&pool->lock, mtx_plain);
+    
+    *pool_out = pool;
+    return OsSuccess;
+}
+
+OsStatus_t
+dma_slab_pool_destroy(
+    _In_ struct dma_slab_pool* pool)
+{
+    struct dma_slab_cache* cache;
+    
+    if (!pool) {
+        return OsInvalidParameters;
+    }
+    
+    // Thread caches are not flushed, the objects in them are released with the pool
+    tss_delete(pool->cache_key);
+    cache = pool->caches;
+    while (cache) {
+        struct dma_slab_cache* next = cache->next;
+        free(cache);
+        cache = next;
+    }
+    
+    mtx_destroy(&pool->lock);
+    free(pool->slab_classes);
+    free(pool->table.entries);
+    free(pool);
+    return OsSuccess;
+}
+
+/* dma_slab_grow
+ * Assigns the next unused contiguous slab to the class and splits it into objects.
+ * The pool lock must be held. */
+static OsStatus_t
+dma_slab_grow(
+    _In_ struct dma_slab_pool* pool,
+    _In_ int                   class_index)
+{
+    struct dma_slab_class* class = &pool->classes[class_index];
+    uint8_t*               slab;
+    size_t                 i;
+    
+    while (pool->next_slab < pool->slab_count) {
+        size_t index = pool->next_slab++;
+        if (!dma_slab_is_contiguous(pool, index * pool->slab_size)) {
+            pool->slab_classes[index] = DMA_SLAB_INVALID;
+            continue;
+        }
+        
+        TRACE("dma_slab_grow(class %u, slab %u)", class->size, index);
+        pool->slab_classes[index] = (uint8_t)class_index;
+        slab = (uint8_t*)pool->attachment->buffer + (index * pool->slab_size);
+        for (i = pool->slab_size; i >= class->size; i -= class->size) {
+            struct dma_slab_object* object = (struct dma_slab_object*)(slab + i - class->size);
+            object->next     = class->free_list;
+            class->free_list = object;
+        }
+        return OsSuccess;
+    }
+    return OsOutOfMemory;
+}
+
+static int
+dma_slab_class_index(
+    _In_ struct dma_slab_pool* pool,
+    _In_ size_t                length)
+{
+    int i;
+    for (i = 0; i < pool->class_count; i++) {
+        if (length <= pool->classes[i].size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static struct dma_slab_cache*
+dma_slab_get_cache(
+    _In_ struct dma_slab_pool* pool)
+{
+    struct dma_slab_cache* cache = (struct dma_slab_cache*)tss_get(pool->cache_key);
+    if (cache) {
+        return cache;
+    }
+    
+    cache = (struct dma_slab_cache*)malloc(sizeof(struct dma_slab_cache));
+    if (!cache) {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(struct dma_slab_cache));
+    cache->pool = pool;
+    
+    mtx_lock(&pool->lock);
+    cache->next = pool->caches;
+    if (pool->caches) {
+        pool->caches->previous = cache;
+    }
+    pool->caches = cache;
+    mtx_unlock(&pool->lock);
+    
+    tss_set(pool->cache_key, cache);
+    return cache;
+}
+
+/* dma_slab_cache_destroy
+ * Returns the cached objects of a thread to the pool when the thread exits. */
+static void
+dma_slab_cache_destroy(
+    _In_ void* context)
+{
+    struct dma_slab_cache* cache = (struct dma_slab_cache*)context;
+    struct dma_slab_pool*  pool  = cache->pool;
+    int                    i;
+    
+    mtx_lock(&pool->lock);
+    for (i = 0; i < pool->class_count; i++) {
+        while (cache->count[i]) {
+            struct dma_slab_object* object = cache->objects[i][--cache->count[i]];
+            object->next                = pool->classes[i].free_list;
+            pool->classes[i].free_list = object;
+        }
+    }
+    
+    if (cache->previous) {
+        cache->previous->next = cache->next;
+    }
+    else {
+        pool->caches = cache->next;
+    }
+    if (cache->next) {
+        cache->next->previous = cache->previous;
+    }
+    mtx_unlock(&pool->lock);
+    free(cache);
+}
+
+static uintptr_t
+dma_slab_get_dma(
+    _In_ struct dma_slab_pool* pool,
+    _In_ size_t                offset)
+{
+    int        entry_index;
+    size_t     sg_offset;
+    OsStatus_t status = dma_sg_table_offset(
+        &pool->table, offset, &entry_index, &sg_offset);
+    return status != OsSuccess ? 0 : pool->table.entries[entry_index].address + sg_offset;
+}
+
+OsStatus_t
+dma_slab_pool_allocate(
+    _In_      struct dma_slab_pool* pool,
+    _In_      size_t                length,
+    _Out_     void**                address_out,
+    _Out_Opt_ uintptr_t*            dma_out)
+{
+    struct dma_slab_cache*  cache;
+    struct dma_slab_class*  class;
+    struct dma_slab_object* object;
+    int                     class_index;
+    
+    TRACE("dma_slab_pool_allocate(Size %u)", length);
+    if (!pool || !address_out) {
+        return OsInvalidParameters;
+    }
+    
+    class_index = dma_slab_class_index(pool, length);
+    if (class_index < 0) {
+        ERROR("dma_slab_pool_allocate length %u is larger than a slab", length);
+        return OsInvalidParameters;
+    }
+    class = &pool->classes[class_index];
+    
+    cache = dma_slab_get_cache(pool);
+    if (cache && cache->count[class_index]) {
+        object = cache->objects[class_index][--cache->count[class_index]];
+    }
+    else {
+        // Refill half of the cache while we hold the lock, so the next allocations
+        // can be served from the cache
+        mtx_lock(&pool->lock);
+        if (!class->free_list && dma_slab_grow(pool, class_index) != OsSuccess) {
+            mtx_unlock(&pool->lock);
+            ERROR("Failed to allocate slab pool memory (size %u)", length);
+            return OsOutOfMemory;
+        }
+        
+        object           = class->free_list;
+        class->free_list = object->next;
+        while (cache && class->free_list && cache->count[class_index] < (DMA_SLAB_CACHE_SIZE / 2)) {
+            cache->objects[class_index][cache->count[class_index]++] = class->free_list;
+            class->free_list = class->free_list->next;
+        }
+        mtx_unlock(&pool->lock);
+    }
+    
+    *address_out = object;
+    if (dma_out) {
+        *dma_out = dma_slab_get_dma(pool, dma_slab_pool_offset(pool, object));
+    }
+    return OsSuccess;
+}
+
+OsStatus_t
+dma_slab_pool_free(
+    _In_ struct dma_slab_pool* pool,
+    _In_ void*                 address)
+{
+    struct dma_slab_cache*  cache;
+    struct dma_slab_object* object = (struct dma_slab_object*)address;
+    size_t                  offset;
+    int                     class_index;
+    int                     i;
+    
+    if (!pool || !address || (uintptr_t)address < (uintptr_t)pool->attachment->buffer) {
+        return OsInvalidParameters;
+    }
+    
+    offset = dma_slab_pool_offset(pool, address);
+    if (offset >= pool->slab_count * pool->slab_size) {
+        return OsInvalidParameters;
+    }
+    
+    class_index = pool->slab_classes[offset / pool->slab_size];
+    if (class_index >= pool->class_count || (offset & (pool->classes[class_index].size - 1))) {
+        ERROR("dma_slab_pool_free 0x%" PRIxIN " was not allocated from the pool", address);
+        return OsInvalidParameters;
+    }
+    
+    cache = dma_slab_get_cache(pool);
+    if (cache && cache->count[class_index] < DMA_SLAB_CACHE_SIZE) {
+        cache->objects[class_index][cache->count[class_index]++] = address;
+        return OsSuccess;
+    }
+    
+    // The cache is full, return the object and half of the cache to the pool
+    mtx_lock(&pool->lock);
+    object->next = pool->classes[class_index].free_list;
+    pool->classes[class_index].free_list = object;
+    for (i = 0; cache && i < (DMA_SLAB_CACHE_SIZE / 2); i++) {
+        object       = cache->objects[class_index][--cache->count[class_index]];
+        object->next = pool->classes[class_index].free_list;
+        pool->classes[class_index].free_list = object;
+    }
+    mtx_unlock(&pool->lock);
+    return OsSuccess;
+}
+
+UUId_t
+dma_slab_pool_handle(
+    _In_ struct dma_slab_pool* pool)
+{
+    if (!pool || !pool->attachment) {
+        return UUID_INVALID;
+    }
+    return pool->attachment->handle;
+}
+
+size_t
+dma_slab_pool_offset(
+    _In_ struct dma_slab_pool* pool,
+    _In_ void*                 address)
+{
+    if (!pool || !pool->attachment || !address) {
+        return 0;
+    }
+    return (uintptr_t)address - (uintptr_t)pool->attachment->buffer;
+}
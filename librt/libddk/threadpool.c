@@ -21,10 +21,10 @@
  *   and functionality, refer to the individual things for descriptions
  */
 
-#include <os/binarysemaphore.h>
 #include <os/mollenos.h>
 #include <ddk/threadpool.h>
 #include <ddk/utils.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
@@ -32,44 +32,51 @@
 /* ThreadPoolJob (Private)
  * Describes a linked list of jobs for threads to execute */
 typedef struct ThreadPoolJob {
+    struct ThreadPoolJob* Next;
     struct ThreadPoolJob* Previous;
     thrd_start_t          Function;
     void*                 Argument;
 } ThreadPoolJob_t;
 
 /* ThreadPoolJobQueue (Private)
- * Contains a list of job entries (ThreadPoolJob), and keeps
- * the synchronization between retrieving and adding */
+ * A double ended queue of jobs that belongs to a single worker. The owner pushes
+ * and pops jobs at the tail, while idle workers steal the oldest jobs from the head. */
 typedef struct ThreadPoolJobQueue {
-    mtx_t               Lock;
-    ThreadPoolJob_t*    Head;
-    ThreadPoolJob_t*    Tail;
-    BinarySemaphore_t*  HasJobs;
-    int                 Length;
+    mtx_t            Lock;
+    ThreadPoolJob_t* Head;
+    ThreadPoolJob_t* Tail;
+    int              Length;
 } ThreadPoolJobQueue_t;
 
 /* ThreadPoolThread (Private) 
- * Contains the thread information and some extra information */
+ * Contains the thread information and the job queue of the thread */
 typedef struct ThreadPoolThread {
-    int                 Id;
-    thrd_t              Thread;
-    ThreadPool_t*       Pool;
+    int                  Id;
+    thrd_t               Thread;
+    ThreadPool_t*        Pool;
+    ThreadPoolJobQueue_t JobQueue;
 } ThreadPoolThread_t;
 
 /* ThreadPool (Private) 
  * Contains all the neccessary information about the threadpool
  * and it's locks/threads/jobs */
 typedef struct ThreadPool {
-    volatile int            ThreadsAlive;
-    volatile int            ThreadsWorking;
+    _Atomic(int)            ThreadsAlive;
+    _Atomic(int)            ThreadsWorking;
+    _Atomic(int)            ThreadsSleeping;
     volatile int            ThreadsKeepAlive;
     volatile sig_atomic_t   ThreadsOnHold;
+    int                     ThreadCount;
+    _Atomic(unsigned int)   NextThread;
+    _Atomic(int)            JobsQueued;  // Jobs waiting in any of the queues
+    _Atomic(int)            JobsPending; // Jobs queued or running
 
     // Resources
+    mtx_t                   SleepLock;
+    cnd_t                   HasJobs;
     mtx_t                   ThreadLock;
     cnd_t                   ThreadsIdle;
     ThreadPoolThread_t**    Threads;
-    ThreadPoolJobQueue_t    JobQueue;
 } ThreadPool_t;
 
 /* Globals
@@ -77,239 +84,269 @@ typedef struct ThreadPool {
 static tss_t __GlbThreadPoolKey = TSS_KEY_INVALID;
 
 /* JobQueueInitialize
- * Allocates resources and initializes the job-queue */
-OsStatus_t
+ * Initializes the job-queue of a worker */
+static void
 JobQueueInitialize(
-    _In_ ThreadPoolJobQueue_t *JobQueue)
+    _In_ ThreadPoolJobQueue_t* JobQueue)
 {
-    // Sanitize
-    if (JobQueue == NULL) {
-        return OsError;
-    }
-
-    // Reset members
+    JobQueue->Head   = NULL;
+    JobQueue->Tail   = NULL;
     JobQueue->Length = 0;
-    JobQueue->Head = NULL;
-    JobQueue->Tail = NULL;
-
-    // Allocate a new lock
-    JobQueue->HasJobs = (BinarySemaphore_t*)malloc(sizeof(BinarySemaphore_t));
     mtx_init(&JobQueue->Lock, mtx_plain);
-    BinarySemaphoreConstruct(JobQueue->HasJobs, 0);
-    return OsSuccess;
 }
 
 /* JobQueuePush
- * Adds a new job to the end of the queue, the job will be executed
- * as fast as possible. */
-OsStatus_t
+ * Appends a chain of jobs to the tail of the queue. */
+static void
 JobQueuePush(
-    _In_ ThreadPoolJobQueue_t*  JobQueue,
-    _In_ ThreadPoolJob_t*       Job)
+    _In_ ThreadPoolJobQueue_t* JobQueue,
+    _In_ ThreadPoolJob_t*      First,
+    _In_ ThreadPoolJob_t*      Last,
+    _In_ int                   Count)
 {
-    // Sanitize
-    if (JobQueue == NULL) {
-        return OsError;
-    }
-
-    // Acquire lock and reset previous
     mtx_lock(&JobQueue->Lock);
-    Job->Previous = NULL;
-
-    // Either add to start or end
-    if (JobQueue->Length == 0) {
-        JobQueue->Head = Job;
-        JobQueue->Tail = Job;
+    First->Previous = JobQueue->Tail;
+    Last->Next      = NULL;
+    if (JobQueue->Tail) {
+        JobQueue->Tail->Next = First;
     }
     else {
-        JobQueue->Tail->Previous = Job;
-        JobQueue->Tail = Job;
+        JobQueue->Head = First;
     }
-
-    // Increase length
-    JobQueue->Length++;
-
-    // Notify threads
-    BinarySemaphorePost(JobQueue->HasJobs);
-    return mtx_unlock(&JobQueue->Lock);
+    JobQueue->Tail    = Last;
+    JobQueue->Length += Count;
+    mtx_unlock(&JobQueue->Lock);
 }
 
-/* JobQueuePull
- * Get first job from queue and removes it from the job-queue
- * The caller must hold a mutex */
-ThreadPoolJob_t*
-JobQueuePull(
-    _In_ ThreadPoolJobQueue_t *JobQueue)
+/* JobQueuePop
+ * Removes the newest job from the queue, this is used by the owner of the queue
+ * as the newest job is the most likely to still be in the cache. */
+static ThreadPoolJob_t*
+JobQueuePop(
+    _In_ ThreadPoolJobQueue_t* JobQueue)
 {
-    // Variables
-    ThreadPoolJob_t *Job = NULL;
-
-    // Sanitize
-    if (JobQueue == NULL) {
-        return NULL;
-    }
+    ThreadPoolJob_t* Job;
 
-    // Acquire lock and reset previous
     mtx_lock(&JobQueue->Lock);
-    Job = JobQueue->Head;
-
-    // On pull we have three different cases
-    // Either it's empty, return null
-    // If there is one job, clear head/tail
-    // If more, get head and notify
-    if (JobQueue->Length == 0) {
-        // Do nothing
-    }
-    else if (JobQueue->Length == 1) {
-        JobQueue->Head = NULL;
-        JobQueue->Tail = NULL;
-        JobQueue->Length--;
-    }
-    else {
-        JobQueue->Head = Job->Previous;
+    Job = JobQueue->Tail;
+    if (Job) {
+        JobQueue->Tail = Job->Previous;
+        if (JobQueue->Tail) {
+            JobQueue->Tail->Next = NULL;
+        }
+        else {
+            JobQueue->Head = NULL;
+        }
         JobQueue->Length--;
-
-        // Update that we still have jobs
-        BinarySemaphorePost(JobQueue->HasJobs);
     }
-
-    // Unlock and return the job
     mtx_unlock(&JobQueue->Lock);
     return Job;
 }
 
-/* JobQueueClear
- * Clears the job-queue and resets it's members. Also frees
- * any resources associated with the jobs */
-OsStatus_t
-JobQueueClear(
-    _In_ ThreadPoolJobQueue_t *JobQueue)
+/* JobQueueSteal
+ * Removes the oldest job from the queue, this is used by other workers. */
+static ThreadPoolJob_t*
+JobQueueSteal(
+    _In_ ThreadPoolJobQueue_t* JobQueue)
 {
-    // Sanitize
-    if (JobQueue == NULL) {
-        return OsError;
+    ThreadPoolJob_t* Job;
+
+    // Avoid taking the lock of queues that are empty anyway
+    if (!JobQueue->Length) {
+        return NULL;
     }
 
-    // Iterate and free jobs
-    while (JobQueue->Length) {
-        free(JobQueuePull(JobQueue));
+    if (mtx_trylock(&JobQueue->Lock) != thrd_success) {
+        return NULL;
     }
 
-    // Reset members
-    JobQueue->Head = NULL;
-    JobQueue->Tail = NULL;
-    BinarySemaphoreReset(JobQueue->HasJobs);
-    JobQueue->Length = 0;
-    return OsSuccess;
+    Job = JobQueue->Head;
+    if (Job) {
+        JobQueue->Head = Job->Next;
+        if (JobQueue->Head) {
+            JobQueue->Head->Previous = NULL;
+        }
+        else {
+            JobQueue->Tail = NULL;
+        }
+        JobQueue->Length--;
+    }
+    mtx_unlock(&JobQueue->Lock);
+    return Job;
 }
 
 /* JobQueueDestroy
- * Free all queue resources back to the system and clears the queue */
-void
+ * Frees all jobs left in the queue and the resources of the queue */
+static void
 JobQueueDestroy(
-    _In_ ThreadPoolJobQueue_t *JobQueue)
+    _In_ ThreadPoolJobQueue_t* JobQueue)
 {
-    // Clear queue, then cleanup
-    JobQueueClear(JobQueue);
-    free(JobQueue->HasJobs);
+    ThreadPoolJob_t* Job = JobQueue->Head;
+    while (Job) {
+        ThreadPoolJob_t* Next = Job->Next;
+        free(Job);
+        Job = Next;
+    }
+    mtx_destroy(&JobQueue->Lock);
 }
 
 /* ThreadPoolThreadHold
  * Signal-handler: Sets the calling thread on hold */
-void
+static void
 ThreadPoolThreadHold(
-    _In_ int                    SignalCode)
+    _In_ int SignalCode)
 {
-    // Variables 
-    ThreadPool_t *Tp = NULL;
+    ThreadPoolThread_t* Thread;
     _CRT_UNUSED(SignalCode);
 
     // Extract pool from tls
-    Tp = (ThreadPool_t*)tss_get(__GlbThreadPoolKey);
-    if (Tp != NULL) {
-        Tp->ThreadsOnHold = 1;
-        while (Tp->ThreadsOnHold) {
+    Thread = (ThreadPoolThread_t*)tss_get(__GlbThreadPoolKey);
+    if (Thread != NULL) {
+        Thread->Pool->ThreadsOnHold = 1;
+        while (Thread->Pool->ThreadsOnHold) {
             thrd_sleepex(1);
         }
     }
 }
 
+/* ThreadPoolGetJob
+ * Retrieves the next job for the thread, from its own queue or by stealing it
+ * from the queue of another thread. */
+static ThreadPoolJob_t*
+ThreadPoolGetJob(
+    _In_ ThreadPoolThread_t* Thread)
+{
+    ThreadPool_t*    Pool = Thread->Pool;
+    ThreadPoolJob_t* Job;
+    int              i;
+
+    Job = JobQueuePop(&Thread->JobQueue);
+    for (i = 1; !Job && i < Pool->ThreadCount; i++) {
+        Job = JobQueueSteal(&Pool->Threads[(Thread->Id + i) % Pool->ThreadCount]->JobQueue);
+    }
+
+    if (Job) {
+        atomic_fetch_sub(&Pool->JobsQueued, 1);
+    }
+    return Job;
+}
+
 /* ThreadPoolThreadLoop
  * The primary loop of each thread */
-int
+static int
 ThreadPoolThreadLoop(
-    _In_ void*                  Argument)
+    _In_ void* Argument)
 {
-    ThreadPoolThread_t* Thread;
-    ThreadPoolJob_t *Job;
-    ThreadPool_t *Pool;
+    ThreadPoolThread_t* Thread = (ThreadPoolThread_t*)Argument;
+    ThreadPool_t*       Pool   = Thread->Pool;
+    ThreadPoolJob_t*    Job;
 
-    // Instantiate the pointers
-    Thread  = (ThreadPoolThread_t*)Argument;
-    Pool    = Thread->Pool;
-
-    // Update tls and store the pool
-    tss_set(__GlbThreadPoolKey, Pool);
+    // Update tls and store the thread
+    tss_set(__GlbThreadPoolKey, Thread);
 
     // Update signal handler for this thread
     signal(SIGUSR1, ThreadPoolThreadHold);
 
     // Enter job-queue loop
-    Pool->ThreadsAlive++;
+    atomic_fetch_add(&Pool->ThreadsAlive, 1);
     while (Pool->ThreadsKeepAlive) {
-        BinarySemaphoreWait(Pool->JobQueue.HasJobs);
-
-        // Make sure we check it again after wake-up
-        if (Pool->ThreadsKeepAlive) {
-            // Increase thread-working count
-            Pool->ThreadsWorking++;
-
-            // Get next job and execute
-            Job = JobQueuePull(&Pool->JobQueue);
-            if (Job != NULL) {
-                Job->Function(Job->Argument);
-                free(Job);
+        Job = ThreadPoolGetJob(Thread);
+        if (Job != NULL) {
+            atomic_fetch_add(&Pool->ThreadsWorking, 1);
+            Job->Function(Job->Argument);
+            free(Job);
+            atomic_fetch_sub(&Pool->ThreadsWorking, 1);
+
+            // If this was the last job, then signal all waiters
+            if (atomic_fetch_sub(&Pool->JobsPending, 1) == 1) {
+                mtx_lock(&Pool->ThreadLock);
+                cnd_broadcast(&Pool->ThreadsIdle);
+                mtx_unlock(&Pool->ThreadLock);
             }
+            continue;
+        }
 
-            // Decrease thread-working count
-            mtx_lock(&Pool->ThreadLock);
-            Pool->ThreadsWorking--;
-
-            // If none are working anymore, signal all idle
-            if (!Pool->ThreadsWorking) {
-                cnd_signal(&Pool->ThreadsIdle);
-            }
-            mtx_unlock(&Pool->ThreadLock);
+        // Announce that we are going to sleep before checking for jobs, so a job that
+        // is queued at the same time will see us and wake us up
+        mtx_lock(&Pool->SleepLock);
+        atomic_fetch_add(&Pool->ThreadsSleeping, 1);
+        while (Pool->ThreadsKeepAlive && !atomic_load(&Pool->JobsQueued)) {
+            cnd_wait(&Pool->HasJobs, &Pool->SleepLock);
         }
+        atomic_fetch_sub(&Pool->ThreadsSleeping, 1);
+        mtx_unlock(&Pool->SleepLock);
     }
 
     // Decrease thread-live count
-    Pool->ThreadsAlive--;
+    atomic_fetch_sub(&Pool->ThreadsAlive, 1);
     return 0;
 }
 
-/* ThreadPoolInitializeThread
- * Initialize a thread in the thread pool */
-int 
-ThreadPoolInitializeThread(
-    _In_ ThreadPool_t*          ThreadPool,
-    _In_ ThreadPoolThread_t**   Thread,
-    _In_ int                    Id)
+/* ThreadPoolWakeThreads
+ * Wakes up sleeping threads after jobs have been queued. */
+static void
+ThreadPoolWakeThreads(
+    _In_ ThreadPool_t* ThreadPool,
+    _In_ int           Count)
+{
+    if (!atomic_load(&ThreadPool->ThreadsSleeping)) {
+        return;
+    }
+
+    mtx_lock(&ThreadPool->SleepLock);
+    if (Count > 1) {
+        cnd_broadcast(&ThreadPool->HasJobs);
+    }
+    else {
+        cnd_signal(&ThreadPool->HasJobs);
+    }
+    mtx_unlock(&ThreadPool->SleepLock);
+}
+
+/* ThreadPoolSelectThread
+ * Selects the queue new jobs are added to. Jobs queued by a worker of the pool are
+ * kept on the queue of that worker, otherwise the hint is used, or jobs are spread
+ * evenly between the workers. */
+static ThreadPoolThread_t*
+ThreadPoolSelectThread(
+    _In_ ThreadPool_t* ThreadPool,
+    _In_ int           Hint)
+{
+    ThreadPoolThread_t* Current = (ThreadPoolThread_t*)tss_get(__GlbThreadPoolKey);
+
+    if (Hint >= 0) {
+        return ThreadPool->Threads[Hint % ThreadPool->ThreadCount];
+    }
+
+    if (Current != NULL && Current->Pool == ThreadPool) {
+        return Current;
+    }
+    return ThreadPool->Threads[atomic_fetch_add(&ThreadPool->NextThread, 1) % (unsigned int)ThreadPool->ThreadCount];
+}
+
+/* ThreadPoolQueueJobs
+ * Queues a chain of jobs on the queue of a worker and wakes up sleeping workers. */
+static void
+ThreadPoolQueueJobs(
+    _In_ ThreadPool_t*       ThreadPool,
+    _In_ ThreadPoolThread_t* Thread,
+    _In_ ThreadPoolJob_t*    First,
+    _In_ ThreadPoolJob_t*    Last,
+    _In_ int                 Count)
 {
-    // Allocate a new instance of a thread
-    *Thread = (ThreadPoolThread_t*)malloc(sizeof(ThreadPoolThread_t));
-    (*Thread)->Id   = Id;
-    (*Thread)->Pool = ThreadPool;
-    return thrd_create(&(*Thread)->Thread, ThreadPoolThreadLoop, *Thread);
+    atomic_fetch_add(&ThreadPool->JobsPending, Count);
+    JobQueuePush(&Thread->JobQueue, First, Last, Count);
+    atomic_fetch_add(&ThreadPool->JobsQueued, Count);
+    ThreadPoolWakeThreads(ThreadPool, Count);
 }
 
 /* ThreadPoolThreadDestroy
  * Frees any resources related to the given thread */
-void
+static void
 ThreadPoolThreadDestroy(
-    _In_ ThreadPoolThread_t*    Thread)
+    _In_ ThreadPoolThread_t* Thread)
 {
-    // Simply free it
+    JobQueueDestroy(&Thread->JobQueue);
     free(Thread);
 }
 
@@ -317,11 +354,11 @@ ThreadPoolThreadDestroy(
  * Initializes a new thread-pool with the given number of threads */
 OsStatus_t
 ThreadPoolInitialize(
-    _In_  int                   NumThreads,
-    _Out_ ThreadPool_t**        ThreadPool)
+    _In_  int            NumThreads,
+    _Out_ ThreadPool_t** ThreadPool)
 {
-    ThreadPool_t *Instance;
-    int i;
+    ThreadPool_t* Instance;
+    int           i;
 
     // Trace
     TRACE("ThreadPoolInitialize(%i)", NumThreads);
@@ -334,7 +371,7 @@ ThreadPoolInitialize(
     }
 
     // Sanitize parameters
-    if (ThreadPool == NULL || NumThreads < 0) {
+    if (ThreadPool == NULL || NumThreads <= 0) {
         ERROR("Invalid parameters");
         return OsError;
     }
@@ -349,6 +386,7 @@ ThreadPoolInitialize(
     if (Instance == NULL) {
         return OsOutOfMemory;
     }
+    memset((void*)Instance, 0, sizeof(ThreadPool_t));
     
     // Allocate the list of threads
     Instance->Threads = (ThreadPoolThread_t**)malloc(NumThreads * sizeof(ThreadPoolThread_t*));
@@ -356,28 +394,39 @@ ThreadPoolInitialize(
         free(Instance);
         return OsOutOfMemory;
     }
-
-    memset((void*)Instance, 0, sizeof(ThreadPool_t));
+    Instance->ThreadCount      = NumThreads;
     Instance->ThreadsKeepAlive = 1;
 
-    // Initialize job queue
-    if (JobQueueInitialize(&Instance->JobQueue) != OsSuccess) {
-        free(Instance->Threads);
-        free(Instance);
-        return OsError;
-    }
-
     // Initialize locks
-    cnd_init(&Instance->ThreadsIdle);
+    mtx_init(&Instance->SleepLock, mtx_plain);
+    cnd_init(&Instance->HasJobs);
     mtx_init(&Instance->ThreadLock, mtx_plain);
+    cnd_init(&Instance->ThreadsIdle);
+
+    // All queues must exist before any thread starts stealing from them, so the
+    // threads are created in two steps
+    for (i = 0; i < NumThreads; i++) {
+        Instance->Threads[i] = (ThreadPoolThread_t*)malloc(sizeof(ThreadPoolThread_t));
+        if (Instance->Threads[i] == NULL) {
+            while (i--) {
+                ThreadPoolThreadDestroy(Instance->Threads[i]);
+            }
+            free(Instance->Threads);
+            free(Instance);
+            return OsOutOfMemory;
+        }
+        Instance->Threads[i]->Id   = i;
+        Instance->Threads[i]->Pool = Instance;
+        JobQueueInitialize(&Instance->Threads[i]->JobQueue);
+    }
 
     // Spawn threads
     for (i = 0; i < NumThreads; i++) {
-        ThreadPoolInitializeThread(Instance, &Instance->Threads[i], i);
+        thrd_create(&Instance->Threads[i]->Thread, ThreadPoolThreadLoop, Instance->Threads[i]);
     }
 
     // Wait for all threads to spin-up
-    while (Instance->ThreadsAlive != NumThreads);
+    while (atomic_load(&Instance->ThreadsAlive) != NumThreads);
     *ThreadPool = Instance;
     return OsSuccess;
 }
@@ -391,6 +440,18 @@ ThreadPoolAddWork(
     _In_ ThreadPool_t* ThreadPool,
     _In_ thrd_start_t  Function,
     _In_ void*         Argument)
+{
+    return ThreadPoolAddWorkEx(ThreadPool, Function, Argument, THREADPOOL_ANY_WORKER);
+}
+
+/* ThreadPoolAddWorkEx
+ * Adds a job to the queue of a specific worker. */
+OsStatus_t
+ThreadPoolAddWorkEx(
+    _In_ ThreadPool_t* ThreadPool,
+    _In_ thrd_start_t  Function,
+    _In_ void*         Argument,
+    _In_ int           Worker)
 {
     ThreadPoolJob_t* Job;
 
@@ -407,7 +468,67 @@ ThreadPoolAddWork(
     
     Job->Function = Function;
     Job->Argument = Argument;
-    return JobQueuePush(&ThreadPool->JobQueue, Job);
+    ThreadPoolQueueJobs(ThreadPool, ThreadPoolSelectThread(ThreadPool, Worker), Job, Job, 1);
+    return OsSuccess;
+}
+
+/* ThreadPoolAddWorkBatch
+ * Adds a job for each of the arguments. The jobs are split evenly between the
+ * workers, and each queue is only locked once per batch. */
+OsStatus_t
+ThreadPoolAddWorkBatch(
+    _In_ ThreadPool_t* ThreadPool,
+    _In_ thrd_start_t  Function,
+    _In_ void**        Arguments,
+    _In_ size_t        Count)
+{
+    ThreadPoolJob_t* Jobs;
+    ThreadPoolJob_t* First;
+    size_t           PerThread;
+    size_t           Queued = 0;
+    size_t           i;
+
+    // Sanitize parameters
+    if (ThreadPool == NULL || (Count && Arguments == NULL)) {
+        return OsError;
+    }
+
+    PerThread = (Count + (ThreadPool->ThreadCount - 1)) / ThreadPool->ThreadCount;
+    while (Queued < Count) {
+        size_t Length = MIN(PerThread, Count - Queued);
+
+        // Jobs are freed individually, so they can't share an allocation
+        First = NULL;
+        Jobs  = NULL;
+        for (i = 0; i < Length; i++) {
+            ThreadPoolJob_t* Job = (ThreadPoolJob_t*)malloc(sizeof(ThreadPoolJob_t));
+            if (Job == NULL) {
+                while (First) {
+                    Job   = First;
+                    First = First->Next;
+                    free(Job);
+                }
+                return OsOutOfMemory;
+            }
+
+            Job->Function = Function;
+            Job->Argument = Arguments[Queued + i];
+            Job->Next     = NULL;
+            Job->Previous = Jobs;
+            if (Jobs) {
+                Jobs->Next = Job;
+            }
+            else {
+                First = Job;
+            }
+            Jobs = Job;
+        }
+
+        ThreadPoolQueueJobs(ThreadPool, ThreadPoolSelectThread(ThreadPool, THREADPOOL_ANY_WORKER),
+            First, Jobs, (int)Length);
+        Queued += Length;
+    }
+    return OsSuccess;
 }
 
 /* ThreadPoolWait
@@ -416,7 +537,7 @@ ThreadPoolAddWork(
  * (probably the main program) will continue. */
 OsStatus_t
 ThreadPoolWait(
-    _In_ ThreadPool_t*          ThreadPool)
+    _In_ ThreadPool_t* ThreadPool)
 {
     if (ThreadPool == NULL) {
         return OsError;
@@ -426,7 +547,7 @@ ThreadPoolWait(
     mtx_lock(&ThreadPool->ThreadLock);
 
     // Now wait for all threads
-    while (ThreadPool->JobQueue.Length || ThreadPool->ThreadsWorking) {
+    while (atomic_load(&ThreadPool->JobsPending)) {
         cnd_wait(&ThreadPool->ThreadsIdle, &ThreadPool->ThreadLock);
     }
 
@@ -441,7 +562,7 @@ ThreadPoolWait(
  * is called. */
 OsStatus_t
 ThreadPoolPause(
-    _In_ ThreadPool_t*          ThreadPool)
+    _In_ ThreadPool_t* ThreadPool)
 {
     int i;
 
@@ -451,7 +572,7 @@ ThreadPoolPause(
     }
 
     // Iterate and pause threads
-    for (i = 0; i < ThreadPool->ThreadsAlive; i++) {
+    for (i = 0; i < ThreadPool->ThreadCount; i++) {
         thrd_signal(ThreadPool->Threads[i]->Thread, SIGUSR1);
     }
     return OsSuccess;
@@ -462,7 +583,7 @@ ThreadPoolPause(
  * threadpool workers. */
 OsStatus_t
 ThreadPoolResume(
-    _In_ ThreadPool_t*          ThreadPool)
+    _In_ ThreadPool_t* ThreadPool)
 {
     if (ThreadPool == NULL) {
         return OsError;
@@ -476,13 +597,8 @@ ThreadPoolResume(
  * the whole threadpool to free up memory. */
 OsStatus_t
 ThreadPoolDestroy(
-    _In_ ThreadPool_t*          ThreadPool)
+    _In_ ThreadPool_t* ThreadPool)
 {
-    // Variables
-    volatile int ThreadsTotal;
-    double TimeOut      = 1.0;
-    double TimePassed   = 0.0;
-    time_t Start, End;
     int i;
 
     // Sanitize the parameters
@@ -490,31 +606,25 @@ ThreadPoolDestroy(
         return OsError;
     }
 
-    // Store information and end infinite loop
-    ThreadsTotal                    = ThreadPool->ThreadsAlive;
-    ThreadPool->ThreadsKeepAlive    = 0;
-
-    // Give it a second to shut-down threads
-    time(&Start);
-    while (TimePassed < TimeOut && ThreadPool->ThreadsAlive) {
-        BinarySemaphorePostAll(ThreadPool->JobQueue.HasJobs);
-        time(&End);
-        TimePassed = difftime(End, Start);
-    }
-
-    // Wait for remaining threads to shut-down
-    while (ThreadPool->ThreadsAlive) {
-        BinarySemaphorePostAll(ThreadPool->JobQueue.HasJobs);
+    // End infinite loop and wait for the threads to shut-down
+    ThreadPool->ThreadsKeepAlive = 0;
+    while (atomic_load(&ThreadPool->ThreadsAlive)) {
+        mtx_lock(&ThreadPool->SleepLock);
+        cnd_broadcast(&ThreadPool->HasJobs);
+        mtx_unlock(&ThreadPool->SleepLock);
         thrd_sleepex(1);
     }
 
-    // Cleanup job-queue
-    JobQueueDestroy(&ThreadPool->JobQueue);
-    for (i = 0; i < ThreadsTotal; i++) {
+    // Cleanup threads and their job-queues
+    for (i = 0; i < ThreadPool->ThreadCount; i++) {
         ThreadPoolThreadDestroy(ThreadPool->Threads[i]);
     }
 
     // Cleanup
+    cnd_destroy(&ThreadPool->HasJobs);
+    cnd_destroy(&ThreadPool->ThreadsIdle);
+    mtx_destroy(&ThreadPool->SleepLock);
+    mtx_destroy(&ThreadPool->ThreadLock);
     free(ThreadPool->Threads);
     free(ThreadPool);
     return OsSuccess;
@@ -524,10 +634,10 @@ ThreadPoolDestroy(
  * Returns the number of working threads are the threads that are performing work (not idle). */
 size_t
 ThreadPoolGetWorkingCount(
-    _In_ ThreadPool_t*          ThreadPool)
+    _In_ ThreadPool_t* ThreadPool)
 {
     if (ThreadPool == NULL) {
         return 0;
     }
-    return ThreadPool->ThreadsWorking;
+    return (size_t)atomic_load(&ThreadPool->ThreadsWorking);
 }
@@ -74,6 +74,19 @@ list_append(
     _In_ list_t*,
     _In_ element_t*));
 
+/**
+ * list_insert_before
+ * * Inserts the element in front of another element in the list.
+ * @param list    [In] The list that contains the before element.
+ * @param before  [In] The element to insert in front of, if NULL the element is appended.
+ * @param element [In] The element that should be inserted.
+ */
+DSDECL(int,
+list_insert_before(
+    _In_ list_t*,
+    _In_ element_t*,
+    _In_ element_t*));
+
 DSDECL(int,
 list_remove(
     _In_ list_t*,
@@ -146,4 +146,19 @@ streambuffer_read_packet_end(
     _In_ unsigned int    base,
     _In_ size_t          length));
 
+DSDECL(size_t,
+streambuffer_splice(
+    _In_ streambuffer_t* target,
+    _In_ streambuffer_t* source,
+    _In_ size_t          length,
+    _In_ unsigned int    options));
+
+DSDECL(void,
+streambuffer_splice_packet_data(
+    _In_    streambuffer_t* target,
+    _InOut_ unsigned int*   target_state,
+    _In_    streambuffer_t* source,
+    _InOut_ unsigned int*   source_state,
+    _In_    size_t          length));
+
 #endif //!__RINGBUFFER_H__
@@ -121,6 +121,34 @@ list_append(
     return 0;
 }
 
+int
+list_insert_before(
+    _In_ list_t*    list,
+    _In_ element_t* before,
+    _In_ element_t* element)
+{
+    assert(list != NULL);
+    assert(element != NULL);
+    
+    if (!before) {
+        return list_append(list, element);
+    }
+
+    LIST_LOCK;
+    element->next     = before;
+    element->previous = before->previous;
+    if (!before->previous) {
+        list->head = element;
+    }
+    else {
+        before->previous->next = element;
+    }
+    before->previous = element;
+    list->count++;
+    LIST_UNLOCK;
+    return 0;
+}
+
 static int
 __list_remove(
     _In_  list_t*    list, 
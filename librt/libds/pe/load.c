@@ -23,6 +23,7 @@
 //#define __TRACE
 
 #include <ds/ds.h>
+#include <ds/hash_sip.h>
 #include <ds/list.h>
 #include <ds/mstring.h>
 #include <os/mollenos.h>
@@ -39,6 +40,16 @@ typedef struct SectionMapping {
 
 #define OFFSET_IN_SECTION(Section, _RVA) (uintptr_t)(Section->BasePointer + ((_RVA) - Section->RVA))
 
+struct PeExportIndex {
+    const char*           Name;
+    PeExportedFunction_t* Function;
+};
+
+static uint64_t ExportHash(const void*);
+static int      ExportCompare(const void*, const void*);
+
+static uint8_t HashKey[16] = { 117, 42, 203, 9, 160, 85, 231, 18, 67, 152, 29, 244, 101, 6, 189, 73 };
+
 // Directory handlers
 OsStatus_t PeHandleRelocations(PeExecutable_t*,PeExecutable_t*, SectionMapping_t*, int, uint8_t*, size_t);
 OsStatus_t PeHandleExports(PeExecutable_t*,PeExecutable_t*, SectionMapping_t*, int, uint8_t*, size_t);
@@ -113,40 +124,74 @@ GetExportedFunctionByOrdinal(
     return NULL;
 }
 
+PeExportedFunction_t*
+PeGetExportedFunctionByName(
+    _In_ PeExecutable_t* Library,
+    _In_ const char*     Name)
+{
+    struct PeExportIndex* Index;
+    int                   Low  = 0;
+    int                   High = Library->NumberOfExportedFunctions - 1;
+
+    if (Library->ExportedFunctionsIndex.capacity) {
+        Index = hashtable_get(&Library->ExportedFunctionsIndex, &(struct PeExportIndex) { .Name = Name });
+        return (Index != NULL) ? Index->Function : NULL;
+    }
+
+    while (Low <= High) {
+        int Middle = Low + ((High - Low) / 2);
+        int Result = strcmp(Library->ExportedFunctions[Middle].Name, Name);
+        if (!Result) {
+            return &Library->ExportedFunctions[Middle];
+        }
+        else if (Result < 0) {
+            Low = Middle + 1;
+        }
+        else {
+            High = Middle - 1;
+        }
+    }
+    return NULL;
+}
+
 static PeExportedFunction_t*
 GetExportedFunctionByNameDescriptor(
-    _In_ PeExportedFunction_t*     Exports,
-    _In_ int                       NumberOfExports,
+    _In_ PeExecutable_t*           Library,
     _In_ PeImportNameDescriptor_t* Descriptor)
 {
-    int i;
+    const char* Name = (const char*)&Descriptor->Name[0];
 
-    // Use the hint if provided
-    if (Descriptor->OrdinalHint != 0) {
-        for (i = 0; i < NumberOfExports; i++) {
-            if (Exports[i].Ordinal == Descriptor->OrdinalHint) {
-                if (!strcmp(Exports[i].Name, (const char*)&Descriptor->Name[0])) {
-                    return &Exports[i];
-                }
-            }
+    // The hint is the index into the name table where the name is expected to be
+    if (Descriptor->OrdinalHint < Library->NumberOfExportedFunctions) {
+        PeExportedFunction_t* Function = &Library->ExportedFunctions[Descriptor->OrdinalHint];
+        if (!strcmp(Function->Name, Name)) {
+            return Function;
         }
     }
 
     // Hint was invalid or not present
-    for (i = 0; i < NumberOfExports; i++) {
-        if (Exports[i].Name != NULL) {
-            if (!strcmp(Exports[i].Name, (const char*)&Descriptor->Name[0])) {
-                return &Exports[i];
-            }
+    return PeGetExportedFunctionByName(Library, Name);
+}
+
+// Store first code segment we encounter
+static void
+SetCodeBase(
+    _In_ PeExecutable_t*    Image,
+    _In_ PeSectionHeader_t* Section)
+{
+    if (Section->Flags & PE_SECTION_CODE) {
+        if (Image->CodeBase == 0) {
+            Image->CodeBase = (uintptr_t)Image->VirtualAddress + Section->VirtualAddress;
+            Image->CodeSize = Section->VirtualSize;
         }
     }
-    return NULL;
 }
 
 static OsStatus_t
 PeHandleSections(
     _In_ PeExecutable_t*   Parent,
     _In_ PeExecutable_t*   Image,
+    _In_ PeSharedImage_t*  Shared,
     _In_ uint8_t*          Data,
     _In_ uintptr_t         SectionAddress,
     _In_ int               SectionCount,
@@ -182,6 +227,27 @@ PeHandleSections(
             PageFlags |= MEMORY_WRITE;
         }
 
+        // Sections of a shared image are mapped directly, they are already relocated. The
+        // memory is the same in all processes, so it is never mapped writable.
+        if (Shared != NULL && Shared->Sections[i].Region != NULL) {
+            Status = MapImageRegion(Image->MemorySpace, Shared->Sections[i].Region,
+                VirtualDestination, Shared->Sections[i].Length, PageFlags & ~(MEMORY_WRITE));
+            if (Status != OsSuccess) {
+                dserror("%s: Failed to map shared section %s at 0x%" PRIxIN ": %u",
+                    MStringRaw(Image->Name), &SectionName[0], VirtualDestination, Status);
+                return Status;
+            }
+
+            SectionHandles[i].Handle      = NULL;
+            SectionHandles[i].BasePointer = (uint8_t*)Shared->Sections[i].Buffer;
+            SectionHandles[i].RVA         = Section->VirtualAddress;
+            SectionHandles[i].Size        = SectionSize;
+            SetCodeBase(Image, Section);
+            CurrentAddress = (Image->VirtualAddress + Section->VirtualAddress + SectionSize);
+            Section++;
+            continue;
+        }
+
         // Iterate pages and map them in our memory space
         Status = AcquireImageMapping(Image->MemorySpace, &VirtualDestination, SectionSize, PageFlags, &MapHandle);
         if (Status != OsSuccess) {
@@ -195,13 +261,14 @@ PeHandleSections(
         SectionHandles[i].BasePointer = Destination;
         SectionHandles[i].RVA         = Section->VirtualAddress;
         SectionHandles[i].Size        = SectionSize;
-
-        // Store first code segment we encounter
-        if (Section->Flags & PE_SECTION_CODE) {
-            if (Image->CodeBase == 0) {
-                Image->CodeBase = (uintptr_t)Image->VirtualAddress + Section->VirtualAddress;
-                Image->CodeSize = Section->VirtualSize;
-            }
+        SetCodeBase(Image, Section);
+
+        // The private sections of a shared image are copied from the relocated contents
+        if (Shared != NULL) {
+            memcpy(Destination, Shared->Sections[i].Buffer, Shared->Sections[i].Length);
+            CurrentAddress = (Image->VirtualAddress + Section->VirtualAddress + SectionSize);
+            Section++;
+            continue;
         }
 
         // Handle sections specifics, we want to:
@@ -238,8 +305,15 @@ PeHandleSections(
         CurrentAddress += (GetPageSize() - (CurrentAddress % GetPageSize()));
     }
 
-    if (Parent != NULL) Parent->NextLoadingAddress = CurrentAddress;
-    else                Image->NextLoadingAddress  = CurrentAddress;
+    // Shared images are placed outside of the process' own range
+    if (Parent != NULL) {
+        if (Image->SharedImage == NULL) {
+            Parent->NextLoadingAddress = CurrentAddress;
+        }
+    }
+    else {
+        Image->NextLoadingAddress = CurrentAddress;
+    }
     return OsSuccess;
 }
 
@@ -289,7 +363,7 @@ PeResolveImportDescriptor(
             }
             else {
                 NameDescriptor = (PeImportNameDescriptor_t*)OFFSET_IN_SECTION(Section, Value & PE_IMPORT_NAMEMASK);
-                Function       = GetExportedFunctionByNameDescriptor(Exports, NumberOfExports, NameDescriptor);
+                Function       = GetExportedFunctionByNameDescriptor(ResolvedLibrary, NameDescriptor);
                 if (!Function) {
                     dserror("Failed to locate function (%s)", &NameDescriptor->Name[0]);
                     return OsError;
@@ -316,7 +390,7 @@ PeResolveImportDescriptor(
             }
             else {
                 NameDescriptor = (PeImportNameDescriptor_t*)OFFSET_IN_SECTION(Section, Value & PE_IMPORT_NAMEMASK);
-                Function       = GetExportedFunctionByNameDescriptor(Exports, NumberOfExports, NameDescriptor);
+                Function       = GetExportedFunctionByNameDescriptor(ResolvedLibrary, NameDescriptor);
                 if (!Function) {
                     dserror("Failed to locate function (%s)", &NameDescriptor->Name[0]);
                     return OsError;
@@ -502,7 +576,9 @@ PeHandleExports(
             NameAddress = OFFSET_IN_SECTION(Section, FunctionAddressTable[i]);
         }
         else {
-            uintptr_t MaxImageValue = (ParentImage == NULL) ? Image->NextLoadingAddress : ParentImage->NextLoadingAddress; 
+            // Shared images are not placed below the loading address of the parent, so
+            // exports are bounded by the range of the image itself
+            uintptr_t MaxImageValue = Image->VirtualAddress + Image->ImageSize;
             if (!ISINRANGE(ExFunc->Address, Image->CodeBase, MaxImageValue)) {
                 dserror("%s: Address 0x%x (Table RVA value: 0x%x), %i", 
                     MStringRaw(Image->Name), ExFunc->Address, FunctionAddressTable[ExFunc->Ordinal], i);
@@ -510,7 +586,7 @@ PeHandleExports(
                     Image->CodeBase, MaxImageValue);
                 dserror("ExportTable->NumberOfFunctions [%u]", ExportTable->NumberOfFunctions);
                 dserror("ExportTable->AddressOfFunctions [0x%x]", ExportTable->AddressOfFunctions);
-                assert(0);
+                return OsError;
             }
         }
         FunctionNameLengths += strlen((const char*)NameAddress) + 1;
@@ -540,9 +616,35 @@ PeHandleExports(
         ExFunc->Name         = NameBuffer;
         FunctionNameLengths += FunctionLength;
     }
+
+    // Build the index used to resolve imports by name, if this fails the imports are
+    // resolved by searching the exports instead
+    if (hashtable_construct(&Image->ExportedFunctionsIndex, (size_t)Image->NumberOfExportedFunctions,
+            sizeof(struct PeExportIndex), ExportHash, ExportCompare)) {
+        dswarning("%s: failed to build the export index", MStringRaw(Image->Name));
+        return OsSuccess;
+    }
+
+    for (i = 0; i < Image->NumberOfExportedFunctions; i++) {
+        hashtable_set(&Image->ExportedFunctionsIndex, &(struct PeExportIndex) {
+            .Name = Image->ExportedFunctions[i].Name, .Function = &Image->ExportedFunctions[i] });
+    }
     return OsSuccess;
 }
 
+static uint64_t ExportHash(const void* Element)
+{
+    const struct PeExportIndex* Index = Element;
+    return siphash_64((const uint8_t*)Index->Name, strlen(Index->Name), &HashKey[0]);
+}
+
+static int ExportCompare(const void* Element1, const void* Element2)
+{
+    const struct PeExportIndex* Index1 = Element1;
+    const struct PeExportIndex* Index2 = Element2;
+    return strcmp(Index1->Name, Index2->Name);
+}
+
 OsStatus_t
 PeHandleImports(
     _In_ PeExecutable_t*    ParentImage,
@@ -568,6 +670,73 @@ PeHandleImports(
     return OsSuccess;
 }
 
+/* PeCaptureSections
+ * Captures the sections of an image loaded at the address of its shared image. Sections
+ * are shared if they are not writable, not written by the import binding and do not
+ * share pages with other sections. */
+static void
+PeCaptureSections(
+    _In_ PeExecutable_t*    Image,
+    _In_ PeSectionHeader_t* Sections,
+    _In_ int                SectionCount,
+    _In_ SectionMapping_t*  SectionMappings,
+    _In_ uint8_t*           ImportDirectory)
+{
+    PeImportDescriptor_t* ImportDescriptor;
+    uintptr_t             PageSize = GetPageSize();
+    void**                SectionData;
+    size_t*               SectionLengths;
+    int*                  Shareable;
+    int                   i;
+
+    SectionData    = (void**)dsalloc(sizeof(void*) * SectionCount);
+    SectionLengths = (size_t*)dsalloc(sizeof(size_t) * SectionCount);
+    Shareable      = (int*)dsalloc(sizeof(int) * SectionCount);
+    if (!SectionData || !SectionLengths || !Shareable) {
+        goto Cleanup;
+    }
+
+    for (i = 0; i < SectionCount; i++) {
+        uintptr_t SectionEnd = SectionMappings[i].RVA + SectionMappings[i].Size;
+        SectionData[i]    = SectionMappings[i].BasePointer;
+        SectionLengths[i] = SectionMappings[i].Size;
+        Shareable[i]      = !(Sections[i].Flags & PE_SECTION_WRITE) &&
+            !(SectionMappings[i].RVA % PageSize);
+
+        SectionEnd = (SectionEnd + (PageSize - 1)) & ~(PageSize - 1);
+        if (i + 1 < SectionCount && SectionEnd > SectionMappings[i + 1].RVA) {
+            Shareable[i] = 0;
+        }
+    }
+
+    ImportDescriptor = (PeImportDescriptor_t*)ImportDirectory;
+    while (ImportDescriptor != NULL && ImportDescriptor->ImportAddressTable != 0) {
+        for (i = 0; i < SectionCount; i++) {
+            if (ImportDescriptor->ImportAddressTable >= SectionMappings[i].RVA &&
+                ImportDescriptor->ImportAddressTable < (SectionMappings[i].RVA + SectionMappings[i].Size)) {
+                Shareable[i] = 0;
+            }
+        }
+        ImportDescriptor++;
+    }
+
+    if (PeCaptureSharedImage(Image->SharedImage, SectionCount, SectionData,
+            SectionLengths, Shareable) != OsSuccess) {
+        dswarning("%s: sections could not be shared", MStringRaw(Image->Name));
+    }
+
+Cleanup:
+    if (SectionData) {
+        dsfree(SectionData);
+    }
+    if (SectionLengths) {
+        dsfree(SectionLengths);
+    }
+    if (Shareable) {
+        dsfree(Shareable);
+    }
+}
+
 static OsStatus_t
 PeParseAndMapImage(
     _In_ PeExecutable_t*    Parent,
@@ -580,6 +749,7 @@ PeParseAndMapImage(
 {
     uintptr_t          VirtualAddress = Image->VirtualAddress;
     uint8_t*           DirectoryContents[PE_NUM_DIRECTORIES] = { 0 };
+    PeSharedImage_t*   Shared = NULL;
     SectionMapping_t*  SectionMappings;
     MemoryMapHandle_t  MapHandle;
     OsStatus_t         Status;
@@ -603,7 +773,10 @@ PeParseAndMapImage(
 
     // Now we want to handle all the directories and sections in the image
     dstrace("Handling sections and data directory mappings");
-    Status = PeHandleSections(Parent, Image, ImageBuffer, SectionBase, SectionCount, SectionMappings);
+    if (Image->SharedImage != NULL && Image->SharedImage->Sections != NULL) {
+        Shared = Image->SharedImage;
+    }
+    Status = PeHandleSections(Parent, Image, Shared, ImageBuffer, SectionBase, SectionCount, SectionMappings);
     if (Status != OsSuccess) {
         return OsError;
     }
@@ -639,6 +812,11 @@ PeParseAndMapImage(
             break; // End of list of handlers
         }
 
+        // The sections of a shared image were relocated when they were captured
+        if (Shared != NULL && DataDirectoryIndex == PE_SECTION_BASE_RELOCATION) {
+            continue;
+        }
+
         // Is there any directory available for the handler?
         if (DirectoryContents[DataDirectoryIndex] != NULL) {
             dstrace("parsing data-directory[%i]", DataDirectoryIndex);
@@ -652,6 +830,12 @@ PeParseAndMapImage(
         }
     }
 
+    // Keep the relocated sections if this is the first load of a shared image
+    if (Image->SharedImage != NULL && Shared == NULL && Status == OsSuccess) {
+        PeCaptureSections(Image, (PeSectionHeader_t*)SectionBase, SectionCount,
+            SectionMappings, DirectoryContents[PE_SECTION_IMPORT]);
+    }
+
     // Free all the section mappings
     for (i = 0; i < SectionCount; i++) {
         if (SectionMappings[i].Handle != NULL) {
@@ -662,6 +846,32 @@ PeParseAndMapImage(
     return Status;
 }
 
+/* PeGetSharedImage
+ * Acquires the shared image of a library that is about to be loaded into the process. The
+ * library is loaded privately if the address of the shared image is already in use by
+ * the process. */
+static PeSharedImage_t*
+PeGetSharedImage(
+    _In_ PeExecutable_t* Parent,
+    _In_ MString_t*      FullPath,
+    _In_ uint32_t        TimeStamp,
+    _In_ size_t          SizeOfImage)
+{
+    PeSharedImage_t* SharedImage = PeAcquireSharedImage(FullPath, TimeStamp, SizeOfImage);
+    if (SharedImage == NULL) {
+        return NULL;
+    }
+
+    if (SharedImage->VirtualAddress < Parent->NextLoadingAddress &&
+        (SharedImage->VirtualAddress + SharedImage->ImageSize) > Parent->VirtualAddress) {
+        dswarning("%s: shared address 0x%" PRIxIN " is in use, relocating",
+            MStringRaw(FullPath), SharedImage->VirtualAddress);
+        PeReleaseSharedImage(SharedImage);
+        return NULL;
+    }
+    return SharedImage;
+}
+
 static OsStatus_t
 ResolvePeImagePath(
     _In_  UUId_t           Owner,
@@ -691,7 +901,11 @@ ResolvePeImagePath(
 
     *BufferOut   = Buffer;
     *FullPathOut = FullPath;
-    return PeValidateImageBuffer(Buffer, Length);
+    Status       = PeValidateImageBuffer(Buffer, Length);
+    if (Status != OsSuccess) {
+        UnloadFile(FullPath, Buffer);
+    }
+    return Status;
 }
 
 OsStatus_t
@@ -710,6 +924,7 @@ PeLoadImage(
     MString_t*         FullPath = NULL;
     uintptr_t          SectionAddress;
     uintptr_t          ImageBase;
+    size_t             SizeOfImage;
     size_t             SizeOfMetaData;
     PeDataDirectory_t* DirectoryPtr;
     PeExecutable_t*    Image;
@@ -735,7 +950,7 @@ PeLoadImage(
         dserror("The image as built for machine type 0x%x, "
                 "which is not the current machine type.", 
                 BaseHeader->Machine);
-        return OsError;
+        goto Error;
     }
 
     // Validate the current architecture,
@@ -744,7 +959,7 @@ PeLoadImage(
         dserror("The image was built for architecture 0x%x, "
                 "and was not supported by the current architecture.", 
                 OptHeader->Architecture);
-        return OsError;
+        goto Error;
     }
 
     // We need to re-cast based on architecture 
@@ -753,6 +968,7 @@ PeLoadImage(
         OptHeader32     = (PeOptionalHeader32_t*)(Buffer 
             + DosHeader->PeHeaderAddress + sizeof(PeHeader_t));
         ImageBase       = OptHeader32->BaseAddress;
+        SizeOfImage     = OptHeader32->SizeOfImage;
         SizeOfMetaData  = OptHeader32->SizeOfHeaders;
         SectionAddress  = (uintptr_t)(Buffer + DosHeader->PeHeaderAddress 
             + sizeof(PeHeader_t) + sizeof(PeOptionalHeader32_t));
@@ -762,6 +978,7 @@ PeLoadImage(
         OptHeader64     = (PeOptionalHeader64_t*)(Buffer 
             + DosHeader->PeHeaderAddress + sizeof(PeHeader_t));
         ImageBase       = (uintptr_t)OptHeader64->BaseAddress;
+        SizeOfImage     = OptHeader64->SizeOfImage;
         SizeOfMetaData  = OptHeader64->SizeOfHeaders;
         SectionAddress  = (uintptr_t)(Buffer + DosHeader->PeHeaderAddress 
             + sizeof(PeHeader_t) + sizeof(PeOptionalHeader64_t));
@@ -769,11 +986,13 @@ PeLoadImage(
     }
     else {
         dserror("Unsupported architecture %u", OptHeader->Architecture);
-        return OsError;
+        goto Error;
     }
 
     Image = (PeExecutable_t*)dsalloc(sizeof(PeExecutable_t));
     if (!Image) {
+        UnloadFile(FullPath, (void*)Buffer);
+        MStringDestroy(FullPath);
         return OsOutOfMemory;
     }
     
@@ -784,10 +1003,16 @@ PeLoadImage(
     Image->FullPath          = FullPath;
     Image->Architecture      = OptHeader->Architecture;
     Image->VirtualAddress    = (Parent == NULL) ? GetBaseAddress() : Parent->NextLoadingAddress;
+    Image->ImageSize         = SizeOfImage;
+    Image->SharedImage       = (Parent == NULL) ? NULL : PeGetSharedImage(Parent, FullPath,
+        BaseHeader->DateTimeStamp, SizeOfImage);
     Image->Libraries         = dsalloc(sizeof(list_t));
     Image->References        = 1;
     Image->OriginalImageBase = ImageBase;
     list_construct(Image->Libraries);
+    if (Image->SharedImage != NULL) {
+        Image->VirtualAddress = Image->SharedImage->VirtualAddress;
+    }
     dstrace("library (%s) => 0x%x", MStringRaw(Image->Name), Image->VirtualAddress);
 
     // Set the entry point if there is any
@@ -799,6 +1024,7 @@ PeLoadImage(
         Status = CreateImageSpace(&Image->MemorySpace);
         if (Status != OsSuccess) {
             dserror("Failed to create pe's memory space");
+            UnloadFile(FullPath, (void*)Buffer);
             MStringDestroy(Image->Name);
             MStringDestroy(Image->FullPath);
             dsfree(Image->Libraries);
@@ -820,6 +1046,11 @@ PeLoadImage(
     }
     *ImageOut = Image;
     return OsSuccess;
+
+Error:
+    UnloadFile(FullPath, (void*)Buffer);
+    MStringDestroy(FullPath);
+    return OsError;
 }
 
 OsStatus_t
@@ -833,6 +1064,15 @@ PeUnloadImage(
         if (Image->ExportedFunctions != NULL) {
             dsfree(Image->ExportedFunctions);
         }
+        if (Image->ExportedFunctionNames != NULL) {
+            dsfree(Image->ExportedFunctionNames);
+        }
+        if (Image->ExportedFunctionsIndex.capacity) {
+            hashtable_destroy(&Image->ExportedFunctionsIndex);
+        }
+        if (Image->SharedImage != NULL) {
+            PeReleaseSharedImage(Image->SharedImage);
+        }
         if (Image->Libraries != NULL) {
             _foreach(Element, Image->Libraries) {
                 PeUnloadImage(Element->value);
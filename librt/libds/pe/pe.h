@@ -26,6 +26,7 @@
 
 #include <os/osdefs.h>
 #include <os/types/process.h>
+#include <ds/hashtable.h>
 #include <ds/list.h>
 #include <os/pe.h>
 #include <time.h>
@@ -33,6 +34,7 @@
 DECL_STRUCT(MString);
 typedef void* MemorySpaceHandle_t;
 typedef void* MemoryMapHandle_t;
+typedef void* ImageRegionHandle_t;
 
 #if defined(i386) || defined(__i386__)
 #define PE_CURRENT_MACHINE                  PE_MACHINE_X32
@@ -51,6 +53,30 @@ typedef struct PeExportedFunction {
     uintptr_t   Address;
 } PeExportedFunction_t;
 
+typedef struct PeSharedSection {
+    ImageRegionHandle_t Region; // NULL if the section is private to each process
+    void*               Buffer;
+    size_t              Length;
+} PeSharedSection_t;
+
+/* PeSharedImage
+ * The relocated contents of a library that has been loaded once, so it can be loaded at
+ * the same address in other processes without relocating it again. Sections that are
+ * never written after relocation are mapped into the processes directly. Images that
+ * are no longer referenced stay cached until they are evicted. */
+typedef struct PeSharedImage {
+    element_t          Header;
+    MString_t*         FullPath;
+    uint32_t           TimeStamp;
+    size_t             ImageSize;
+    uintptr_t          VirtualAddress;
+    int                References;
+    int                Stale;
+    unsigned int       LastUse;
+    int                SectionCount;
+    PeSharedSection_t* Sections;
+} PeSharedImage_t;
+
 typedef struct PeExecutable {
     UUId_t                Owner;
     MString_t*            Name;
@@ -62,6 +88,7 @@ typedef struct PeExecutable {
     uint32_t              Architecture;
 
     uintptr_t             VirtualAddress;
+    size_t                ImageSize;
     uintptr_t             EntryAddress;
     uintptr_t             OriginalImageBase;
     uintptr_t             CodeBase;
@@ -71,7 +98,9 @@ typedef struct PeExecutable {
     int                   NumberOfExportedFunctions;
     PeExportedFunction_t* ExportedFunctions;
     char*                 ExportedFunctionNames;
+    hashtable_t           ExportedFunctionsIndex;
     list_t*               Libraries;
+    PeSharedImage_t*      SharedImage;
 } PeExecutable_t;
 
 /*******************************************************************************
@@ -86,6 +115,9 @@ __EXTERN void       UnloadFile(MString_t*, void*);
 __EXTERN OsStatus_t CreateImageSpace(MemorySpaceHandle_t*);
 __EXTERN OsStatus_t AcquireImageMapping(MemorySpaceHandle_t, uintptr_t*, size_t, unsigned int, MemoryMapHandle_t*);
 __EXTERN void       ReleaseImageMapping(MemoryMapHandle_t);
+__EXTERN OsStatus_t CreateImageRegion(size_t, void**, ImageRegionHandle_t*);
+__EXTERN OsStatus_t MapImageRegion(MemorySpaceHandle_t, ImageRegionHandle_t, uintptr_t, size_t, unsigned int);
+__EXTERN void       DestroyImageRegion(ImageRegionHandle_t);
 
 /*******************************************************************************
  * Public API 
@@ -141,6 +173,44 @@ PeResolveFunction(
     _In_ PeExecutable_t* Library, 
     _In_ const char*     Function);
 
+/* PeGetExportedFunctionByName
+ * Looks up an exported function by name in the export index of the library. If the
+ * index could not be built, the exports are binary searched instead, as the PE name
+ * table is sorted. Returns NULL if the library does not export the function. */
+__EXTERN PeExportedFunction_t*
+PeGetExportedFunctionByName(
+    _In_ PeExecutable_t* Library,
+    _In_ const char*     Name);
+
+/* PeAcquireSharedImage
+ * Acquires the shared image of a library, or reserves an address for a new one if the
+ * library has not been loaded before or has changed since. Returns NULL if the library
+ * can not be shared. The sections of a new shared image must be captured before it is used. */
+__EXTERN PeSharedImage_t*
+PeAcquireSharedImage(
+    _In_ MString_t* FullPath,
+    _In_ uint32_t   TimeStamp,
+    _In_ size_t     ImageSize);
+
+/* PeReleaseSharedImage
+ * Releases a reference to the shared image. Images that have been replaced are destroyed
+ * once they are no longer in use. */
+__EXTERN void
+PeReleaseSharedImage(
+    _In_ PeSharedImage_t* SharedImage);
+
+/* PeCaptureSharedImage
+ * Stores the relocated contents of the sections of a library that has just been loaded
+ * at the address of the shared image. Sections marked as shareable are placed in memory
+ * regions that later loads map directly. */
+__EXTERN OsStatus_t
+PeCaptureSharedImage(
+    _In_ PeSharedImage_t* SharedImage,
+    _In_ int              SectionCount,
+    _In_ void**           SectionData,
+    _In_ size_t*          SectionLengths,
+    _In_ int*             Shareable);
+
 /* PeGetModuleHandles
  * Retrieves a list of loaded module handles currently loaded for the process. */
 __EXTERN OsStatus_t
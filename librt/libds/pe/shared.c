@@ -0,0 +1,322 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PE/COFF Image Loader
+ *    - Shared images. Every library is given an address in a part of the code space
+ *      that is reserved for libraries, and is loaded at that address in all processes.
+ *      The relocated sections are kept, so later loads only copy the writable sections
+ *      and map the others directly. Unused images stay cached until they are evicted.
+ */
+
+//#define __TRACE
+
+#include <ds/ds.h>
+#include <ds/list.h>
+#include <ds/mstring.h>
+#include <os/mollenos.h>
+#include <string.h>
+#include "pe.h"
+
+#ifndef __TRACE
+#undef dstrace
+#define dstrace(...)
+#endif
+
+// Libraries are placed in the upper half of the code space, the executable and libraries
+// that can not be shared are placed from the start of the code space
+#define PE_SHARED_IMAGE_OFFSET 0x8000000
+#define PE_SHARED_IMAGE_LENGTH 0x8000000
+
+// Libraries may be loaded by several threads at once, the lock protects the list of
+// shared images, their references and sections, and the address allocator
+#ifdef __LIBDS_KERNEL__
+#define SHARED_LOCK()
+#define SHARED_UNLOCK()
+#else
+#include <threads.h>
+static mtx_t SharedLock = MUTEX_INIT(mtx_plain);
+#define SHARED_LOCK()   mtx_lock(&SharedLock)
+#define SHARED_UNLOCK() mtx_unlock(&SharedLock)
+#endif
+
+// Images that are not used by any process keep their address and sections, so loading
+// them again is as cheap as the first time they were shared. The least recently used
+// are destroyed when too many are cached, or when their addresses are needed.
+#define PE_SHARED_CACHE_MAX 32
+
+static list_t       SharedImages = LIST_INIT;
+static int          SharedCached = 0;
+static unsigned int SharedClock  = 0;
+
+static void
+PeDestroySharedSections(
+    _In_ PeSharedSection_t* Sections,
+    _In_ int                SectionCount)
+{
+    int i;
+
+    for (i = 0; i < SectionCount; i++) {
+        if (Sections[i].Region != NULL) {
+            DestroyImageRegion(Sections[i].Region);
+        }
+        else if (Sections[i].Buffer != NULL) {
+            dsfree(Sections[i].Buffer);
+        }
+    }
+    dsfree(Sections);
+}
+
+static void
+PeDestroySharedImage(
+    _In_ PeSharedImage_t* SharedImage)
+{
+    dstrace("PeDestroySharedImage(%s)", MStringRaw(SharedImage->FullPath));
+    if (SharedImage->Sections != NULL) {
+        PeDestroySharedSections(SharedImage->Sections, SharedImage->SectionCount);
+    }
+    MStringDestroy(SharedImage->FullPath);
+    dsfree(SharedImage);
+}
+
+static void
+PeRemoveSharedImage(
+    _In_ PeSharedImage_t* SharedImage)
+{
+    list_remove(&SharedImages, &SharedImage->Header);
+    PeDestroySharedImage(SharedImage);
+}
+
+/* PeEvictSharedImage
+ * Destroys the least recently used image that is not used by any process. Returns 0 if
+ * there was no image to evict. */
+static int
+PeEvictSharedImage(void)
+{
+    PeSharedImage_t* Victim = NULL;
+
+    foreach(i, &SharedImages) {
+        PeSharedImage_t* SharedImage = (PeSharedImage_t*)i->value;
+        if (!SharedImage->References && (!Victim || SharedImage->LastUse < Victim->LastUse)) {
+            Victim = SharedImage;
+        }
+    }
+
+    if (!Victim) {
+        return 0;
+    }
+    SharedCached--;
+    PeRemoveSharedImage(Victim);
+    return 1;
+}
+
+/* PeReserveSharedAddress
+ * Finds the first range that is not used by an image in the list. Replaced images stay
+ * in the list until the last process using them releases them, so their addresses are
+ * not reused while they are mapped. */
+static OsStatus_t
+PeReserveSharedAddress(
+    _In_  size_t     ImageSize,
+    _Out_ uintptr_t* AddressOut)
+{
+    uintptr_t Start = GetBaseAddress() + PE_SHARED_IMAGE_OFFSET;
+    uintptr_t End   = Start + PE_SHARED_IMAGE_LENGTH;
+    uintptr_t Address;
+    int       Overlaps;
+
+    do {
+        Address = Start;
+        do {
+            Overlaps = 0;
+            foreach(i, &SharedImages) {
+                PeSharedImage_t* SharedImage = (PeSharedImage_t*)i->value;
+                if (Address < (SharedImage->VirtualAddress + SharedImage->ImageSize) &&
+                    SharedImage->VirtualAddress < (Address + ImageSize)) {
+                    Address  = SharedImage->VirtualAddress + SharedImage->ImageSize;
+                    Overlaps = 1;
+                }
+            }
+        } while (Overlaps && (Address + ImageSize) <= End);
+
+        if ((Address + ImageSize) <= End) {
+            *AddressOut = Address;
+            return OsSuccess;
+        }
+    } while (PeEvictSharedImage());
+    return OsOutOfMemory;
+}
+
+PeSharedImage_t*
+PeAcquireSharedImage(
+    _In_ MString_t* FullPath,
+    _In_ uint32_t   TimeStamp,
+    _In_ size_t     ImageSize)
+{
+    PeSharedImage_t* SharedImage;
+    size_t           PageSize = GetPageSize();
+
+    dstrace("PeAcquireSharedImage(%s)", MStringRaw(FullPath));
+#ifdef __LIBDS_KERNEL__
+    // The kernel loads all images into the same memory space
+    return NULL;
+#endif
+    ImageSize = (ImageSize + (PageSize - 1)) & ~(PageSize - 1);
+
+    SHARED_LOCK();
+    foreach(i, &SharedImages) {
+        SharedImage = (PeSharedImage_t*)i->value;
+        if (SharedImage->Stale ||
+            MStringCompare(SharedImage->FullPath, FullPath, 0) != MSTRING_FULL_MATCH) {
+            continue;
+        }
+
+        if (SharedImage->TimeStamp == TimeStamp && SharedImage->ImageSize == ImageSize) {
+            if (!SharedImage->References) {
+                SharedCached--;
+            }
+            SharedImage->References++;
+            SHARED_UNLOCK();
+            return SharedImage;
+        }
+
+        // The library has been replaced since it was shared, the old image keeps its
+        // address until it is no longer used
+        if (SharedImage->References) {
+            SharedImage->Stale = 1;
+        }
+        else {
+            SharedCached--;
+            PeRemoveSharedImage(SharedImage);
+        }
+        break;
+    }
+
+    SharedImage = (PeSharedImage_t*)dsalloc(sizeof(PeSharedImage_t));
+    if (!SharedImage) {
+        SHARED_UNLOCK();
+        return NULL;
+    }
+    memset(SharedImage, 0, sizeof(PeSharedImage_t));
+
+    if (PeReserveSharedAddress(ImageSize, &SharedImage->VirtualAddress) != OsSuccess) {
+        SHARED_UNLOCK();
+        dsfree(SharedImage);
+        return NULL;
+    }
+
+    ELEMENT_INIT(&SharedImage->Header, 0, SharedImage);
+    SharedImage->FullPath   = MStringClone(FullPath);
+    SharedImage->TimeStamp  = TimeStamp;
+    SharedImage->ImageSize  = ImageSize;
+    SharedImage->References = 1;
+    list_append(&SharedImages, &SharedImage->Header);
+    SHARED_UNLOCK();
+    return SharedImage;
+}
+
+void
+PeReleaseSharedImage(
+    _In_ PeSharedImage_t* SharedImage)
+{
+    SHARED_LOCK();
+    SharedImage->References--;
+    if (!SharedImage->References) {
+        if (SharedImage->Stale) {
+            PeRemoveSharedImage(SharedImage);
+        }
+        else {
+            SharedImage->LastUse = ++SharedClock;
+            if (++SharedCached > PE_SHARED_CACHE_MAX) {
+                PeEvictSharedImage();
+            }
+        }
+    }
+    SHARED_UNLOCK();
+}
+
+OsStatus_t
+PeCaptureSharedImage(
+    _In_ PeSharedImage_t* SharedImage,
+    _In_ int              SectionCount,
+    _In_ void**           SectionData,
+    _In_ size_t*          SectionLengths,
+    _In_ int*             Shareable)
+{
+    PeSharedSection_t* Sections;
+    size_t             PageSize = GetPageSize();
+    OsStatus_t         Status   = OsSuccess;
+    int                i;
+
+    dstrace("PeCaptureSharedImage(%s, %i)", MStringRaw(SharedImage->FullPath), SectionCount);
+    Sections = (PeSharedSection_t*)dsalloc(sizeof(PeSharedSection_t) * SectionCount);
+    if (!Sections) {
+        return OsOutOfMemory;
+    }
+    memset(Sections, 0, sizeof(PeSharedSection_t) * SectionCount);
+
+    for (i = 0; i < SectionCount; i++) {
+        if (Shareable[i]) {
+            Sections[i].Length = (SectionLengths[i] + (PageSize - 1)) & ~(PageSize - 1);
+            Status = CreateImageRegion(Sections[i].Length, &Sections[i].Buffer, &Sections[i].Region);
+        }
+        else {
+            Sections[i].Length = SectionLengths[i];
+            Sections[i].Buffer = dsalloc(SectionLengths[i]);
+            Status             = (Sections[i].Buffer != NULL) ? OsSuccess : OsOutOfMemory;
+        }
+
+        if (Status != OsSuccess) {
+            break;
+        }
+        memcpy(Sections[i].Buffer, SectionData[i], SectionLengths[i]);
+
+#ifndef __LIBDS_KERNEL__
+        // Shared sections are mapped read-only into the processes, and the loader must
+        // not write them either once they are captured, as that would change them in
+        // every process
+        if (Sections[i].Region != NULL) {
+            unsigned int PreviousFlags;
+            Status = MemoryProtect(Sections[i].Buffer, Sections[i].Length, MEMORY_READ, &PreviousFlags);
+            if (Status != OsSuccess) {
+                break;
+            }
+        }
+#endif
+    }
+
+    if (Status != OsSuccess) {
+        dserror("%s: failed to capture section %i: %u", MStringRaw(SharedImage->FullPath), i, Status);
+        PeDestroySharedSections(Sections, i + 1);
+        return Status;
+    }
+
+    // Another process may have finished loading the library first, its sections are
+    // kept and ours are discarded
+    SHARED_LOCK();
+    if (SharedImage->Sections == NULL) {
+        SharedImage->SectionCount = SectionCount;
+        SharedImage->Sections     = Sections;
+        Sections                  = NULL;
+    }
+    SHARED_UNLOCK();
+
+    if (Sections != NULL) {
+        PeDestroySharedSections(Sections, SectionCount);
+    }
+    return OsSuccess;
+}
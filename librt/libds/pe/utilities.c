@@ -83,12 +83,11 @@ PeResolveFunction(
     _In_ PeExecutable_t* Library, 
     _In_ const char*    Function)
 {
-    PeExportedFunction_t* Exports = Library->ExportedFunctions;
-    if (Exports != NULL) {
-        for (int i = 0; i < Library->NumberOfExportedFunctions; i++) {
-            if (Exports[i].Name != NULL && !strcmp(Exports[i].Name, Function)) {
-                return Exports[i].Address;
-            }
+    PeExportedFunction_t* Export;
+    if (Library->ExportedFunctions != NULL) {
+        Export = PeGetExportedFunctionByName(Library, Function);
+        if (Export != NULL) {
+            return Export->Address;
         }
     }
     return 0;
@@ -618,6 +618,129 @@ streambuffer_read_packet_end(
     }
 }
 
+/* streambuffer_copy_ring
+ * Copies data directly between two rings in as few contiguous chunks as the
+ * wrap-around of each ring allows. Returns the indices after the copy. */
+static void
+streambuffer_copy_ring(
+    _In_    streambuffer_t* target,
+    _InOut_ unsigned int*   target_index,
+    _In_    streambuffer_t* source,
+    _InOut_ unsigned int*   source_index,
+    _In_    size_t          length)
+{
+    size_t write_index = (*target_index % target->capacity);
+    size_t read_index  = (*source_index % source->capacity);
+    
+    while (length) {
+        size_t chunk = MIN(length, MIN(target->capacity - write_index, source->capacity - read_index));
+        memcpy(&target->buffer[write_index], &source->buffer[read_index], chunk);
+        
+        write_index += chunk;
+        read_index  += chunk;
+        length      -= chunk;
+        if (write_index == target->capacity) {
+            write_index = 0;
+        }
+        if (read_index == source->capacity) {
+            read_index = 0;
+        }
+    }
+    
+    *target_index = (unsigned int)write_index;
+    *source_index = (unsigned int)read_index;
+}
+
+size_t
+streambuffer_splice(
+    _In_ streambuffer_t* target,
+    _In_ streambuffer_t* source,
+    _In_ size_t          length,
+    _In_ unsigned int    options)
+{
+    size_t            bytes_spliced = 0;
+    unsigned int      write_state;
+    unsigned int      read_state;
+    FutexParameters_t parameters;
+    dstrace("[streambuffer_splice] 0x%" PRIxIN " => 0x%" PRIxIN ", length %" PRIuIN ", options 0x%x",
+        source, target, length, options);
+    
+    // Has any of the streambuffers been disabled?
+    if ((target->options & STREAMBUFFER_DISABLED) || (source->options & STREAMBUFFER_DISABLED)) {
+        return 0;
+    }
+    
+    // The splice never blocks, it moves as many bytes as is both readable in the source
+    // and writable in the target. The caller must be the only consumer of the source, as the
+    // bytes are consumed only once the space in the target has been allocated.
+    while (bytes_spliced < length) {
+        unsigned int source_write    = atomic_load(&source->producer_comitted_index);
+        unsigned int source_read     = atomic_load(&source->consumer_index);
+        unsigned int target_write    = atomic_load(&target->producer_index);
+        unsigned int target_read     = atomic_load(&target->consumer_comitted_index);
+        size_t       bytes_available = MIN(
+            MIN(bytes_readable(source->capacity, source_read, source_write),
+                bytes_writable(target->capacity, target_read, target_write)),
+            length - bytes_spliced);
+        size_t       bytes_comitted  = bytes_available;
+        if (!bytes_available) {
+            break;
+        }
+        
+        if (!bytes_spliced && !STREAMBUFFER_CAN_WRITE(options, bytes_available, length)) {
+            break;
+        }
+        
+        // Perform the allocation in the target
+        if (!atomic_compare_exchange_strong(&target->producer_index,
+                &target_write, target_write + bytes_available)) {
+            continue;
+        }
+        atomic_store(&source->consumer_index, source_read + bytes_available);
+        
+        write_state = target_write;
+        read_state  = source_read;
+        streambuffer_copy_ring(target, &write_state, source, &read_state, bytes_available);
+        
+        // Synchronize with other producers of the target before comitting
+        if (STREAMBUFFER_HAS_MULTIPLE_WRITERS(target)) {
+            unsigned int current_commit = atomic_load(&target->producer_comitted_index);
+            while (current_commit < target_write) {
+                current_commit = atomic_load(&target->producer_comitted_index);
+            }
+        }
+        
+        atomic_fetch_add(&target->producer_comitted_index, bytes_comitted);
+        parameters._val0 = atomic_exchange(&target->consumer_count, 0);
+        if (parameters._val0 != 0) {
+            parameters._futex0 = (atomic_int*)&target->producer_comitted_index;
+            parameters._flags  = STREAMBUFFER_WAKE_FLAGS(target);
+            dswake(&parameters);
+        }
+        
+        atomic_fetch_add(&source->consumer_comitted_index, bytes_comitted);
+        parameters._val0 = atomic_exchange(&source->producer_count, 0);
+        if (parameters._val0 != 0) {
+            parameters._futex0 = (atomic_int*)&source->consumer_comitted_index;
+            parameters._flags  = STREAMBUFFER_WAKE_FLAGS(source);
+            dswake(&parameters);
+        }
+        bytes_spliced += bytes_comitted;
+    }
+    return bytes_spliced;
+}
+
+void
+streambuffer_splice_packet_data(
+    _In_    streambuffer_t* target,
+    _InOut_ unsigned int*   target_state,
+    _In_    streambuffer_t* source,
+    _InOut_ unsigned int*   source_state,
+    _In_    size_t          length)
+{
+    streambuffer_copy_ring(target, target_state, source, source_state, length);
+}
+
 #if 0
 int main()
 {
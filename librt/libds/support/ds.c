@@ -43,6 +43,7 @@ extern OsStatus_t ScFutexWake(FutexParameters_t*);
 #include <internal/_syscalls.h>
 #include <ddk/memory.h>
 #include <ddk/utils.h>
+#include <os/dmabuf.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -366,3 +367,69 @@ void ReleaseImageMapping(MemoryMapHandle_t Handle)
 #endif
     dsfree(StateObject);
 }
+
+// Image regions hold section contents that are shared between processes. In kernel mode all
+// images are loaded into the same memory space, so there is nothing to share.
+OsStatus_t CreateImageRegion(size_t Length, void** BufferOut, ImageRegionHandle_t* HandleOut)
+{
+#ifdef LIBC_KERNEL
+    _CRT_UNUSED(Length);
+    _CRT_UNUSED(BufferOut);
+    _CRT_UNUSED(HandleOut);
+    return OsNotSupported;
+#else
+    struct dma_buffer_info Info;
+    struct dma_attachment* Attachment = (struct dma_attachment*)dsalloc(sizeof(struct dma_attachment));
+    OsStatus_t             Status;
+
+    if (!Attachment) {
+        return OsOutOfMemory;
+    }
+
+    Info.name     = "pe_shared_section";
+    Info.length   = Length;
+    Info.capacity = Length;
+    Info.flags    = DMA_CLEAN;
+
+    Status = dma_create(&Info, Attachment);
+    if (Status != OsSuccess) {
+        dsfree(Attachment);
+        return Status;
+    }
+
+    *BufferOut = Attachment->buffer;
+    *HandleOut = (ImageRegionHandle_t)Attachment;
+    return OsSuccess;
+#endif
+}
+
+OsStatus_t MapImageRegion(MemorySpaceHandle_t Handle, ImageRegionHandle_t Region, uintptr_t Address, size_t Length, unsigned int Flags)
+{
+#ifdef LIBC_KERNEL
+    _CRT_UNUSED(Handle);
+    _CRT_UNUSED(Region);
+    _CRT_UNUSED(Address);
+    _CRT_UNUSED(Length);
+    _CRT_UNUSED(Flags);
+    return OsNotSupported;
+#else
+    struct dma_attachment*         Attachment = (struct dma_attachment*)Region;
+    struct MemoryMappingParameters Parameters;
+    Parameters.VirtualAddress = Address;
+    Parameters.Length         = Length;
+    Parameters.Flags          = Flags;
+    return CreateMemoryRegionMapping((UUId_t)(uintptr_t)Handle, &Parameters, Attachment->handle, 0);
+#endif
+}
+
+void DestroyImageRegion(ImageRegionHandle_t Region)
+{
+#ifdef LIBC_KERNEL
+    _CRT_UNUSED(Region);
+#else
+    struct dma_attachment* Attachment = (struct dma_attachment*)Region;
+    dma_attachment_unmap(Attachment);
+    dma_detach(Attachment);
+    dsfree(Attachment);
+#endif
+}
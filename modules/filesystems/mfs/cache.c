@@ -0,0 +1,278 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2017, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * General File System (MFS) Driver
+ *  - Contains the implementation of the MFS driver for mollenos
+ *  - Entry data cache, provides read-ahead and write coalescing. The cache
+ *    holds a single run of consecutive disk sectors and is shared between
+ *    all handles of an entry, so handles always observe the same data.
+ */
+//#define __TRACE
+
+#include <ddk/utils.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mfs.h"
+
+static OsStatus_t
+MfsCacheEnsure(
+    _In_ FileSystemDescriptor_t* FileSystem,
+    _In_ MfsEntry_t*             Entry)
+{
+    struct dma_buffer_info DmaInfo;
+
+    if (Entry->Cache.buffer != NULL) {
+        return OsSuccess;
+    }
+
+    DmaInfo.name     = "mfs_entry_cache";
+    DmaInfo.length   = MfsCacheCapacity(FileSystem) * FileSystem->Disk.Descriptor.SectorSize;
+    DmaInfo.capacity = DmaInfo.length;
+    DmaInfo.flags    = 0;
+    return dma_create(&DmaInfo, &Entry->Cache);
+}
+
+size_t
+MfsCacheCapacity(
+    _In_ FileSystemDescriptor_t* FileSystem)
+{
+    MfsInstance_t* Mfs = (MfsInstance_t*)FileSystem->ExtensionData;
+    return Mfs->SectorsPerBucket * MFS_CACHE_BUCKETS;
+}
+
+OsStatus_t
+MfsCacheFlush(
+    _In_ FileSystemDescriptor_t* FileSystem,
+    _In_ MfsEntry_t*             Entry)
+{
+    size_t SectorsWritten;
+
+    if (!Entry->CacheDirty || !Entry->CacheSectors) {
+        return OsSuccess;
+    }
+
+    TRACE("[mfs] [cache_flush] sector %u, count %u", LODWORD(Entry->CacheSector), Entry->CacheSectors);
+    if (MfsWriteSectors(FileSystem, Entry->Cache.handle, 0, Entry->CacheSector,
+            Entry->CacheSectors, &SectorsWritten) != OsSuccess || SectorsWritten != Entry->CacheSectors) {
+        ERROR("[mfs] [cache_flush] failed to write sector %u", LODWORD(Entry->CacheSector));
+        return OsDeviceError;
+    }
+    Entry->CacheDirty = 0;
+    return OsSuccess;
+}
+
+OsStatus_t
+MfsCacheInvalidate(
+    _In_ FileSystemDescriptor_t* FileSystem,
+    _In_ MfsEntry_t*             Entry,
+    _In_ uint64_t                Sector,
+    _In_ size_t                  Count)
+{
+    OsStatus_t Status = OsSuccess;
+
+    // Only drop the cache if the range actually overlaps the cached sectors, but
+    // make sure that dirty data reaches the disk before we do so.
+    if (Entry->CacheSectors != 0 && Sector < (Entry->CacheSector + Entry->CacheSectors) &&
+        (Sector + Count) > Entry->CacheSector) {
+        Status = MfsCacheFlush(FileSystem, Entry);
+        if (Status == OsSuccess) {
+            Entry->CacheSectors = 0;
+        }
+    }
+    return Status;
+}
+
+void
+MfsCacheDestroy(
+    _In_ MfsEntry_t* Entry)
+{
+    if (Entry->Cache.buffer != NULL) {
+        dma_attachment_unmap(&Entry->Cache);
+        dma_detach(&Entry->Cache);
+        Entry->Cache.buffer = NULL;
+    }
+    Entry->CacheSectors = 0;
+    Entry->CacheDirty   = 0;
+}
+
+OsStatus_t
+MfsCacheRead(
+    _In_  FileSystemDescriptor_t* FileSystem,
+    _In_  MfsEntryHandle_t*       Handle,
+    _In_  uint64_t                Sector,
+    _In_  size_t                  SectorOffset,
+    _In_  size_t                  SectorsLeft,
+    _In_  int                     Sequential,
+    _In_  void*                   Buffer,
+    _In_  size_t                  Length,
+    _Out_ size_t*                 BytesRead)
+{
+    MfsInstance_t* Mfs        = (MfsInstance_t*)FileSystem->ExtensionData;
+    MfsEntry_t*    Entry      = (MfsEntry_t*)Handle->Base.Entry;
+    size_t         SectorSize = FileSystem->Disk.Descriptor.SectorSize;
+    size_t         Capacity   = MfsCacheCapacity(FileSystem);
+    size_t         ByteCount;
+    OsStatus_t     Status;
+
+    *BytesRead = 0;
+    if (SectorsLeft == 0) {
+        return OsSuccess;
+    }
+
+    // On a miss we only fill the cache when the handle is being read sequentially, and
+    // the request is small enough that a read-ahead actually saves transfers. Otherwise
+    // the caller is better off reading directly into the user buffer.
+    if (Entry->CacheSectors == 0 || Sector < Entry->CacheSector ||
+        Sector >= (Entry->CacheSector + Entry->CacheSectors)) {
+        size_t SectorCount;
+        size_t SectorsRead;
+
+        if (!Sequential) {
+            return OsSuccess;
+        }
+
+        // Grow the window for every fill while access stays sequential, bounded by the
+        // capacity of the cache and the length of the bucket run we are reading from.
+        Handle->ReadAheadSectors = MIN(Capacity, Handle->ReadAheadSectors == 0 ?
+            Mfs->SectorsPerBucket : Handle->ReadAheadSectors * 2);
+        SectorCount = MIN(Handle->ReadAheadSectors, SectorsLeft);
+        if ((SectorOffset + Length) >= (SectorCount * SectorSize)) {
+            return OsSuccess;
+        }
+
+        Status = MfsCacheEnsure(FileSystem, Entry);
+        if (Status != OsSuccess) {
+            return Status;
+        }
+
+        Status = MfsCacheFlush(FileSystem, Entry);
+        if (Status != OsSuccess) {
+            return Status;
+        }
+
+        TRACE("[mfs] [cache_read] read-ahead sector %u, count %u", LODWORD(Sector), SectorCount);
+        Entry->CacheSectors = 0;
+        if (MfsReadSectors(FileSystem, Entry->Cache.handle, 0, Sector,
+                SectorCount, &SectorsRead) != OsSuccess || SectorsRead == 0) {
+            ERROR("[mfs] [cache_read] failed to read sector %u", LODWORD(Sector));
+            return OsDeviceError;
+        }
+        Entry->CacheSector  = Sector;
+        Entry->CacheSectors = SectorsRead;
+    }
+
+    // Runs built by writes can continue into a bucket that follows on disk, but the caller
+    // has to switch buckets itself, so never copy past the bucket it is reading from.
+    ByteCount = (size_t)(Entry->CacheSector + Entry->CacheSectors - Sector);
+    ByteCount = (MIN(ByteCount, SectorsLeft) * SectorSize) - SectorOffset;
+    ByteCount = MIN(ByteCount, Length);
+    memcpy(Buffer, (uint8_t*)Entry->Cache.buffer +
+        ((size_t)(Sector - Entry->CacheSector) * SectorSize) + SectorOffset, ByteCount);
+    *BytesRead = ByteCount;
+    return OsSuccess;
+}
+
+OsStatus_t
+MfsCacheWrite(
+    _In_  FileSystemDescriptor_t* FileSystem,
+    _In_  MfsEntryHandle_t*       Handle,
+    _In_  uint64_t                Sector,
+    _In_  size_t                  SectorOffset,
+    _In_  size_t                  SectorsLeft,
+    _In_  uint64_t                Position,
+    _In_  void*                   Buffer,
+    _In_  size_t                  Length,
+    _Out_ size_t*                 BytesWritten)
+{
+    MfsEntry_t* Entry      = (MfsEntry_t*)Handle->Base.Entry;
+    size_t      SectorSize = FileSystem->Disk.Descriptor.SectorSize;
+    size_t      Capacity   = MfsCacheCapacity(FileSystem);
+    uint64_t    SectorBase = Position - SectorOffset; // File position of <Sector>
+    size_t      SectorCount;
+    size_t      ByteCount;
+    size_t      i;
+    OsStatus_t  Status;
+
+    *BytesWritten = 0;
+    if (SectorsLeft == 0) {
+        return OsSuccess;
+    }
+
+    Status = MfsCacheEnsure(FileSystem, Entry);
+    if (Status != OsSuccess) {
+        return Status;
+    }
+
+    // The write can be appended to the current cache contents as long as it starts inside
+    // or directly after the cached run, and there is room left for it. Anything else means
+    // we write out what we have and start a new run at <Sector>.
+    if (Entry->CacheSectors == 0 || Sector < Entry->CacheSector ||
+        Sector > (Entry->CacheSector + Entry->CacheSectors) ||
+        Sector >= (Entry->CacheSector + Capacity)) {
+        Status = MfsCacheFlush(FileSystem, Entry);
+        if (Status != OsSuccess) {
+            return Status;
+        }
+        Entry->CacheSector  = Sector;
+        Entry->CacheSectors = 0;
+    }
+
+    SectorCount = DIVUP(SectorOffset + Length, SectorSize);
+    SectorCount = MIN(SectorCount, SectorsLeft);
+    SectorCount = MIN(SectorCount, (size_t)(Entry->CacheSector + Capacity - Sector));
+    ByteCount   = MIN(Length, (SectorCount * SectorSize) - SectorOffset);
+
+    // Sectors that are not already cached, and not entirely overwritten by this write
+    // must be loaded from disk first. Sectors beyond the end of file have no valid data.
+    for (i = 0; i < SectorCount; i++) {
+        uint64_t CurrentSector = Sector + i;
+        size_t   CacheOffset   = (size_t)(CurrentSector - Entry->CacheSector) * SectorSize;
+        size_t   SectorsRead;
+
+        if (CurrentSector < (Entry->CacheSector + Entry->CacheSectors)) {
+            continue;
+        }
+
+        if ((i * SectorSize) >= SectorOffset && ((i + 1) * SectorSize) <= (SectorOffset + ByteCount)) {
+            continue;
+        }
+
+        if ((SectorBase + (i * SectorSize)) >= Entry->Base.Descriptor.Size.QuadPart) {
+            memset((uint8_t*)Entry->Cache.buffer + CacheOffset, 0, SectorSize);
+        }
+        else if (MfsReadSectors(FileSystem, Entry->Cache.handle, CacheOffset,
+                CurrentSector, 1, &SectorsRead) != OsSuccess || SectorsRead != 1) {
+            ERROR("[mfs] [cache_write] failed to read sector %u", LODWORD(CurrentSector));
+            return OsDeviceError;
+        }
+    }
+
+    TRACE("[mfs] [cache_write] sector %u, offset %u, count %u", LODWORD(Sector), SectorOffset, ByteCount);
+    memcpy((uint8_t*)Entry->Cache.buffer + ((size_t)(Sector - Entry->CacheSector) * SectorSize) + SectorOffset,
+        Buffer, ByteCount);
+    Entry->CacheSectors = MAX(Entry->CacheSectors, (size_t)(Sector + SectorCount - Entry->CacheSector));
+    Entry->CacheDirty   = 1;
+    *BytesWritten       = ByteCount;
+
+    // Write out the run as soon as the cache is full, the data stays valid for reading
+    if (Entry->CacheSectors == Capacity) {
+        return MfsCacheFlush(FileSystem, Entry);
+    }
+    return OsSuccess;
+}
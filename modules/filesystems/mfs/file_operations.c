@@ -44,6 +44,7 @@ FsReadFromFile(
     uint64_t       Position        = Handle->Base.Position;
     size_t         BucketSizeBytes = Mfs->SectorsPerBucket * FileSystem->Disk.Descriptor.SectorSize;
     size_t         BytesToRead     = UnitCount;
+    int            Sequential      = Position == Handle->ReadAheadPosition;
 
     TRACE("[mfs] [read_file] id 0x%x, position %u, length %u",
         Handle->Base.Id, LODWORD(Handle->Base.Position), LODWORD(UnitCount));
@@ -51,6 +52,12 @@ FsReadFromFile(
     // Zero this first to indicate no bytes read
     *UnitsRead = 0;
 
+    // Random access resets the read-ahead window, so we don't fill the
+    // cache with data that is never going to be read
+    if (!Sequential) {
+        Handle->ReadAheadSectors = 0;
+    }
+
     // Sanitize the amount of bytes we want to read, cap it at bytes available
     if ((Position + BytesToRead) > Entry->Base.Descriptor.Size.QuadPart) {
         if (Position >= Entry->Base.Descriptor.Size.QuadPart) {
@@ -96,13 +103,32 @@ FsReadFromFile(
         // Calculate the sector index into bucket
         Sector += SectorIndex;
 
+        // CASE 0: READ FROM THE ENTRY CACHE
+        // The data might already be present from an earlier read-ahead or write, otherwise
+        // the cache is filled with a read-ahead window if the handle is read sequentially.
+        Result = MfsCacheRead(FileSystem, Handle, Sector, (size_t)SectorOffset, SectorsLeft,
+            Sequential, ((uint8_t*)Buffer + BufferOffset), BytesToRead, &ByteCount);
+        if (Result != OsSuccess) {
+            ERROR("Failed to read from entry cache");
+            Result = OsDeviceError;
+            break;
+        }
+
+        if (ByteCount != 0) {
+            SectorCount   = 0;
+            *UnitsRead   += ByteCount;
+            BufferOffset += ByteCount;
+            Position     += ByteCount;
+            BytesToRead  -= ByteCount;
+        }
+
         // CASE 1: DIRECT READING INTO USER BUFFER
         // <Sector> now contains where we should start reading, and SectorOffset is
         // the byte offset into that first sector. This means if we request any number of bytes
         // we should also have room for that. So to read directly into user provided buffer, we MUST
         // ensure that <SectorOffset> is 0 and that we can read atleast one entire sector to avoid
         // any form for discarding of data.
-        if (SectorOffset == 0 && BytesToRead >= FileSystem->Disk.Descriptor.SectorSize) {
+        else if (SectorOffset == 0 && BytesToRead >= FileSystem->Disk.Descriptor.SectorSize) {
             SectorCount    = BytesToRead / FileSystem->Disk.Descriptor.SectorSize;
             SelectedHandle = BufferHandle;
             SelectedOffset = BufferOffset;
@@ -146,6 +172,12 @@ FsReadFromFile(
             // SectorIndex = 0, SectorOffset = 490, SectorCount = 8 - ByteCount = 3606 (Capacity 4096)
             TRACE(" > sector %u (b-start %u, b-index %u), num-sectors %u, sector-byte-offset %u, bytecount %u",
                 LODWORD(Sector), LODWORD(Sector) - SectorIndex, SectorIndex, SectorCount, LODWORD(SectorOffset), ByteCount);
+
+            // Buffered writes must reach the disk before we read around the cache
+            if (MfsCacheFlush(FileSystem, Entry) != OsSuccess) {
+                Result = OsDeviceError;
+                break;
+            }
     
             if (MfsReadSectors(FileSystem, SelectedHandle, SelectedOffset, 
                     Sector, SectorCount, &SectorsRead) != OsSuccess) {
@@ -185,6 +217,8 @@ FsReadFromFile(
         }
     }
 
+    Handle->ReadAheadPosition = Position;
+
     // if (update_when_accessed) @todo
     // entry->accessed = now
     // entry->action_on_close = update
@@ -209,6 +243,7 @@ FsWriteToFile(
     uint64_t       Position        = Handle->Base.Position;
     size_t         BucketSizeBytes = Mfs->SectorsPerBucket * FileSystem->Disk.Descriptor.SectorSize;
     size_t         BytesToWrite    = UnitCount;
+    size_t         CacheBytes      = MfsCacheCapacity(FileSystem) * FileSystem->Disk.Descriptor.SectorSize;
 
     TRACE("FsWriteEntry(Id 0x%x, Position %u, Length %u)",
         Handle->Base.Id, LODWORD(Position), UnitCount);
@@ -248,12 +283,34 @@ FsWriteToFile(
 
         // Calculate the sector index into bucket
         Sector += SectorIndex;
+
+        // CASE 0: COALESCE SMALL WRITES IN THE ENTRY CACHE
+        // Writes smaller than the cache are gathered and written out as a single transfer
+        // once the cache is full, or when the entry is flushed or closed.
+        ByteCount = 0;
+        if (BytesToWrite < CacheBytes) {
+            Result = MfsCacheWrite(FileSystem, Handle, Sector, (size_t)SectorOffset, SectorsLeft,
+                Position, ((uint8_t*)Buffer + BufferOffset), BytesToWrite, &ByteCount);
+            if (Result != OsSuccess) {
+                ERROR("Failed to write to entry cache");
+                Result = OsDeviceError;
+                break;
+            }
+        }
+
+        if (ByteCount != 0) {
+            SectorCount    = 0;
+            *UnitsWritten += ByteCount;
+            BufferOffset  += ByteCount;
+            Position      += ByteCount;
+            BytesToWrite  -= ByteCount;
+        }
         
         // CASE 1: WE CAN WRITE DIRECTLY FROM USER-BUFFER TO DISK
         // If <SectorOffset> is 0, this means we can write directly to the disk
         // from <Buffer> + <BufferOffset>. We must also be able to write an entire
         // sector to avoid writing out of bounds from the buffer
-        if (SectorOffset == 0 && BytesToWrite >= FileSystem->Disk.Descriptor.SectorSize) {
+        else if (SectorOffset == 0 && BytesToWrite >= FileSystem->Disk.Descriptor.SectorSize) {
             SectorCount    = BytesToWrite / FileSystem->Disk.Descriptor.SectorSize;
             SelectedHandle = BufferHandle;
             SelectedOffset = BufferOffset;
@@ -281,6 +338,12 @@ FsWriteToFile(
             // SectorIndex = 0, SectorOffset = 490, SectorCount = 8 - ByteCount = 3606 (Capacity 4096)
             TRACE("Write metrics - Sector %u + %u, Count %u, ByteOffset %u, ByteCount %u",
                 LODWORD(Sector), SectorIndex, SectorCount, LODWORD(SectorOffset), ByteCount);
+
+            // Drop any cached copy of the sectors we are about to write around the cache
+            if (MfsCacheInvalidate(FileSystem, Entry, Sector, SectorCount) != OsSuccess) {
+                Result = OsDeviceError;
+                break;
+            }
     
             // First of all, calculate the bounds as we might need to read
             // in existing data - Start out by clearing our combination buffer
@@ -465,6 +528,10 @@ FsChangeFileSize(
 
     // Handle a special case of 0
     if (Size == 0) {
+        // Buffered data belongs to buckets we are about to release
+        Entry->CacheSectors = 0;
+        Entry->CacheDirty   = 0;
+
         // Free all buckets allocated, if any are allocated
         if (Entry->StartBucket != MFS_ENDOFCHAIN) {
             OsStatus_t Status = MfsFreeBuckets(FileSystem, Entry->StartBucket, Entry->StartLength);
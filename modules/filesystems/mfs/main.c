@@ -101,7 +101,10 @@ FsCloseEntry(
     MfsEntry_t* Entry = (MfsEntry_t*)BaseEntry;
     
     TRACE("FsCloseEntry(%i)", Entry->ActionOnClose);
-    if (Entry->ActionOnClose) {
+    Code = MfsCacheFlush(FileSystem, Entry);
+    MfsCacheDestroy(Entry);
+
+    if (Code == OsSuccess && Entry->ActionOnClose) {
         Code = MfsUpdateRecord(FileSystem, Entry, Entry->ActionOnClose);
     }
     if (BaseEntry->Name != NULL) { MStringDestroy(BaseEntry->Name); }
@@ -120,6 +123,9 @@ FsDeleteEntry(
     OsStatus_t        Code;
     OsStatus_t        Status;
 
+    // Discard any buffered data, the buckets are released
+    MfsCacheDestroy(Entry);
+
     Status = MfsFreeBuckets(FileSystem, Entry->StartBucket, Entry->StartLength);
     if (Status != OsSuccess) {
         ERROR("Failed to free the buckets at start 0x%x, length 0x%x",
@@ -165,8 +171,9 @@ FsCloseHandle(
     _In_ FileSystemEntryHandle_t*   BaseHandle)
 {
     MfsEntryHandle_t* Handle = (MfsEntryHandle_t*)BaseHandle;
+    OsStatus_t        Status = MfsCacheFlush(FileSystem, (MfsEntry_t*)Handle->Base.Entry);
     free(Handle);
-    return OsSuccess;
+    return Status;
 }
 
 OsStatus_t
@@ -207,6 +214,93 @@ FsWriteEntry(
     return OsInvalidParameters;
 }
 
+/* FsTransferFileVector
+ * Transfers the parts of the vector one after another. The file operations read the
+ * position from the handle, so it is advanced between the parts and restored afterwards
+ * as the filemanager updates the position with the total. */
+static OsStatus_t
+FsTransferFileVector(
+    _In_  FileSystemDescriptor_t* FileSystem,
+    _In_  MfsEntryHandle_t*       Handle,
+    _In_  FileSystemVector_t*     Vectors,
+    _In_  int                     VectorCount,
+    _In_  int                     Write,
+    _Out_ size_t*                 UnitsTransferred)
+{
+    uint64_t   Position = Handle->Base.Position;
+    OsStatus_t Status   = OsSuccess;
+    size_t     PartTransferred;
+    int        i;
+
+    *UnitsTransferred = 0;
+    for (i = 0; i < VectorCount; i++) {
+        PartTransferred = 0;
+        if (Write) {
+            Status = FsWriteToFile(FileSystem, Handle, Vectors[i].BufferHandle, Vectors[i].Buffer,
+                Vectors[i].BufferOffset, Vectors[i].Length, &PartTransferred);
+        }
+        else {
+            Status = FsReadFromFile(FileSystem, Handle, Vectors[i].BufferHandle, Vectors[i].Buffer,
+                Vectors[i].BufferOffset, Vectors[i].Length, &PartTransferred);
+        }
+
+        *UnitsTransferred     += PartTransferred;
+        Handle->Base.Position += PartTransferred;
+        if (Status != OsSuccess || PartTransferred != Vectors[i].Length) {
+            break;
+        }
+    }
+    Handle->Base.Position = Position;
+
+    // Report partial transfers as success, the error surfaces on the next call
+    return (*UnitsTransferred != 0) ? OsSuccess : Status;
+}
+
+OsStatus_t
+FsReadEntryVector(
+    _In_  FileSystemDescriptor_t*   FileSystem,
+    _In_  FileSystemEntryHandle_t*  BaseHandle,
+    _In_  FileSystemVector_t*       Vectors,
+    _In_  int                       VectorCount,
+    _Out_ size_t*                   UnitsRead)
+{
+    MfsEntryHandle_t* Handle = (MfsEntryHandle_t*)BaseHandle;
+    TRACE("FsReadEntryVector(flags 0x%x, count %i)", Handle->Base.Entry->Descriptor.Flags, VectorCount);
+    if (Handle->Base.Entry->Descriptor.Flags & FILE_FLAG_DIRECTORY) {
+        return OsInvalidParameters;
+    }
+    return FsTransferFileVector(FileSystem, Handle, Vectors, VectorCount, 0, UnitsRead);
+}
+
+OsStatus_t
+FsWriteEntryVector(
+    _In_  FileSystemDescriptor_t*   FileSystem,
+    _In_  FileSystemEntryHandle_t*  BaseHandle,
+    _In_  FileSystemVector_t*       Vectors,
+    _In_  int                       VectorCount,
+    _Out_ size_t*                   UnitsWritten)
+{
+    MfsEntryHandle_t* Handle = (MfsEntryHandle_t*)BaseHandle;
+    TRACE("FsWriteEntryVector(flags 0x%x, count %i)", Handle->Base.Entry->Descriptor.Flags, VectorCount);
+    if (Handle->Base.Entry->Descriptor.Flags & FILE_FLAG_DIRECTORY) {
+        return OsInvalidParameters;
+    }
+    return FsTransferFileVector(FileSystem, Handle, Vectors, VectorCount, 1, UnitsWritten);
+}
+
+OsStatus_t
+FsFlushEntry(
+    _In_ FileSystemDescriptor_t*    FileSystem,
+    _In_ FileSystemEntryHandle_t*   BaseHandle)
+{
+    MfsEntryHandle_t* Handle = (MfsEntryHandle_t*)BaseHandle;
+    TRACE("FsFlushEntry(flags 0x%x)", Handle->Base.Entry->Descriptor.Flags);
+    if (!(Handle->Base.Entry->Descriptor.Flags & FILE_FLAG_DIRECTORY)) {
+        return MfsCacheFlush(FileSystem, (MfsEntry_t*)Handle->Base.Entry);
+    }
+    return OsSuccess;
+}
+
 OsStatus_t
 FsSeekInEntry(
     _In_ FileSystemDescriptor_t*    FileSystem,
@@ -301,6 +395,7 @@ FsInitialize(
     memset(Mfs, 0, sizeof(MfsInstance_t));
     
     // Create a generic transferbuffer for us to use
+    DmaInfo.name     = "mfs_transfer";
     DmaInfo.length   = Descriptor->Disk.Descriptor.SectorSize;
     DmaInfo.capacity = Descriptor->Disk.Descriptor.SectorSize;
     DmaInfo.flags    = 0;
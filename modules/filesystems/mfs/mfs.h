@@ -43,6 +43,7 @@
 #define MFS_GETSECTOR(mInstance, Bucket)        ((Mfs->SectorsPerBucket * Bucket))
 #define MFS_ROOTSIZE                            8
 #define MFS_DIRECTORYEXPANSION                  4
+#define MFS_CACHE_BUCKETS                       8 // Size of the per-entry data cache
 
 #define MFS_ACTION_NONE     0x0
 #define MFS_ACTION_UPDATE   0x1
@@ -209,6 +210,13 @@ PACKED_TYPESTRUCT(MfsEntry, {
     uint32_t DirectoryBucket;
     uint32_t DirectoryLength;
     size_t   DirectoryIndex;
+
+    // Data cache shared by all handles to this entry, it holds a run of
+    // consecutive sectors used for read-ahead and for coalescing small writes.
+    struct dma_attachment Cache;
+    uint64_t              CacheSector;
+    size_t                CacheSectors;
+    int                   CacheDirty;
 });
 
 PACKED_TYPESTRUCT(MfsEntryHandle, {
@@ -219,6 +227,11 @@ PACKED_TYPESTRUCT(MfsEntryHandle, {
     uint32_t DataBucketPosition;
     uint32_t DataBucketLength;
     uint64_t BucketByteBoundary;  // Support variadic bucket sizes
+
+    // Sequential access detection. If a read starts where the previous read
+    // ended the read-ahead window is grown, otherwise it is reset.
+    uint64_t ReadAheadPosition;
+    size_t   ReadAheadSectors;
 });
 
 typedef struct MfsInstance {
@@ -262,6 +275,67 @@ MfsWriteSectors(
     _In_ size_t                     Count,
     _In_ size_t*                    SectorsWritten);
 
+/* MfsCacheCapacity
+ * Retrieves the capacity of the per-entry data cache in sectors. */
+__EXTERN size_t
+MfsCacheCapacity(
+    _In_ FileSystemDescriptor_t*    FileSystem);
+
+/* MfsCacheFlush
+ * Writes any dirty data held in the entry cache to disk. The cached data
+ * stays valid for reading afterwards. */
+__EXTERN OsStatus_t
+MfsCacheFlush(
+    _In_ FileSystemDescriptor_t*    FileSystem,
+    _In_ MfsEntry_t*                Entry);
+
+/* MfsCacheInvalidate
+ * Drops the entry cache if it overlaps the given sector range, any dirty data
+ * is written to disk first. */
+__EXTERN OsStatus_t
+MfsCacheInvalidate(
+    _In_ FileSystemDescriptor_t*    FileSystem,
+    _In_ MfsEntry_t*                Entry,
+    _In_ uint64_t                   Sector,
+    _In_ size_t                     Count);
+
+/* MfsCacheDestroy
+ * Releases the resources of the entry cache without writing dirty data. */
+__EXTERN void
+MfsCacheDestroy(
+    _In_ MfsEntry_t*                Entry);
+
+/* MfsCacheRead
+ * Serves a read from the entry cache. On a miss the cache is filled with a read-ahead
+ * window if <Sequential> is set and the request is small. BytesRead is 0 if the
+ * read could not be served and must be performed directly. */
+__EXTERN OsStatus_t
+MfsCacheRead(
+    _In_  FileSystemDescriptor_t*   FileSystem,
+    _In_  MfsEntryHandle_t*         Handle,
+    _In_  uint64_t                  Sector,
+    _In_  size_t                    SectorOffset,
+    _In_  size_t                    SectorsLeft,
+    _In_  int                       Sequential,
+    _In_  void*                     Buffer,
+    _In_  size_t                    Length,
+    _Out_ size_t*                   BytesRead);
+
+/* MfsCacheWrite
+ * Coalesces a write into the entry cache, the cache is written out once full or when
+ * the entry is flushed/closed. BytesWritten is 0 if the write must be performed directly. */
+__EXTERN OsStatus_t
+MfsCacheWrite(
+    _In_  FileSystemDescriptor_t*   FileSystem,
+    _In_  MfsEntryHandle_t*         Handle,
+    _In_  uint64_t                  Sector,
+    _In_  size_t                    SectorOffset,
+    _In_  size_t                    SectorsLeft,
+    _In_  uint64_t                  Position,
+    _In_  void*                     Buffer,
+    _In_  size_t                    Length,
+    _Out_ size_t*                   BytesWritten);
+
 /* MfsGetBucketLink
  * Looks up the next bucket link by utilizing the cached
  * in-memory version of the bucketmap */
@@ -81,6 +81,17 @@ HciProcessEvent(
     _In_ int                     Event,
     _In_ void*                   Context);
 
+/* HciTransferRetired
+ * Checks whether the controller has stopped processing the transfer, either because
+ * all of its elements have completed or because one of them failed. This must be cheap
+ * as <UsbManagerProbeTransfers> invokes it for the first active transfer of every endpoint,
+ * and it may report a transfer as retired when it is not, but never the other way around. */
+__EXTERN
+int
+HciTransferRetired(
+    _In_ UsbManagerController_t* Controller,
+    _In_ UsbManagerTransfer_t*   Transfer);
+
 /* HciTransactionFinalize
  * Finalizes a transfer by cleaning up resources allocated. This should free
  * all elements and unschedule elements. */
@@ -45,9 +45,19 @@ struct usb_controller_device_index {
     UsbManagerController_t* pointer;
 };
 
+// Endpoints also keep the transfers the controller is processing on them in queue order,
+// only the first of them can complete before the others. See UsbManagerGetActiveEndpoint.
 struct usb_controller_endpoint {
-    UUId_t address;
-    int    toggle;
+    UUId_t                address;
+    int                   toggle;
+    UsbManagerTransfer_t* active_head;
+    UsbManagerTransfer_t* active_tail;
+    unsigned int          active_sequence;
+};
+
+struct usb_controller_transfer {
+    UUId_t                id;
+    UsbManagerTransfer_t* transfer;
 };
 
 static void UsbManagerQueryUHCIPorts(void*);
@@ -58,6 +68,9 @@ static int      default_dev_cmp(const void*, const void*);
 static uint64_t endpoint_hash(const void*);
 static int      endpoint_cmp(const void*, const void*);
 
+static uint64_t transfer_hash(const void*);
+static int      transfer_cmp(const void*, const void*);
+
 static EventQueue_t* eventQueue           = NULL;
 static int           hciCheckupRegistered = 0;
 static hashtable_t   controllers          = { 0 };
@@ -106,8 +119,12 @@ UsbManagerCreateController(
 
     controller->Type = type;
     list_construct(&controller->TransactionList);
+    list_construct(&controller->RetiredList);
+    list_construct(&controller->ActiveList);
     hashtable_construct(&controller->Endpoints, 0,
             sizeof(struct usb_controller_endpoint), endpoint_hash, endpoint_cmp);
+    hashtable_construct(&controller->Transfers, 0,
+            sizeof(struct usb_controller_transfer), transfer_hash, transfer_cmp);
     spinlock_init(&controller->Lock, spinlock_plain);
 
     // create the event descriptor to allow listening for interrupts
@@ -157,6 +174,7 @@ UsbManagerDestroyController(
 
     // clean up resources
     hashtable_destroy(&controller->Endpoints);
+    hashtable_destroy(&controller->Transfers);
 
     // remove the event descriptor to the gracht server
     ioset_ctrl(gracht_server_get_set_iod(), IOSET_DEL, controller->event_descriptor, NULL);
@@ -183,6 +201,20 @@ UsbManagerQueryUHCIPorts(
     hashtable_enumerate(&controllers, UsbManagerQueryUHCIController, unusedContext);
 }
 
+static void
+UsbManagerRemoveTransfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ UsbManagerTransfer_t*   transfer)
+{
+    if (transfer->Retired) {
+        list_remove(&controller->RetiredList, &transfer->RetiredHeader);
+    }
+    UsbManagerDeactivateTransfer(controller, transfer);
+    list_remove(&controller->TransactionList, &transfer->header);
+    hashtable_remove(&controller->Transfers, &(struct usb_controller_transfer) { .id = transfer->Id });
+    UsbManagerDestroyTransfer(transfer);
+}
+
 void
 UsbManagerIterateTransfers(
     _In_ UsbManagerController_t* controller,
@@ -194,9 +226,7 @@ UsbManagerIterateTransfers(
         int                   status = itemCallback(controller, transfer, context);
         if (status & ITERATOR_REMOVE) {
             element_t* next = node->next;
-            list_remove(&controller->TransactionList, node);
-            UsbManagerDestroyTransfer(transfer);
-
+            UsbManagerRemoveTransfer(controller, transfer);
             node = next;
         }
         else {
@@ -209,6 +239,33 @@ UsbManagerIterateTransfers(
     }
 }
 
+void
+UsbManagerRegisterTransfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ UsbManagerTransfer_t*   transfer)
+{
+    if (hashtable_get(&controller->Transfers, &(struct usb_controller_transfer) { .id = transfer->Id })) {
+        return;
+    }
+
+    hashtable_set(&controller->Transfers, &(struct usb_controller_transfer) {
+        .id = transfer->Id, .transfer = transfer });
+    list_append(&controller->TransactionList, &transfer->header);
+}
+
+UsbManagerTransfer_t*
+UsbManagerGetTransfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ UUId_t                  transferId)
+{
+    struct usb_controller_transfer* index = hashtable_get(&controller->Transfers,
+            &(struct usb_controller_transfer) { .id = transferId });
+    if (!index) {
+        return NULL;
+    }
+    return index->transfer;
+}
+
 UsbManagerController_t*
 UsbManagerGetController(
     _In_ UUId_t deviceId)
@@ -333,7 +390,9 @@ ClearTransferCallback(
     UsbManagerTransfer_t*   transfer   = (UsbManagerTransfer_t*)item->value;
 
     // clear the partial flag
+    UsbManagerDeactivateTransfer(controller, transfer);
     transfer->Flags &= ~(TransferFlagPartial);
+    hashtable_remove(&controller->Transfers, &(struct usb_controller_transfer) { .id = transfer->Id });
 
     // finalize the transfer
     HciTransactionFinalize(controller, transfer, 1);
@@ -345,7 +404,10 @@ void
 UsbManagerClearTransfers(
     _In_ UsbManagerController_t* controller)
 {
+    // the retired list only links transfers that are destroyed below
+    list_construct(&controller->RetiredList);
     list_clear(&controller->TransactionList, ClearTransferCallback, controller);
+    list_construct(&controller->ActiveList);
 }
 
 OsStatus_t
@@ -398,6 +460,7 @@ UsbManagerScheduleTransfer(
         Transfer->Flags &= ~(TransferFlagUnschedule);
         HciTransactionFinalize(Controller, Transfer, 0);
         Transfer->Flags |= TransferFlagCleanup;
+        UsbManagerRetireTransfer(Controller, Transfer);
     }
 
     // Has the transfer been marked for schedule?
@@ -450,6 +513,10 @@ UsbManagerProcessTransfer(
         USB_CHAIN_DEPTH, USB_REASON_SCAN, HciProcessElement, Transfer);
     TRACE("> Updated metrics (Id %u, Status %u, Flags 0x%x)", Transfer->Id, Transfer->Status, Transfer->Flags);
     if (Transfer->Status == TransferQueued) {
+        // Still in progress, it must be probed again
+        if (Transfer->Tracked) {
+            UsbManagerActivateTransfer(Controller, Transfer);
+        }
         return ITERATOR_CONTINUE;
     }
     
@@ -471,6 +538,9 @@ UsbManagerProcessTransfer(
         }
         Transfer->Status = TransferQueued;
         Transfer->Flags  = TransferFlagNone;
+        if (Transfer->Tracked) {
+            UsbManagerActivateTransfer(Controller, Transfer);
+        }
     }
     else if (Transfer->Transfer.Type == USB_TRANSFER_CONTROL || Transfer->Transfer.Type == USB_TRANSFER_BULK) {
         HciTransactionFinalize(Controller, Transfer, 0);
@@ -484,11 +554,189 @@ UsbManagerProcessTransfer(
     return ITERATOR_CONTINUE;
 }
 
+/* UsbManagerGetActiveEndpoint
+ * Active transfers are kept per pipe. The endpoint address does not carry the direction,
+ * so the in pipe of an endpoint uses the address with bit 7 set like its descriptor. */
+static struct usb_controller_endpoint*
+UsbManagerGetActiveEndpoint(
+    _In_ UsbManagerController_t* controller,
+    _In_ UsbManagerTransfer_t*   transfer)
+{
+    UsbHcAddress_t*                 address = &transfer->Transfer.Address;
+    UUId_t                          endpointAddress = ((uint32_t)address->DeviceAddress << 8) | address->EndpointAddress;
+    struct usb_controller_endpoint* endpoint;
+
+    if (transfer->Transfer.Type != USB_TRANSFER_CONTROL &&
+        transfer->Transfer.Transactions[0].Type == USB_TRANSACTION_IN) {
+        endpointAddress |= 0x80;
+    }
+
+    endpoint = hashtable_get(&controller->Endpoints, &(struct usb_controller_endpoint) {
+            .address = endpointAddress });
+    if (!endpoint) {
+        hashtable_set(&controller->Endpoints, &(struct usb_controller_endpoint) {
+                .address = endpointAddress, .toggle = 0 });
+        endpoint = hashtable_get(&controller->Endpoints, &(struct usb_controller_endpoint) {
+                .address = endpointAddress });
+    }
+    return endpoint;
+}
+
+void
+UsbManagerActivateTransfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ UsbManagerTransfer_t*   transfer)
+{
+    struct usb_controller_endpoint* endpoint;
+    UsbManagerTransfer_t*           previous = NULL;
+    UsbManagerTransfer_t*           current  = NULL;
+
+    if (transfer->Active) {
+        return;
+    }
+
+    endpoint = UsbManagerGetActiveEndpoint(controller, transfer);
+    if (!endpoint) {
+        return;
+    }
+
+    // The position on the endpoint is given when the transfer is first queued, transfers
+    // that continue or restart later keep it
+    if (!transfer->Tracked) {
+        transfer->Tracked        = 1;
+        transfer->ActiveSequence = endpoint->active_sequence++;
+    }
+    transfer->Active = 1;
+
+    if (endpoint->active_tail && endpoint->active_tail->ActiveSequence < transfer->ActiveSequence) {
+        previous = endpoint->active_tail;
+    }
+    else {
+        for (current = endpoint->active_head; current && current->ActiveSequence < transfer->ActiveSequence;
+             current = current->ActiveNext) {
+            previous = current;
+        }
+    }
+
+    transfer->ActiveNext = current;
+    if (!current) {
+        endpoint->active_tail = transfer;
+    }
+    if (previous) {
+        previous->ActiveNext = transfer;
+        return;
+    }
+
+    // The transfer is the first on the endpoint, it replaces the one being probed
+    if (current) {
+        list_remove(&controller->ActiveList, &current->ActiveHeader);
+    }
+    endpoint->active_head = transfer;
+    ELEMENT_INIT(&transfer->ActiveHeader, (uintptr_t)transfer->Id, transfer);
+    list_append(&controller->ActiveList, &transfer->ActiveHeader);
+}
+
+void
+UsbManagerDeactivateTransfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ UsbManagerTransfer_t*   transfer)
+{
+    struct usb_controller_endpoint* endpoint;
+    UsbManagerTransfer_t*           previous = NULL;
+    UsbManagerTransfer_t*           current;
+
+    if (!transfer->Active) {
+        return;
+    }
+
+    transfer->Active = 0;
+    endpoint = UsbManagerGetActiveEndpoint(controller, transfer);
+    if (!endpoint) {
+        return;
+    }
+
+    for (current = endpoint->active_head; current && current != transfer; current = current->ActiveNext) {
+        previous = current;
+    }
+    if (!current) {
+        return;
+    }
+
+    if (endpoint->active_tail == transfer) {
+        endpoint->active_tail = previous;
+    }
+
+    if (previous) {
+        previous->ActiveNext = transfer->ActiveNext;
+        return;
+    }
+
+    // The next transfer on the endpoint is the one that can complete now
+    list_remove(&controller->ActiveList, &transfer->ActiveHeader);
+    endpoint->active_head = transfer->ActiveNext;
+    if (endpoint->active_head) {
+        UsbManagerTransfer_t* next = endpoint->active_head;
+        ELEMENT_INIT(&next->ActiveHeader, (uintptr_t)next->Id, next);
+        list_append(&controller->ActiveList, &next->ActiveHeader);
+    }
+}
+
+void
+UsbManagerRetireTransfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ UsbManagerTransfer_t*   transfer)
+{
+    UsbManagerDeactivateTransfer(controller, transfer);
+    if (transfer->Retired) {
+        return;
+    }
+
+    ELEMENT_INIT(&transfer->RetiredHeader, (uintptr_t)transfer->Id, transfer);
+    transfer->Retired = 1;
+    list_append(&controller->RetiredList, &transfer->RetiredHeader);
+}
+
+void
+UsbManagerProbeTransfers(
+    _In_ UsbManagerController_t* controller)
+{
+    element_t* node = list_front(&controller->ActiveList);
+
+    // Retiring a transfer appends the next transfer on its endpoint to the list, so it
+    // is probed in the same round
+    while (node) {
+        UsbManagerTransfer_t* transfer = (UsbManagerTransfer_t*)node->value;
+        UsbManagerTransfer_t* promoted = transfer->ActiveNext;
+        element_t*            next     = node->next;
+
+        if (transfer->Status != TransferQueued || HciTransferRetired(controller, transfer)) {
+            UsbManagerRetireTransfer(controller, transfer);
+            if (!next && promoted) {
+                next = &promoted->ActiveHeader;
+            }
+        }
+        node = next;
+    }
+}
+
 void
 UsbManagerProcessTransfers(
     _In_ UsbManagerController_t* controller)
 {
-    UsbManagerIterateTransfers(controller, UsbManagerProcessTransfer, NULL);
+    // Only handle the transfers retired before we started, processing a transfer can
+    // retire it again (cleanup after the doorbell), and that must wait for the next round
+    int count = list_count(&controller->RetiredList);
+
+    while (count--) {
+        element_t*            node     = list_front(&controller->RetiredList);
+        UsbManagerTransfer_t* transfer = (UsbManagerTransfer_t*)node->value;
+
+        list_remove(&controller->RetiredList, node);
+        transfer->Retired = 0;
+        if (UsbManagerProcessTransfer(controller, transfer, NULL) & ITERATOR_REMOVE) {
+            UsbManagerRemoveTransfer(controller, transfer);
+        }
+    }
     UsbManagerQueueWaitingTransfers(controller);
 }
 
@@ -592,6 +840,19 @@ UsbManagerDumpSchedule(
     }
 }
 
+static uint64_t transfer_hash(const void* element)
+{
+    const struct usb_controller_transfer* index = element;
+    return siphash_64((const uint8_t*)&index->id, sizeof(UUId_t), &hashKey[0]);
+}
+
+static int transfer_cmp(const void* element1, const void* element2)
+{
+    const struct usb_controller_transfer* index1 = element1;
+    const struct usb_controller_transfer* index2 = element2;
+    return index1->id == index2->id ? 0 : 1;
+}
+
 static uint64_t default_dev_hash(const void* deviceIndex)
 {
     const struct usb_controller_device_index* index = deviceIndex;
@@ -47,7 +47,10 @@ typedef struct _UsbManagerController {
     UsbScheduler_t*     Scheduler;
 
     hashtable_t Endpoints;
+    hashtable_t Transfers;
     list_t      TransactionList;
+    list_t      RetiredList;
+    list_t      ActiveList;
     spinlock_t  Lock;
 } UsbManagerController_t;
 
@@ -122,6 +125,28 @@ __EXTERN OsStatus_t
 UsbManagerDestroyController(
     _In_ UsbManagerController_t* controller);
 
+/**
+ * Adds the transfer to the list of transfers the controller keeps track of. Nothing happens if
+ * the transfer is already registered.
+ * @param controller The controller that the transfer is queued on.
+ * @param transfer   The transfer to register.
+ */
+__EXTERN void
+UsbManagerRegisterTransfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ UsbManagerTransfer_t*   transfer);
+
+/**
+ * Looks up a registered transfer by its id.
+ * @param controller The controller that the transfer is queued on.
+ * @param transferId The id of the transfer.
+ * @return           The transfer, or NULL if no transfer with the id is registered.
+ */
+__EXTERN UsbManagerTransfer_t*
+UsbManagerGetTransfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ UUId_t                  transferId);
+
 /**
  * Clears all queued transfers by iterating them and invoking Finalize. This also notifies waiters.
  * @param controller The controller to clear transfers from.
@@ -193,9 +218,52 @@ UsbManagerSetToggle(
     _In_ UsbHcAddress_t* address,
     _In_ int             toggle);
 
+/**
+ * Marks the transfer as retired by the controller, it will be handled on the next call to
+ * UsbManagerProcessTransfers. Nothing happens if the transfer is already marked.
+ * @param controller The controller that the transfer is queued on.
+ * @param transfer   The transfer that the controller has stopped processing.
+ */
+__EXTERN void
+UsbManagerRetireTransfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ UsbManagerTransfer_t*   transfer);
+
+/**
+ * Marks the transfer as being processed by the controller. Transfers on the same endpoint
+ * complete in the order they were activated, and only the first of them is probed.
+ * @param controller The controller that the transfer is queued on.
+ * @param transfer   The transfer that has been linked into the schedule.
+ */
+__EXTERN void
+UsbManagerActivateTransfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ UsbManagerTransfer_t*   transfer);
+
+/**
+ * Stops probing the transfer, the next transfer on its endpoint is probed instead. This
+ * is done when the transfer is retired or removed.
+ * @param controller The controller that the transfer is queued on.
+ * @param transfer   The transfer that is no longer processed by the controller.
+ */
+__EXTERN void
+UsbManagerDeactivateTransfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ UsbManagerTransfer_t*   transfer);
+
+/**
+ * Retires the active transfers that <HciTransferRetired> reports as retired. This is meant
+ * for controllers that have no done queue to tell which transfers have completed. Only the
+ * first active transfer of each endpoint is probed.
+ * @param controller The controller to probe transfers on.
+ */
+__EXTERN void
+UsbManagerProbeTransfers(
+    _In_ UsbManagerController_t* controller);
+
 /* UsbManagerProcessTransfers
- * Processes all the associated transfers with the given usb controller.
- * The iteration process will invoke <HciProcessElement> */
+ * Processes the transfers that have been retired since the last call, only those have
+ * their elements scanned. The iteration process will invoke <HciProcessElement> */
 __EXTERN void
 UsbManagerProcessTransfers(
     _In_ UsbManagerController_t* controller);
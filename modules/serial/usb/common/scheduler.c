@@ -50,17 +50,24 @@ UsbSchedulerResetInternalData(
     // Start out by zeroing out memory
     if (ResetElements) {
         for (i = 0; i < Scheduler->Settings.PoolCount; i++) {
-            memset((void*)Scheduler->Settings.Pools[i].ElementPool, 0, (Scheduler->Settings.Pools[i].ElementCount * Scheduler->Settings.Pools[i].ElementAlignedSize));
+            UsbSchedulerPool_t* Pool = &Scheduler->Settings.Pools[i];
+            memset((void*)Pool->ElementPool, 0, (Pool->ElementCount * Pool->ElementAlignedSize));
             
             // Allocate and initialze all the reserved elements
-            for (j = 0; j < Scheduler->Settings.Pools[i].ElementCountReserved; j++) {
-                uint8_t *Element              = USB_ELEMENT_INDEX((&Scheduler->Settings.Pools[i]), j);
-                UsbSchedulerObject_t *sObject = USB_ELEMENT_OBJECT((&Scheduler->Settings.Pools[i]), Element);
+            for (j = 0; j < (int)Pool->ElementCountReserved; j++) {
+                uint8_t *Element              = USB_ELEMENT_INDEX(Pool, j);
+                UsbSchedulerObject_t *sObject = USB_ELEMENT_OBJECT(Pool, Element);
                 sObject->Index                = USB_ELEMENT_CREATE_INDEX(i, j);
                 sObject->BreathIndex          = USB_ELEMENT_NO_INDEX;
                 sObject->DepthIndex           = USB_ELEMENT_NO_INDEX;
                 sObject->Flags                = USB_ELEMENT_ALLOCATED;
             }
+
+            // Push the remaining elements in reverse, so the lowest indices are handed out first
+            Pool->ElementFreeCount = 0;
+            for (j = (int)Pool->ElementCount - 1; j >= (int)Pool->ElementCountReserved; j--) {
+                Pool->ElementFreeStack[Pool->ElementFreeCount++] = (uint16_t)j;
+            }
         }
     }
     if (ResetFramelist) {
@@ -75,6 +82,47 @@ UsbSchedulerResetInternalData(
     return OsSuccess;
 }
 
+/* CreatePoolPageTable
+ * Records the physical address of every page in the element pool, so translating
+ * an element address does not have to walk the scatter-gather table. */
+static OsStatus_t
+CreatePoolPageTable(
+    _In_ UsbSchedulerPool_t* Pool,
+    _In_ size_t              ElementBytes)
+{
+    SystemDescriptor_t Descriptor;
+    size_t             PageSize;
+    size_t             PageCount;
+    size_t             Page = 0;
+    int                i;
+
+    if (SystemQuery(&Descriptor) != OsSuccess) {
+        return OsError;
+    }
+
+    PageSize               = Descriptor.PageSizeBytes;
+    PageCount              = DIVUP(ElementBytes, PageSize);
+    Pool->ElementPageShift = 0;
+    while (((size_t)1 << Pool->ElementPageShift) < PageSize) {
+        Pool->ElementPageShift++;
+    }
+
+    Pool->ElementPagePhysical = (uintptr_t*)malloc(PageCount * sizeof(uintptr_t));
+    if (!Pool->ElementPagePhysical) {
+        return OsOutOfMemory;
+    }
+
+    // The pool buffer is page aligned and every entry but the last covers whole pages
+    for (i = 0; i < Pool->ElementPoolDMATable.count && Page < PageCount; i++) {
+        struct dma_sg* Entry = &Pool->ElementPoolDMATable.entries[i];
+        size_t         Offset;
+        for (Offset = 0; Offset < Entry->length && Page < PageCount; Offset += PageSize) {
+            Pool->ElementPagePhysical[Page++] = Entry->address + Offset;
+        }
+    }
+    return (Page == PageCount) ? OsSuccess : OsError;
+}
+
 static OsStatus_t
 AllocateMemoryForPool(
     _In_ UsbSchedulerPool_t* Pool)
@@ -97,11 +145,20 @@ AllocateMemoryForPool(
         ERROR("... failed! %u", Status);
         return Status;
     }
-    (void)dma_get_sg_table(&Pool->ElementPoolDMA, &Pool->ElementPoolDMATable, -1);
+    Pool->ElementPool = Pool->ElementPoolDMA.buffer;
 
+    Status = dma_get_sg_table(&Pool->ElementPoolDMA, &Pool->ElementPoolDMATable, -1);
+    if (Status != OsSuccess) {
+        ERROR("... failed to retrieve sg table %u", Status);
+        return Status;
+    }
     TRACE("... address 0x%" PRIxIN, Pool->ElementPoolDMATable.entries[0].address);
-    Pool->ElementPool = Pool->ElementPoolDMA.buffer;
-    return OsSuccess;
+
+    Pool->ElementFreeStack = (uint16_t*)malloc(Pool->ElementCount * sizeof(uint16_t));
+    if (!Pool->ElementFreeStack) {
+        return OsOutOfMemory;
+    }
+    return CreatePoolPageTable(Pool, ElementBytes);
 }
 
 static OsStatus_t
@@ -206,6 +263,8 @@ static void
 FreePoolMemory(
     _In_ UsbSchedulerPool_t* Pool)
 {
+    free(Pool->ElementFreeStack);
+    free(Pool->ElementPagePhysical);
     if (!Pool->ElementPoolDMA.buffer) {
         return;
     }
@@ -338,7 +397,8 @@ UsbSchedulerAllocateElement(
 {
     UsbSchedulerObject_t* sObject = NULL;
     UsbSchedulerPool_t*   sPool   = NULL;
-    size_t                i;
+    uint8_t*              Element = NULL;
+    uint16_t              Index   = 0;
 
     // Get pool
     assert(ElementOut != NULL);
@@ -352,24 +412,24 @@ UsbSchedulerAllocateElement(
     // and isoc, but it doesn't make sense for us as we keep one
     // large pool of TDs, just allocate from that in any case
     spinlock_acquire(&Scheduler->Lock);
-    for (i = sPool->ElementCountReserved; i < sPool->ElementCount; i++) {
-        uint8_t *Element = USB_ELEMENT_INDEX(sPool, i);
-        sObject          = USB_ELEMENT_OBJECT(sPool, Element);
-        if (sObject->Flags & USB_ELEMENT_ALLOCATED) {
-            continue;
-        }
-
-        // Found one, reset
-        memset((void*)Element, 0, sPool->ElementAlignedSize);
-        sObject->Index       = USB_ELEMENT_CREATE_INDEX(Pool, i);
-        sObject->BreathIndex = USB_ELEMENT_NO_INDEX;
-        sObject->DepthIndex  = USB_ELEMENT_NO_INDEX;
-        sObject->Flags       = USB_ELEMENT_ALLOCATED;
-        *ElementOut          = Element;
-        break;
+    if (sPool->ElementFreeCount) {
+        Index   = sPool->ElementFreeStack[--sPool->ElementFreeCount];
+        Element = USB_ELEMENT_INDEX(sPool, Index);
     }
     spinlock_release(&Scheduler->Lock);
-    return (i == sPool->ElementCount) ? OsError : OsSuccess;
+    if (!Element) {
+        return OsError;
+    }
+
+    // The element is owned by the caller now, so it can be reset without the lock
+    sObject = USB_ELEMENT_OBJECT(sPool, Element);
+    memset((void*)Element, 0, sPool->ElementAlignedSize);
+    sObject->Index       = USB_ELEMENT_CREATE_INDEX(Pool, Index);
+    sObject->BreathIndex = USB_ELEMENT_NO_INDEX;
+    sObject->DepthIndex  = USB_ELEMENT_NO_INDEX;
+    sObject->Flags       = USB_ELEMENT_ALLOCATED;
+    *ElementOut          = Element;
+    return OsSuccess;
 }
 
 OsStatus_t
@@ -605,17 +665,32 @@ UsbSchedulerFreeElement(
     UsbSchedulerObject_t* sObject = NULL;
     UsbSchedulerPool_t*   sPool   = NULL;
     OsStatus_t            Result  = OsSuccess;
+    size_t                Index;
     
     // Validate element and lookup pool
     Result = UsbSchedulerGetPoolFromElement(Scheduler, Element, &sPool);
     assert(Result == OsSuccess);
     sObject = USB_ELEMENT_OBJECT(sPool, Element);
+    Index   = ((uintptr_t)Element - (uintptr_t)sPool->ElementPool) / sPool->ElementAlignedSize;
+
+    // Pushing an element twice would hand it out to two owners
+    if (!(sObject->Flags & USB_ELEMENT_ALLOCATED)) {
+        WARNING("UsbSchedulerFreeElement element %u was not allocated", (unsigned int)Index);
+        return;
+    }
 
     // Should we free bandwidth?
     if (sObject->Flags & USB_ELEMENT_BANDWIDTH) {
         UsbSchedulerFreeBandwidth(Scheduler, Element);
     }
     memset((void*)Element, 0, sPool->ElementAlignedSize);
+
+    // Reserved elements are never handed out by the allocator
+    if (Index >= sPool->ElementCountReserved) {
+        spinlock_acquire(&Scheduler->Lock);
+        sPool->ElementFreeStack[sPool->ElementFreeCount++] = (uint16_t)Index;
+        spinlock_release(&Scheduler->Lock);
+    }
 }
 
 uintptr_t
@@ -623,14 +698,33 @@ UsbSchedulerGetDma(
     _In_ UsbSchedulerPool_t* Pool,
     _In_ uint8_t*            ElementPointer)
 {
-    size_t Offset = (uintptr_t)ElementPointer - (uintptr_t)Pool->ElementPoolDMA.buffer;
-    int    i;
-    
-    for (i = 0; i < Pool->ElementPoolDMATable.count; i++) {
-        if (Offset < Pool->ElementPoolDMATable.entries[i].length) {
-            return Pool->ElementPoolDMATable.entries[i].address + Offset;
+    size_t Offset   = (uintptr_t)ElementPointer - (uintptr_t)Pool->ElementPool;
+    size_t PageMask = ((size_t)1 << Pool->ElementPageShift) - 1;
+    return Pool->ElementPagePhysical[Offset >> Pool->ElementPageShift] + (Offset & PageMask);
+}
+
+OsStatus_t
+UsbSchedulerGetElementFromDma(
+    _In_  UsbScheduler_t* Scheduler,
+    _In_  uintptr_t       Physical,
+    _Out_ uint8_t**       ElementOut)
+{
+    int i;
+
+    for (i = 0; i < Scheduler->Settings.PoolCount; i++) {
+        UsbSchedulerPool_t* Pool      = &Scheduler->Settings.Pools[i];
+        size_t              PageSize  = (size_t)1 << Pool->ElementPageShift;
+        size_t              PageCount = DIVUP(Pool->ElementCount * Pool->ElementAlignedSize, PageSize);
+        size_t              Page;
+
+        for (Page = 0; Page < PageCount; Page++) {
+            uintptr_t PageStart = Pool->ElementPagePhysical[Page];
+            if (Physical >= PageStart && Physical < (PageStart + PageSize)) {
+                size_t Offset = (Page << Pool->ElementPageShift) + (Physical - PageStart);
+                *ElementOut = USB_ELEMENT_INDEX(Pool, Offset / Pool->ElementAlignedSize);
+                return OsSuccess;
+            }
         }
-        Offset -= Pool->ElementPoolDMATable.entries[i].length;
     }
-    return 0;
+    return OsDoesNotExist;
 }
@@ -102,6 +102,11 @@ typedef struct UsbSchedulerPool {
     struct dma_attachment ElementPoolDMA;         // Frame element pool DMA attachment
     struct dma_sg_table   ElementPoolDMATable;
     uint8_t*              ElementPool;
+
+    uint16_t*  ElementFreeStack;          // Indices of free elements, allocations pop from the top
+    size_t     ElementFreeCount;          // Number of indices on the free stack
+    uintptr_t* ElementPagePhysical;       // Physical address of each page of the element pool
+    size_t     ElementPageShift;          // Log2 of the page size
 } UsbSchedulerPool_t;
 
 typedef struct UsbSchedulerSettings {
@@ -201,11 +206,22 @@ UsbSchedulerResetInternalData(
     _In_ int                        ResetElements,
     _In_ int                        ResetFramelist);
 
+/* UsbSchedulerGetDma
+ * Translates an address inside the element pool to its physical address. */
 __EXTERN uintptr_t
 UsbSchedulerGetDma(
     _In_ UsbSchedulerPool_t* Pool,
     _In_ uint8_t*            ElementPointer);
 
+/* UsbSchedulerGetElementFromDma
+ * Translates a physical address inside one of the element pools back to the
+ * element that contains it. */
+__EXTERN OsStatus_t
+UsbSchedulerGetElementFromDma(
+    _In_  UsbScheduler_t* Scheduler,
+    _In_  uintptr_t       Physical,
+    _Out_ uint8_t**       ElementOut);
+
 /* UsbSchedulerGetPoolElement
  * Retrieves the element at the given pool and index. */
 __EXTERN OsStatus_t
@@ -227,7 +243,8 @@ UsbSchedulerGetPoolFromElement(
 /* UsbSchedulerAllocateElement
  * Allocates a new element for usage with the scheduler. If this returns
  * OsError we are out of elements and we should wait till next transfer. ElementOut
- * will in this case be set to USB_OUT_OF_RESOURCES. */
+ * will in this case be set to USB_OUT_OF_RESOURCES. Elements are taken from the
+ * free stack of the pool, so allocation does not depend on the size of the pool. */
 __EXTERN OsStatus_t
 UsbSchedulerAllocateElement(
     _In_  UsbScheduler_t*           Scheduler,
@@ -215,13 +215,8 @@ void ctt_usbhost_dequeue_callback(struct gracht_recv_message* message, struct ct
     UsbManagerController_t* controller = UsbManagerGetController(args->device_id);
     UsbManagerTransfer_t*   transfer   = NULL;
 
-    // Lookup transfer by iterating through available transfers
-    foreach(node, &controller->TransactionList) {
-        UsbManagerTransfer_t* itr = (UsbManagerTransfer_t*)node->value;
-        if (itr->Id == args->transfer_id) {
-            transfer = itr;
-            break;
-        }
+    if (controller != NULL) {
+        transfer = UsbManagerGetTransfer(controller, args->transfer_id);
     }
 
     // Dequeue and send result back
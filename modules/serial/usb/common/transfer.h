@@ -46,6 +46,15 @@ typedef enum _UsbManagerTransferFlags {
 typedef struct UsbManagerTransfer {
     UsbTransfer_t Transfer;
     element_t     header;
+    element_t     RetiredHeader; // Link in the controller's list of retired transfers
+    int           Retired;
+
+    // Transfers that the controller is processing, see UsbManagerActivateTransfer
+    element_t                  ActiveHeader;   // Link in the controller's list of transfers to probe
+    struct UsbManagerTransfer* ActiveNext;     // Next active transfer on the same endpoint
+    unsigned int               ActiveSequence; // Position in the queue of the endpoint
+    int                        Active;
+    int                        Tracked;        // Set once activated, restarts are activated again
 
     // Transfer Metadata
     UUId_t                    Id;
@@ -69,6 +69,7 @@ ProcessInterrupt:
 
     // Transaction update, either error or completion
     if (interruptStatus & (EHCI_STATUS_PROCESS | EHCI_STATUS_PROCESSERROR | EHCI_STATUS_ASYNC_DOORBELL)) {
+        UsbManagerProbeTransfers(&controller->Base);
         UsbManagerProcessTransfers(&controller->Base);
     }
 
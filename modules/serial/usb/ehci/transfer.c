@@ -45,6 +45,7 @@ EhciTransactionDispatch(
 #endif
     UsbManagerIterateChain(&Controller->Base, Transfer->EndpointDescriptor, 
         USB_CHAIN_DEPTH, USB_REASON_LINK, HciProcessElement, Transfer);
+    UsbManagerActivateTransfer(&Controller->Base, Transfer);
     return TransferQueued;
 }
 
@@ -70,11 +71,29 @@ HciTransactionFinalize(
     }
     else {
         Transfer->Flags |= TransferFlagCleanup;
+        UsbManagerRetireTransfer(Controller, Transfer);
         EhciRingDoorbell((EhciController_t*)Controller);
     }
     return OsSuccess;
 }
 
+int
+HciTransferRetired(
+    _In_ UsbManagerController_t* Controller,
+    _In_ UsbManagerTransfer_t*   Transfer)
+{
+    EhciQueueHead_t* Qh = (EhciQueueHead_t*)Transfer->EndpointDescriptor;
+
+    // Isochronous transfers are not queued on a queue head
+    if (!Qh || Transfer->Transfer.Type == USB_TRANSFER_ISOCHRONOUS) {
+        return 1;
+    }
+
+    // The overlay holds the td the controller is working on, it stays active
+    // until the td has completed, failed or the endpoint stopped responding
+    return (READ_VOLATILE(Qh->Overlay.Status) & EHCI_TD_ACTIVE) ? 0 : 1;
+}
+
 OsStatus_t
 HciDequeueTransfer(
     _In_ UsbManagerTransfer_t* Transfer)
@@ -93,9 +112,11 @@ HciDequeueTransfer(
     // Mark transfer for cleanup and ring doorbell if async
     if (Transfer->Transfer.Type == USB_TRANSFER_CONTROL || Transfer->Transfer.Type == USB_TRANSFER_BULK) {
         Transfer->Flags |= TransferFlagCleanup;
+        UsbManagerRetireTransfer(&Controller->Base, Transfer);
         EhciRingDoorbell(Controller);
     }
     else {
+        UsbManagerDeactivateTransfer(&Controller->Base, Transfer);
         UsbManagerIterateChain(&Controller->Base, Transfer->EndpointDescriptor, 
             USB_CHAIN_DEPTH, USB_REASON_CLEANUP, HciProcessElement, Transfer);
     }
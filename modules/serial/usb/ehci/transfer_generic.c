@@ -194,9 +194,7 @@ HciQueueTransferGeneric(
     }
 
     // Store transaction in queue if it's not there already
-    if (list_find(&Controller->Base.TransactionList, (void*)(uintptr_t)Transfer->Id) == NULL) {
-        list_append(&Controller->Base.TransactionList, &Transfer->header);
-    }
+    UsbManagerRegisterTransfer(&Controller->Base, Transfer);
 
     // If it fails to queue up => restore toggle
     if (EhciTransferFill(Controller, Transfer) != OsSuccess) {
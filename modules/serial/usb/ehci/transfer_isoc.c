@@ -113,6 +113,6 @@ HciQueueTransferIsochronous(
 
     Transfer->EndpointDescriptor = (void*)FirstTd;
     
-    list_append(&Controller->Base.TransactionList, &Transfer->header);
+    UsbManagerRegisterTransfer(&Controller->Base, Transfer);
     return EhciTransactionDispatch(Controller, Transfer);
 }
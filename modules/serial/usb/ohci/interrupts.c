@@ -45,8 +45,10 @@ OnFastInterrupt(
     reg32_t           InterruptStatus;
 
     // There are two cases where it might be, just to be sure
-    // we don't miss an interrupt, if the HeadDone is set or the intr is set
-    if (Hcca->HeadDone != 0) {
+    // we don't miss an interrupt, if the HeadDone is set or the intr is set. The
+    // HeadDone stays set until the done queue has been processed, so only look at
+    // it while the event is enabled
+    if (Hcca->HeadDone != 0 && (Registers->HcInterruptEnable & OHCI_PROCESS_EVENT)) {
         InterruptStatus = OHCI_PROCESS_EVENT;
         // If halted bit is set, get rest of interrupt
         if (Hcca->HeadDone & 0x1) {
@@ -65,10 +67,10 @@ OnFastInterrupt(
     }
     
     // Process Checks first
-    // This happens if a transaction has completed
+    // This happens if a transaction has completed. The done queue is read and
+    // acknowledged by the interrupt callback, keep the event disabled until then
     if (InterruptStatus & OHCI_PROCESS_EVENT) {
-        //reg32_t TdAddress = (Hcca->HeadDone & ~(0x00000001));
-        Hcca->HeadDone = 0;
+        Registers->HcInterruptDisable = OHCI_PROCESS_EVENT;
     }
 
     // Stage 1 of the linking/unlinking event, disable queues untill
@@ -79,7 +81,7 @@ OnFastInterrupt(
     }
 
     // Store interrupts, acknowledge and return
-    Registers->HcInterruptStatus = InterruptStatus;
+    Registers->HcInterruptStatus = InterruptStatus & ~(OHCI_PROCESS_EVENT);
     atomic_fetch_or(&Controller->Base.InterruptStatus, InterruptStatus);
     
     InterruptTable->EventSignal(ResourceTable->HandleResource);
@@ -98,6 +100,7 @@ ProcessInterrupt:
 
     // Process Checks
     if (InterruptStatus & OHCI_PROCESS_EVENT) {
+        OhciProcessDoneQueue(Controller);
         UsbManagerProcessTransfers(&Controller->Base);
     }
 
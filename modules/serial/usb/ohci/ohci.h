@@ -283,6 +283,10 @@ typedef struct {
     uint16_t                TransactionQueueControlIndex;
     uint16_t                TransactionQueueBulkIndex;
 
+    // Transfer that owns each td, tds on the done queue are traced back with these
+    UUId_t                  TdTransfers[OHCI_TD_COUNT];
+    UUId_t                  iTdTransfers[OHCI_iTD_COUNT];
+
     // Registers and resources
     OhciRegisters_t*        Registers;
     struct dma_attachment   HccaDMA;
@@ -399,6 +403,15 @@ OhciTdIo(
     _In_ uintptr_t                  Address,
     _In_ size_t                     Length);
 
+/* OhciTdSetTransfer
+ * Records the transfer that a td or isochronous td belongs to, this is what allows
+ * the done queue to be mapped back to transfers. */
+__EXTERN void
+OhciTdSetTransfer(
+    _In_ OhciController_t*          Controller,
+    _In_ uint8_t*                   Td,
+    _In_ UUId_t                     TransferId);
+
 /* OhciTdDump
  * Dumps the information contained in the descriptor by writing it. */
 __EXTERN void
@@ -490,6 +503,13 @@ OhciTransactionDispatch(
     _In_ OhciController_t*      Controller,
     _In_ UsbManagerTransfer_t*  Transfer);
 
+/* OhciProcessDoneQueue
+ * Retires the transfers of the tds that the controller has written to the done queue,
+ * and acknowledges the done queue so the controller can write the next one. */
+__EXTERN void
+OhciProcessDoneQueue(
+    _In_ OhciController_t*      Controller);
+
 /* OhciGetStatusCode
  * Retrieves a status-code from a given condition code */
 __EXTERN UsbTransferStatus_t
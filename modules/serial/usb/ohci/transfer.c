@@ -160,6 +160,100 @@ HciTransactionFinalize(
     return OsSuccess;
 }
 
+int
+HciTransferRetired(
+    _In_ UsbManagerController_t* Controller,
+    _In_ UsbManagerTransfer_t*   Transfer)
+{
+    OhciQueueHead_t* Qh = (OhciQueueHead_t*)Transfer->EndpointDescriptor;
+    reg32_t          Current;
+
+    if (!Qh) {
+        return 1;
+    }
+
+    // The controller retires tds from the head of the endpoint, the endpoint is done
+    // when the head reaches the null td at the tail, or is halted by a failed td
+    Current = READ_VOLATILE(Qh->Current);
+    if (Current & OHCI_LINK_HALTED) {
+        return 1;
+    }
+    return ((Current & ~0xF) == (READ_VOLATILE(Qh->EndPointer) & ~0xF)) ? 1 : 0;
+}
+
+static UUId_t*
+OhciGetTdTransfer(
+    _In_ OhciController_t* Controller,
+    _In_ uint8_t*          Td)
+{
+    UsbSchedulerPool_t* Pool;
+    size_t              Index;
+
+    if (UsbSchedulerGetPoolFromElement(Controller->Base.Scheduler, Td, &Pool) != OsSuccess) {
+        return NULL;
+    }
+
+    // Isochronous tds are allocated from the td pool, so go by the pool the address
+    // is inside and not by the type of td
+    Index = (size_t)(Td - Pool->ElementPool) / Pool->ElementAlignedSize;
+    if (Pool == &Controller->Base.Scheduler->Settings.Pools[OHCI_TD_POOL] && Index < OHCI_TD_COUNT) {
+        return &Controller->TdTransfers[Index];
+    }
+    if (Pool == &Controller->Base.Scheduler->Settings.Pools[OHCI_iTD_POOL] && Index < OHCI_iTD_COUNT) {
+        return &Controller->iTdTransfers[Index];
+    }
+    return NULL;
+}
+
+void
+OhciTdSetTransfer(
+    _In_ OhciController_t* Controller,
+    _In_ uint8_t*          Td,
+    _In_ UUId_t            TransferId)
+{
+    UUId_t* Owner = OhciGetTdTransfer(Controller, Td);
+    if (Owner) {
+        *Owner = TransferId;
+    }
+}
+
+void
+OhciProcessDoneQueue(
+    _In_ OhciController_t* Controller)
+{
+    reg32_t DoneHead;
+
+    // The controller does not write the done queue again before the event has been
+    // acknowledged, so the head must be read before that. The lowest bit is used to
+    // indicate other pending interrupts and is not part of the address
+    DoneHead = READ_VOLATILE(Controller->Hcca->HeadDone) & ~0xF;
+    WRITE_VOLATILE(Controller->Hcca->HeadDone, 0);
+    WRITE_VOLATILE(Controller->Registers->HcInterruptStatus, OHCI_PROCESS_EVENT);
+    WRITE_VOLATILE(Controller->Registers->HcInterruptEnable, OHCI_PROCESS_EVENT);
+
+    // The controller chains the retired tds by reusing their link field, the last td
+    // on the done queue has a zero link
+    while (DoneHead != 0) {
+        UsbManagerTransfer_t* Transfer;
+        uint8_t*              Td;
+        UUId_t*               Owner;
+
+        if (UsbSchedulerGetElementFromDma(Controller->Base.Scheduler, DoneHead, &Td) != OsSuccess) {
+            ERROR("[ohci] [done_queue] invalid td 0x%x on the done queue", DoneHead);
+            break;
+        }
+
+        Owner = OhciGetTdTransfer(Controller, Td);
+        if (Owner) {
+            Transfer = UsbManagerGetTransfer(&Controller->Base, *Owner);
+            if (Transfer) {
+                UsbManagerRetireTransfer(&Controller->Base, Transfer);
+            }
+        }
+        DoneHead = READ_VOLATILE(((OhciTransferDescriptor_t*)Td)->Link) & ~0xF;
+    }
+}
+
 OsStatus_t
 HciDequeueTransfer(
     _In_ UsbManagerTransfer_t* Transfer)
@@ -101,6 +101,7 @@ OhciTransferFill(
             Toggle = UsbManagerGetToggle(Transfer->DeviceId, &Transfer->Transfer.Address);
             TRACE("... address 0x%" PRIxIN ", length %u, toggle %i", Address, LODWORD(Length), Toggle);
             if (UsbSchedulerAllocateElement(Controller->Base.Scheduler, OHCI_TD_POOL, (uint8_t**)&Td) == OsSuccess) {
+                OhciTdSetTransfer(Controller, (uint8_t*)Td, Transfer->Id);
                 if (Type == USB_TRANSACTION_SETUP) {
                     TRACE("... setup packet");
                     Toggle = 0; // Initial toggle must ALWAYS be 0 for setup
@@ -202,9 +203,7 @@ HciQueueTransferGeneric(
     }
 
     // Store transaction in queue if it's not there already
-    if (list_find(&Controller->Base.TransactionList, (void*)(uintptr_t)Transfer->Id) == NULL) {
-        list_append(&Controller->Base.TransactionList, &Transfer->header);
-    }
+    UsbManagerRegisterTransfer(&Controller->Base, Transfer);
 
     // If it fails to queue up => restore toggle
     if (OhciTransferFill(Controller, Transfer) != OsSuccess) {
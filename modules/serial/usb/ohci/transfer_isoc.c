@@ -69,6 +69,7 @@ OhciTransferFill(
             Transfer->Transactions[0].SgIndex].address + Transfer->Transactions[0].SgOffset;
         
         if (UsbSchedulerAllocateElement(Controller->Base.Scheduler, OHCI_TD_POOL, (uint8_t**)&iTd) == OsSuccess) {
+            OhciTdSetTransfer(Controller, (uint8_t*)iTd, Transfer->Id);
             OhciTdIsochronous(iTd, Transfer->Transfer.MaxPacketSize, 
                 (Type == USB_TRANSACTION_IN ? OHCI_TD_IN : OHCI_TD_OUT), AddressPointer, BytesStep);
         }
@@ -142,9 +143,7 @@ HciQueueTransferIsochronous(
     }
 
     // Store transaction in queue if it's not there already
-    if (list_find(&Controller->Base.TransactionList, (void*)(uintptr_t)Transfer->Id) == NULL) {
-        list_append(&Controller->Base.TransactionList, &Transfer->header);
-    }
+    UsbManagerRegisterTransfer(&Controller->Base, Transfer);
 
     // If it fails to queue up => restore toggle
     if (OhciTransferFill(Controller, Transfer) != OsSuccess) {
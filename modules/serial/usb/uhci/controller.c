@@ -180,6 +180,7 @@ HciTimerCallback(
     TRACE("HciTimerCallback()");
     UhciUpdateCurrentFrame((UhciController_t*)baseController);
     UhciPortsCheck((UhciController_t*)baseController);
+    UsbManagerProbeTransfers((UsbManagerController_t*)baseController);
     UsbManagerProcessTransfers((UsbManagerController_t*)baseController);
 }
 
@@ -66,6 +66,7 @@ HandleInterrupt:
     // in one of our transactions
     if (InterruptStatus & (UHCI_STATUS_USBINT | UHCI_STATUS_INTR_ERROR)) {
         UhciUpdateCurrentFrame(Controller);
+        UsbManagerProbeTransfers(&Controller->Base);
         UsbManagerProcessTransfers(&Controller->Base);
     }
 
@@ -45,6 +45,7 @@ UhciTransactionDispatch(
 
     UsbManagerIterateChain(&Controller->Base, Transfer->EndpointDescriptor, 
         USB_CHAIN_DEPTH, USB_REASON_LINK, HciProcessElement, Transfer);
+    UsbManagerActivateTransfer(&Controller->Base, Transfer);
     return TransferQueued;
 }
 
@@ -64,6 +65,34 @@ HciTransactionFinalize(
     return OsSuccess;
 }
 
+int
+HciTransferRetired(
+    _In_ UsbManagerController_t* Controller,
+    _In_ UsbManagerTransfer_t*   Transfer)
+{
+    UhciQueueHead_t*          Qh = (UhciQueueHead_t*)Transfer->EndpointDescriptor;
+    UhciTransferDescriptor_t* Td;
+    reg32_t                   Child;
+
+    // Isochronous transfers are not queued on a queue head, the endpoint descriptor
+    // is the first td of the transfer
+    if (!Qh || Transfer->Transfer.Type == USB_TRANSFER_ISOCHRONOUS) {
+        return 1;
+    }
+
+    // The controller moves the element pointer past every td that completes, and
+    // leaves it at a td that failed or came up short
+    Child = READ_VOLATILE(Qh->Child);
+    if (Child & UHCI_LINK_END) {
+        return 1;
+    }
+
+    if (UsbSchedulerGetElementFromDma(Controller->Scheduler, Child & ~0xF, (uint8_t**)&Td) != OsSuccess) {
+        return 1;
+    }
+    return (READ_VOLATILE(Td->Flags) & UHCI_TD_ACTIVE) ? 0 : 1;
+}
+
 OsStatus_t
 HciDequeueTransfer(
     _In_ UsbManagerTransfer_t* Transfer)
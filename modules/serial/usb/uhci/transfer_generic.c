@@ -278,9 +278,7 @@ HciQueueTransferGeneric(
     }
 
     // Store transaction in queue if it's not there already
-    if (list_find(&Controller->Base.TransactionList, (void*)(uintptr_t)Transfer->Id) == NULL) {
-        list_append(&Controller->Base.TransactionList, &Transfer->header);
-    }
+    UsbManagerRegisterTransfer(&Controller->Base, Transfer);
 
     // If it fails to queue up => restore toggle
     if (UhciTransferFill(Controller, Transfer) != OsSuccess) {
@@ -300,9 +298,7 @@ HciQueueTransferIsochronous(
     Transfer->Status = TransferNotProcessed;
 
     // Store transaction in queue if it's not there already
-    if (list_find(&Controller->Base.TransactionList, (void*)(uintptr_t)Transfer->Id) == NULL) {
-        list_append(&Controller->Base.TransactionList, &Transfer->header);
-    }
+    UsbManagerRegisterTransfer(&Controller->Base, Transfer);
     
     // Fill the transfer
     if (UhciTransferFillIsochronous(Controller, Transfer) != OsSuccess) {
@@ -42,6 +42,7 @@
 #define AHCI_REGISTER_VENDORSPEC        0xA0
 #define AHCI_REGISTER_PORTBASE(Port)    (0x100 + (Port * 0x80))
 #define AHCI_MAX_PORTS                  32
+#define AHCI_MAX_COMMAND_SLOTS          32
 #define AHCI_RECIEVED_FIS_SIZE          256
 
 PACKED_ATYPESTRUCT(volatile, AHCIGenericRegisters, {
@@ -311,6 +312,8 @@ PACKED_ATYPESTRUCT(volatile, AHCIFis, {
 #define AHCI_PORT_SSTS_DET_ENABLED          0x3
 #define AHCI_PORT_SSTS_DET_DISABLED         0x4
 
+struct AhciTransation;
+
 typedef struct _AhciPort {
     int                     Id;
     int                     Index;
@@ -325,7 +328,18 @@ typedef struct _AhciPort {
 
     _Atomic(int)            Slots;
     int                     SlotCount;
+    int                     QueueDepth;
+    reg32_t                 QueuedSlots;
+    struct AhciTransation*  SlotTransactions[AHCI_MAX_COMMAND_SLOTS];
+
+    // Queued commands that were aborted by an error, by their tag. They wait for the
+    // error log to tell which one of them failed.
+    struct AhciTransation*  AbortedTransactions[AHCI_MAX_COMMAND_SLOTS];
+
+    // Transactions waiting for a command slot, sorted by their next sector. They
+    // are dispatched in ascending order from the end of the last dispatched command.
     list_t                  Transactions;
+    uint64_t                NextSector;
 } AhciPort_t;
 
 /* AhciInterruptResource
@@ -427,6 +441,14 @@ AhciPortStartCommandSlot(
     _In_ AhciPort_t*        Port, 
     _In_ int                Slot);
 
+/* AhciPortStartQueuedCommandSlot
+ * Starts a native command queuing command on the given port, the slot number is
+ * used as the tag of the command. */
+__EXTERN void
+AhciPortStartQueuedCommandSlot(
+    _In_ AhciPort_t*        Port, 
+    _In_ int                Slot);
+
 /* AhciPortInterruptHandler
  * Handles port-specific interrupts. */
 __EXTERN void
@@ -64,19 +64,28 @@ DumpCurrentState(
         Port->Registers->AtaStatus);
 }
 
-static void
+static AHCICommandTable_t*
+GetCommandTable(
+    _In_ AhciPort_t* Port,
+    _In_ int         Slot)
+{
+    // Each command header has its own page of memory for the command table
+    return (AHCICommandTable_t*)((uint8_t*)Port->CommandTableDMA.buffer + (Slot * AHCI_COMMAND_TABLE_SIZE));
+}
+
+static int
 BuildPRDTTable(
-    _In_  AhciTransaction_t*  Transaction,
-    _In_  AHCICommandTable_t* CommandTable,
-    _In_  size_t              SectorSize,
-    _Out_ int*                PrdtCountOut)
+    _In_ AhciTransaction_t*  Transaction,
+    _In_ AHCICommandTable_t* CommandTable,
+    _In_ int                 PrdtIndex,
+    _In_ size_t              SectorSize)
 {
     size_t BytesQueued = 0;
     int    i;
     TRACE("Building PRDT Table");
     
     // Build PRDT entries
-    for (i = 0; i < AHCI_COMMAND_TABLE_PRDT_COUNT && Transaction->BytesLeft > 0; i++) {
+    for (i = PrdtIndex; i < AHCI_COMMAND_TABLE_PRDT_COUNT && Transaction->BytesLeft > 0; i++) {
         AHCIPrdtEntry_t* Prdt           = &CommandTable->PrdtEntry[i];
         uintptr_t        Address        = Transaction->DmaTable.entries[Transaction->SgIndex].address + Transaction->SgOffset;
         size_t           TransferLength = MIN(AHCI_PRDT_MAX_LENGTH, 
@@ -119,11 +128,8 @@ BuildPRDTTable(
         BytesQueued            += TransferLength;
     }
 
-    // Set IOC on the last PRDT entry
-    CommandTable->PrdtEntry[i].Descriptor |= AHCI_PRDT_IOC;
-    *PrdtCountOut                         = i;
-
-    TRACE("PRDT Count %u, Number of DW's %u", CommandHeader->TableLength, CommandHeader->Flags);
+    Transaction->BytesQueued = BytesQueued;
+    return i;
 }
 
 static size_t
@@ -135,21 +141,31 @@ PrepareCommandSlot(
     AHCICommandList_t*   CommandList;
     AHCICommandHeader_t* CommandHeader;
     AHCICommandTable_t*  CommandTable;
-    size_t               BytesQueued = Transaction->BytesLeft;
-    int                  PrdtCount;
+    AhciTransaction_t*   Member;
+    size_t               BytesQueued = 0;
+    int                  PrdtCount   = 0;
 
     // Get a reference to the command slot and reset the data in the command table
     CommandList   = (AHCICommandList_t*)Port->CommandListDMA.buffer;
-    CommandTable  = (AHCICommandTable_t*)Port->CommandTableDMA.buffer;
+    CommandTable  = GetCommandTable(Port, Transaction->Slot);
     CommandHeader = &CommandList->Headers[Transaction->Slot];
 
-    // Build the PRDT table
-    BuildPRDTTable(Transaction, CommandTable, SectorSize, &PrdtCount);
+    // Build the PRDT table, merged transactions continue where the previous one ended
+    for (Member = Transaction; Member != NULL; Member = Member->Merged) {
+        PrdtCount    = BuildPRDTTable(Member, CommandTable, PrdtCount, SectorSize);
+        BytesQueued += Member->BytesQueued;
+    }
+
+    // Set IOC on the last PRDT entry
+    if (PrdtCount) {
+        CommandTable->PrdtEntry[PrdtCount - 1].Descriptor |= AHCI_PRDT_IOC;
+    }
+    TRACE("PRDT Count %i, Bytes Queued %u", PrdtCount, BytesQueued);
 
     // Update command table to the new command
     CommandHeader->PRDByteCount = 0;
     CommandHeader->TableLength  = (uint16_t)(PrdtCount & 0xFFFF);
-    return BytesQueued - Transaction->BytesLeft;
+    return BytesQueued;
 }
 
 static OsStatus_t
@@ -186,7 +202,7 @@ DispatchCommand(
     }
 
     CommandList   = (AHCICommandList_t*)Port->CommandListDMA.buffer;
-    CommandTable  = (AHCICommandTable_t*)Port->CommandTableDMA.buffer;
+    CommandTable  = GetCommandTable(Port, Transaction->Slot);
     CommandHeader = &CommandList->Headers[Transaction->Slot];
 
     if (AtaCommand != NULL) {
@@ -219,7 +235,12 @@ DispatchCommand(
     CommandHeader->Flags |= (DISPATCH_MULTIPLIER(Flags) << 12);
     
     TRACE("Enabling command on slot %u", Transaction->Slot);
-    AhciPortStartCommandSlot(Port, Transaction->Slot);
+    if (Flags & DISPATCH_QUEUED) {
+        AhciPortStartQueuedCommandSlot(Port, Transaction->Slot);
+    }
+    else {
+        AhciPortStartCommandSlot(Port, Transaction->Slot);
+    }
 
 #ifdef __TRACE
     // Dump state
@@ -263,6 +284,14 @@ ComposeRegisterFIS(
     Fis->Command = LOBYTE(Transaction->Command);
     Fis->Device  = 0x40 | ((LOBYTE(DeviceLUN) & 0x1) << 4);
     Fis->Count   = (uint16_t)SectorCount;
+
+    // Queued commands carry the sector count in the features register, and the
+    // tag of the command in bits 3-7 of the count register
+    if (Transaction->Queued) {
+        Fis->FeaturesLow  = LOBYTE(SectorCount);
+        Fis->FeaturesHigh = (uint8_t)((SectorCount >> 8) & 0xFF);
+        Fis->Count        = (uint16_t)((Transaction->Slot & 0x1F) << 3);
+    }
     
     // Handle LBA to CHS translation if disk uses
     // the CHS scheme
@@ -317,5 +346,9 @@ AhciDispatchRegisterFIS(
     if (Transaction->Direction == AHCI_XACTION_OUT) {
         Flags |= DISPATCH_WRITE;
     }
+
+    if (Transaction->Queued) {
+        Flags |= DISPATCH_QUEUED;
+    }
     return DispatchCommand(Controller, Port, Transaction, Flags, &Fis, sizeof(FISRegisterH2D_t), NULL, 0);
 }
@@ -36,6 +36,7 @@
 #define DISPATCH_PREFETCH               0x20
 #define DISPATCH_CLEARBUSY              0x40
 #define DISPATCH_ATAPI                  0x80
+#define DISPATCH_QUEUED                 0x100
 
 /**
  * AhciDispatchRegisterFIS 
@@ -174,14 +174,15 @@ AhciManagerRegisterDevice(
         return OsOutOfMemory;
     }
     
-    Status = AhciTransactionControlCreate(Device, AtaPIOIdentifyDevice,
+    // The device must be registered before the identify command can complete
+    list_append(&devices, &Device->header);
+    Status = AhciTransactionControlCreate(Device, AtaPIOIdentifyDevice, 0,
         sizeof(ATAIdentify_t), AHCI_XACTION_IN);
     if (Status != OsSuccess) {
+        list_remove(&devices, &Device->header);
         free(Device);
         return Status;
     }
-
-    list_append(&devices, &Device->header);
     return OsSuccess;
 }
 
@@ -266,6 +267,16 @@ HandleIdentifyCommand(
         device->AddressingMode = 0; // CHS
     }
 
+    // Native command queuing is only used for LBA48 dma transfers, and the slot number
+    // is the tag of the command, so the port may not use more slots than the queue depth
+    if ((deviceInformation->SataCapabilities & (1 << 8)) && device->HasDMAEngine &&
+        device->AddressingMode == 2 &&
+        (READ_VOLATILE(device->Controller->Registers->Capabilities) & AHCI_CAPABILITIES_SNCQ)) {
+        device->HasNCQ           = 1;
+        device->QueueDepth       = (deviceInformation->QueueDepth & 0x1F) + 1;
+        device->Port->QueueDepth = MIN(device->QueueDepth, device->Port->SlotCount);
+    }
+
     // Calculate sector size if neccessary
     if (deviceInformation->SectorSize & (1 << 12)) {
         device->SectorSize = deviceInformation->WordsPerLogicalSector * 2;
@@ -322,6 +333,10 @@ AhciManagerHandleControlResponse(
         case AtaPIOIdentifyDevice: {
             HandleIdentifyCommand(Device);
         } break;
+
+        case AtaPIOReadLogExt: {
+            AhciTransactionHandleErrorLog(Port, Transaction);
+        } break;
         
         default: {
             WARNING("Unsupported ATA command 0x%x", Transaction->Command);
@@ -329,6 +344,33 @@ AhciManagerHandleControlResponse(
     }
 }
 
+void
+AhciManagerHandleQueuedError(
+    _In_ AhciController_t* Controller,
+    _In_ AhciPort_t*       Port)
+{
+    AhciDevice_t* Device = NULL;
+    OsStatus_t    Status;
+
+    foreach(Node, &devices) {
+        AhciDevice_t* _Device = (AhciDevice_t*)Node;
+        if (_Device->Port == Port) {
+            Device = _Device;
+            break;
+        }
+    }
+    
+    if (!Device) {
+        return;
+    }
+
+    // The log address is given in the low byte of the sector
+    Status = AhciTransactionControlCreate(Device, AtaPIOReadLogExt, AHCI_LOG_NCQ_ERROR,
+        Device->SectorSize, AHCI_XACTION_IN);
+    if (Status != OsSuccess) {
+        ERROR("AHCI::Port (%i): failed to read the queued error log: %u", Port->Id, Status);
+    }
+}
 
 void ctt_storage_stat_callback(struct gracht_recv_message* message, struct ctt_storage_stat_args* args)
 {
@@ -60,6 +60,8 @@ typedef struct AhciDevice {
 
     DeviceType_t      Type;
     int               HasDMAEngine;
+    int               HasNCQ;
+    int               QueueDepth;
     size_t            SectorSize;
     uint64_t          SectorCount;
     
@@ -75,6 +77,21 @@ typedef struct AhciDevice {
 #define AHCI_DEVICE_MODE_LBA28  1
 #define AHCI_DEVICE_MODE_LBA48  2
 
+// The log page that must be read after a queued command has failed, reading it
+// clears the error state of the device
+#define AHCI_LOG_NCQ_ERROR      0x10
+
+// The start of the queued error log page, the tag is only valid when NQ is clear
+#define AHCI_LOG_NCQ_NQ         0x80
+#define AHCI_LOG_NCQ_TAG(Tag)   ((Tag) & 0x1F)
+
+typedef struct AhciNcqErrorLog {
+    uint8_t Tag;
+    uint8_t Reserved;
+    uint8_t Status;
+    uint8_t Error;
+} AhciNcqErrorLog_t;
+
 typedef struct AhciTransation {
     element_t             header;
     int                   Internal;
@@ -82,6 +99,7 @@ typedef struct AhciTransation {
     TransactionType_t     Type;
     AtaCommand_t          Command;
     int                   Slot;
+    int                   Queued;
     int                   Direction;
     AHCIFis_t             Response;
     struct dma_attachment DmaAttachment;
@@ -96,10 +114,15 @@ typedef struct AhciTransation {
     uint64_t              Sector;
     size_t                SectorsTransferred;
     int                   SectorAlignment;
+    size_t                MaxSectors;
     size_t                BytesLeft;
+    size_t                BytesQueued;
     
     int                   SgIndex;
     size_t                SgOffset;
+
+    // Adjacent transactions that are transferred by the same command
+    struct AhciTransation* Merged;
     
     struct vali_link_deferred_response DeferredMessage;
 } AhciTransaction_t;
@@ -118,6 +141,7 @@ __EXTERN size_t     AhciManagerGetFrameSize(void);
 __EXTERN OsStatus_t AhciManagerRegisterDevice(AhciController_t*, AhciPort_t*, uint32_t);
 __EXTERN void       AhciManagerUnregisterDevice(AhciController_t*, AhciPort_t*);
 __EXTERN void       AhciManagerHandleControlResponse(AhciPort_t*, AhciTransaction_t*);
+__EXTERN void       AhciManagerHandleQueuedError(AhciController_t*, AhciPort_t*);
 
 /**
  * AhciManagerGetDevice
@@ -131,14 +155,31 @@ AhciManagerGetDevice(
  * AhciTransactionControlCreate
  * @param Device  [In] The device that should handle the transaction.
  * @param Command [In] The transaction that should get queued up.
+ * @param Sector  [In] The sector, or log address, the command should target.
  */
 __EXTERN OsStatus_t
 AhciTransactionControlCreate(
     _In_ AhciDevice_t* Device,
     _In_ AtaCommand_t  Command,
+    _In_ uint64_t      Sector,
     _In_ size_t        Length,
     _In_ int           Direction);
 
+/**
+ * AhciTransactionStorageCreate
+ * Queues a storage transfer for the device. Waiting transfers that are adjacent on
+ * the disk are merged into a single command.
+ */
+__EXTERN OsStatus_t
+AhciTransactionStorageCreate(
+    _In_ AhciDevice_t*               device,
+    _In_ struct gracht_recv_message* message,
+    _In_ int                         direction,
+    _In_ uint64_t                    sector,
+    _In_ UUId_t                      bufferHandle,
+    _In_ unsigned int                bufferOffset,
+    _In_ size_t                      sectorCount);
+
 /** 
  * AhciDeviceCancelTransaction
  */
@@ -155,4 +196,15 @@ AhciTransactionHandleResponse(
     _In_ AhciPort_t*        Port,
     _In_ AhciTransaction_t* Transaction);
 
+/**
+ * AhciTransactionHandleErrorLog
+ * Resolves the queued commands that were aborted by a queued error, once the error log
+ * has been read by the given transaction. Only the command named by the log fails,
+ * the others are queued again.
+ */
+void
+AhciTransactionHandleErrorLog(
+    _In_ AhciPort_t*        Port,
+    _In_ AhciTransaction_t* Transaction);
+
 #endif //!_AHCI_MANAGER_H_
@@ -64,6 +64,9 @@ AhciPortCreate(
     AhciPort->Index     = Index;    // Index in validity map
     AhciPort->SlotCount = AHCI_CAPABILITIES_NCS(Controller->Registers->Capabilities);
 
+    // Only one command can be outstanding until we know the device supports queuing
+    AhciPort->QueueDepth = 1;
+
     // Allocate a transfer buffer for internal transactions
     DmaInfo.length   = AhciManagerGetFrameSize();
     DmaInfo.capacity = AhciManagerGetFrameSize();
@@ -88,11 +91,23 @@ AhciPortCleanup(
     _In_ AhciController_t* Controller, 
     _In_ AhciPort_t*       Port)
 {
+    int i;
+
     // Null out the port-entry in the controller
     Controller->Ports[Port->Index] = NULL;
 
     // Go through each transaction for the ports and clean up
     list_clear(&Port->Transactions, AhciPortCancelTransactionCallback, NULL);
+    for (i = 0; i < AHCI_MAX_COMMAND_SLOTS; i++) {
+        if (Port->SlotTransactions[i] != NULL) {
+            AhciManagerCancelTransaction(Port->SlotTransactions[i]);
+            Port->SlotTransactions[i] = NULL;
+        }
+        if (Port->AbortedTransactions[i] != NULL) {
+            AhciManagerCancelTransaction(Port->AbortedTransactions[i]);
+            Port->AbortedTransactions[i] = NULL;
+        }
+    }
     AhciManagerUnregisterDevice(Controller, Port);
     
     // Destroy the internal transfer buffer
@@ -362,8 +377,9 @@ AhciPortStart(
     free(DmaTable.entries);
 
     // Setup the interesting interrupts we want
+    // Queued commands complete with a set device bits FIS
     WRITE_VOLATILE(Port->Registers->InterruptEnable, (reg32_t)(AHCI_PORT_IE_CPDE | AHCI_PORT_IE_TFEE
-        | AHCI_PORT_IE_PCE | AHCI_PORT_IE_DSE | AHCI_PORT_IE_PSE | AHCI_PORT_IE_DHRE));
+        | AHCI_PORT_IE_PCE | AHCI_PORT_IE_SDBE | AHCI_PORT_IE_DSE | AHCI_PORT_IE_PSE | AHCI_PORT_IE_DHRE));
 
     // Make sure AHCI_PORT_CR and AHCI_PORT_FR is not set
     WaitForConditionWithFault(Hung, (
@@ -391,32 +407,44 @@ AhciPortStartCommandSlot(
     WRITE_VOLATILE(Port->Registers->CommandIssue, (1 << Slot));
 }
 
+void
+AhciPortStartQueuedCommandSlot(
+    _In_ AhciPort_t* Port, 
+    _In_ int         Slot)
+{
+    // The tag must be marked active before the command is issued
+    Port->QueuedSlots |= (1 << Slot);
+    WRITE_VOLATILE(Port->Registers->AtaActive, (1 << Slot));
+    WRITE_VOLATILE(Port->Registers->CommandIssue, (1 << Slot));
+}
+
 OsStatus_t
 AhciPortAllocateCommandSlot(
     _In_  AhciPort_t* Port,
     _Out_ int*        SlotOut)
 {
-    OsStatus_t Status = OsError;
-    int        Slots;
-    int        i;
+    int SlotCount = MIN(Port->SlotCount, Port->QueueDepth);
+    int Slots;
+    int i;
     
-    while (Status != OsSuccess) {
-        Slots = atomic_load(&Port->Slots);
-        
-        for (i = 0; i < Port->SlotCount; i++) {
-            // Check availability status on this command slot
-            if (Slots & (1 << i)) {
-                continue;
-            }
+    // The slot number is used as the tag for queued commands, so slots are only
+    // allocated below the queue depth of the device
+    Slots = atomic_load(&Port->Slots);
+    for (i = 0; i < SlotCount; i++) {
+        // Check availability status on this command slot
+        if (Slots & (1 << i)) {
+            continue;
+        }
 
-            if (atomic_compare_exchange_strong(&Port->Slots, &Slots, Slots | (1 << i))) {
-                Status   = OsSuccess;
-                *SlotOut = i;
-            }
-            break;
+        if (atomic_compare_exchange_strong(&Port->Slots, &Slots, Slots | (1 << i))) {
+            *SlotOut = i;
+            return OsSuccess;
         }
+
+        // Another slot was taken meanwhile, start over
+        i = -1;
     }
-    return Status;
+    return OsError;
 }
 
 void
@@ -424,7 +452,57 @@ AhciPortFreeCommandSlot(
     _In_ AhciPort_t* Port,
     _In_ int         Slot)
 {
-    
+    Port->SlotTransactions[Slot] = NULL;
+    Port->QueuedSlots           &= ~(1 << Slot);
+    atomic_fetch_and(&Port->Slots, ~(1 << Slot));
+}
+
+/* AhciPortRestartCommandEngine
+ * Restarts the command engine after a task file error. Stopping the engine clears
+ * all outstanding commands on the port. */
+static void
+AhciPortRestartCommandEngine(
+    _In_ AhciPort_t* Port)
+{
+    reg32_t Status = READ_VOLATILE(Port->Registers->CommandAndStatus);
+    int     Hung   = 0;
+
+    WRITE_VOLATILE(Port->Registers->CommandAndStatus, Status & ~AHCI_PORT_ST);
+    WaitForConditionWithFault(Hung, (READ_VOLATILE(Port->Registers->CommandAndStatus) & AHCI_PORT_CR) == 0, 6, 100);
+    if (Hung) {
+        ERROR(" > failed to stop command engine: 0x%x", Port->Registers->CommandAndStatus);
+        return;
+    }
+
+    WRITE_VOLATILE(Port->Registers->AtaError, 0xFFFFFFFF);
+    Status = READ_VOLATILE(Port->Registers->CommandAndStatus);
+    WRITE_VOLATILE(Port->Registers->CommandAndStatus, Status | AHCI_PORT_ST);
+}
+
+/* AhciPortAbortQueuedCommands
+ * Releases the slots of the queued commands that were aborted by an error. The commands
+ * are held by their tag until the error log tells which one of them failed. */
+static void
+AhciPortAbortQueuedCommands(
+    _In_ AhciPort_t* Port,
+    _In_ reg32_t     Commands)
+{
+    AhciTransaction_t* Transaction;
+    int                i;
+
+    for (i = 0; Commands != 0 && i < AHCI_MAX_COMMAND_SLOTS; i++) {
+        if (!(Commands & (1 << i))) {
+            continue;
+        }
+
+        Commands   &= ~(1 << i);
+        Transaction = Port->SlotTransactions[i];
+        assert(Transaction != NULL);
+
+        AhciPortFreeCommandSlot(Port, i);
+        Transaction->Slot            = -1;
+        Port->AbortedTransactions[i] = Transaction;
+    }
 }
 
 void
@@ -434,7 +512,11 @@ AhciPortInterruptHandler(
 {
     AhciTransaction_t* Transaction;
     reg32_t            InterruptStatus;
+    reg32_t            ActiveCommands;
     reg32_t            DoneCommands;
+    reg32_t            FailedCommands;
+    reg32_t            TaskFileData;
+    int                QueuedError;
     int                i;
     
     // Check interrupt services 
@@ -445,12 +527,35 @@ AhciPortInterruptHandler(
 HandleInterrupt:
     InterruptStatus = Controller->InterruptResource.PortInterruptStatus[Port->Index];
     Controller->InterruptResource.PortInterruptStatus[Port->Index] = 0;
+    DoneCommands    = 0;
+    FailedCommands  = 0;
+    QueuedError     = 0;
+    TaskFileData    = 0;
     
     // Check for errors status's
     if (InterruptStatus & (AHCI_PORT_IE_TFEE | AHCI_PORT_IE_HBFE 
         | AHCI_PORT_IE_HBDE | AHCI_PORT_IE_IFE | AHCI_PORT_IE_INFE)) {
         if (InterruptStatus & AHCI_PORT_IE_TFEE) {
-            PrintTaskDataErrorString(HIBYTE(Port->Registers->TaskFileData));
+            // The command engine must be restarted before anything else can be issued,
+            // which clears CommandIssue and AtaActive, so the commands that were still
+            // outstanding are read first. Those that finished are completed normally.
+            TaskFileData   = READ_VOLATILE(Port->Registers->TaskFileData);
+            ActiveCommands = atomic_load(&Port->Slots) & (READ_VOLATILE(Port->Registers->CommandIssue) |
+                READ_VOLATILE(Port->Registers->AtaActive));
+            DoneCommands   = atomic_load(&Port->Slots) & ~ActiveCommands;
+            PrintTaskDataErrorString(HIBYTE(TaskFileData));
+            AhciPortRestartCommandEngine(Port);
+
+            // A command that is not queued runs alone, so it is the one that failed. The
+            // device aborts every queued command instead, and only the error log tells
+            // which one of them failed
+            if (Port->QueuedSlots != 0) {
+                QueuedError = 1;
+                AhciPortAbortQueuedCommands(Port, ActiveCommands);
+            }
+            else {
+                FailedCommands = ActiveCommands;
+            }
         }
         else {
             ERROR("AHCI::Port ERROR %i, CMD: 0x%x, CI 0x%x, IE: 0x%x, IS 0x%x, TFD: 0x%x", Port->Id,
@@ -477,29 +582,51 @@ HandleInterrupt:
         }
     }
 
-    // Get completed commands, by using our own slot-status
-    DoneCommands = atomic_load(&Port->Slots) ^ READ_VOLATILE(Port->Registers->AtaActive);
-    TRACE("DoneCommands(0x%x) <= SlotStatus(0x%x) ^ AtaActive(0x%x)", 
-        DoneCommands, atomic_load(&Port->Slots), Port->Registers->AtaActive);
+    // Get completed commands, by using our own slot-status. Queued commands are
+    // done when their bit in AtaActive clears, other commands when CommandIssue clears.
+    // After an error the registers have been cleared, so they were read before that
+    if (!(InterruptStatus & AHCI_PORT_IE_TFEE)) {
+        DoneCommands = atomic_load(&Port->Slots) & ~(READ_VOLATILE(Port->Registers->CommandIssue) |
+            READ_VOLATILE(Port->Registers->AtaActive));
+    }
+    DoneCommands |= FailedCommands;
+    TRACE("DoneCommands(0x%x) <= SlotStatus(0x%x), AtaActive(0x%x), CommandIssue(0x%x)", 
+        DoneCommands, atomic_load(&Port->Slots), Port->Registers->AtaActive, Port->Registers->CommandIssue);
+
+    // The device refuses new queued commands until the error log has been read, so
+    // the log is read before any of the waiting transactions are dispatched
+    if (QueuedError) {
+        AhciManagerHandleQueuedError(Controller, Port);
+    }
 
     // Check for command completion
     // by iterating through the command slots
-    if (DoneCommands != 0) {
-        for (i = 0; i < AHCI_MAX_PORTS; i++) {
-            if (DoneCommands & (1 << i)) {
-                Transaction = (AhciTransaction_t*)list_find_value(&Port->Transactions, (void*)(uintptr_t)i);
-                assert(Transaction != NULL);
-
-                // Handle transaction completion, release slot, queue up a new command if any
-                // and then handle the event
-                list_remove(&Port->Transactions, &Transaction->header);
-                memcpy((void*)&Transaction->Response, Port->RecievedFisDMA.buffer, sizeof(AHCIFis_t));
-                AhciPortFreeCommandSlot(Port, Transaction->Slot);
-                Transaction->Slot = -1;
-
-                AhciTransactionHandleResponse(Controller, Port, Transaction);
-            }
+    for (i = 0; DoneCommands != 0 && i < AHCI_MAX_COMMAND_SLOTS; i++) {
+        if (!(DoneCommands & (1 << i))) {
+            continue;
+        }
+
+        DoneCommands &= ~(1 << i);
+        Transaction   = Port->SlotTransactions[i];
+        assert(Transaction != NULL);
+
+        // The register FIS is only written for commands that are not queued, queued
+        // commands are completed by a set device bits FIS that covers many commands
+        memcpy((void*)&Transaction->Response, Port->RecievedFisDMA.buffer, sizeof(AHCIFis_t));
+        if (FailedCommands & (1 << i)) {
+            Transaction->Response.RegisterD2H.Status = ATA_STS_DEV_ERROR;
+            Transaction->Response.RegisterD2H.Error  = HIBYTE(TaskFileData);
+        }
+        else if (Transaction->Queued) {
+            Transaction->Response.RegisterD2H.Status = ATA_STS_DEV_READY;
+            Transaction->Response.RegisterD2H.Error  = 0;
         }
+
+        // Release the slot before handling the response, so the next transaction
+        // can be dispatched into it
+        AhciPortFreeCommandSlot(Port, i);
+        Transaction->Slot = -1;
+        AhciTransactionHandleResponse(Controller, Port, Transaction);
     }
 
     // Re-handle?
@@ -43,7 +43,11 @@ static struct {
     AtaCommand_t Command;
     size_t       SectorAlignment;
     size_t       MaxSectors;
+    int          Queued;
 } CommandTable[] = {
+    { __STORAGE_OPERATION_READ, 1, 2, AtaFPDMAReadQueued, 1, 0xFFFF, 1 },
+    { __STORAGE_OPERATION_WRITE, 1, 2, AtaFPDMAWriteQueued, 1, 0xFFFF, 1 },
+
     { __STORAGE_OPERATION_READ, 0, 2, AtaPIOReadExt, 1, 0xFFFF },
     { __STORAGE_OPERATION_READ, 0, 1, AtaPIORead, 1, 0xFF },
     { __STORAGE_OPERATION_READ, 0, 0, AtaPIORead, 1, 0xFF },
@@ -61,62 +65,274 @@ static struct {
 };
 
 static OsStatus_t
-QueueTransaction(
-    _In_ AhciController_t*  Controller,
+AhciTransactionDestroy(
+    _In_ AhciTransaction_t* Transaction)
+{
+    // Detach from our buffer reference
+    dma_detach(&Transaction->DmaAttachment);
+    free(Transaction->DmaTable.entries);
+    free(Transaction);
+    return OsSuccess;
+}
+
+static uint64_t
+GetTransactionPosition(
+    _In_ AhciTransaction_t* Transaction)
+{
+    return Transaction->Sector + Transaction->SectorsTransferred;
+}
+
+static size_t
+GetChainSectors(
+    _In_ AhciTransaction_t* Transaction)
+{
+    size_t Sectors = 0;
+
+    for (; Transaction != NULL; Transaction = Transaction->Merged) {
+        Sectors += Transaction->BytesLeft / Transaction->Target.SectorSize;
+    }
+    return Sectors;
+}
+
+static int
+GetChainPrdtCount(
+    _In_ AhciTransaction_t* Transaction)
+{
+    int Count = 0;
+
+    for (; Transaction != NULL; Transaction = Transaction->Merged) {
+        size_t BytesLeft = Transaction->BytesLeft;
+        size_t Offset    = Transaction->SgOffset;
+        int    Index     = Transaction->SgIndex;
+
+        while (BytesLeft && Index < Transaction->DmaTable.count) {
+            size_t Length = MIN(BytesLeft, Transaction->DmaTable.entries[Index].length - Offset);
+            Count     += (int)DIVUP(Length, AHCI_PRDT_MAX_LENGTH);
+            BytesLeft -= Length;
+            Offset     = 0;
+            Index++;
+        }
+    }
+    return Count;
+}
+
+/* MergeTransactions
+ * Lets the second transaction be transferred by the command of the first one, if it
+ * starts where the first one ends. The merged command must complete in one round, so
+ * only transactions that have not been started, and that fit a single command table,
+ * are merged. */
+static int
+MergeTransactions(
+    _In_ AhciTransaction_t* First,
+    _In_ AhciTransaction_t* Second)
+{
+    AhciTransaction_t* Last         = First;
+    size_t             FirstSectors = GetChainSectors(First);
+
+    if (First->Internal || Second->Internal ||
+        First->SectorsTransferred || Second->SectorsTransferred ||
+        First->Command != Second->Command) {
+        return 0;
+    }
+
+    if ((GetTransactionPosition(First) + FirstSectors) != GetTransactionPosition(Second) ||
+        (FirstSectors + GetChainSectors(Second)) > First->MaxSectors ||
+        (GetChainPrdtCount(First) + GetChainPrdtCount(Second)) > AHCI_COMMAND_TABLE_PRDT_COUNT) {
+        return 0;
+    }
+
+    while (Last->Merged) {
+        Last = Last->Merged;
+    }
+    Last->Merged = Second;
+    return 1;
+}
+
+/* RewindTransaction
+ * Gives back the bytes that were queued by a command that was aborted, so the next
+ * command transfers them again. */
+static void
+RewindTransaction(
+    _In_ AhciTransaction_t* Transaction)
+{
+    for (; Transaction != NULL; Transaction = Transaction->Merged) {
+        size_t Length = Transaction->BytesQueued;
+
+        Transaction->BytesLeft  += Length;
+        Transaction->BytesQueued = 0;
+        while (Length) {
+            size_t Step;
+
+            if (Transaction->SgOffset == 0) {
+                Transaction->SgIndex--;
+                Transaction->SgOffset = Transaction->DmaTable.entries[Transaction->SgIndex].length;
+            }
+
+            Step                   = MIN(Length, Transaction->SgOffset);
+            Transaction->SgOffset -= Step;
+            Length                -= Step;
+        }
+    }
+}
+
+static void
+InsertTransaction(
     _In_ AhciPort_t*        Port,
     _In_ AhciTransaction_t* Transaction)
 {
-    OsStatus_t status;
-    
-    // OK so the transaction we just recieved needs to be queued up,
-    // so we must initally see if we can allocate a new slot on the port
-    status = AhciPortAllocateCommandSlot(Port, &Transaction->Slot);
-    list_append(&Port->Transactions, &Transaction->header);
-    if (status != OsSuccess) {
-        Transaction->State = TransactionQueued;
-        return OsSuccess;
+    element_t*         Next     = list_front(&Port->Transactions);
+    AhciTransaction_t* Previous = NULL;
+    uint64_t           Position = GetTransactionPosition(Transaction);
+
+    Transaction->State = TransactionQueued;
+
+    // Control transactions are dispatched before any waiting transfers
+    if (Transaction->Internal) {
+        list_insert_before(&Port->Transactions, Next, &Transaction->header);
+        return;
     }
-    
-    // If we reach here we've successfully allocated a slot, now we should dispatch 
-    // the transaction
-    Transaction->State = TransactionInProgress;
-    switch (Transaction->Type) {
-        case TransactionRegisterFISH2D: {
-            status = AhciDispatchRegisterFIS(Controller, Port, Transaction);
-        } break;
-        
-        default: {
-            assert(0);
-        } break;
+
+    // Find the first waiting transfer that starts after this one
+    while (Next != NULL) {
+        AhciTransaction_t* Waiting = (AhciTransaction_t*)Next->value;
+        if (!Waiting->Internal) {
+            if (GetTransactionPosition(Waiting) > Position) {
+                break;
+            }
+            Previous = Waiting;
+        }
+        Next = Next->next;
     }
-    
-    if (status != OsSuccess) {
+
+    // Join the transfer that ends where this one starts, this may also close the gap
+    // to the transfer that follows
+    if (Previous != NULL && MergeTransactions(Previous, Transaction)) {
+        if (Next != NULL && MergeTransactions(Previous, (AhciTransaction_t*)Next->value)) {
+            list_remove(&Port->Transactions, Next);
+        }
+        return;
+    }
+
+    // Otherwise lead the transfer that starts where this one ends
+    if (Next != NULL && MergeTransactions(Transaction, (AhciTransaction_t*)Next->value)) {
+        element_t* Following = Next->next;
+        list_remove(&Port->Transactions, Next);
+        Next = Following;
+    }
+    list_insert_before(&Port->Transactions, Next, &Transaction->header);
+}
+
+static AhciTransaction_t*
+GetNextTransaction(
+    _In_ AhciPort_t* Port)
+{
+    element_t* Front = list_front(&Port->Transactions);
+
+    if (!Front || ((AhciTransaction_t*)Front->value)->Internal) {
+        return Front ? (AhciTransaction_t*)Front->value : NULL;
+    }
+
+    // Continue upwards from where the previous command ended, and start over from
+    // the lowest sector when nothing is waiting above it
+    foreach(Element, &Port->Transactions) {
+        AhciTransaction_t* Transaction = (AhciTransaction_t*)Element->value;
+        if (GetTransactionPosition(Transaction) >= Port->NextSector) {
+            return Transaction;
+        }
+    }
+    return (AhciTransaction_t*)Front->value;
+}
+
+static void
+CompleteTransaction(
+    _In_ AhciPort_t*        Port,
+    _In_ AhciTransaction_t* Transaction,
+    _In_ OsStatus_t         Status)
+{
+    AhciTransaction_t* Merged;
+
+    while (Transaction != NULL) {
+        Merged = Transaction->Merged;
+        if (Transaction->Internal) {
+            AhciManagerHandleControlResponse(Port, Transaction);
+        }
+        else {
+            ctt_storage_transfer_response(&Transaction->DeferredMessage.recv_message,
+                Status, Transaction->SectorsTransferred);
+        }
+        AhciTransactionDestroy(Transaction);
+        Transaction = Merged;
+    }
+}
+
+/* DispatchTransactions
+ * Moves waiting transactions into free command slots until the port is out of slots.
+ * Commands that are not queued can not run alongside any other command, so they wait
+ * for the port to drain, and queued commands wait for them in turn. */
+static void
+DispatchTransactions(
+    _In_ AhciController_t* Controller,
+    _In_ AhciPort_t*       Port)
+{
+    AhciTransaction_t* Transaction;
+    OsStatus_t         Status;
+    int                Slots;
+
+    while ((Transaction = GetNextTransaction(Port)) != NULL) {
+        Slots = atomic_load(&Port->Slots);
+        if ((!Transaction->Queued && Slots) || (Slots & ~Port->QueuedSlots)) {
+            break;
+        }
+
+        if (AhciPortAllocateCommandSlot(Port, &Transaction->Slot) != OsSuccess) {
+            break;
+        }
+
         list_remove(&Port->Transactions, &Transaction->header);
-        AhciPortFreeCommandSlot(Port, Transaction->Slot);
+        Port->SlotTransactions[Transaction->Slot] = Transaction;
+        if (!Transaction->Internal) {
+            Port->NextSector = GetTransactionPosition(Transaction) + GetChainSectors(Transaction);
+        }
+
+        Transaction->State = TransactionInProgress;
+        switch (Transaction->Type) {
+            case TransactionRegisterFISH2D: {
+                Status = AhciDispatchRegisterFIS(Controller, Port, Transaction);
+            } break;
+            
+            default: {
+                assert(0);
+                Status = OsNotSupported;
+            } break;
+        }
+
+        if (Status != OsSuccess) {
+            AhciPortFreeCommandSlot(Port, Transaction->Slot);
+            Transaction->Slot = -1;
+            CompleteTransaction(Port, Transaction, Status);
+        }
     }
-    return status;
 }
 
-static OsStatus_t
-AhciTransactionDestroy(
+static void
+QueueTransaction(
+    _In_ AhciController_t*  Controller,
+    _In_ AhciPort_t*        Port,
     _In_ AhciTransaction_t* Transaction)
 {
-    // Detach from our buffer reference
-    dma_detach(&Transaction->DmaAttachment);
-    free(Transaction->DmaTable.entries);
-    free(Transaction);
-    return OsSuccess;
+    InsertTransaction(Port, Transaction);
+    DispatchTransactions(Controller, Port);
 }
 
 OsStatus_t
 AhciTransactionControlCreate(
     _In_ AhciDevice_t* Device,
     _In_ AtaCommand_t  Command,
+    _In_ uint64_t      Sector,
     _In_ size_t        Length,
     _In_ int           Direction)
 {
     AhciTransaction_t* transaction;
-    OsStatus_t         status;
     UUId_t             transactionId;
     
     if (!Device) {
@@ -141,6 +357,7 @@ AhciTransactionControlCreate(
     transaction->State     = TransactionCreated;
     transaction->Slot      = -1;
     transaction->Command   = Command;
+    transaction->Sector    = Sector;
     transaction->BytesLeft = Length;
     transaction->Direction = Direction;
 
@@ -149,11 +366,8 @@ AhciTransactionControlCreate(
     transaction->Target.AddressingMode = Device->AddressingMode;
     
     // The transaction is now prepared and ready for the dispatch
-    status = QueueTransaction(Device->Controller, Device->Port, transaction);
-    if (status != OsSuccess) {
-        AhciTransactionDestroy(transaction);
-    }
-    return status;
+    QueueTransaction(Device->Controller, Device->Port, transaction);
+    return OsSuccess;
 }
 
 OsStatus_t
@@ -227,10 +441,13 @@ AhciTransactionStorageCreate(
     while (CommandTable[i].Direction != -1) {
         if (CommandTable[i].Direction      == direction &&
             CommandTable[i].DMA            == device->HasDMAEngine &&
-            CommandTable[i].AddressingMode == device->AddressingMode) {
+            CommandTable[i].AddressingMode == device->AddressingMode &&
+            CommandTable[i].Queued         == device->HasNCQ) {
             // Found the appropriate command
             transaction->Command         = CommandTable[i].Command;
+            transaction->Queued          = CommandTable[i].Queued;
             transaction->SectorAlignment = CommandTable[i].SectorAlignment;
+            transaction->MaxSectors      = CommandTable[i].MaxSectors;
             transaction->BytesLeft       = MIN(sectorCount, CommandTable[i].MaxSectors) * device->SectorSize;
             break;
         }
@@ -241,12 +458,10 @@ AhciTransactionStorageCreate(
     assert(CommandTable[i].Direction != -1);
     assert(transaction->BytesLeft != 0);
     
-    // The transaction is now prepared and ready for the dispatch
-    status = QueueTransaction(device->Controller, device->Port, transaction);
-    if (status != OsSuccess) {
-        AhciTransactionDestroy(transaction);
-    }
-    return status;
+    // The transaction is now prepared and ready for the dispatch, waiting transactions
+    // that are adjacent to it are merged with it
+    QueueTransaction(device->Controller, device->Port, transaction);
+    return OsSuccess;
 }
 
 void ctt_storage_transfer_async_callback(struct gracht_recv_message* message, struct ctt_storage_transfer_async_args* args)
@@ -293,7 +508,8 @@ VerifyRegisterFISD2H(
     _In_ AhciPort_t*        Port,
     _In_ AhciTransaction_t* Transaction)
 {
-    FISRegisterD2H_t* Result = (FISRegisterD2H_t*)&Transaction->Response.RegisterD2H;
+    FISRegisterD2H_t*  Result = (FISRegisterD2H_t*)&Transaction->Response.RegisterD2H;
+    AhciTransaction_t* Member;
 
     // Is the error bit set?
     if (Result->Status & ATA_STS_DEV_ERROR) {
@@ -308,11 +524,54 @@ VerifyRegisterFISD2H(
         return OsError;
     }
     
-    // Increase the sector with the number of sectors transferred
-    Transaction->SectorsTransferred += Result->Count;
+    // Increase the sector with the number of sectors transferred, every member of
+    // the command has been transferred in full
+    for (Member = Transaction; Member != NULL; Member = Member->Merged) {
+        Member->SectorsTransferred += Member->BytesQueued / Member->Target.SectorSize;
+    }
     return OsSuccess;
 }
 
+void
+AhciTransactionHandleErrorLog(
+    _In_ AhciPort_t*        Port,
+    _In_ AhciTransaction_t* Transaction)
+{
+    AhciNcqErrorLog_t* Log    = (AhciNcqErrorLog_t*)Port->InternalBuffer.buffer;
+    reg32_t            Failed = 0;
+    AhciTransaction_t* Aborted;
+    int                i;
+
+    // Without the log there is no telling which command failed, and retrying them
+    // all could fail the same way again. The log was only read if its sector was.
+    if (!Transaction->SectorsTransferred) {
+        ERROR("AHCI::Port (%i): the queued error log could not be read", Port->Id);
+        Failed = 0xFFFFFFFF;
+    }
+    else if (!(Log->Tag & AHCI_LOG_NCQ_NQ)) {
+        TRACE("AhciTransactionHandleErrorLog() tag %u, status 0x%x",
+            AHCI_LOG_NCQ_TAG(Log->Tag), Log->Status);
+        PrintTaskDataErrorString(Log->Error);
+        Failed = 1 << AHCI_LOG_NCQ_TAG(Log->Tag);
+    }
+
+    for (i = 0; i < AHCI_MAX_COMMAND_SLOTS; i++) {
+        Aborted = Port->AbortedTransactions[i];
+        if (Aborted == NULL) {
+            continue;
+        }
+
+        Port->AbortedTransactions[i] = NULL;
+        if (Failed & (1 << i)) {
+            CompleteTransaction(Port, Aborted, OsError);
+        }
+        else {
+            RewindTransaction(Aborted);
+            InsertTransaction(Port, Aborted);
+        }
+    }
+}
+
 OsStatus_t
 AhciTransactionHandleResponse(
     _In_ AhciController_t*  Controller,
@@ -333,14 +592,13 @@ AhciTransactionHandleResponse(
 
     // Is the transaction finished? (Or did it error?)
     if (status != OsSuccess || Transaction->BytesLeft == 0) {
-        if (Transaction->Internal) {
-            AhciManagerHandleControlResponse(Port, Transaction);
-        }
-        else {
-            ctt_storage_transfer_response(&Transaction->DeferredMessage.recv_message,
-                status, Transaction->SectorsTransferred);
-        }
-        return AhciTransactionDestroy(Transaction);
+        CompleteTransaction(Port, Transaction, status);
     }
-    return QueueTransaction(Controller, Port, Transaction);
+    else {
+        InsertTransaction(Port, Transaction);
+    }
+
+    // The command slot has been released, so the next transaction can go
+    DispatchTransactions(Controller, Port);
+    return OsSuccess;
 }
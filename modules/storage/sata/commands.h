@@ -89,6 +89,8 @@ typedef enum
 	AtaDMAWriteQueued				= 0xCC,
 	AtaDMAWriteQueuedExt			= 0x36,
 	AtaDmaWriteQueuedExtFUA			= 0x3E,
+	AtaFPDMAReadQueued				= 0x60,
+	AtaFPDMAWriteQueued				= 0x61,
 
 	AtaPIOReadLogExt				= 0x2F,
 	AtaPIOWriteLogExt				= 0x3F,
@@ -200,8 +202,20 @@ PACKED_TYPESTRUCT(ATAIdentify, {
 	uint32_t SectorCountLBA28;
 
 	/* Obsolete AND i don't care 
-	 * Words 62-79 */
-	uint16_t Obsolete5[18];
+	 * Words 62-74 */
+	uint16_t Obsolete5[13];
+
+	/* 75: Queue Depth 
+	 * Bits 0-4: Maximum queue depth - 1 */
+	uint16_t QueueDepth;
+
+	/* 76: Serial ATA Capabilities 
+	 * Bit 8: Native Command Queuing Supported */
+	uint16_t SataCapabilities;
+
+	/* Serial ATA features and reserved 
+	 * Words 77-79 */
+	uint16_t Obsolete10[3];
 
 	/* 80: Drive Revision 
 	 * - Major */
@@ -0,0 +1,159 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2017, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * File Manager Service
+ * - Dma attachment cache. Clients tend to transfer through the same buffers over
+ *   and over, so attachments are kept mapped until they are evicted by the least
+ *   recently used policy, or the owning process closes its last file handle.
+ */
+//#define __TRACE
+
+#include <ddk/utils.h>
+#include <ds/hash_sip.h>
+#include <ds/hashtable.h>
+#include <ds/list.h>
+#include "include/vfs.h"
+#include <os/dmabuf.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct VfsAttachment {
+    element_t             Header;
+    UUId_t                ProcessId;
+    struct dma_attachment Attachment;
+} VfsAttachment_t;
+
+// Buffer handles are only valid for the process that presented them, so the
+// process is part of the key
+struct VfsAttachmentIndex {
+    UUId_t           ProcessId;
+    UUId_t           Handle;
+    VfsAttachment_t* Attachment;
+};
+
+static uint64_t AttachmentHash(const void*);
+static int      AttachmentCompare(const void*, const void*);
+
+static hashtable_t Attachments     = { 0 };
+static list_t      AttachmentsLru  = LIST_INIT;
+static uint8_t     HashKey[16]     = { 61, 201, 14, 177, 92, 3, 248, 130, 75, 39, 166, 220, 9, 113, 186, 50 };
+
+OsStatus_t
+VfsAttachmentCacheInitialize(void)
+{
+    if (hashtable_construct(&Attachments, 0, sizeof(struct VfsAttachmentIndex),
+            AttachmentHash, AttachmentCompare)) {
+        return OsOutOfMemory;
+    }
+    return OsSuccess;
+}
+
+static void
+AttachmentDestroy(
+    _In_ VfsAttachment_t* Attachment)
+{
+    TRACE("[vfs] [attachment_destroy] handle %u", Attachment->Attachment.handle);
+    hashtable_remove(&Attachments, &(struct VfsAttachmentIndex) {
+        .ProcessId = Attachment->ProcessId, .Handle = Attachment->Attachment.handle });
+    list_remove(&AttachmentsLru, &Attachment->Header);
+    dma_attachment_unmap(&Attachment->Attachment);
+    dma_detach(&Attachment->Attachment);
+    free(Attachment);
+}
+
+OsStatus_t
+VfsAttachmentCacheGet(
+    _In_  UUId_t                  ProcessId,
+    _In_  UUId_t                  BufferHandle,
+    _Out_ struct dma_attachment** AttachmentOut)
+{
+    struct VfsAttachmentIndex* Index;
+    VfsAttachment_t*           Attachment;
+    OsStatus_t                 Status;
+
+    Index = hashtable_get(&Attachments, &(struct VfsAttachmentIndex) {
+        .ProcessId = ProcessId, .Handle = BufferHandle });
+    if (Index != NULL) {
+        // Move the attachment to the back of the lru
+        list_remove(&AttachmentsLru, &Index->Attachment->Header);
+        list_append(&AttachmentsLru, &Index->Attachment->Header);
+        *AttachmentOut = &Index->Attachment->Attachment;
+        return OsSuccess;
+    }
+
+    if (list_count(&AttachmentsLru) >= VFS_ATTACHMENT_CACHE_SIZE) {
+        AttachmentDestroy((VfsAttachment_t*)list_front(&AttachmentsLru));
+    }
+
+    Attachment = (VfsAttachment_t*)malloc(sizeof(VfsAttachment_t));
+    if (!Attachment) {
+        return OsOutOfMemory;
+    }
+
+    Status = dma_attach(BufferHandle, &Attachment->Attachment);
+    if (Status != OsSuccess) {
+        ERROR("[vfs] [attachment_get] [dma_attach] failed: %u", Status);
+        free(Attachment);
+        return OsInvalidParameters;
+    }
+
+    Status = dma_attachment_map(&Attachment->Attachment);
+    if (Status != OsSuccess) {
+        ERROR("[vfs] [attachment_get] [dma_attachment_map] failed: %u", Status);
+        dma_detach(&Attachment->Attachment);
+        free(Attachment);
+        return OsInvalidParameters;
+    }
+
+    ELEMENT_INIT(&Attachment->Header, 0, Attachment);
+    Attachment->ProcessId = ProcessId;
+    list_append(&AttachmentsLru, &Attachment->Header);
+    hashtable_set(&Attachments, &(struct VfsAttachmentIndex) {
+        .ProcessId = ProcessId, .Handle = BufferHandle, .Attachment = Attachment });
+    *AttachmentOut = &Attachment->Attachment;
+    return OsSuccess;
+}
+
+void
+VfsAttachmentCacheEvict(
+    _In_ UUId_t ProcessId)
+{
+    element_t* Element = list_front(&AttachmentsLru);
+    while (Element) {
+        VfsAttachment_t* Attachment = (VfsAttachment_t*)Element;
+        Element = Element->next;
+        if (Attachment->ProcessId == ProcessId) {
+            AttachmentDestroy(Attachment);
+        }
+    }
+}
+
+static uint64_t AttachmentHash(const void* Element)
+{
+    const struct VfsAttachmentIndex* Index = Element;
+    UUId_t                           Key[2] = { Index->ProcessId, Index->Handle };
+    return siphash_64((const uint8_t*)&Key[0], sizeof(Key), &HashKey[0]);
+}
+
+static int AttachmentCompare(const void* Element1, const void* Element2)
+{
+    const struct VfsAttachmentIndex* Index1 = Element1;
+    const struct VfsAttachmentIndex* Index2 = Element2;
+    return (Index1->ProcessId == Index2->ProcessId && Index1->Handle == Index2->Handle) ? 0 : 1;
+}
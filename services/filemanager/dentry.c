@@ -0,0 +1,236 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2017, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * File Manager Service
+ * - Dentry cache. Resolved entries that are no longer open are kept around instead
+ *   of being closed, and paths the filesystem could not find are remembered as
+ *   negative entries, so repeated lookups of the same path never reach the filesystem.
+ */
+//#define __TRACE
+
+#include <ddk/utils.h>
+#include <ds/hashtable.h>
+#include <ds/list.h>
+#include "include/vfs.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct VfsDentry {
+    element_t          Header;
+    size_t             Hash;
+    MString_t*         Path;
+    FileSystem_t*      FileSystem;
+    FileSystemEntry_t* Entry;      // NULL for negative entries
+} VfsDentry_t;
+
+struct VfsDentryIndex {
+    size_t       Hash;
+    MString_t*   Path;
+    VfsDentry_t* Dentry;
+};
+
+static uint64_t DentryHash(const void*);
+static int      DentryCompare(const void*, const void*);
+
+static hashtable_t Dentries    = { 0 };
+static list_t      DentriesLru = LIST_INIT;
+
+OsStatus_t
+VfsDentryCacheInitialize(void)
+{
+    if (hashtable_construct(&Dentries, 0, sizeof(struct VfsDentryIndex),
+            DentryHash, DentryCompare)) {
+        return OsOutOfMemory;
+    }
+    return OsSuccess;
+}
+
+/* DentryDestroy
+ * Removes the dentry from the cache, a retained entry is closed by its filesystem. */
+static void
+DentryDestroy(
+    _In_ VfsDentry_t* Dentry,
+    _In_ int          CloseEntry)
+{
+    TRACE("[vfs] [dentry_destroy] %s", MStringRaw(Dentry->Path));
+    hashtable_remove(&Dentries, &(struct VfsDentryIndex) {
+        .Hash = Dentry->Hash, .Path = Dentry->Path });
+    list_remove(&DentriesLru, &Dentry->Header);
+
+    if (CloseEntry && Dentry->Entry != NULL) {
+        Dentry->FileSystem->Module->CloseEntry(&Dentry->FileSystem->Descriptor, Dentry->Entry);
+    }
+    MStringDestroy(Dentry->Path);
+    free(Dentry);
+}
+
+static OsStatus_t
+DentryInsert(
+    _In_ FileSystem_t*      FileSystem,
+    _In_ MString_t*         Path,
+    _In_ FileSystemEntry_t* Entry)
+{
+    struct VfsDentryIndex* Index;
+    VfsDentry_t*           Dentry;
+    size_t                 Hash = MStringHash(Path);
+
+    Index = hashtable_get(&Dentries, &(struct VfsDentryIndex) { .Hash = Hash, .Path = Path });
+    if (Index != NULL) {
+        DentryDestroy(Index->Dentry, 1);
+    }
+
+    if (list_count(&DentriesLru) >= VFS_DENTRY_CACHE_SIZE) {
+        DentryDestroy((VfsDentry_t*)list_front(&DentriesLru), 1);
+    }
+
+    Dentry = (VfsDentry_t*)malloc(sizeof(VfsDentry_t));
+    if (!Dentry) {
+        return OsOutOfMemory;
+    }
+
+    Dentry->Path = MStringCreate((void*)MStringRaw(Path), StrUTF8);
+    if (!Dentry->Path) {
+        free(Dentry);
+        return OsOutOfMemory;
+    }
+
+    ELEMENT_INIT(&Dentry->Header, 0, Dentry);
+    Dentry->Hash       = Hash;
+    Dentry->FileSystem = FileSystem;
+    Dentry->Entry      = Entry;
+    list_append(&DentriesLru, &Dentry->Header);
+    hashtable_set(&Dentries, &(struct VfsDentryIndex) {
+        .Hash = Hash, .Path = Dentry->Path, .Dentry = Dentry });
+    return OsSuccess;
+}
+
+OsStatus_t
+VfsDentryLookup(
+    _In_  MString_t*          Path,
+    _Out_ FileSystemEntry_t** EntryOut)
+{
+    struct VfsDentryIndex* Index;
+    VfsDentry_t*           Dentry;
+
+    Index = hashtable_get(&Dentries, &(struct VfsDentryIndex) {
+        .Hash = MStringHash(Path), .Path = Path });
+    if (Index == NULL) {
+        return OsDoesNotExist;
+    }
+
+    // Retained entries are handed back to the caller and leave the cache while
+    // they are open, negative entries stay until they are invalidated
+    Dentry    = Index->Dentry;
+    *EntryOut = Dentry->Entry;
+    if (Dentry->Entry != NULL) {
+        DentryDestroy(Dentry, 0);
+    }
+    else {
+        list_remove(&DentriesLru, &Dentry->Header);
+        list_append(&DentriesLru, &Dentry->Header);
+    }
+    return OsSuccess;
+}
+
+OsStatus_t
+VfsDentryRetain(
+    _In_ FileSystemEntry_t* Entry)
+{
+    return DentryInsert((FileSystem_t*)Entry->System, Entry->Path, Entry);
+}
+
+void
+VfsDentryInsertNegative(
+    _In_ FileSystem_t* FileSystem,
+    _In_ MString_t*    Path)
+{
+    if (DentryInsert(FileSystem, Path, NULL) != OsSuccess) {
+        WARNING("[vfs] [dentry_insert] failed to cache %s", MStringRaw(Path));
+    }
+}
+
+/* PathIsRelated
+ * Returns 1 if one of the paths is equal to, or a parent directory of the other. */
+static int
+PathIsRelated(
+    _In_ const char* Path1,
+    _In_ const char* Path2)
+{
+    size_t Length1 = strlen(Path1);
+    size_t Length2 = strlen(Path2);
+
+    if (Length1 > Length2) {
+        const char* Path   = Path1;
+        size_t      Length = Length1;
+        Path1   = Path2;
+        Length1 = Length2;
+        Path2   = Path;
+        Length2 = Length;
+    }
+
+    if (strncmp(Path1, Path2, Length1)) {
+        return 0;
+    }
+    return (Length1 == Length2 || Length1 == 0 ||
+        Path1[Length1 - 1] == '/' || Path2[Length1] == '/') ? 1 : 0;
+}
+
+void
+VfsDentryInvalidate(
+    _In_ MString_t* Path)
+{
+    element_t* Element = list_front(&DentriesLru);
+    while (Element) {
+        VfsDentry_t* Dentry = (VfsDentry_t*)Element;
+        Element = Element->next;
+        if (PathIsRelated(MStringRaw(Dentry->Path), MStringRaw(Path))) {
+            DentryDestroy(Dentry, 1);
+        }
+    }
+}
+
+void
+VfsDentryInvalidateFileSystem(
+    _In_ FileSystem_t* FileSystem)
+{
+    element_t* Element = list_front(&DentriesLru);
+    while (Element) {
+        VfsDentry_t* Dentry = (VfsDentry_t*)Element;
+        Element = Element->next;
+        if (Dentry->FileSystem == FileSystem) {
+            DentryDestroy(Dentry, 1);
+        }
+    }
+}
+
+static uint64_t DentryHash(const void* Element)
+{
+    const struct VfsDentryIndex* Index = Element;
+    return (uint64_t)Index->Hash;
+}
+
+static int DentryCompare(const void* Element1, const void* Element2)
+{
+    const struct VfsDentryIndex* Index1 = Element1;
+    const struct VfsDentryIndex* Index2 = Element2;
+    if (Index1->Hash != Index2->Hash) {
+        return 1;
+    }
+    return MStringCompare(Index1->Path, Index2->Path, 0) == MSTRING_FULL_MATCH ? 0 : 1;
+}
@@ -24,6 +24,8 @@
 
 #include <ctype.h>
 #include <ddk/utils.h>
+#include <ds/queue.h>
+#include <gracht/link/vali.h>
 #include "include/vfs.h"
 #include <os/mollenos.h>
 #include <os/dmabuf.h>
@@ -31,12 +33,29 @@
 #include <os/process.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 
 #include "svc_file_protocol_server.h"
 
+typedef struct VfsTransfer {
+    element_t                           Header;
+    struct svc_file_transfer_async_args Args;
+    struct vali_link_deferred_response  Response;
+} VfsTransfer_t;
+
 extern MString_t* VfsPathCanonicalize(const char* Path);
 
 static OsStatus_t Flush(UUId_t processId, UUId_t handle);
+static OsStatus_t Seek(UUId_t processId, UUId_t handle, uint32_t seekLo, uint32_t seekHi);
+
+// The vfs lock serializes access to handles and entries between the service thread
+// and the transfer thread. Asynchronous transfers are executed in the order they were
+// queued, which keeps multiple outstanding transfers on a single handle ordered.
+static mtx_t   VfsLock;
+static queue_t TransferQueue = QUEUE_INIT;
+static mtx_t   TransferLock;
+static cnd_t   TransferSignal;
+static thrd_t  TransferThread;
 
 int
 VfsEntryIsFile(
@@ -87,15 +106,12 @@ VfsIsHandleValid(
     _In_  unsigned int                   RequiredAccess,
     _Out_ FileSystemEntryHandle_t** entryHandle)
 {
-    CollectionItem_t *Node;
-    DataKey_t key = { .Value.Id = handle };
-    Node       = CollectionGetNodeByKey(VfsGetOpenHandles(), key, 0);
-    if (Node == NULL) {
+    *entryHandle = VfsOpenHandleLookup(handle);
+    if (*entryHandle == NULL) {
         ERROR("Invalid handle given for file");
         return OsInvalidParameters;
     }
 
-    *entryHandle = (FileSystemEntryHandle_t*)Node->Data;
     if ((*entryHandle)->Owner != processId) {
         ERROR("Owner of the handle did not match the requester. Access Denied.");
         return OsInvalidPermissions;
@@ -170,41 +186,33 @@ VfsVerifyAccessToPath(
     _In_  unsigned int                   Access,
     _Out_ FileSystemEntry_t**       ExistingEntry)
 {
-    CollectionItem_t* Node;
-    int PathHash = (int)MStringHash(Path);
-
-    _foreach(Node, VfsGetOpenFiles()) {
-        FileSystemEntry_t *Entry = (FileSystemEntry_t*)Node->Data;
-        // If our requested mode is exclusive, then we must verify
-        // none in our sub-path is opened in exclusive
-        if (Access & __FILE_WRITE_ACCESS && !(Access & __FILE_WRITE_SHARE) &&
-            Node->Key.Value.Id != PathHash) {
-            // Check if <Entry> contains the entirety of <Path>, if it does then deny
-            // the request as we try to open a higher-level entry in exclusive mode
-            if (MStringCompare(Entry->Path, Path, 0) != MSTRING_NO_MATCH) {
-                ERROR("Entry is blocked from exclusive access, access denied.");
-                return OsInvalidPermissions;
-            }
+    FileSystemEntry_t* Entry;
+
+    // If our requested mode is exclusive, then we must verify
+    // none in our sub-path is opened already
+    if (Access & __FILE_WRITE_ACCESS && !(Access & __FILE_WRITE_SHARE)) {
+        if (VfsOpenFileIsOpenBelow(Path)) {
+            ERROR("Entry is blocked from exclusive access, access denied.");
+            return OsInvalidPermissions;
         }
+    }
 
-        // Have we found the existing already opened file?
-        if (Node->Key.Value.Id == PathHash) {
-            if (Entry->IsLocked != UUID_INVALID) {
-                ERROR("File is opened in exclusive mode already, access denied.");
-                return OsInvalidPermissions;
-            }
-            else {
-                // It's important here that we check if the flag
-                // __FILE_FAILONEXIST has been set, then we return
-                // the appropriate code instead of opening a new handle
-                if (Options & __FILE_FAILONEXIST) {
-                    ERROR("File already exists - open mode specifies this to be failure.");
-                    return OsExists;
-                }
-                *ExistingEntry = Entry;
-                break;
-            }
+    // Have we found the existing already opened file?
+    Entry = VfsOpenFileLookup(Path);
+    if (Entry != NULL) {
+        if (Entry->IsLocked != UUID_INVALID) {
+            ERROR("File is opened in exclusive mode already, access denied.");
+            return OsInvalidPermissions;
+        }
+
+        // It's important here that we check if the flag
+        // __FILE_FAILONEXIST has been set, then we return
+        // the appropriate code instead of opening a new handle
+        if (Options & __FILE_FAILONEXIST) {
+            ERROR("File already exists - open mode specifies this to be failure.");
+            return OsExists;
         }
+        *ExistingEntry = Entry;
     }
     return OsSuccess;
 }
@@ -222,7 +230,6 @@ VfsOpenInternal(
     FileSystemEntry_t* Entry   = NULL;
     MString_t*         SubPath = NULL;
     OsStatus_t         status;
-    DataKey_t          key;
 
     TRACE("VfsOpenInternal(Path %s)", MStringRaw(Path));
 
@@ -230,18 +237,46 @@ VfsOpenInternal(
     if (status == OsSuccess) {
         // Ok if it didn't exist in cache it's a new lookup
         if (Entry == NULL) {
-            FileSystem_t *Filesystem    = VfsGetFileSystemFromPath(Path, &SubPath);
-            int Created                 = 0;
-            if (Filesystem == NULL) {
+            FileSystem_t* Filesystem;
+            int           Cached  = VfsDentryLookup(Path, &Entry) == OsSuccess;
+            int           Created = 0;
+
+            // The dentry cache knows this path does not exist
+            if (Cached && Entry == NULL && !(Options & (__FILE_CREATE | __FILE_CREATE_RECURSIVE))) {
                 return OsDoesNotExist;
             }
 
-            // Let the module do the rest
-            status = Filesystem->Module->OpenEntry(&Filesystem->Descriptor, SubPath, &Entry);
-            if (status == OsDoesNotExist && (Options & (__FILE_CREATE | __FILE_CREATE_RECURSIVE))) {
-                TRACE("File was not found, but options are to create 0x%x", Options);
-                status  = Filesystem->Module->CreatePath(&Filesystem->Descriptor, SubPath, Options, &Entry);
-                Created = 1;
+            if (Entry != NULL) {
+                Filesystem = (FileSystem_t*)Entry->System;
+            }
+            else {
+                Filesystem = VfsGetFileSystemFromPath(Path, &SubPath);
+                if (Filesystem == NULL) {
+                    return OsDoesNotExist;
+                }
+
+                // Let the module do the rest, unless the path is known not to exist
+                status = Cached ? OsDoesNotExist : Filesystem->Module->OpenEntry(&Filesystem->Descriptor, SubPath, &Entry);
+                if (status == OsDoesNotExist && (Options & (__FILE_CREATE | __FILE_CREATE_RECURSIVE))) {
+                    TRACE("File was not found, but options are to create 0x%x", Options);
+                    status  = Filesystem->Module->CreatePath(&Filesystem->Descriptor, SubPath, Options, &Entry);
+                    Created = 1;
+                    if (status == OsSuccess) {
+                        VfsDentryInvalidate(Path);
+                    }
+                }
+                else if (status == OsDoesNotExist) {
+                    VfsDentryInsertNegative(Filesystem, Path);
+                }
+                MStringDestroy(SubPath);
+
+                if (status == OsSuccess) {
+                    Entry->System       = (uintptr_t*)Filesystem;
+                    Entry->Path         = MStringCreate((void*)MStringRaw(Path), StrUTF8);
+                    Entry->Hash         = MStringHash(Path);
+                    Entry->IsLocked     = UUID_INVALID;
+                    Entry->References   = 0;
+                }
             }
 
             // Sanitize the open otherwise we must cleanup
@@ -252,30 +287,28 @@ VfsOpenInternal(
                 // Also this is ok if file was just created
                 if ((Options & __FILE_FAILONEXIST) && Created == 0) {
                     ERROR("Entry already exists in path. FailOnExists has been specified.");
-                    status = Filesystem->Module->CloseEntry(&Filesystem->Descriptor, Entry);
-                    Entry = NULL;
+                    if (VfsDentryRetain(Entry) != OsSuccess) {
+                        Filesystem->Module->CloseEntry(&Filesystem->Descriptor, Entry);
+                    }
+                    return OsExists;
                 }
-                else {
-                    Entry->System       = (uintptr_t*)Filesystem;
-                    Entry->Path         = MStringCreate((void*)MStringRaw(Path), StrUTF8);
-                    Entry->Hash         = MStringHash(Path);
-                    Entry->IsLocked     = UUID_INVALID;
-                    Entry->References   = 0;
 
-                    // Take care of truncation flag if file was not newly created. The entry type
-                    // must equal to file otherwise we will ignore the flag
-                    if ((Options & __FILE_TRUNCATE) && Created == 0 && VfsEntryIsFile(Entry)) {
-                        status = Filesystem->Module->ChangeFileSize(&Filesystem->Descriptor, Entry, 0);
-                    }
-                    key.Value.Id = Entry->Hash;
-                    CollectionAppend(VfsGetOpenFiles(), CollectionCreateNode(key, Entry));
+                // Take care of truncation flag if file was not newly created. The entry type
+                // must equal to file otherwise we will ignore the flag
+                if ((Options & __FILE_TRUNCATE) && Created == 0 && VfsEntryIsFile(Entry)) {
+                    status = Filesystem->Module->ChangeFileSize(&Filesystem->Descriptor, Entry, 0);
+                    Access |= __FILE_WRITE_ACCESS;
+                }
+                if (VfsOpenFileInsert(Entry) != OsSuccess) {
+                    status = OsOutOfMemory;
+                    Filesystem->Module->CloseEntry(&Filesystem->Descriptor, Entry);
+                    Entry = NULL;
                 }
             }
             else {
                 TRACE("File opening/creation failed with code: %i", status);
                 Entry = NULL;
             }
-            MStringDestroy(SubPath);
         }
 
         // Now we can open the handle
@@ -283,6 +316,7 @@ VfsOpenInternal(
         if (Entry != NULL) {
             status = VfsOpenHandleInternal(Entry, handle);
             if (status == OsSuccess) {
+                VfsOpenFileAddAccess(Entry, Access);
                 Entry->References++;
             }
         }
@@ -362,7 +396,6 @@ OpenFile(
     FileSystemEntryHandle_t* entry;
     OsStatus_t               status = OsDoesNotExist;
     MString_t*               resolvedPath;
-    DataKey_t                key;
 
     TRACE("OpenFile(Path %s, Options 0x%x, Access 0x%x)", path, options, access);
     if (path == NULL) {
@@ -387,8 +420,7 @@ OpenFile(
         entry->Access  = access;
         entry->Options = options;
         
-        key.Value.Id = entry->Id;
-        CollectionAppend(VfsGetOpenHandles(), CollectionCreateNode(key, entry));
+        VfsOpenHandleInsert(entry);
         *handleOut = entry->Id;
     }
     return status;
@@ -397,8 +429,12 @@ OpenFile(
 void svc_file_open_callback(struct gracht_recv_message* message, struct svc_file_open_args* args)
 {
     UUId_t     handle = UUID_INVALID;
-    OsStatus_t status = OpenFile(args->process_id, args->path, args->options,
+    OsStatus_t status;
+
+    mtx_lock(&VfsLock);
+    status = OpenFile(args->process_id, args->path, args->options,
         args->access, &handle);
+    mtx_unlock(&VfsLock);
     svc_file_open_response(message, status, handle);
 }
 
@@ -410,9 +446,7 @@ CloseFile(
     FileSystemEntryHandle_t* entryHandle;
     FileSystemEntry_t*       entry;
     OsStatus_t               status;
-    CollectionItem_t*        node;
     FileSystem_t*            fileSystem;
-    DataKey_t                key = { .Value.Id = handle };
 
     TRACE("CloseFile(handle %u)", handle);
 
@@ -421,7 +455,6 @@ CloseFile(
         return status;
     }
     
-    node  = CollectionGetNodeByKey(VfsGetOpenHandles(), key, 0);
     entry = entryHandle->Entry;
 
     // handle file specific flags
@@ -440,8 +473,12 @@ CloseFile(
     if (status != OsSuccess) {
         return status;
     }
-    CollectionRemoveByNode(VfsGetOpenHandles(), node);
-    free(node);
+    VfsOpenHandleRemove(handle);
+
+    // Release the cached buffers of the process with its last handle
+    if (!VfsOpenHandleCount(processId)) {
+        VfsAttachmentCacheEvict(processId);
+    }
 
     // Take care of any entry cleanup / reduction
     entry->References--;
@@ -450,18 +487,27 @@ CloseFile(
     }
 
     // Last reference?
-    // Cleanup the file in case of no refs
+    // Cleanup the file in case of no refs. Entries that were never opened for writing
+    // are kept in the dentry cache, modified entries are closed so their records are
+    // written back by the filesystem
     if (entry->References == 0) {
-        key.Value.Id = entry->Hash;
-        CollectionRemoveByKey(VfsGetOpenFiles(), key);
-        status = fileSystem->Module->CloseEntry(&fileSystem->Descriptor, entry);
+        unsigned int access = VfsOpenFileGetAccess(entry);
+        VfsOpenFileRemove(entry);
+        VfsMappingCacheEvict(entry);
+        if ((access & __FILE_WRITE_ACCESS) || VfsDentryRetain(entry) != OsSuccess) {
+            status = fileSystem->Module->CloseEntry(&fileSystem->Descriptor, entry);
+        }
     }
     return status;
 }
 
 void svc_file_close_callback(struct gracht_recv_message* message, struct svc_file_close_args* args)
 {
-    OsStatus_t status = CloseFile(args->process_id, args->handle);
+    OsStatus_t status;
+
+    mtx_lock(&VfsLock);
+    status = CloseFile(args->process_id, args->handle);
+    mtx_unlock(&VfsLock);
     svc_file_close_response(message, status);
 }
 
@@ -476,8 +522,8 @@ DeletePath(
     FileSystem_t*            fileSystem;
     MString_t*               subPath;
     MString_t *              resolvedPath;
+    FileSystemEntry_t*       entry;
     UUId_t                   handle;
-    DataKey_t                key;
 
     TRACE("VfsDeletePath(Path %s, Options 0x%x)", path, Options);
     if (path == NULL) {
@@ -492,34 +538,48 @@ DeletePath(
     }
     
     fileSystem = VfsGetFileSystemFromPath(resolvedPath, &subPath);
-    MStringDestroy(resolvedPath);
     if (fileSystem == NULL) {
+        MStringDestroy(resolvedPath);
         return OsDoesNotExist;
     }
+    MStringDestroy(subPath);
 
     // First step is to open the path in exclusive mode
     status = OpenFile(processId, path, __FILE_VOLATILE, __FILE_READ_ACCESS | __FILE_WRITE_ACCESS, &handle);
     if (status == OsSuccess) {
         status = VfsIsHandleValid(processId, handle, 0, &entryHandle);
         if (status != OsSuccess) {
+            MStringDestroy(resolvedPath);
             return status;
         }
         
-        key.Value.Id = entryHandle->Entry->Hash;
-        status       = fileSystem->Module->DeleteEntry(&fileSystem->Descriptor, entryHandle);
-        if (status == OsSuccess) {
-            // Cleanup handles and open file
-            CollectionRemoveByKey(VfsGetOpenFiles(), key);
-            key.Value.Id = handle;
-            CollectionRemoveByKey(VfsGetOpenHandles(), key);
+        // The module cleans up both the handle and the entry on success, so they
+        // must be removed from the tables while they are still valid
+        entry = entryHandle->Entry;
+        VfsOpenHandleRemove(handle);
+        VfsOpenFileRemove(entry);
+        VfsMappingCacheEvict(entry);
+        status = fileSystem->Module->DeleteEntry(&fileSystem->Descriptor, entryHandle);
+        if (status != OsSuccess) {
+            VfsOpenFileInsert(entry);
+            VfsOpenHandleInsert(entryHandle);
+        }
+        else {
+            VfsDentryInvalidate(resolvedPath);
+            VfsDentryInsertNegative(fileSystem, resolvedPath);
         }
     }
+    MStringDestroy(resolvedPath);
     return status;
 }
 
 void svc_file_delete_callback(struct gracht_recv_message* message, struct svc_file_delete_args* args)
 {
-    OsStatus_t status = DeletePath(args->process_id, args->path, args->flags);
+    OsStatus_t status;
+
+    mtx_lock(&VfsLock);
+    status = DeletePath(args->process_id, args->path, args->flags);
+    mtx_unlock(&VfsLock);
     svc_file_delete_response(message, status);
 }
 
@@ -535,7 +595,7 @@ ReadFile(
     FileSystemEntryHandle_t* entryHandle;
     OsStatus_t               status;
     FileSystem_t*            fileSystem;
-    struct dma_attachment    dmaAttachment;
+    struct dma_attachment*   dmaAttachment;
 
     TRACE("[vfs_read] pid => %u, id => %u, b_id => %u, len => %u", 
         processId, handle, bufferHandle, LODWORD(length));
@@ -555,31 +615,19 @@ ReadFile(
         status = Flush(processId, handle);
     }
 
-    status = dma_attach(bufferHandle, &dmaAttachment);
+    status = VfsAttachmentCacheGet(processId, bufferHandle, &dmaAttachment);
     if (status != OsSuccess) {
-        ERROR("[vfs_read] [dma_attach] failed: %u", status);
-        return OsInvalidParameters;
-    }
-    
-    status = dma_attachment_map(&dmaAttachment);
-    if (status != OsSuccess) {
-        ERROR("[vfs_read] [dma_attachment_map] failed: %u", status);
-        dma_detach(&dmaAttachment);
-        return OsInvalidParameters;
+        return status;
     }
 
     TRACE("[vfs_read] [module_read]");
     fileSystem   = (FileSystem_t*)entryHandle->Entry->System;
     status = fileSystem->Module->ReadEntry(&fileSystem->Descriptor, entryHandle, bufferHandle, 
-        dmaAttachment.buffer, offset, length, bytesRead);
+        dmaAttachment->buffer, offset, length, bytesRead);
     if (status == OsSuccess) {
         entryHandle->LastOperation  = __FILE_OPERATION_READ;
         entryHandle->Position       += *bytesRead;
     }
-    
-    // Unregister the dma buffer
-    dma_attachment_unmap(&dmaAttachment);
-    dma_detach(&dmaAttachment);
     return status;
 }
 
@@ -595,7 +643,7 @@ WriteFile(
     FileSystemEntryHandle_t* entryHandle;
     OsStatus_t               status;
     FileSystem_t*            fileSystem;
-    struct dma_attachment    dmaAttachment;
+    struct dma_attachment*   dmaAttachment;
 
     TRACE("[vfs_write] pid => %u, id => %u, b_id => %u", processId, handle, bufferHandle);
 
@@ -614,46 +662,131 @@ WriteFile(
         status = Flush(processId, handle);
     }
 
-    status = dma_attach(bufferHandle, &dmaAttachment);
+    status = VfsAttachmentCacheGet(processId, bufferHandle, &dmaAttachment);
     if (status != OsSuccess) {
-        ERROR("[vfs_write] [dma_attach] failed: %u", status);
-        return OsInvalidParameters;
-    }
-    
-    status = dma_attachment_map(&dmaAttachment);
-    if (status != OsSuccess) {
-        ERROR("[vfs_write] [dma_attachment_map] failed: %u", status);
-        dma_detach(&dmaAttachment);
-        return OsInvalidParameters;
+        return status;
     }
 
     fileSystem   = (FileSystem_t*)entryHandle->Entry->System;
     status = fileSystem->Module->WriteEntry(&fileSystem->Descriptor, entryHandle, bufferHandle,
-        dmaAttachment.buffer, offset, length, bytesWritten);
+        dmaAttachment->buffer, offset, length, bytesWritten);
     if (status == OsSuccess) {
+        VfsMappingCacheUpdate(entryHandle->Entry, entryHandle->Position,
+            (uint8_t*)dmaAttachment->buffer + offset, *bytesWritten);
         entryHandle->LastOperation  = __FILE_OPERATION_WRITE;
         entryHandle->Position       += *bytesWritten;
         if (entryHandle->Position > entryHandle->Entry->Descriptor.Size.QuadPart) {
             entryHandle->Entry->Descriptor.Size.QuadPart = entryHandle->Position;
         }
     }
-    
-    // Unregister the dma buffer
-    dma_attachment_unmap(&dmaAttachment);
-    dma_detach(&dmaAttachment);
     return status;
 }
 
+static void
+HandleTransfer(
+    _In_ VfsTransfer_t* transfer)
+{
+    struct svc_file_transfer_async_args* args             = &transfer->Args;
+    size_t                               bytesTransferred = 0;
+    OsStatus_t                           status           = OsSuccess;
+
+    TRACE("[vfs_transfer] handle => %u, len => %u", args->handle, LODWORD(args->length));
+
+    mtx_lock(&VfsLock);
+    if (args->offset_lo != FILE_POSITION_CURRENT || args->offset_hi != FILE_POSITION_CURRENT) {
+        status = Seek(args->process_id, args->handle, args->offset_lo, args->offset_hi);
+    }
+
+    if (status == OsSuccess) {
+        if (args->direction == 0) {
+            status = ReadFile(args->process_id, args->handle, args->buffer_handle,
+                args->buffer_offset, args->length, &bytesTransferred);
+        }
+        else {
+            status = WriteFile(args->process_id, args->handle, args->buffer_handle,
+                args->buffer_offset, args->length, &bytesTransferred);
+        }
+    }
+    mtx_unlock(&VfsLock);
+
+    svc_file_transfer_async_response(&transfer->Response.recv_message, status, bytesTransferred);
+}
+
+static int
+TransferWorker(
+    _In_ void* context)
+{
+    VfsTransfer_t* transfer;
+    _CRT_UNUSED(context);
+
+    while (1) {
+        mtx_lock(&TransferLock);
+        transfer = (VfsTransfer_t*)queue_pop(&TransferQueue);
+        while (!transfer) {
+            cnd_wait(&TransferSignal, &TransferLock);
+            transfer = (VfsTransfer_t*)queue_pop(&TransferQueue);
+        }
+        mtx_unlock(&TransferLock);
+
+        HandleTransfer(transfer);
+        free(transfer);
+    }
+    return 0;
+}
+
+void
+VfsAcquireLock(void)
+{
+    mtx_lock(&VfsLock);
+}
+
+void
+VfsReleaseLock(void)
+{
+    mtx_unlock(&VfsLock);
+}
+
+OsStatus_t
+VfsTransferInitialize(void)
+{
+    mtx_init(&VfsLock, mtx_plain);
+    mtx_init(&TransferLock, mtx_plain);
+    cnd_init(&TransferSignal);
+    if (thrd_create(&TransferThread, TransferWorker, NULL) != thrd_success) {
+        ERROR("[vfs] [transfer_initialize] thrd_create failed");
+        return OsError;
+    }
+    return OsSuccess;
+}
+
 void svc_file_transfer_async_callback(struct gracht_recv_message* message, struct svc_file_transfer_async_args* args)
 {
+    VfsTransfer_t* transfer;
     
+    // Queue the transfer and return immediately, the transfer thread responds to the
+    // request once the transfer is done.
+    transfer = (VfsTransfer_t*)malloc(sizeof(VfsTransfer_t) + VALI_MSG_DEFER_SIZE(message));
+    if (!transfer) {
+        svc_file_transfer_async_response(message, OsOutOfMemory, 0);
+        return;
+    }
+    
+    ELEMENT_INIT(&transfer->Header, 0, transfer);
+    memcpy(&transfer->Args, args, sizeof(struct svc_file_transfer_async_args));
+    gracht_vali_message_defer_response(&transfer->Response, message);
+    
+    mtx_lock(&TransferLock);
+    queue_push(&TransferQueue, &transfer->Header);
+    cnd_signal(&TransferSignal);
+    mtx_unlock(&TransferLock);
 }
 
 void svc_file_transfer_callback(struct gracht_recv_message* message, struct svc_file_transfer_args* args)
 {
-    size_t     bytesTransferred;
+    size_t     bytesTransferred = 0;
     OsStatus_t status;
     
+    mtx_lock(&VfsLock);
     if (args->direction == 0) {
         status = ReadFile(args->process_id, args->handle, args->buffer_handle,
             args->buffer_offset, args->length, &bytesTransferred);
@@ -662,10 +795,283 @@ void svc_file_transfer_callback(struct gracht_recv_message* message, struct svc_
         status = WriteFile(args->process_id, args->handle, args->buffer_handle,
             args->buffer_offset, args->length, &bytesTransferred);
     }
+    mtx_unlock(&VfsLock);
     
     svc_file_transfer_response(message, status, bytesTransferred);
 }
 
+/* TransferVector
+ * Transfers a list of buffer parts in a single request. If an offset is given the
+ * transfer is positional, it is done at that offset and the position of the handle is
+ * left untouched, otherwise the transfer is done at, and advances, the current position. */
+static OsStatus_t
+TransferVector(
+    _In_  UUId_t            processId,
+    _In_  UUId_t            handle,
+    _In_  int               direction,
+    _In_  uint32_t          offsetLo,
+    _In_  uint32_t          offsetHi,
+    _In_  FileVector_t*     vectors,
+    _In_  int               count,
+    _Out_ size_t*           bytesTransferred)
+{
+    FileSystemEntryHandle_t* entryHandle;
+    FileSystemVector_t       parts[FILE_VECTOR_MAX];
+    FileSystem_t*            fileSystem;
+    struct dma_attachment*   dmaAttachment;
+    OsStatus_t               status;
+    uint64_t                 position;
+    unsigned int             operation = direction ? __FILE_OPERATION_WRITE : __FILE_OPERATION_READ;
+    int                      positional;
+    int                      i;
+
+    TRACE("[vfs_transfer_vector] pid => %u, id => %u, count => %i", processId, handle, count);
+
+    *bytesTransferred = 0;
+    if (!vectors || count <= 0 || count > FILE_VECTOR_MAX) {
+        ERROR("[vfs_transfer_vector] error invalid parameters, count %i", count);
+        return OsInvalidParameters;
+    }
+
+    status = VfsIsHandleValid(processId, handle,
+        direction ? __FILE_WRITE_ACCESS : __FILE_READ_ACCESS, &entryHandle);
+    if (status != OsSuccess) {
+        return status;
+    }
+
+    if (!VfsEntryIsFile(entryHandle->Entry)) {
+        return OsInvalidParameters;
+    }
+
+    // Resolve all the buffers before touching the handle
+    for (i = 0; i < count; i++) {
+        status = VfsAttachmentCacheGet(processId, vectors[i].BufferHandle, &dmaAttachment);
+        if (status != OsSuccess) {
+            return status;
+        }
+
+        if (vectors[i].BufferOffset > dmaAttachment->length ||
+            vectors[i].Length > (dmaAttachment->length - vectors[i].BufferOffset)) {
+            ERROR("[vfs_transfer_vector] error part %i is out of bounds", i);
+            return OsInvalidParameters;
+        }
+
+        parts[i].BufferHandle = vectors[i].BufferHandle;
+        parts[i].Buffer       = dmaAttachment->buffer;
+        parts[i].BufferOffset = vectors[i].BufferOffset;
+        parts[i].Length       = vectors[i].Length;
+    }
+
+    positional = offsetLo != FILE_POSITION_CURRENT || offsetHi != FILE_POSITION_CURRENT;
+    position   = entryHandle->Position;
+    if (positional) {
+        status = Seek(processId, handle, offsetLo, offsetHi);
+    }
+    else if (entryHandle->LastOperation != operation) {
+        status = Flush(processId, handle);
+    }
+
+    if (status != OsSuccess) {
+        return status;
+    }
+
+    fileSystem = (FileSystem_t*)entryHandle->Entry->System;
+    if (direction && fileSystem->Module->WriteEntryVector) {
+        status = fileSystem->Module->WriteEntryVector(&fileSystem->Descriptor, entryHandle,
+            &parts[0], count, bytesTransferred);
+    }
+    else if (!direction && fileSystem->Module->ReadEntryVector) {
+        status = fileSystem->Module->ReadEntryVector(&fileSystem->Descriptor, entryHandle,
+            &parts[0], count, bytesTransferred);
+    }
+    else {
+        // The filesystem has no vector support, transfer the parts one by one and stop
+        // at the first part that could not be completed
+        for (i = 0; i < count; i++) {
+            size_t partTransferred = 0;
+            if (direction) {
+                status = fileSystem->Module->WriteEntry(&fileSystem->Descriptor, entryHandle,
+                    parts[i].BufferHandle, parts[i].Buffer, parts[i].BufferOffset,
+                    parts[i].Length, &partTransferred);
+            }
+            else {
+                status = fileSystem->Module->ReadEntry(&fileSystem->Descriptor, entryHandle,
+                    parts[i].BufferHandle, parts[i].Buffer, parts[i].BufferOffset,
+                    parts[i].Length, &partTransferred);
+            }
+
+            *bytesTransferred     += partTransferred;
+            entryHandle->Position += partTransferred;
+            if (status != OsSuccess || partTransferred != parts[i].Length) {
+                break;
+            }
+        }
+        entryHandle->Position -= *bytesTransferred;
+        if (*bytesTransferred != 0) {
+            status = OsSuccess;
+        }
+    }
+
+    if (status == OsSuccess) {
+        // Keep the cached chunks of file mappings up to date with the written parts
+        if (direction) {
+            uint64_t updateOffset = entryHandle->Position;
+            size_t   remaining    = *bytesTransferred;
+            for (i = 0; i < count && remaining; i++) {
+                size_t partLength = MIN(parts[i].Length, remaining);
+                VfsMappingCacheUpdate(entryHandle->Entry, updateOffset,
+                    (uint8_t*)parts[i].Buffer + parts[i].BufferOffset, partLength);
+                updateOffset += partLength;
+                remaining    -= partLength;
+            }
+        }
+
+        entryHandle->LastOperation  = operation;
+        entryHandle->Position      += *bytesTransferred;
+        if (direction && entryHandle->Position > entryHandle->Entry->Descriptor.Size.QuadPart) {
+            entryHandle->Entry->Descriptor.Size.QuadPart = entryHandle->Position;
+        }
+    }
+
+    // Positional transfers must not move the handle, so restore the original position
+    if (positional) {
+        union {
+            struct {
+                uint32_t Lo;
+                uint32_t Hi;
+            } Parts;
+            uint64_t Full;
+        } restore;
+        restore.Full = position;
+        if (Seek(processId, handle, restore.Parts.Lo, restore.Parts.Hi) != OsSuccess) {
+            ERROR("[vfs_transfer_vector] failed to restore position");
+        }
+    }
+    return status;
+}
+
+// Index of the vectors buffer in the parameters of the transfer_vector request
+#define TRANSFER_VECTOR_PARAM_VECTORS 5
+
+void svc_file_transfer_vector_callback(struct gracht_recv_message* message, struct svc_file_transfer_vector_args* args)
+{
+    struct gracht_param* params           = (struct gracht_param*)message->params;
+    size_t               bytesTransferred = 0;
+    OsStatus_t           status;
+
+    // The count is supplied by the client, it must not describe more vectors than
+    // the received buffer actually holds
+    if (message->param_in <= TRANSFER_VECTOR_PARAM_VECTORS ||
+        (size_t)args->count > (params[TRANSFER_VECTOR_PARAM_VECTORS].length / sizeof(FileVector_t))) {
+        ERROR("[vfs_transfer_vector] count %i exceeds the vector buffer", args->count);
+        svc_file_transfer_vector_response(message, OsInvalidParameters, 0);
+        return;
+    }
+
+    mtx_lock(&VfsLock);
+    status = TransferVector(args->process_id, args->handle, args->direction,
+        args->offset_lo, args->offset_hi, (FileVector_t*)args->vectors, args->count,
+        &bytesTransferred);
+    mtx_unlock(&VfsLock);
+
+    svc_file_transfer_vector_response(message, status, bytesTransferred);
+}
+
+/* GetMapping
+ * Retrieves the cached chunk of the file that contains <offset>, the chunk is read from
+ * the file the first time it is requested. The chunk is shared by all processes that map
+ * the same part of the file. */
+static OsStatus_t
+GetMapping(
+    _In_  UUId_t   processId,
+    _In_  UUId_t   handle,
+    _In_  uint32_t offsetLo,
+    _In_  uint32_t offsetHi,
+    _Out_ UUId_t*  regionHandle,
+    _Out_ size_t*  regionOffset,
+    _Out_ size_t*  length)
+{
+    FileSystemEntryHandle_t* entryHandle;
+    FileSystem_t*            fileSystem;
+    struct dma_attachment*   dmaAttachment;
+    OsStatus_t               status;
+    uint64_t                 position;
+    uint64_t                 index;
+    size_t                   bytesRead = 0;
+    union {
+        struct {
+            uint32_t Lo;
+            uint32_t Hi;
+        } Parts;
+        uint64_t Full;
+    } offset;
+
+    offset.Parts.Lo = offsetLo;
+    offset.Parts.Hi = offsetHi;
+    TRACE("[vfs_get_mapping] pid => %u, id => %u, offset => 0x%x", processId, handle, offsetLo);
+
+    status = VfsIsHandleValid(processId, handle, __FILE_READ_ACCESS, &entryHandle);
+    if (status != OsSuccess) {
+        return status;
+    }
+
+    if (!VfsEntryIsFile(entryHandle->Entry) ||
+        offset.Full >= entryHandle->Entry->Descriptor.Size.QuadPart) {
+        return OsInvalidParameters;
+    }
+
+    index  = offset.Full / FILE_MAPPING_CHUNK_SIZE;
+    status = VfsMappingCacheGet(entryHandle->Entry, index, &dmaAttachment);
+    if (status != OsSuccess) {
+        status = VfsMappingCacheCreate(entryHandle->Entry, index, &dmaAttachment);
+        if (status != OsSuccess) {
+            return status;
+        }
+
+        // Read the chunk without moving the handle
+        position    = entryHandle->Position;
+        offset.Full = index * FILE_MAPPING_CHUNK_SIZE;
+        status      = Seek(processId, handle, offset.Parts.Lo, offset.Parts.Hi);
+        if (status == OsSuccess) {
+            fileSystem = (FileSystem_t*)entryHandle->Entry->System;
+            status     = fileSystem->Module->ReadEntry(&fileSystem->Descriptor, entryHandle,
+                dmaAttachment->handle, dmaAttachment->buffer, 0, FILE_MAPPING_CHUNK_SIZE, &bytesRead);
+        }
+
+        offset.Full = position;
+        if (Seek(processId, handle, offset.Parts.Lo, offset.Parts.Hi) != OsSuccess) {
+            ERROR("[vfs_get_mapping] failed to restore position");
+        }
+
+        if (status != OsSuccess) {
+            VfsMappingCacheRemove(entryHandle->Entry, index);
+            return status;
+        }
+        offset.Parts.Lo = offsetLo;
+        offset.Parts.Hi = offsetHi;
+    }
+
+    *regionHandle = dmaAttachment->handle;
+    *regionOffset = (size_t)(offset.Full % FILE_MAPPING_CHUNK_SIZE);
+    *length       = FILE_MAPPING_CHUNK_SIZE - *regionOffset;
+    return OsSuccess;
+}
+
+void svc_file_get_mapping_callback(struct gracht_recv_message* message, struct svc_file_get_mapping_args* args)
+{
+    UUId_t     regionHandle = UUID_INVALID;
+    size_t     regionOffset = 0;
+    size_t     length       = 0;
+    OsStatus_t status;
+
+    mtx_lock(&VfsLock);
+    status = GetMapping(args->process_id, args->handle, args->offset_lo, args->offset_hi,
+        &regionHandle, &regionOffset, &length);
+    mtx_unlock(&VfsLock);
+
+    svc_file_get_mapping_response(message, status, regionHandle, regionOffset, length);
+}
+
 static OsStatus_t
 Seek(
     _In_ UUId_t   processId,
@@ -717,7 +1123,11 @@ Seek(
 
 void svc_file_seek_callback(struct gracht_recv_message* message, struct svc_file_seek_args* args)
 {
-    OsStatus_t status = Seek(args->process_id, args->handle, args->seek_lo, args->seek_hi);
+    OsStatus_t status;
+
+    mtx_lock(&VfsLock);
+    status = Seek(args->process_id, args->handle, args->seek_lo, args->seek_hi);
+    mtx_unlock(&VfsLock);
     svc_file_seek_response(message, status);
 }
 
@@ -728,7 +1138,7 @@ Flush(
 {
     FileSystemEntryHandle_t* entryHandle = NULL;
     OsStatus_t               status;
-    //FileSystem_t *fileSystem;
+    FileSystem_t*            fileSystem;
 
     status = VfsIsHandleValid(processId, handle, 0, &entryHandle);
     if (status != OsSuccess) {
@@ -752,13 +1162,23 @@ Flush(
             return OsDeviceError;
         }
     }
+
+    // Let the filesystem write out any data it has buffered
+    fileSystem = (FileSystem_t*)entryHandle->Entry->System;
+    if (fileSystem->Module->FlushEntry != NULL) {
+        status = fileSystem->Module->FlushEntry(&fileSystem->Descriptor, entryHandle);
+    }
     return status;
 }
 
 
 void svc_file_flush_callback(struct gracht_recv_message* message, struct svc_file_flush_args* args)
 {
-    OsStatus_t status = Flush(args->process_id, args->handle);
+    OsStatus_t status;
+
+    mtx_lock(&VfsLock);
+    status = Flush(args->process_id, args->handle);
+    mtx_unlock(&VfsLock);
     svc_file_flush_response(message, status);
 }
 
@@ -804,7 +1224,11 @@ GetPosition(
 void svc_file_get_position_callback(struct gracht_recv_message* message, struct svc_file_get_position_args* args)
 {
     LargeUInteger_t position;
-    OsStatus_t      status = GetPosition(args->process_id, args->handle, &position);
+    OsStatus_t      status;
+
+    mtx_lock(&VfsLock);
+    status = GetPosition(args->process_id, args->handle, &position);
+    mtx_unlock(&VfsLock);
     svc_file_get_position_response(message, status, position.u.LowPart, position.u.HighPart);
 }
 
@@ -831,7 +1255,11 @@ GetOptions(
 void svc_file_get_options_callback(struct gracht_recv_message* message, struct svc_file_get_options_args* args)
 {
     unsigned int options, access;
-    OsStatus_t   status = GetOptions(args->process_id, args->handle, &options, &access);
+    OsStatus_t   status;
+
+    mtx_lock(&VfsLock);
+    status = GetOptions(args->process_id, args->handle, &options, &access);
+    mtx_unlock(&VfsLock);
     svc_file_get_position_response(message, status, options, access);
 }
 
@@ -852,12 +1280,17 @@ SetOptions(
 
     entryHandle->Options = options;
     entryHandle->Access  = access;
+    VfsOpenFileAddAccess(entryHandle->Entry, access);
     return status;
 }
 
 void svc_file_set_options_callback(struct gracht_recv_message* message, struct svc_file_set_options_args* args)
 {
-    OsStatus_t status = SetOptions(args->process_id, args->handle, args->options, args->access);
+    OsStatus_t status;
+
+    mtx_lock(&VfsLock);
+    status = SetOptions(args->process_id, args->handle, args->options, args->access);
+    mtx_unlock(&VfsLock);
     svc_file_set_options_response(message, status);
 }
 
@@ -882,7 +1315,11 @@ GetSize(
 void svc_file_get_size_callback(struct gracht_recv_message* message, struct svc_file_get_size_args* args)
 {
     LargeUInteger_t size;
-    OsStatus_t      status = GetSize(args->process_id, args->handle, &size);
+    OsStatus_t      status;
+
+    mtx_lock(&VfsLock);
+    status = GetSize(args->process_id, args->handle, &size);
+    mtx_unlock(&VfsLock);
     svc_file_get_size_response(message, status, size.u.LowPart, size.u.HighPart);
 }
 
@@ -910,13 +1347,17 @@ GetAbsolutePathOfHandle(
 void svc_file_get_path_callback(struct gracht_recv_message* message, struct svc_file_get_path_args* args)
 {
     MString_t* path;
-    OsStatus_t status = GetAbsolutePathOfHandle(args->process_id, args->handle, &path);
+    OsStatus_t status;
+
+    mtx_lock(&VfsLock);
+    status = GetAbsolutePathOfHandle(args->process_id, args->handle, &path);
     if (status == OsSuccess) {
         svc_file_get_path_response(message, status, MStringRaw(path));
     }
     else {
         svc_file_get_path_response(message, status, "");
     }
+    mtx_unlock(&VfsLock);
 }
 
 OsStatus_t
@@ -938,7 +1379,11 @@ StatFromHandle(
 void svc_file_fstat_callback(struct gracht_recv_message* message, struct svc_file_fstat_args* args)
 {
     OsFileDescriptor_t descriptor;
-    OsStatus_t         status = StatFromHandle(args->process_id, args->handle, &descriptor);
+    OsStatus_t         status;
+
+    mtx_lock(&VfsLock);
+    status = StatFromHandle(args->process_id, args->handle, &descriptor);
+    mtx_unlock(&VfsLock);
     svc_file_fstat_response(message, status, &descriptor);
 }
 
@@ -962,7 +1407,11 @@ StatFromPath(
 void svc_file_fstat_from_path_callback(struct gracht_recv_message* message, struct svc_file_fstat_from_path_args* args)
 {
     OsFileDescriptor_t descriptor;
-    OsStatus_t         status = StatFromPath(args->process_id, args->path, &descriptor);
+    OsStatus_t         status;
+
+    mtx_lock(&VfsLock);
+    status = StatFromPath(args->process_id, args->path, &descriptor);
+    mtx_unlock(&VfsLock);
     svc_file_fstat_from_path_response(message, status, &descriptor);
 }
 
@@ -0,0 +1,363 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2017, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * File Manager Service
+ * - Open file and open handle tables. Handles are indexed by their id and open
+ *   files by their path, and all open files are tracked in a tree of path
+ *   components so exclusive access to a directory can be verified without
+ *   visiting every open file.
+ */
+//#define __TRACE
+
+#include <ddk/utils.h>
+#include <ds/hash_sip.h>
+#include <ds/hashtable.h>
+#include "include/vfs.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct VfsHandleIndex {
+    UUId_t                   Id;
+    UUId_t                   Owner;
+    FileSystemEntryHandle_t* Handle;
+};
+
+struct VfsProcessIndex {
+    UUId_t ProcessId;
+    int    Handles;
+};
+
+struct VfsEntryIndex {
+    size_t             Hash;
+    MString_t*         Path;
+    FileSystemEntry_t* Entry;
+    unsigned int       Access;     // Combined access of all handles opened on the entry
+};
+
+typedef struct VfsPathNode {
+    struct VfsPathNode* Parent;
+    struct VfsPathNode* Children;
+    struct VfsPathNode* Link;
+    size_t              Open;       // Number of open entries at this node
+    size_t              OpenBelow;  // Number of open entries in the sub-tree of this node
+    size_t              NameLength;
+    char                Name[1];
+} VfsPathNode_t;
+
+static void     PathTreePrune(VfsPathNode_t*);
+static uint64_t HandleHash(const void*);
+static int      HandleCompare(const void*, const void*);
+static uint64_t ProcessHash(const void*);
+static int      ProcessCompare(const void*, const void*);
+static uint64_t EntryHash(const void*);
+static int      EntryCompare(const void*, const void*);
+
+static hashtable_t   OpenHandles  = { 0 };
+static hashtable_t   Processes    = { 0 };
+static hashtable_t   OpenFiles    = { 0 };
+static VfsPathNode_t PathTreeRoot = { 0 };
+static uint8_t       HashKey[16]  = { 147, 21, 203, 66, 91, 240, 17, 189, 54, 128, 7, 230, 111, 72, 36, 9 };
+
+OsStatus_t
+VfsOpenTablesInitialize(void)
+{
+    if (hashtable_construct(&OpenHandles, 0, sizeof(struct VfsHandleIndex),
+            HandleHash, HandleCompare)) {
+        return OsOutOfMemory;
+    }
+
+    if (hashtable_construct(&Processes, 0, sizeof(struct VfsProcessIndex),
+            ProcessHash, ProcessCompare)) {
+        hashtable_destroy(&OpenHandles);
+        return OsOutOfMemory;
+    }
+
+    if (hashtable_construct(&OpenFiles, 0, sizeof(struct VfsEntryIndex),
+            EntryHash, EntryCompare)) {
+        hashtable_destroy(&Processes);
+        hashtable_destroy(&OpenHandles);
+        return OsOutOfMemory;
+    }
+    return OsSuccess;
+}
+
+FileSystemEntryHandle_t*
+VfsOpenHandleLookup(
+    _In_ UUId_t Id)
+{
+    struct VfsHandleIndex* Index = hashtable_get(&OpenHandles,
+        &(struct VfsHandleIndex) { .Id = Id });
+    return Index != NULL ? Index->Handle : NULL;
+}
+
+void
+VfsOpenHandleInsert(
+    _In_ FileSystemEntryHandle_t* Handle)
+{
+    struct VfsProcessIndex* Process;
+
+    hashtable_set(&OpenHandles, &(struct VfsHandleIndex) {
+        .Id = Handle->Id, .Owner = Handle->Owner, .Handle = Handle });
+    
+    Process = hashtable_get(&Processes, &(struct VfsProcessIndex) { .ProcessId = Handle->Owner });
+    if (Process != NULL) {
+        Process->Handles++;
+    }
+    else {
+        hashtable_set(&Processes, &(struct VfsProcessIndex) {
+            .ProcessId = Handle->Owner, .Handles = 1 });
+    }
+}
+
+void
+VfsOpenHandleRemove(
+    _In_ UUId_t Id)
+{
+    struct VfsHandleIndex*  Index;
+    struct VfsProcessIndex* Process;
+    UUId_t                  ProcessId;
+
+    Index = hashtable_remove(&OpenHandles, &(struct VfsHandleIndex) { .Id = Id });
+    if (!Index) {
+        return;
+    }
+
+    // The handle itself may already have been cleaned up by the filesystem
+    ProcessId = Index->Owner;
+    Process   = hashtable_get(&Processes, &(struct VfsProcessIndex) { .ProcessId = ProcessId });
+    if (Process != NULL && --Process->Handles == 0) {
+        hashtable_remove(&Processes, &(struct VfsProcessIndex) { .ProcessId = ProcessId });
+    }
+}
+
+int
+VfsOpenHandleCount(
+    _In_ UUId_t ProcessId)
+{
+    struct VfsProcessIndex* Process = hashtable_get(&Processes,
+        &(struct VfsProcessIndex) { .ProcessId = ProcessId });
+    return Process != NULL ? Process->Handles : 0;
+}
+
+static VfsPathNode_t*
+PathTreeFindChild(
+    _In_ VfsPathNode_t* Node,
+    _In_ const char*    Name,
+    _In_ size_t         Length)
+{
+    VfsPathNode_t* Child = Node->Children;
+    while (Child) {
+        if (Child->NameLength == Length && !strncmp(&Child->Name[0], Name, Length)) {
+            return Child;
+        }
+        Child = Child->Link;
+    }
+    return NULL;
+}
+
+/* PathTreeLookup
+ * Walks the path components of the given path, and returns the node of the last
+ * component. Missing nodes are created on the way if <Create> is set. */
+static VfsPathNode_t*
+PathTreeLookup(
+    _In_ const char* Path,
+    _In_ int         Create)
+{
+    VfsPathNode_t* Node = &PathTreeRoot;
+
+    while (*Path) {
+        const char* End    = strchr(Path, '/');
+        size_t      Length = (End != NULL) ? (size_t)(End - Path) : strlen(Path);
+
+        if (Length != 0) {
+            VfsPathNode_t* Child = PathTreeFindChild(Node, Path, Length);
+            if (!Child) {
+                if (!Create) {
+                    return NULL;
+                }
+
+                Child = (VfsPathNode_t*)malloc(sizeof(VfsPathNode_t) + Length);
+                if (!Child) {
+                    // Get rid of the nodes we created on the way
+                    PathTreePrune(Node);
+                    return NULL;
+                }
+                memset(Child, 0, sizeof(VfsPathNode_t));
+                memcpy(&Child->Name[0], Path, Length);
+                Child->Name[Length] = '\0';
+                Child->NameLength   = Length;
+                Child->Parent       = Node;
+                Child->Link         = Node->Children;
+                Node->Children      = Child;
+            }
+            Node = Child;
+        }
+
+        Path += Length;
+        if (*Path == '/') {
+            Path++;
+        }
+    }
+    return Node;
+}
+
+/* PathTreePrune
+ * Removes unused nodes starting at the given node and moving up through the parents. */
+static void
+PathTreePrune(
+    _In_ VfsPathNode_t* Node)
+{
+    while (Node != &PathTreeRoot && Node->Open == 0 && Node->OpenBelow == 0) {
+        VfsPathNode_t*  Parent = Node->Parent;
+        VfsPathNode_t** Link   = &Parent->Children;
+
+        while (*Link != Node) {
+            Link = &(*Link)->Link;
+        }
+        *Link = Node->Link;
+        free(Node);
+        Node = Parent;
+    }
+}
+
+FileSystemEntry_t*
+VfsOpenFileLookup(
+    _In_ MString_t* Path)
+{
+    struct VfsEntryIndex* Index = hashtable_get(&OpenFiles,
+        &(struct VfsEntryIndex) { .Hash = MStringHash(Path), .Path = Path });
+    return Index != NULL ? Index->Entry : NULL;
+}
+
+OsStatus_t
+VfsOpenFileInsert(
+    _In_ FileSystemEntry_t* Entry)
+{
+    VfsPathNode_t* Node;
+    VfsPathNode_t* Parent;
+
+    Node = PathTreeLookup(MStringRaw(Entry->Path), 1);
+    if (!Node) {
+        return OsOutOfMemory;
+    }
+
+    Node->Open++;
+    for (Parent = Node->Parent; Parent != NULL; Parent = Parent->Parent) {
+        Parent->OpenBelow++;
+    }
+
+    hashtable_set(&OpenFiles, &(struct VfsEntryIndex) {
+        .Hash = Entry->Hash, .Path = Entry->Path, .Entry = Entry });
+    return OsSuccess;
+}
+
+void
+VfsOpenFileRemove(
+    _In_ FileSystemEntry_t* Entry)
+{
+    VfsPathNode_t* Node;
+    VfsPathNode_t* Parent;
+
+    if (!hashtable_remove(&OpenFiles, &(struct VfsEntryIndex) {
+            .Hash = Entry->Hash, .Path = Entry->Path })) {
+        return;
+    }
+
+    Node = PathTreeLookup(MStringRaw(Entry->Path), 0);
+    if (!Node) {
+        return;
+    }
+
+    Node->Open--;
+    for (Parent = Node->Parent; Parent != NULL; Parent = Parent->Parent) {
+        Parent->OpenBelow--;
+    }
+    PathTreePrune(Node);
+}
+
+void
+VfsOpenFileAddAccess(
+    _In_ FileSystemEntry_t* Entry,
+    _In_ unsigned int       Access)
+{
+    struct VfsEntryIndex* Index = hashtable_get(&OpenFiles,
+        &(struct VfsEntryIndex) { .Hash = Entry->Hash, .Path = Entry->Path });
+    if (Index != NULL) {
+        Index->Access |= Access;
+    }
+}
+
+unsigned int
+VfsOpenFileGetAccess(
+    _In_ FileSystemEntry_t* Entry)
+{
+    struct VfsEntryIndex* Index = hashtable_get(&OpenFiles,
+        &(struct VfsEntryIndex) { .Hash = Entry->Hash, .Path = Entry->Path });
+    return Index != NULL ? Index->Access : 0;
+}
+
+int
+VfsOpenFileIsOpenBelow(
+    _In_ MString_t* Path)
+{
+    VfsPathNode_t* Node = PathTreeLookup(MStringRaw(Path), 0);
+    return (Node != NULL && Node->OpenBelow != 0) ? 1 : 0;
+}
+
+static uint64_t HandleHash(const void* Element)
+{
+    const struct VfsHandleIndex* Index = Element;
+    return siphash_64((const uint8_t*)&Index->Id, sizeof(UUId_t), &HashKey[0]);
+}
+
+static int HandleCompare(const void* Element1, const void* Element2)
+{
+    const struct VfsHandleIndex* Index1 = Element1;
+    const struct VfsHandleIndex* Index2 = Element2;
+    return Index1->Id == Index2->Id ? 0 : 1;
+}
+
+static uint64_t ProcessHash(const void* Element)
+{
+    const struct VfsProcessIndex* Index = Element;
+    return siphash_64((const uint8_t*)&Index->ProcessId, sizeof(UUId_t), &HashKey[0]);
+}
+
+static int ProcessCompare(const void* Element1, const void* Element2)
+{
+    const struct VfsProcessIndex* Index1 = Element1;
+    const struct VfsProcessIndex* Index2 = Element2;
+    return Index1->ProcessId == Index2->ProcessId ? 0 : 1;
+}
+
+static uint64_t EntryHash(const void* Element)
+{
+    const struct VfsEntryIndex* Index = Element;
+    return (uint64_t)Index->Hash;
+}
+
+static int EntryCompare(const void* Element1, const void* Element2)
+{
+    const struct VfsEntryIndex* Index1 = Element1;
+    const struct VfsEntryIndex* Index2 = Element2;
+    if (Index1->Hash != Index2->Hash) {
+        return 1;
+    }
+    return MStringCompare(Index1->Path, Index2->Path, 0) == MSTRING_FULL_MATCH ? 0 : 1;
+}
@@ -29,10 +29,14 @@
 #include <ds/collection.h>
 #include <os/mollenos.h>
 #include <ds/mstring.h>
+#include <os/dmabuf.h>
 
 /* VFS Definitions 
  * - General identifiers can be used in paths */
 #define __FILEMANAGER_MAXDISKS          64
+#define VFS_ATTACHMENT_CACHE_SIZE       32
+#define VFS_DENTRY_CACHE_SIZE           128
+#define VFS_MAPPING_CACHE_SIZE          256
 
 #define __FILE_OPERATION_NONE           0x00000000
 #define __FILE_OPERATION_READ           0x00000001
@@ -69,6 +73,9 @@ typedef struct _FileSystemModule {
     FsCloseHandle_t     CloseHandle;
     FsReadEntry_t       ReadEntry;
     FsWriteEntry_t      WriteEntry;
+    FsReadEntryVector_t  ReadEntryVector;
+    FsWriteEntryVector_t WriteEntryVector;
+    FsFlushEntry_t      FlushEntry;
     FsSeekInEntry_t     SeekInEntry;
 } FileSystemModule_t;
 
@@ -138,11 +145,110 @@ __EXTERN Collection_t *VfsGetDisks(void);
  * is system-wide unique */
 __EXTERN UUId_t VfsIdentifierFileGet(void);
 
-/* VfsGetOpenFiles / VfsGetOpenHandles
- * Retrieves the list of open files /handles and allows
- * access and manipulation of the list */
-__EXTERN Collection_t* VfsGetOpenFiles(void);
-__EXTERN Collection_t* VfsGetOpenHandles(void);
+/* VfsOpenTablesInitialize
+ * Initializes the tables of open files and open handles */
+__EXTERN OsStatus_t VfsOpenTablesInitialize(void);
+
+/* VfsOpenHandleLookup / VfsOpenHandleInsert / VfsOpenHandleRemove
+ * Retrieves, adds or removes an open handle in the table of open handles,
+ * the handles are indexed by their id */
+__EXTERN FileSystemEntryHandle_t* VfsOpenHandleLookup(_In_ UUId_t Id);
+__EXTERN void VfsOpenHandleInsert(_In_ FileSystemEntryHandle_t* Handle);
+__EXTERN void VfsOpenHandleRemove(_In_ UUId_t Id);
+
+/* VfsOpenHandleCount
+ * Retrieves the number of open handles owned by the given process */
+__EXTERN int VfsOpenHandleCount(_In_ UUId_t ProcessId);
+
+/* VfsOpenFileLookup / VfsOpenFileInsert / VfsOpenFileRemove
+ * Retrieves, adds or removes an open file in the table of open files,
+ * the files are indexed by their full path */
+__EXTERN FileSystemEntry_t* VfsOpenFileLookup(_In_ MString_t* Path);
+__EXTERN OsStatus_t VfsOpenFileInsert(_In_ FileSystemEntry_t* Entry);
+__EXTERN void VfsOpenFileRemove(_In_ FileSystemEntry_t* Entry);
+
+/* VfsOpenFileAddAccess / VfsOpenFileGetAccess
+ * Records or retrieves the combined access that handles have been opened with
+ * on the given open file */
+__EXTERN void VfsOpenFileAddAccess(_In_ FileSystemEntry_t* Entry, _In_ unsigned int Access);
+__EXTERN unsigned int VfsOpenFileGetAccess(_In_ FileSystemEntry_t* Entry);
+
+/* VfsAttachmentCacheInitialize
+ * Initializes the cache of dma attachments for client buffers */
+__EXTERN OsStatus_t VfsAttachmentCacheInitialize(void);
+
+/* VfsAttachmentCacheGet
+ * Retrieves a mapped attachment of the given buffer handle, the buffer is attached
+ * and mapped on the first use and stays mapped until evicted */
+__EXTERN OsStatus_t VfsAttachmentCacheGet(_In_ UUId_t ProcessId, _In_ UUId_t BufferHandle,
+    _Out_ struct dma_attachment** AttachmentOut);
+
+/* VfsAttachmentCacheEvict
+ * Releases all cached attachments that were created for the given process */
+__EXTERN void VfsAttachmentCacheEvict(_In_ UUId_t ProcessId);
+
+/* VfsMappingCacheInitialize
+ * Initializes the cache of file chunks that are shared with file mappings */
+__EXTERN OsStatus_t VfsMappingCacheInitialize(void);
+
+/* VfsMappingCacheGet / VfsMappingCacheCreate / VfsMappingCacheRemove
+ * Retrieves, creates or removes the cached chunk <Index> of the entry. Created chunks
+ * are cleared and must be filled with the file contents by the caller */
+__EXTERN OsStatus_t VfsMappingCacheGet(_In_ FileSystemEntry_t* Entry, _In_ uint64_t Index,
+    _Out_ struct dma_attachment** AttachmentOut);
+__EXTERN OsStatus_t VfsMappingCacheCreate(_In_ FileSystemEntry_t* Entry, _In_ uint64_t Index,
+    _Out_ struct dma_attachment** AttachmentOut);
+__EXTERN void VfsMappingCacheRemove(_In_ FileSystemEntry_t* Entry, _In_ uint64_t Index);
+
+/* VfsMappingCacheUpdate
+ * Copies data written to the entry at <Offset> into the cached chunks it overlaps, so
+ * file mappings see the same contents as reads */
+__EXTERN void VfsMappingCacheUpdate(_In_ FileSystemEntry_t* Entry, _In_ uint64_t Offset,
+    _In_ const void* Buffer, _In_ size_t Length);
+
+/* VfsMappingCacheEvict
+ * Releases all cached chunks of the entry */
+__EXTERN void VfsMappingCacheEvict(_In_ FileSystemEntry_t* Entry);
+
+/* VfsOpenFileIsOpenBelow
+ * Returns 1 if any entries are open in the sub-tree of the given path */
+__EXTERN int VfsOpenFileIsOpenBelow(_In_ MString_t* Path);
+
+/* VfsDentryCacheInitialize
+ * Initializes the cache of resolved paths */
+__EXTERN OsStatus_t VfsDentryCacheInitialize(void);
+
+/* VfsDentryLookup
+ * Looks up the path in the dentry cache. Returns OsDoesNotExist if the path is not
+ * cached, otherwise <EntryOut> is set to the retained entry, which leaves the cache,
+ * or NULL if the path is known not to exist */
+__EXTERN OsStatus_t VfsDentryLookup(_In_ MString_t* Path, _Out_ FileSystemEntry_t** EntryOut);
+
+/* VfsDentryRetain
+ * Keeps an entry that is no longer open in the dentry cache instead of closing it,
+ * the entry is closed when it is evicted or invalidated */
+__EXTERN OsStatus_t VfsDentryRetain(_In_ FileSystemEntry_t* Entry);
+
+/* VfsDentryInsertNegative
+ * Remembers that the given path does not exist on the filesystem */
+__EXTERN void VfsDentryInsertNegative(_In_ FileSystem_t* FileSystem, _In_ MString_t* Path);
+
+/* VfsDentryInvalidate / VfsDentryInvalidateFileSystem
+ * Drops the cached entries of the path, its parents and everything below it, or
+ * all cached entries of the filesystem */
+__EXTERN void VfsDentryInvalidate(_In_ MString_t* Path);
+__EXTERN void VfsDentryInvalidateFileSystem(_In_ FileSystem_t* FileSystem);
+
+/* VfsTransferInitialize
+ * Initializes the vfs lock and spawns the thread that executes
+ * asynchronous transfers queued by clients */
+__EXTERN OsStatus_t VfsTransferInitialize(void);
+
+/* VfsAcquireLock / VfsReleaseLock
+ * Serializes changes to the mounted filesystems against the file callbacks and
+ * the transfer thread, which may be executing inside a filesystem */
+__EXTERN void VfsAcquireLock(void);
+__EXTERN void VfsReleaseLock(void);
 
 /* VfsIdentifierAllocate 
  * Allocates a free identifier index for the
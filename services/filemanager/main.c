@@ -36,6 +36,8 @@ extern void svc_file_close_callback(struct gracht_recv_message* message, struct
 extern void svc_file_delete_callback(struct gracht_recv_message* message, struct svc_file_delete_args*);
 extern void svc_file_transfer_async_callback(struct gracht_recv_message* message, struct svc_file_transfer_async_args*);
 extern void svc_file_transfer_callback(struct gracht_recv_message* message, struct svc_file_transfer_args*);
+extern void svc_file_transfer_vector_callback(struct gracht_recv_message* message, struct svc_file_transfer_vector_args*);
+extern void svc_file_get_mapping_callback(struct gracht_recv_message* message, struct svc_file_get_mapping_args*);
 extern void svc_file_seek_callback(struct gracht_recv_message* message, struct svc_file_seek_args*);
 extern void svc_file_flush_callback(struct gracht_recv_message* message, struct svc_file_flush_args*);
 extern void svc_file_move_callback(struct gracht_recv_message* message, struct svc_file_move_args*);
@@ -49,12 +51,14 @@ extern void svc_file_fsstat_callback(struct gracht_recv_message* message, struct
 extern void svc_file_fstat_from_path_callback(struct gracht_recv_message* message, struct svc_file_fstat_from_path_args*);
 extern void svc_file_fsstat_from_path_callback(struct gracht_recv_message* message, struct svc_file_fsstat_from_path_args*);
 
-static gracht_protocol_function_t svc_file_callbacks[17] = {
+static gracht_protocol_function_t svc_file_callbacks[19] = {
     { PROTOCOL_SVC_FILE_OPEN_ID , svc_file_open_callback },
     { PROTOCOL_SVC_FILE_CLOSE_ID , svc_file_close_callback },
     { PROTOCOL_SVC_FILE_DELETE_ID , svc_file_delete_callback },
     { PROTOCOL_SVC_FILE_TRANSFER_ASYNC_ID , svc_file_transfer_async_callback },
     { PROTOCOL_SVC_FILE_TRANSFER_ID , svc_file_transfer_callback },
+    { PROTOCOL_SVC_FILE_TRANSFER_VECTOR_ID , svc_file_transfer_vector_callback },
+    { PROTOCOL_SVC_FILE_GET_MAPPING_ID , svc_file_get_mapping_callback },
     { PROTOCOL_SVC_FILE_SEEK_ID , svc_file_seek_callback },
     { PROTOCOL_SVC_FILE_FLUSH_ID , svc_file_flush_callback },
     { PROTOCOL_SVC_FILE_MOVE_ID , svc_file_move_callback },
@@ -68,7 +72,7 @@ static gracht_protocol_function_t svc_file_callbacks[17] = {
     { PROTOCOL_SVC_FILE_FSTAT_FROM_PATH_ID , svc_file_fstat_from_path_callback },
     { PROTOCOL_SVC_FILE_FSSTAT_FROM_PATH_ID , svc_file_fsstat_from_path_callback },
 };
-DEFINE_SVC_FILE_SERVER_PROTOCOL(svc_file_callbacks, 17);
+DEFINE_SVC_FILE_SERVER_PROTOCOL(svc_file_callbacks, 19);
 
 #include <svc_path_protocol_server.h>
 
@@ -100,24 +104,12 @@ DEFINE_SVC_STORAGE_SERVER_PROTOCOL(svc_storage_callbacks, 4);
 static int          DiskTable[__FILEMANAGER_MAXDISKS] = { 0 };
 static Collection_t ResolveQueue    = COLLECTION_INIT(KeyId);
 static Collection_t FileSystems     = COLLECTION_INIT(KeyId);
-static Collection_t OpenHandles     = COLLECTION_INIT(KeyId);
-static Collection_t OpenFiles       = COLLECTION_INIT(KeyId);
 static Collection_t Modules         = COLLECTION_INIT(KeyId);
 static Collection_t Disks           = COLLECTION_INIT(KeyId);
 
 //static UUId_t FileSystemIdGenerator = 0;
 static UUId_t FileIdGenerator = 0;
 
-Collection_t*
-VfsGetOpenFiles(void) {
-    return &OpenFiles;
-}
-
-Collection_t*
-VfsGetOpenHandles(void) {
-    return &OpenHandles;
-}
-
 Collection_t*
 VfsGetModules(void) {
     return &Modules;
@@ -200,9 +192,31 @@ void GetServiceAddress(struct ipmsg_addr* address)
 OsStatus_t
 OnLoad(void)
 {
+    OsStatus_t status;
+
+    status = VfsOpenTablesInitialize();
+    if (status != OsSuccess) {
+        return status;
+    }
+
+    status = VfsAttachmentCacheInitialize();
+    if (status != OsSuccess) {
+        return status;
+    }
+
+    status = VfsDentryCacheInitialize();
+    if (status != OsSuccess) {
+        return status;
+    }
+
+    status = VfsMappingCacheInitialize();
+    if (status != OsSuccess) {
+        return status;
+    }
+
     // Register supported interfaces
     gracht_server_register_protocol(&svc_file_server_protocol);
     gracht_server_register_protocol(&svc_path_server_protocol);
     gracht_server_register_protocol(&svc_storage_server_protocol);
-    return OsSuccess;
+    return VfsTransferInitialize();
 }
@@ -0,0 +1,219 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * File Manager Service
+ * - File mapping cache. The contents of files that are mapped into memory are cached
+ *   in chunks of dma buffers, and all processes that map the same part of a file are
+ *   given the same chunk. Chunks that are evicted stay alive for as long as processes
+ *   have them mapped, but they are no longer shared with new mappings.
+ */
+//#define __TRACE
+
+#include <ddk/utils.h>
+#include <ds/hash_sip.h>
+#include <ds/hashtable.h>
+#include <ds/list.h>
+#include "include/vfs.h"
+#include <os/dmabuf.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct VfsMappingChunk {
+    element_t             Header;
+    FileSystemEntry_t*    Entry;
+    uint64_t              Index;
+    struct dma_attachment Attachment;
+} VfsMappingChunk_t;
+
+struct VfsMappingIndex {
+    FileSystemEntry_t* Entry;
+    uint64_t           Index;
+    VfsMappingChunk_t* Chunk;
+};
+
+static uint64_t MappingHash(const void*);
+static int      MappingCompare(const void*, const void*);
+
+static hashtable_t Chunks     = { 0 };
+static list_t      ChunksLru  = LIST_INIT;
+static uint8_t     HashKey[16] = { 144, 7, 231, 62, 19, 205, 88, 171, 36, 250, 113, 4, 197, 58, 129, 82 };
+
+OsStatus_t
+VfsMappingCacheInitialize(void)
+{
+    if (hashtable_construct(&Chunks, 0, sizeof(struct VfsMappingIndex),
+            MappingHash, MappingCompare)) {
+        return OsOutOfMemory;
+    }
+    return OsSuccess;
+}
+
+static void
+ChunkDestroy(
+    _In_ VfsMappingChunk_t* Chunk)
+{
+    TRACE("[vfs] [mapping_destroy] chunk %u", LODWORD(Chunk->Index));
+    hashtable_remove(&Chunks, &(struct VfsMappingIndex) {
+        .Entry = Chunk->Entry, .Index = Chunk->Index });
+    list_remove(&ChunksLru, &Chunk->Header);
+    dma_attachment_unmap(&Chunk->Attachment);
+    dma_detach(&Chunk->Attachment);
+    free(Chunk);
+}
+
+OsStatus_t
+VfsMappingCacheGet(
+    _In_  FileSystemEntry_t*      Entry,
+    _In_  uint64_t                Index,
+    _Out_ struct dma_attachment** AttachmentOut)
+{
+    struct VfsMappingIndex* MappingIndex;
+
+    MappingIndex = hashtable_get(&Chunks, &(struct VfsMappingIndex) {
+        .Entry = Entry, .Index = Index });
+    if (!MappingIndex) {
+        return OsDoesNotExist;
+    }
+
+    list_remove(&ChunksLru, &MappingIndex->Chunk->Header);
+    list_append(&ChunksLru, &MappingIndex->Chunk->Header);
+    *AttachmentOut = &MappingIndex->Chunk->Attachment;
+    return OsSuccess;
+}
+
+OsStatus_t
+VfsMappingCacheCreate(
+    _In_  FileSystemEntry_t*      Entry,
+    _In_  uint64_t                Index,
+    _Out_ struct dma_attachment** AttachmentOut)
+{
+    struct dma_buffer_info Info;
+    VfsMappingChunk_t*     Chunk;
+    OsStatus_t             Status;
+
+    if (list_count(&ChunksLru) >= VFS_MAPPING_CACHE_SIZE) {
+        ChunkDestroy((VfsMappingChunk_t*)list_front(&ChunksLru));
+    }
+
+    Chunk = (VfsMappingChunk_t*)malloc(sizeof(VfsMappingChunk_t));
+    if (!Chunk) {
+        return OsOutOfMemory;
+    }
+
+    // The chunk is cleared, so the part of the last chunk that lies beyond the
+    // end of the file reads as zeroes
+    Info.name     = "vfs_mapping";
+    Info.length   = FILE_MAPPING_CHUNK_SIZE;
+    Info.capacity = FILE_MAPPING_CHUNK_SIZE;
+    Info.flags    = DMA_CLEAN;
+
+    Status = dma_create(&Info, &Chunk->Attachment);
+    if (Status != OsSuccess) {
+        ERROR("[vfs] [mapping_create] [dma_create] failed: %u", Status);
+        free(Chunk);
+        return Status;
+    }
+
+    ELEMENT_INIT(&Chunk->Header, 0, Chunk);
+    Chunk->Entry = Entry;
+    Chunk->Index = Index;
+    list_append(&ChunksLru, &Chunk->Header);
+    hashtable_set(&Chunks, &(struct VfsMappingIndex) {
+        .Entry = Entry, .Index = Index, .Chunk = Chunk });
+    *AttachmentOut = &Chunk->Attachment;
+    return OsSuccess;
+}
+
+void
+VfsMappingCacheRemove(
+    _In_ FileSystemEntry_t* Entry,
+    _In_ uint64_t           Index)
+{
+    struct VfsMappingIndex* MappingIndex;
+
+    MappingIndex = hashtable_get(&Chunks, &(struct VfsMappingIndex) {
+        .Entry = Entry, .Index = Index });
+    if (MappingIndex) {
+        ChunkDestroy(MappingIndex->Chunk);
+    }
+}
+
+void
+VfsMappingCacheUpdate(
+    _In_ FileSystemEntry_t* Entry,
+    _In_ uint64_t           Offset,
+    _In_ const void*        Buffer,
+    _In_ size_t             Length)
+{
+    const uint8_t* Source = (const uint8_t*)Buffer;
+
+    // Most files are never mapped, so skip the lookups when nothing is cached
+    if (!list_count(&ChunksLru)) {
+        return;
+    }
+
+    while (Length) {
+        struct VfsMappingIndex* MappingIndex;
+        uint64_t                Index       = Offset / FILE_MAPPING_CHUNK_SIZE;
+        size_t                  ChunkOffset = (size_t)(Offset % FILE_MAPPING_CHUNK_SIZE);
+        size_t                  BytesToCopy = MIN(Length, FILE_MAPPING_CHUNK_SIZE - ChunkOffset);
+
+        MappingIndex = hashtable_get(&Chunks, &(struct VfsMappingIndex) {
+            .Entry = Entry, .Index = Index });
+        if (MappingIndex) {
+            memcpy((uint8_t*)MappingIndex->Chunk->Attachment.buffer + ChunkOffset,
+                Source, BytesToCopy);
+        }
+
+        Source += BytesToCopy;
+        Offset += BytesToCopy;
+        Length -= BytesToCopy;
+    }
+}
+
+void
+VfsMappingCacheEvict(
+    _In_ FileSystemEntry_t* Entry)
+{
+    element_t* Element = list_front(&ChunksLru);
+    while (Element) {
+        VfsMappingChunk_t* Chunk = (VfsMappingChunk_t*)Element;
+        Element = Element->next;
+        if (Chunk->Entry == Entry) {
+            ChunkDestroy(Chunk);
+        }
+    }
+}
+
+static uint64_t MappingHash(const void* Element)
+{
+    const struct VfsMappingIndex* MappingIndex = Element;
+    uint64_t                      Key[2];
+
+    Key[0] = (uint64_t)(uintptr_t)MappingIndex->Entry;
+    Key[1] = MappingIndex->Index;
+    return siphash_64((const uint8_t*)&Key[0], sizeof(Key), &HashKey[0]);
+}
+
+static int MappingCompare(const void* Element1, const void* Element2)
+{
+    const struct VfsMappingIndex* Index1 = Element1;
+    const struct VfsMappingIndex* Index2 = Element2;
+    return (Index1->Entry == Index2->Entry && Index1->Index == Index2->Index) ? 0 : 1;
+}
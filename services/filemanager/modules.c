@@ -109,6 +109,10 @@ VfsResolveFileSystem(
 	// - FsReadFile
 	// - FsWriteFile
 	// - FsSeekFile
+	// Optional functions
+	// - FsFlushEntry
+	// - FsReadEntryVector
+	// - FsWriteEntryVector
 	Module->Initialize = (FsInitialize_t)
 		SharedObjectGetFunction(Module->Handle, "FsInitialize");
 	Module->Destroy = (FsDestroy_t)
@@ -133,6 +137,12 @@ VfsResolveFileSystem(
 		SharedObjectGetFunction(Module->Handle, "FsWriteEntry");
 	Module->SeekInEntry = (FsSeekInEntry_t)
 		SharedObjectGetFunction(Module->Handle, "FsSeekInEntry");
+	Module->FlushEntry = (FsFlushEntry_t)
+		SharedObjectGetFunction(Module->Handle, "FsFlushEntry");
+	Module->ReadEntryVector = (FsReadEntryVector_t)
+		SharedObjectGetFunction(Module->Handle, "FsReadEntryVector");
+	Module->WriteEntryVector = (FsWriteEntryVector_t)
+		SharedObjectGetFunction(Module->Handle, "FsWriteEntryVector");
 
 	// Sanitize functions
 	if (Module->Initialize == NULL || Module->Destroy == NULL ||
@@ -222,7 +222,9 @@ void svc_storage_unregister_callback(struct gracht_recv_message* message, struct
     CollectionItem_t* lNode = NULL;
     DataKey_t         key = { .Value.Id = args->device_id };
     
-    // Keep iterating untill no more FS's are present on disk
+    // Keep iterating untill no more FS's are present on disk. The vfs lock is held
+    // so no file operation or queued transfer is inside a filesystem while it is destroyed
+    VfsAcquireLock();
     lNode = CollectionGetNodeByKey(VfsGetFileSystems(), key, 0);
     while (lNode != NULL) {
         FileSystem_t* fileSystem = (FileSystem_t*)lNode->Data;
@@ -230,6 +232,9 @@ void svc_storage_unregister_callback(struct gracht_recv_message* message, struct
         // Close all open files that relate to this filesystem
         // @todo
 
+        // Entries retained by the dentry cache must be closed before the filesystem goes away
+        VfsDentryInvalidateFileSystem(fileSystem);
+
         // Call destroy handler for that FS
         if (fileSystem->Module->Destroy(&fileSystem->Descriptor, args->flags) != OsSuccess) {
             // What do?
@@ -250,6 +255,7 @@ void svc_storage_unregister_callback(struct gracht_recv_message* message, struct
         CollectionRemoveByNode(VfsGetFileSystems(), lNode);
         lNode = CollectionGetNodeByKey(VfsGetFileSystems(), key, 0);
     }
+    VfsReleaseLock();
 
     // Remove the disk from the list of disks
     disk = CollectionGetDataByKey(VfsGetDisks(), key, 0);
@@ -0,0 +1,91 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Network Manager (Adapter interface)
+ * - Contains the implementation of the adapter infrastructure in the network
+ *   manager. Adapters are kept in the order they were registered, and routing
+ *   picks the first adapter whose network contains the destination.
+ */
+//#define __TRACE
+
+#include "adapter.h"
+#include <ddk/utils.h>
+#include "domains/internet.h"
+#include <stdlib.h>
+
+static list_t Adapters = LIST_INIT;
+
+NetworkPacket_t*
+NetworkPacketCreate(
+    _In_ size_t Length)
+{
+    NetworkPacket_t* Packet = malloc(sizeof(NetworkPacket_t) + Length);
+    if (!Packet) {
+        return NULL;
+    }
+    
+    ELEMENT_INIT(&Packet->Header, 0, Packet);
+    Packet->Length = Length;
+    return Packet;
+}
+
+void
+NetworkPacketDestroy(
+    _In_ NetworkPacket_t* Packet)
+{
+    free(Packet);
+}
+
+void
+NetworkAdapterRegister(
+    _In_ NetworkAdapter_t* Adapter)
+{
+    TRACE("[net_manager] [adapter] register %s", Adapter->Name);
+    ELEMENT_INIT(&Adapter->Header, 0, Adapter);
+    list_append(&Adapters, &Adapter->Header);
+}
+
+void
+NetworkAdapterUnregister(
+    _In_ NetworkAdapter_t* Adapter)
+{
+    TRACE("[net_manager] [adapter] unregister %s", Adapter->Name);
+    list_remove(&Adapters, &Adapter->Header);
+}
+
+NetworkAdapter_t*
+NetworkAdapterRoute(
+    _In_ in_addr_t Destination)
+{
+    foreach(Element, &Adapters) {
+        NetworkAdapter_t* Adapter = Element->value;
+        if ((Destination & Adapter->Netmask) == (Adapter->Address & Adapter->Netmask)) {
+            return Adapter;
+        }
+    }
+    return NULL;
+}
+
+void
+NetworkAdapterReceive(
+    _In_ NetworkAdapter_t* Adapter,
+    _In_ NetworkPacket_t*  Packet)
+{
+    InternetReceive(Adapter, Packet);
+}
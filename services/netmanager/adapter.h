@@ -19,13 +19,82 @@
  *
  * Network Manager (Adapter interface)
  * - Contains the implementation of the adapter infrastructure in the network
- *   manager. There a lot of different types of sockets, like internet, ipc
- *   and bluetooth to name the popular ones.
+ *   manager. An adapter is anything that can transmit and receive IP packets, like
+ *   a network card driver or the loopback adapter. Packets are routed to the
+ *   adapter whose network contains the destination address.
  */
  
 #ifndef __NETMANAGER_ADAPTER_H__
 #define __NETMANAGER_ADAPTER_H__
 
+#include <ds/list.h>
+#include <inet/internet.h>
+#include <os/osdefs.h>
+
 typedef struct NetworkAdapter NetworkAdapter_t;
 
+typedef struct NetworkPacket {
+    element_t Header;
+    size_t    Length;
+    uint8_t   Data[];
+} NetworkPacket_t;
+
+/* NetworkAdapterTransmitFn
+ * Transmits an IP packet on the adapter. The adapter takes ownership of the packet
+ * and must destroy it once it has been transmitted. */
+typedef OsStatus_t (*NetworkAdapterTransmitFn)(NetworkAdapter_t*, NetworkPacket_t*);
+
+struct NetworkAdapter {
+    element_t                Header;
+    const char*              Name;
+    in_addr_t                Address; // Host byte order
+    in_addr_t                Netmask; // Host byte order
+    size_t                   Mtu;
+    NetworkAdapterTransmitFn Transmit;
+    void*                    Context;
+};
+
+/* NetworkPacketCreate
+ * Allocates a new packet of the given length. */
+NetworkPacket_t*
+NetworkPacketCreate(
+    _In_ size_t Length);
+
+void
+NetworkPacketDestroy(
+    _In_ NetworkPacket_t* Packet);
+
+/* NetworkAdapterRegister
+ * Makes the adapter available for routing. Packets received by the adapter must be
+ * delivered through NetworkAdapterReceive. */
+void
+NetworkAdapterRegister(
+    _In_ NetworkAdapter_t* Adapter);
+
+void
+NetworkAdapterUnregister(
+    _In_ NetworkAdapter_t* Adapter);
+
+/* NetworkAdapterRoute
+ * Finds the adapter whose network contains the destination address. The address must
+ * be in host byte order. */
+NetworkAdapter_t*
+NetworkAdapterRoute(
+    _In_ in_addr_t Destination);
+
+/* NetworkAdapterReceive
+ * Delivers a packet received by an adapter to the network stack, which takes
+ * ownership of the packet. */
+void
+NetworkAdapterReceive(
+    _In_ NetworkAdapter_t* Adapter,
+    _In_ NetworkPacket_t*  Packet);
+
+/* LoopbackAdapterCreate
+ * Creates the loopback adapter, every packet transmitted on it is received again
+ * from a separate thread, like it would be from a network card. */
+OsStatus_t
+LoopbackAdapterCreate(
+    _Out_ NetworkAdapter_t** AdapterOut);
+
 #endif //!__NETMANAGER_ADAPTER_H__
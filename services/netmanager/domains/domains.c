@@ -37,6 +37,19 @@ extern OsStatus_t DomainLocalCreate(SocketDomain_t**);
 extern OsStatus_t DomainInternetCreate(int, SocketDomain_t**);
 extern OsStatus_t DomainBluetoothCreate(SocketDomain_t**);
 
+extern OsStatus_t DomainLocalInitialize(void);
+extern OsStatus_t InternetInitialize(void);
+
+OsStatus_t
+DomainInitialize(void)
+{
+    OsStatus_t Status = DomainLocalInitialize();
+    if (Status != OsSuccess) {
+        return Status;
+    }
+    return InternetInitialize();
+}
+
 OsStatus_t
 DomainCreate(
     _In_ int              DomainType,
@@ -179,3 +192,39 @@ DomainGetAddress(
     }
     return Socket->Domain->Ops.GetAddress(Socket, Source, Address);
 }
+
+OsStatus_t
+DomainSetOption(
+    _In_ Socket_t*    Socket,
+    _In_ int          Protocol,
+    _In_ unsigned int Option,
+    _In_ const void*  Data,
+    _In_ socklen_t    DataLength)
+{
+    if (!Socket->Domain) {
+        return OsInvalidParameters;
+    }
+    
+    if (!Socket->Domain->Ops.SetOption) {
+        return OsNotSupported;
+    }
+    return Socket->Domain->Ops.SetOption(Socket, Protocol, Option, Data, DataLength);
+}
+
+OsStatus_t
+DomainGetOption(
+    _In_  Socket_t*    Socket,
+    _In_  int          Protocol,
+    _In_  unsigned int Option,
+    _In_  void*        Data,
+    _Out_ socklen_t*   DataLengthOut)
+{
+    if (!Socket->Domain) {
+        return OsInvalidParameters;
+    }
+    
+    if (!Socket->Domain->Ops.GetOption) {
+        return OsNotSupported;
+    }
+    return Socket->Domain->Ops.GetOption(Socket, Protocol, Option, Data, DataLengthOut);
+}
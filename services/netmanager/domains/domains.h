@@ -28,6 +28,7 @@
 
 #include <os/osdefs.h>
 #include <gracht/link/vali.h>
+#include <inet/socket.h>
 #include <threads.h>
 
 struct sockaddr;
@@ -44,6 +45,8 @@ typedef OsStatus_t (*DomainSendFn)(Socket_t*);
 typedef OsStatus_t (*DomainReceiveFn)(Socket_t*);
 typedef OsStatus_t (*DomainPairFn)(Socket_t*, Socket_t*);
 typedef OsStatus_t (*DomainGetAddressFn)(Socket_t*, int, struct sockaddr*);
+typedef OsStatus_t (*DomainSetOptionFn)(Socket_t*, int, unsigned int, const void*, socklen_t);
+typedef OsStatus_t (*DomainGetOptionFn)(Socket_t*, int, unsigned int, void*, socklen_t*);
 typedef void       (*DomainDestroyFn)(SocketDomain_t*);
 
 typedef struct SocketDomainOps {
@@ -57,9 +60,16 @@ typedef struct SocketDomainOps {
     DomainReceiveFn          Receive;
     DomainPairFn             Pair;
     DomainGetAddressFn       GetAddress;
+    DomainSetOptionFn        SetOption;
+    DomainGetOptionFn        GetOption;
     DomainDestroyFn          Destroy;
 } SocketDomainOps_t;
 
+/* DomainInitialize
+ * Initializes the global state of all supported socket domains. */
+OsStatus_t
+DomainInitialize(void);
+
 OsStatus_t
 DomainCreate(
     _In_ int              DomainType,
@@ -116,4 +126,23 @@ DomainGetAddress(
     _In_ int              Source,
     _In_ struct sockaddr* Address);
 
+/* DomainSetOption
+ * Sets a protocol option of the socket, domains that have no options of their own
+ * return OsNotSupported. */
+OsStatus_t
+DomainSetOption(
+    _In_ Socket_t*    Socket,
+    _In_ int          Protocol,
+    _In_ unsigned int Option,
+    _In_ const void*  Data,
+    _In_ socklen_t    DataLength);
+
+OsStatus_t
+DomainGetOption(
+    _In_  Socket_t*    Socket,
+    _In_  int          Protocol,
+    _In_  unsigned int Option,
+    _In_  void*        Data,
+    _Out_ socklen_t*   DataLengthOut);
+
 #endif //!__NETMANAGER_DOMAINS_H__
@@ -18,21 +18,854 @@
  *
  *
  * Network Manager (Domain Handler)
- * - Contains the implementation of the socket domain type in the network
- *   manager. There a lot of different types of sockets, like internet, ipc
- *   and bluetooth to name the popular ones.
+ * - Contains the implementation of the internet socket domain. IPv4 packets are
+ *   routed to the network adapters, and received packets are dispatched to the UDP
+ *   and TCP protocol handlers. Ports are registered per protocol in a hashtable.
  */
+//#define __TRACE
 
-#include "domains.h"
+#include <ddk/handle.h>
+#include <ddk/utils.h>
+#include <ds/hash_sip.h>
+#include <ds/hashtable.h>
+#include <inet/bits.h>
+#include <inet/tcp.h>
+#include <internal/_socket.h>
+#include "internet.h"
+#include <ioset.h>
+#include "../socket.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-typedef struct SocketDomain {
-    SocketDomainOps_t Ops;
-} SocketDomain_t;
+#include <svc_socket_protocol_server.h>
+
+struct PortEntry {
+    int             Protocol;
+    in_port_t       Port;
+    SocketDomain_t* Domain;
+};
+
+static uint64_t PortHash(const void*);
+static int      PortCompare(const void*, const void*);
+
+mtx_t InternetLock;
+
+static hashtable_t Ports            = { 0 };
+static in_port_t   NextEphemeral    = INTERNET_EPHEMERAL_PORT_FIRST;
+static uint16_t    NextIdentifier   = 0;
+static uint8_t     HashKey[16]      = { 88, 3, 201, 147, 62, 19, 230, 115, 9, 174, 53, 96, 241, 130, 27, 68 };
+
+uint64_t
+InternetTimestamp(void)
+{
+    struct timespec Now;
+    timespec_get(&Now, TIME_MONOTONIC);
+    return ((uint64_t)Now.tv_sec * 1000) + ((uint64_t)Now.tv_nsec / 1000000);
+}
+
+static uint32_t
+ChecksumAdd(
+    _In_ uint32_t    Sum,
+    _In_ const void* Data,
+    _In_ size_t      Length)
+{
+    const uint8_t* Bytes = Data;
+    size_t         i;
+    
+    for (i = 0; i + 1 < Length; i += 2) {
+        Sum += ((uint32_t)Bytes[i] << 8) | Bytes[i + 1];
+    }
+    if (Length & 1) {
+        Sum += (uint32_t)Bytes[Length - 1] << 8;
+    }
+    return Sum;
+}
+
+static uint16_t
+ChecksumFinish(
+    _In_ uint32_t Sum)
+{
+    while (Sum >> 16) {
+        Sum = (Sum & 0xFFFF) + (Sum >> 16);
+    }
+    return htons((uint16_t)~Sum);
+}
+
+uint16_t
+InternetChecksum(
+    _In_ in_addr_t   Source,
+    _In_ in_addr_t   Destination,
+    _In_ int         Protocol,
+    _In_ const void* Data,
+    _In_ size_t      Length)
+{
+    uint32_t Sum = 0;
+    
+    // The pseudo header is summed as host order words
+    Sum += (Source >> 16) + (Source & 0xFFFF);
+    Sum += (Destination >> 16) + (Destination & 0xFFFF);
+    Sum += (uint32_t)Protocol + (uint32_t)Length;
+    return ChecksumFinish(ChecksumAdd(Sum, Data, Length));
+}
+
+NetworkPacket_t*
+InternetPacketCreate(
+    _In_  size_t PayloadLength,
+    _Out_ void** PayloadOut)
+{
+    NetworkPacket_t* Packet = NetworkPacketCreate(sizeof(Ipv4Header_t) + PayloadLength);
+    if (!Packet) {
+        return NULL;
+    }
+    
+    *PayloadOut = &Packet->Data[sizeof(Ipv4Header_t)];
+    return Packet;
+}
+
+OsStatus_t
+InternetTransmit(
+    _In_ NetworkPacket_t* Packet,
+    _In_ in_addr_t        Source,
+    _In_ in_addr_t        Destination,
+    _In_ int              Protocol)
+{
+    NetworkAdapter_t* Adapter = NetworkAdapterRoute(Destination);
+    Ipv4Header_t*     Header  = (Ipv4Header_t*)&Packet->Data[0];
+    TRACE("[internet] [transmit] %" PRIuIN " bytes, protocol %i", Packet->Length, Protocol);
+    
+    if (!Adapter) {
+        NetworkPacketDestroy(Packet);
+        return OsHostUnreachable;
+    }
+    
+    // Packets are never fragmented, the protocols must respect the MTU
+    if (Packet->Length > Adapter->Mtu) {
+        WARNING("[internet] [transmit] packet of %" PRIuIN " bytes exceeds mtu of %s",
+            Packet->Length, Adapter->Name);
+        NetworkPacketDestroy(Packet);
+        return OsInvalidParameters;
+    }
+    
+    Header->VersionLength      = IPV4_VERSION_LENGTH;
+    Header->TypeOfService      = 0;
+    Header->TotalLength        = htons((uint16_t)Packet->Length);
+    Header->Identification     = htons(NextIdentifier++);
+    Header->FragmentOffset     = htons(IPV4_FLAG_DONT_FRAGMENT);
+    Header->TimeToLive         = IPV4_DEFAULT_TTL;
+    Header->Protocol           = (uint8_t)Protocol;
+    Header->Checksum           = 0;
+    Header->SourceAddress      = htonl(Source);
+    Header->DestinationAddress = htonl(Destination);
+    Header->Checksum           = ChecksumFinish(ChecksumAdd(0, Header, sizeof(Ipv4Header_t)));
+    return Adapter->Transmit(Adapter, Packet);
+}
+
+OsStatus_t
+InternetSourceAddress(
+    _In_  in_addr_t  Destination,
+    _Out_ in_addr_t* SourceOut)
+{
+    NetworkAdapter_t* Adapter = NetworkAdapterRoute(Destination);
+    if (!Adapter) {
+        return OsHostUnreachable;
+    }
+    
+    *SourceOut = Adapter->Address;
+    return OsSuccess;
+}
+
+OsStatus_t
+InternetBindPort(
+    _In_ SocketDomain_t* Domain,
+    _In_ in_addr_t       Address,
+    _In_ in_port_t       Port)
+{
+    int i;
+    TRACE("[internet] [bind] protocol %i, port %u", Domain->Protocol, Port);
+    
+    if (!Port) {
+        for (i = 0; i <= (INTERNET_EPHEMERAL_PORT_LAST - INTERNET_EPHEMERAL_PORT_FIRST); i++) {
+            in_port_t Candidate = NextEphemeral;
+            
+            NextEphemeral = (NextEphemeral == INTERNET_EPHEMERAL_PORT_LAST) ?
+                INTERNET_EPHEMERAL_PORT_FIRST : (in_port_t)(NextEphemeral + 1);
+            if (!hashtable_get(&Ports, &(struct PortEntry) {
+                    .Protocol = Domain->Protocol, .Port = Candidate })) {
+                Port = Candidate;
+                break;
+            }
+        }
+        
+        if (!Port) {
+            ERROR("[internet] [bind] out of ephemeral ports");
+            return OsOutOfMemory;
+        }
+    }
+    else if (hashtable_get(&Ports, &(struct PortEntry) { .Protocol = Domain->Protocol, .Port = Port })) {
+        return OsExists;
+    }
+    
+    hashtable_set(&Ports, &(struct PortEntry) {
+        .Protocol = Domain->Protocol, .Port = Port, .Domain = Domain });
+    Domain->LocalAddress = Address;
+    Domain->LocalPort    = Port;
+    Domain->PortBound    = 1;
+    return OsSuccess;
+}
+
+static void
+InternetUnbindPort(
+    _In_ SocketDomain_t* Domain)
+{
+    if (Domain->PortBound) {
+        hashtable_remove(&Ports, &(struct PortEntry) {
+            .Protocol = Domain->Protocol, .Port = Domain->LocalPort });
+        Domain->PortBound = 0;
+    }
+}
+
+SocketDomain_t*
+InternetLookupPort(
+    _In_ int       Protocol,
+    _In_ in_addr_t Address,
+    _In_ in_port_t Port)
+{
+    struct PortEntry* Entry = hashtable_get(&Ports, &(struct PortEntry) {
+        .Protocol = Protocol, .Port = Port });
+    if (!Entry) {
+        return NULL;
+    }
+    
+    if (Entry->Domain->LocalAddress != INADDR_ANY && Entry->Domain->LocalAddress != Address) {
+        return NULL;
+    }
+    return Entry->Domain;
+}
+
+static void
+FillAddress(
+    _In_ struct sockaddr* Address,
+    _In_ in_addr_t        InternetAddress,
+    _In_ in_port_t        Port)
+{
+    struct sockaddr_in* InAddress = (struct sockaddr_in*)Address;
+    
+    memset(InAddress, 0, sizeof(struct sockaddr_in));
+    InAddress->sin_len         = sizeof(struct sockaddr_in);
+    InAddress->sin_family      = AF_INET;
+    InAddress->sin_port        = htons(Port);
+    InAddress->sin_addr.s_addr = htonl(InternetAddress);
+}
+
+static void
+UdpInput(
+    _In_ Ipv4Header_t* Ip,
+    _In_ void*         Segment,
+    _In_ size_t        Length)
+{
+    UdpHeader_t*       Header = Segment;
+    SocketDomain_t*    Domain;
+    streambuffer_t*    Stream;
+    struct packethdr   Packet;
+    struct sockaddr_in Address;
+    unsigned int       Base, State;
+    size_t             PayloadLength;
+    size_t             TotalLength;
+    in_addr_t          Source      = ntohl(Ip->SourceAddress);
+    in_addr_t          Destination = ntohl(Ip->DestinationAddress);
+    
+    if (Length < sizeof(UdpHeader_t) || ntohs(Header->Length) < sizeof(UdpHeader_t) ||
+        ntohs(Header->Length) > Length) {
+        return;
+    }
+    
+    Length = ntohs(Header->Length);
+    if (Header->Checksum && InternetChecksum(Source, Destination, IPPROTO_UDP, Segment, Length)) {
+        WARNING("[internet] [udp] checksum mismatch");
+        return;
+    }
+    
+    Domain = InternetLookupPort(IPPROTO_UDP, Destination, ntohs(Header->DestinationPort));
+    if (!Domain) {
+        TRACE("[internet] [udp] no socket bound to port %u", ntohs(Header->DestinationPort));
+        return;
+    }
+    
+    // Connected sockets only receive datagrams from their peer
+    if (Domain->RemotePort && (ntohs(Header->SourcePort) != Domain->RemotePort ||
+            (Domain->RemoteAddress != INADDR_ANY && Source != Domain->RemoteAddress))) {
+        TRACE("[internet] [udp] datagram not from the connected peer");
+        return;
+    }
+    
+    // Datagrams are delivered in the same packet format that libc uses for sending,
+    // with the address of the sender
+    PayloadLength = Length - sizeof(UdpHeader_t);
+    TotalLength   = sizeof(struct packethdr) + sizeof(struct sockaddr_in) + PayloadLength;
+    Stream        = GetSocketRecvStream(Domain->Socket);
+    if (streambuffer_write_packet_start(Stream, TotalLength, STREAMBUFFER_NO_BLOCK,
+            &Base, &State) < TotalLength) {
+        TRACE("[internet] [udp] receive stream is full, dropping datagram");
+        return;
+    }
+    
+    Packet.flags      = 0;
+    Packet.controllen = 0;
+    Packet.addresslen = sizeof(struct sockaddr_in);
+    Packet.payloadlen = (intmax_t)PayloadLength;
+    FillAddress((struct sockaddr*)&Address, Source, ntohs(Header->SourcePort));
+    
+    streambuffer_write_packet_data(Stream, &Packet, sizeof(struct packethdr), &State);
+    streambuffer_write_packet_data(Stream, &Address, sizeof(struct sockaddr_in), &State);
+    streambuffer_write_packet_data(Stream, (uint8_t*)Segment + sizeof(UdpHeader_t), PayloadLength, &State);
+    streambuffer_write_packet_end(Stream, Base, TotalLength);
+    handle_post_notification((UUId_t)(uintptr_t)Domain->Socket->Header.key, IOSETIN);
+}
+
+static OsStatus_t
+UdpTransmit(
+    _In_ SocketDomain_t*  Domain,
+    _In_ streambuffer_t*  Stream,
+    _In_ unsigned int*    State,
+    _In_ in_addr_t        Destination,
+    _In_ in_port_t        DestinationPort,
+    _In_ size_t           PayloadLength)
+{
+    NetworkPacket_t* Packet;
+    UdpHeader_t*     Header;
+    in_addr_t        Source = Domain->LocalAddress;
+    OsStatus_t       Status;
+    
+    if (!Domain->PortBound) {
+        Status = InternetBindPort(Domain, INADDR_ANY, 0);
+        if (Status != OsSuccess) {
+            return Status;
+        }
+    }
+    
+    if (Source == INADDR_ANY) {
+        Status = InternetSourceAddress(Destination, &Source);
+        if (Status != OsSuccess) {
+            return Status;
+        }
+    }
+    
+    Packet = InternetPacketCreate(sizeof(UdpHeader_t) + PayloadLength, (void**)&Header);
+    if (!Packet) {
+        return OsOutOfMemory;
+    }
+    
+    // The payload is read directly from the send stream into the packet
+    streambuffer_read_packet_data(Stream, (uint8_t*)Header + sizeof(UdpHeader_t), PayloadLength, State);
+    Header->SourcePort      = htons(Domain->LocalPort);
+    Header->DestinationPort = htons(DestinationPort);
+    Header->Length          = htons((uint16_t)(sizeof(UdpHeader_t) + PayloadLength));
+    Header->Checksum        = 0;
+    Header->Checksum        = InternetChecksum(Source, Destination, IPPROTO_UDP, Header,
+        sizeof(UdpHeader_t) + PayloadLength);
+    if (!Header->Checksum) {
+        Header->Checksum = 0xFFFF;
+    }
+    return InternetTransmit(Packet, Source, Destination, IPPROTO_UDP);
+}
+
+static OsStatus_t
+UdpSend(
+    _In_ Socket_t* Socket)
+{
+    SocketDomain_t*    Domain = Socket->Domain;
+    streambuffer_t*    Stream = GetSocketSendStream(Socket);
+    struct packethdr   Packet;
+    struct sockaddr_in Address;
+    unsigned int       Base, State;
+    size_t             BytesRead;
+    in_addr_t          Destination;
+    in_port_t          DestinationPort;
+    OsStatus_t         Status;
+    TRACE("[internet] [udp] [send]");
+    
+    while (1) {
+        BytesRead = streambuffer_read_packet_start(Stream, STREAMBUFFER_NO_BLOCK, &Base, &State);
+        if (!BytesRead) {
+            break;
+        }
+        
+        if (BytesRead < sizeof(struct packethdr)) {
+            streambuffer_read_packet_end(Stream, Base, BytesRead);
+            continue;
+        }
+        
+        streambuffer_read_packet_data(Stream, &Packet, sizeof(struct packethdr), &State);
+        if (Packet.addresslen < 0 || Packet.controllen < 0 || Packet.payloadlen < 0 ||
+            (sizeof(struct packethdr) + Packet.addresslen + Packet.controllen + Packet.payloadlen) > BytesRead ||
+            (size_t)Packet.payloadlen > (IPV4_MAX_PACKET - sizeof(Ipv4Header_t) - sizeof(UdpHeader_t))) {
+            WARNING("[internet] [udp] [send] invalid packet");
+            streambuffer_read_packet_end(Stream, Base, BytesRead);
+            continue;
+        }
+        
+        if ((size_t)Packet.addresslen >= sizeof(struct sockaddr_in)) {
+            streambuffer_read_packet_data(Stream, &Address, sizeof(struct sockaddr_in), &State);
+            State          += (unsigned int)((size_t)Packet.addresslen - sizeof(struct sockaddr_in));
+            Destination     = ntohl(Address.sin_addr.s_addr);
+            DestinationPort = ntohs(Address.sin_port);
+        }
+        else {
+            State          += (unsigned int)Packet.addresslen;
+            Destination     = Domain->RemoteAddress;
+            DestinationPort = Domain->RemotePort;
+        }
+        State += (unsigned int)Packet.controllen;
+        
+        if (!DestinationPort) {
+            WARNING("[internet] [udp] [send] no destination for datagram");
+            streambuffer_read_packet_end(Stream, Base, BytesRead);
+            continue;
+        }
+        
+        mtx_lock(&InternetLock);
+        Status = UdpTransmit(Domain, Stream, &State, Destination, DestinationPort,
+            (size_t)Packet.payloadlen);
+        mtx_unlock(&InternetLock);
+        streambuffer_read_packet_end(Stream, Base, BytesRead);
+        if (Status != OsSuccess) {
+            TRACE("[internet] [udp] [send] transmit failed %u", Status);
+        }
+    }
+    return OsSuccess;
+}
+
+/* UdpConnect
+ * Associates the socket with a peer. Datagrams without an address are sent to the peer,
+ * and only datagrams from the peer are received. AF_UNSPEC dissolves the association. */
+static OsStatus_t
+UdpConnect(
+    _In_ SocketDomain_t*        Domain,
+    _In_ const struct sockaddr* Address)
+{
+    const struct sockaddr_in* InAddress = (const struct sockaddr_in*)Address;
+    OsStatus_t                Status    = OsSuccess;
+    
+    if (Address->sa_family == AF_UNSPEC) {
+        mtx_lock(&InternetLock);
+        Domain->RemoteAddress = INADDR_ANY;
+        Domain->RemotePort    = 0;
+        mtx_unlock(&InternetLock);
+        return OsSuccess;
+    }
+    
+    if (Address->sa_family != AF_INET || !InAddress->sin_port) {
+        return OsInvalidParameters;
+    }
+    
+    // The reply from the peer must have a port to arrive at
+    mtx_lock(&InternetLock);
+    if (!Domain->PortBound) {
+        Status = InternetBindPort(Domain, INADDR_ANY, 0);
+    }
+    if (Status == OsSuccess) {
+        Domain->RemoteAddress = ntohl(InAddress->sin_addr.s_addr);
+        Domain->RemotePort    = ntohs(InAddress->sin_port);
+    }
+    mtx_unlock(&InternetLock);
+    return Status;
+}
+
+void
+InternetReceive(
+    _In_ NetworkAdapter_t* Adapter,
+    _In_ NetworkPacket_t*  Packet)
+{
+    Ipv4Header_t* Header = (Ipv4Header_t*)&Packet->Data[0];
+    size_t        HeaderLength;
+    size_t        TotalLength;
+    in_addr_t     Destination;
+    
+    if (Packet->Length < sizeof(Ipv4Header_t) || (Header->VersionLength >> 4) != 4) {
+        goto Drop;
+    }
+    
+    HeaderLength = (size_t)(Header->VersionLength & 0xF) * 4;
+    TotalLength  = ntohs(Header->TotalLength);
+    if (HeaderLength < sizeof(Ipv4Header_t) || TotalLength < HeaderLength ||
+        TotalLength > Packet->Length) {
+        goto Drop;
+    }
+    
+    if (ChecksumFinish(ChecksumAdd(0, Header, HeaderLength))) {
+        WARNING("[internet] [receive] header checksum mismatch on %s", Adapter->Name);
+        goto Drop;
+    }
+    
+    // Fragments are not reassembled, all protocols send within the MTU
+    if (ntohs(Header->FragmentOffset) & 0x3FFF) {
+        TRACE("[internet] [receive] dropping fragment");
+        goto Drop;
+    }
+    
+    Destination = ntohl(Header->DestinationAddress);
+    if (Destination != Adapter->Address && Destination != INADDR_BROADCAST &&
+        (Destination >> IN_CLASSA_NSHIFT) != IN_LOOPBACKNET) {
+        goto Drop;
+    }
+    
+    mtx_lock(&InternetLock);
+    switch (Header->Protocol) {
+        case IPPROTO_UDP: {
+            UdpInput(Header, &Packet->Data[HeaderLength], TotalLength - HeaderLength);
+        } break;
+        case IPPROTO_TCP: {
+            TcpInput(Adapter, Header, &Packet->Data[HeaderLength], TotalLength - HeaderLength);
+        } break;
+        
+        default:
+            TRACE("[internet] [receive] unsupported protocol %u", Header->Protocol);
+            break;
+    }
+    mtx_unlock(&InternetLock);
+
+Drop:
+    NetworkPacketDestroy(Packet);
+}
+
+static OsStatus_t
+DomainInternetAllocateAddress(
+    _In_ Socket_t* Socket)
+{
+    SocketDomain_t* Domain = Socket->Domain;
+    TRACE("[internet] [allocate_address] %u", LODWORD(Socket->Header.key));
+    
+    // Addresses are only assigned once the socket is bound, or when it is
+    // used for the first time
+    Domain->Socket = Socket;
+    switch (Socket->Type) {
+        case SOCK_STREAM: {
+            if (Socket->Protocol != 0 && Socket->Protocol != IPPROTO_TCP) {
+                return OsInvalidProtocol;
+            }
+            Domain->Protocol = IPPROTO_TCP;
+        } break;
+        case SOCK_DGRAM: {
+            if (Socket->Protocol != 0 && Socket->Protocol != IPPROTO_UDP) {
+                return OsInvalidProtocol;
+            }
+            Domain->Protocol = IPPROTO_UDP;
+        } break;
+        
+        default:
+            return OsNotSupported;
+    }
+    return OsSuccess;
+}
+
+static void
+DomainInternetFreeAddress(
+    _In_ Socket_t* Socket)
+{
+    mtx_lock(&InternetLock);
+    InternetUnbindPort(Socket->Domain);
+    mtx_unlock(&InternetLock);
+}
+
+static OsStatus_t
+DomainInternetBind(
+    _In_ Socket_t*              Socket,
+    _In_ const struct sockaddr* Address)
+{
+    const struct sockaddr_in* InAddress = (const struct sockaddr_in*)Address;
+    OsStatus_t                Status;
+    
+    if (Address->sa_family != AF_INET) {
+        return OsInvalidParameters;
+    }
+    
+    mtx_lock(&InternetLock);
+    if (Socket->Domain->PortBound) {
+        Status = OsExists;
+    }
+    else {
+        Status = InternetBindPort(Socket->Domain, ntohl(InAddress->sin_addr.s_addr),
+            ntohs(InAddress->sin_port));
+    }
+    mtx_unlock(&InternetLock);
+    return Status;
+}
+
+static OsStatus_t
+DomainInternetConnect(
+    _In_ struct gracht_recv_message* Message,
+    _In_ Socket_t*                   Socket,
+    _In_ const struct sockaddr*      Address)
+{
+    const struct sockaddr_in* InAddress = (const struct sockaddr_in*)Address;
+    OsStatus_t                Status;
+    
+    if (Socket->Domain->Protocol == IPPROTO_UDP) {
+        return UdpConnect(Socket->Domain, Address);
+    }
+    
+    if (Address->sa_family != AF_INET || !InAddress->sin_port) {
+        return OsInvalidParameters;
+    }
+    
+    mtx_lock(&InternetLock);
+    Socket->Domain->RemoteAddress = ntohl(InAddress->sin_addr.s_addr);
+    Socket->Domain->RemotePort    = ntohs(InAddress->sin_port);
+    Status = TcpConnect(Message, Socket->Domain);
+    mtx_unlock(&InternetLock);
+    return Status;
+}
+
+static OsStatus_t
+DomainInternetDisconnect(
+    _In_ Socket_t* Socket)
+{
+    if (Socket->Domain->Protocol == IPPROTO_TCP) {
+        mtx_lock(&InternetLock);
+        TcpClose(Socket->Domain);
+        mtx_unlock(&InternetLock);
+    }
+    Socket->Configuration.Connected = 0;
+    return OsSuccess;
+}
+
+static OsStatus_t
+DomainInternetAccept(
+    _In_ struct gracht_recv_message* Message,
+    _In_ Socket_t*                   Socket)
+{
+    OsStatus_t Status;
+    
+    if (Socket->Domain->Protocol != IPPROTO_TCP) {
+        return OsNotSupported;
+    }
+    
+    mtx_lock(&InternetLock);
+    Status = TcpAccept(Message, Socket->Domain);
+    mtx_unlock(&InternetLock);
+    return Status;
+}
+
+static OsStatus_t
+DomainInternetSend(
+    _In_ Socket_t* Socket)
+{
+    OsStatus_t Status;
+    
+    if (Socket->Domain->Protocol == IPPROTO_UDP) {
+        return UdpSend(Socket);
+    }
+    
+    mtx_lock(&InternetLock);
+    Status = TcpSend(Socket->Domain);
+    mtx_unlock(&InternetLock);
+    return Status;
+}
+
+static OsStatus_t
+DomainInternetReceive(
+    _In_ Socket_t* Socket)
+{
+    OsStatus_t Status = OsSuccess;
+    
+    if (Socket->Domain->Protocol == IPPROTO_TCP) {
+        mtx_lock(&InternetLock);
+        Status = TcpReceive(Socket->Domain);
+        mtx_unlock(&InternetLock);
+    }
+    return Status;
+}
+
+static OsStatus_t
+DomainInternetPair(
+    _In_ Socket_t* Socket1,
+    _In_ Socket_t* Socket2)
+{
+    return OsNotSupported;
+}
+
+static OsStatus_t
+DomainInternetGetAddress(
+    _In_ Socket_t*        Socket,
+    _In_ int              Source,
+    _In_ struct sockaddr* Address)
+{
+    SocketDomain_t* Domain = Socket->Domain;
+    
+    switch (Source) {
+        case SVC_SOCKET_GET_ADDRESS_SOURCE_THIS: {
+            FillAddress(Address, Domain->LocalAddress, Domain->LocalPort);
+            return OsSuccess;
+        } break;
+        
+        case SVC_SOCKET_GET_ADDRESS_SOURCE_PEER: {
+            if (!Domain->RemotePort) {
+                return OsNotConnected;
+            }
+            FillAddress(Address, Domain->RemoteAddress, Domain->RemotePort);
+            return OsSuccess;
+        } break;
+    }
+    return OsInvalidParameters;
+}
+
+static OsStatus_t
+DomainInternetSetOption(
+    _In_ Socket_t*    Socket,
+    _In_ int          Protocol,
+    _In_ unsigned int Option,
+    _In_ const void*  Data,
+    _In_ socklen_t    DataLength)
+{
+    SocketDomain_t* Domain = Socket->Domain;
+    int             Value;
+    
+    if (Protocol != IPPROTO_TCP || Domain->Protocol != IPPROTO_TCP) {
+        return OsNotSupported;
+    }
+    
+    if (!Data || DataLength < sizeof(int)) {
+        return OsInvalidParameters;
+    }
+    Value = *((const int*)Data);
+    
+    mtx_lock(&InternetLock);
+    switch (Option) {
+        case TCP_NODELAY: {
+            // Enabling the option pushes out any data that was held back
+            Domain->NoDelay = (Value != 0);
+            if (Domain->NoDelay) {
+                TcpSend(Domain);
+            }
+        } break;
+        case TCP_QUICKACK: {
+            Domain->QuickAck = (Value != 0);
+        } break;
+        
+        default:
+            mtx_unlock(&InternetLock);
+            return OsNotSupported;
+    }
+    mtx_unlock(&InternetLock);
+    return OsSuccess;
+}
+
+static OsStatus_t
+DomainInternetGetOption(
+    _In_  Socket_t*    Socket,
+    _In_  int          Protocol,
+    _In_  unsigned int Option,
+    _In_  void*        Data,
+    _Out_ socklen_t*   DataLengthOut)
+{
+    SocketDomain_t* Domain = Socket->Domain;
+    
+    if (Protocol != IPPROTO_TCP || Domain->Protocol != IPPROTO_TCP) {
+        return OsNotSupported;
+    }
+    
+    switch (Option) {
+        case TCP_NODELAY: {
+            *((int*)Data) = Domain->NoDelay;
+        } break;
+        case TCP_QUICKACK: {
+            *((int*)Data) = Domain->QuickAck;
+        } break;
+        
+        default:
+            return OsNotSupported;
+    }
+    *DataLengthOut = sizeof(int);
+    return OsSuccess;
+}
+
+static void
+DomainInternetDestroy(
+    _In_ SocketDomain_t* Domain)
+{
+    TRACE("[internet] [destroy]");
+    
+    mtx_lock(&InternetLock);
+    if (Domain->Protocol == IPPROTO_TCP) {
+        TcpCloseListener(Domain);
+        TcpClose(Domain);
+    }
+    InternetUnbindPort(Domain);
+    mtx_unlock(&InternetLock);
+    free(Domain);
+}
 
 OsStatus_t
 DomainInternetCreate(
     _In_  int              DomainType,
     _Out_ SocketDomain_t** DomainOut)
 {
-    return OsNotSupported;
+    SocketDomain_t* Domain;
+    
+    // Only IPv4 is supported for now
+    if (DomainType != AF_INET) {
+        return OsNotSupported;
+    }
+    
+    Domain = malloc(sizeof(SocketDomain_t));
+    if (!Domain) {
+        return OsOutOfMemory;
+    }
+    memset(Domain, 0, sizeof(SocketDomain_t));
+    
+    Domain->Ops.AddressAllocate = DomainInternetAllocateAddress;
+    Domain->Ops.AddressFree     = DomainInternetFreeAddress;
+    Domain->Ops.Bind            = DomainInternetBind;
+    Domain->Ops.Connect         = DomainInternetConnect;
+    Domain->Ops.Disconnect      = DomainInternetDisconnect;
+    Domain->Ops.Accept          = DomainInternetAccept;
+    Domain->Ops.Send            = DomainInternetSend;
+    Domain->Ops.Receive         = DomainInternetReceive;
+    Domain->Ops.Pair            = DomainInternetPair;
+    Domain->Ops.GetAddress      = DomainInternetGetAddress;
+    Domain->Ops.SetOption       = DomainInternetSetOption;
+    Domain->Ops.GetOption       = DomainInternetGetOption;
+    Domain->Ops.Destroy         = DomainInternetDestroy;
+    
+    ELEMENT_INIT(&Domain->Header, 0, Domain);
+    list_construct(&Domain->Children);
+    
+    *DomainOut = Domain;
+    return OsSuccess;
+}
+
+OsStatus_t
+InternetInitialize(void)
+{
+    NetworkAdapter_t* Loopback;
+    OsStatus_t        Status;
+    TRACE("[internet] initialize");
+    
+    mtx_init(&InternetLock, mtx_recursive);
+    if (hashtable_construct(&Ports, 0, sizeof(struct PortEntry), PortHash, PortCompare)) {
+        return OsOutOfMemory;
+    }
+    
+    Status = LoopbackAdapterCreate(&Loopback);
+    if (Status != OsSuccess) {
+        ERROR("[internet] failed to create the loopback adapter");
+        return Status;
+    }
+    NetworkAdapterRegister(Loopback);
+    return TcpInitialize();
+}
+
+static uint64_t PortHash(const void* Element)
+{
+    const struct PortEntry* Entry = Element;
+    uint32_t                Key   = ((uint32_t)Entry->Protocol << 16) | Entry->Port;
+    return siphash_64((const uint8_t*)&Key, sizeof(uint32_t), &HashKey[0]);
+}
+
+static int PortCompare(const void* Element1, const void* Element2)
+{
+    const struct PortEntry* Entry1 = Element1;
+    const struct PortEntry* Entry2 = Element2;
+    return !(Entry1->Protocol == Entry2->Protocol && Entry1->Port == Entry2->Port);
 }
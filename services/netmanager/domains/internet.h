@@ -0,0 +1,224 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Network Manager (Internet Domain)
+ * - Contains the shared definitions of the internet domain. The domain implements
+ *   IPv4 with UDP and TCP on top of the network adapters.
+ */
+
+#ifndef __NETMANAGER_INTERNET_H__
+#define __NETMANAGER_INTERNET_H__
+
+#include "domains.h"
+#include "../adapter.h"
+#include <ds/list.h>
+#include <inet/internet.h>
+
+#define IPV4_VERSION_LENGTH     0x45 // Version 4, 5 words of header
+#define IPV4_DEFAULT_TTL        64
+#define IPV4_FLAG_DONT_FRAGMENT 0x4000
+#define IPV4_MAX_PACKET         0xFFFF
+
+#define INTERNET_EPHEMERAL_PORT_FIRST 49152
+#define INTERNET_EPHEMERAL_PORT_LAST  65535
+
+PACKED_TYPESTRUCT(Ipv4Header, {
+    uint8_t  VersionLength;
+    uint8_t  TypeOfService;
+    uint16_t TotalLength;
+    uint16_t Identification;
+    uint16_t FragmentOffset;
+    uint8_t  TimeToLive;
+    uint8_t  Protocol;
+    uint16_t Checksum;
+    uint32_t SourceAddress;
+    uint32_t DestinationAddress;
+});
+
+PACKED_TYPESTRUCT(UdpHeader, {
+    uint16_t SourcePort;
+    uint16_t DestinationPort;
+    uint16_t Length;
+    uint16_t Checksum;
+});
+
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_SYN 0x02
+#define TCP_FLAG_RST 0x04
+#define TCP_FLAG_PSH 0x08
+#define TCP_FLAG_ACK 0x10
+
+PACKED_TYPESTRUCT(TcpHeader, {
+    uint16_t SourcePort;
+    uint16_t DestinationPort;
+    uint32_t SequenceNumber;
+    uint32_t AcknowledgeNumber;
+    uint8_t  DataOffset; // Upper 4 bits, number of words of header
+    uint8_t  Flags;
+    uint16_t Window;
+    uint16_t Checksum;
+    uint16_t UrgentPointer;
+});
+
+typedef struct SocketDomain {
+    SocketDomainOps_t      Ops;
+    Socket_t*              Socket;
+    int                    Protocol;      // IPPROTO_UDP or IPPROTO_TCP
+    in_addr_t              LocalAddress;  // Host byte order
+    in_port_t              LocalPort;     // Host byte order, 0 if not bound
+    in_addr_t              RemoteAddress;
+    in_port_t              RemotePort;
+    unsigned int           PortBound : 1; // Owns the local port
+    unsigned int           NoDelay   : 1; // Nagle disabled
+    unsigned int           QuickAck  : 1; // Delayed acknowledgements disabled
+    unsigned int           Ready     : 1; // Connection established, can be accepted
+    struct TcpConnection*  Connection;
+    
+    // Connections received by a listener are kept in the list of the listener
+    // until they have been accepted
+    element_t              Header;
+    struct SocketDomain*   Listener;
+    list_t                 Children;
+} SocketDomain_t;
+
+/* InternetLock
+ * Protects the port bindings and all protocol state of the domain. It is recursive,
+ * as the receive path creates sockets for incoming connections. */
+extern mtx_t InternetLock;
+
+/* InternetInitialize
+ * Creates the loopback adapter and starts the protocol timers. */
+OsStatus_t
+InternetInitialize(void);
+
+/* InternetReceive
+ * Processes an IP packet received by an adapter, the packet is destroyed. */
+void
+InternetReceive(
+    _In_ NetworkAdapter_t* Adapter,
+    _In_ NetworkPacket_t*  Packet);
+
+/* InternetTimestamp
+ * Returns a monotonic timestamp in milliseconds. */
+uint64_t
+InternetTimestamp(void);
+
+/* InternetPacketCreate
+ * Allocates a packet with room for the IP header, and returns a pointer to where the
+ * protocol header and payload should be written. */
+NetworkPacket_t*
+InternetPacketCreate(
+    _In_  size_t PayloadLength,
+    _Out_ void** PayloadOut);
+
+/* InternetTransmit
+ * Fills in the IP header of the packet and transmits it on the adapter that the
+ * destination is routed to. Addresses are in host byte order. */
+OsStatus_t
+InternetTransmit(
+    _In_ NetworkPacket_t* Packet,
+    _In_ in_addr_t        Source,
+    _In_ in_addr_t        Destination,
+    _In_ int              Protocol);
+
+/* InternetChecksum
+ * Calculates the checksum of a protocol header and payload, including the IPv4 pseudo
+ * header. Addresses are in host byte order. */
+uint16_t
+InternetChecksum(
+    _In_ in_addr_t   Source,
+    _In_ in_addr_t   Destination,
+    _In_ int         Protocol,
+    _In_ const void* Data,
+    _In_ size_t      Length);
+
+/* InternetBindPort
+ * Binds the socket to a local address and port, if the port is 0 an ephemeral port
+ * is allocated. */
+OsStatus_t
+InternetBindPort(
+    _In_ SocketDomain_t* Domain,
+    _In_ in_addr_t       Address,
+    _In_ in_port_t       Port);
+
+/* InternetLookupPort
+ * Finds the socket that is bound to the port for the given protocol. */
+SocketDomain_t*
+InternetLookupPort(
+    _In_ int       Protocol,
+    _In_ in_addr_t Address,
+    _In_ in_port_t Port);
+
+/* InternetSourceAddress
+ * Selects the local address used for traffic to the destination. */
+OsStatus_t
+InternetSourceAddress(
+    _In_  in_addr_t  Destination,
+    _Out_ in_addr_t* SourceOut);
+
+OsStatus_t
+TcpInitialize(void);
+
+void
+TcpInput(
+    _In_ NetworkAdapter_t* Adapter,
+    _In_ Ipv4Header_t*     Header,
+    _In_ void*             Segment,
+    _In_ size_t            Length);
+
+OsStatus_t
+TcpConnect(
+    _In_ struct gracht_recv_message* Message,
+    _In_ SocketDomain_t*             Domain);
+
+OsStatus_t
+TcpAccept(
+    _In_ struct gracht_recv_message* Message,
+    _In_ SocketDomain_t*             Domain);
+
+/* TcpSend
+ * Transmits the data written to the send stream of the socket, as far as the window
+ * of the peer and the Nagle algorithm allows. */
+OsStatus_t
+TcpSend(
+    _In_ SocketDomain_t* Domain);
+
+/* TcpReceive
+ * Invoked when the application has consumed data from the receive stream, so the
+ * freed space can be advertised to the peer. */
+OsStatus_t
+TcpReceive(
+    _In_ SocketDomain_t* Domain);
+
+/* TcpClose
+ * Closes the connection of the socket. Data that has been written to the socket is
+ * still delivered, and the connection lives on without the socket until it has been
+ * shut down. */
+void
+TcpClose(
+    _In_ SocketDomain_t* Domain);
+
+/* TcpCloseListener
+ * Resets all connections that were created by a listening socket and have not been
+ * accepted yet. */
+void
+TcpCloseListener(
+    _In_ SocketDomain_t* Domain);
+
+#endif //!__NETMANAGER_INTERNET_H__
@@ -29,6 +29,8 @@
 #include "../manager.h"
 #include <ddk/handle.h>
 #include <ddk/utils.h>
+#include <ds/hash_sip.h>
+#include <ds/hashtable.h>
 #include <ds/list.h>
 #include <internal/_socket.h>
 #include <inet/local.h>
@@ -40,10 +42,15 @@
 #include <svc_socket_protocol_server.h>
 
 typedef struct AddressRecord {
-    element_t Header;
+    char*     Address;
     Socket_t* Socket;
 } AddressRecord_t;
 
+struct AddressIndex {
+    const char*      Address;
+    AddressRecord_t* Record;
+};
+
 typedef struct SocketDomain {
     SocketDomainOps_t Ops;
     UUId_t            ConnectedSocket;
@@ -61,8 +68,14 @@ typedef struct AcceptRequest {
     struct vali_link_deferred_response Response;
 } AcceptRequest_t;
 
-// TODO: should be hashtable
-static list_t AddressRegister = LIST_INIT_CMP(list_cmp_string);
+static uint64_t AddressHash(const void*);
+static int      AddressCompare(const void*, const void*);
+
+// The address register contains all local addresses, bound or assigned, indexed
+// by their name. It is accessed by all socket monitors, so it is protected by a lock
+static hashtable_t AddressRegister     = { 0 };
+static mtx_t       AddressRegisterLock;
+static uint8_t     HashKey[16]         = { 201, 64, 137, 18, 92, 245, 170, 3, 58, 119, 226, 81, 14, 187, 99, 152 };
 
 static OsStatus_t HandleInvalidType(Socket_t*);
 static OsStatus_t HandleSocketStreamData(Socket_t*);
@@ -82,14 +95,16 @@ static Socket_t*
 GetSocketFromAddress(
     _In_ const struct sockaddr* Address)
 {
-    AddressRecord_t* Record;
-    element_t*       Element = list_find(&AddressRegister, (void*)&Address->sa_data[0]);
-    if (!Element) {
-        return NULL;
-    }
+    struct AddressIndex* Index;
+    Socket_t*            Socket = NULL;
     
-    Record = Element->value;
-    return Record->Socket;
+    mtx_lock(&AddressRegisterLock);
+    Index = hashtable_get(&AddressRegister, &(struct AddressIndex) { .Address = &Address->sa_data[0] });
+    if (Index) {
+        Socket = Index->Record->Socket;
+    }
+    mtx_unlock(&AddressRegisterLock);
+    return Socket;
 }
 
 static OsStatus_t
@@ -117,7 +132,7 @@ DomainLocalGetAddress(
             if (!Record) {
                 return OsDoesNotExist;
             }
-            strcpy(&LcAddress->slc_addr[0], (const char*)Record->Header.key);
+            strcpy(&LcAddress->slc_addr[0], Record->Address);
             return OsSuccess;
         } break;
         
@@ -137,14 +152,11 @@ static OsStatus_t
 HandleSocketStreamData(
     _In_ Socket_t* Socket)
 {
-    int             DoRead       = 1;
     streambuffer_t* SourceStream = GetSocketSendStream(Socket);
     streambuffer_t* TargetStream;
     Socket_t*       TargetSocket;
-    size_t          BytesRead;
-    size_t          BytesWritten;
-    char            TemporaryBuffer[1024];
-    void*           StoredBuffer;
+    size_t          BytesAvailable;
+    size_t          BytesSpliced;
     TRACE("[socket] [local] [send_stream]");
     
     TargetSocket = NetworkManagerSocketGet(Socket->Domain->ConnectedSocket);
@@ -154,90 +166,66 @@ HandleSocketStreamData(
         return OsDoesNotExist;
     }
     
-    TargetStream = GetSocketRecvStream(TargetSocket);
-    BytesRead    = SocketGetQueuedPacket(Socket, &StoredBuffer);
-    if (BytesRead) {
-        memcpy(&TemporaryBuffer, StoredBuffer, BytesRead);
-        free(StoredBuffer);
-        DoRead = 0;
+    streambuffer_get_bytes_available_in(SourceStream, &BytesAvailable);
+    if (!BytesAvailable) {
+        // This can happen if the first event or last event got out of sync
+        // we handle this by ignoring the event and just returning. Do not mark
+        // anything
+        return OsSuccess;
     }
-    while (1) {
-        if (DoRead) {
-            BytesRead = streambuffer_stream_in(SourceStream, &TemporaryBuffer[0], 
-                sizeof(TemporaryBuffer), STREAMBUFFER_NO_BLOCK | STREAMBUFFER_ALLOW_PARTIAL);
-            TRACE("[socket] [local] [send_stream] read %" PRIuIN " bytes from source", BytesRead);
-            if (!BytesRead) {
-                // This can happen if the first event or last event got out of sync
-                // we handle this by ignoring the event and just returning. Do not mark
-                // anything
-                return OsSuccess;
-            }
-        }
-        DoRead = 1;
-        
-        BytesWritten = streambuffer_stream_out(TargetStream, &TemporaryBuffer[0], 
-            BytesRead, STREAMBUFFER_NO_BLOCK | STREAMBUFFER_ALLOW_PARTIAL);
-        TRACE("[socket] [local] [send_stream] wrote %" PRIuIN " bytes to target", BytesWritten);
-        if (BytesWritten < BytesRead) {
-            StoredBuffer = malloc(BytesRead - BytesWritten);
-            if (!StoredBuffer) {
-                handle_post_notification((UUId_t)TargetSocket->Header.key, IOSETIN);
-                return OsOutOfMemory;
-            }
-            
-            memcpy(StoredBuffer, &TemporaryBuffer[BytesWritten], BytesRead - BytesWritten);
-            SocketSetQueuedPacket(Socket, StoredBuffer, BytesRead - BytesWritten);
-            break;
-        }
-        
-        if (BytesRead < sizeof(TemporaryBuffer)) {
-            break;
-        }
+    
+    // Move the data directly from the send ring of the source to the receive ring
+    // of the target. Whatever the target has no room for is left in the source stream
+    // until the next send event.
+    TargetStream = GetSocketRecvStream(TargetSocket);
+    BytesSpliced = streambuffer_splice(TargetStream, SourceStream, BytesAvailable,
+        STREAMBUFFER_ALLOW_PARTIAL);
+    TRACE("[socket] [local] [send_stream] spliced %" PRIuIN "/%" PRIuIN " bytes to target",
+        BytesSpliced, BytesAvailable);
+    if (BytesSpliced) {
+        handle_post_notification((UUId_t)TargetSocket->Header.key, IOSETIN);
     }
-    handle_post_notification((UUId_t)TargetSocket->Header.key, IOSETIN);
     return OsSuccess;
 }
 
+/* ProcessSocketPacket
+ * Reads the packet header and the target address of a packet in the send stream,
+ * and resolves the socket that should receive it. The state is left at the start of
+ * the control data. */
 static Socket_t*
 ProcessSocketPacket(
-    _In_ Socket_t* Socket,
-    _In_ void*     PacketData,
-    _In_ size_t    PacketLength)
+    _In_    Socket_t*                Socket,
+    _In_    streambuffer_t*          Stream,
+    _In_    size_t                   PacketLength,
+    _InOut_ unsigned int*            State,
+    _Out_   struct packethdr*        Packet,
+    _Out_   struct sockaddr_storage* Address)
 {
-    struct packethdr* Packet  = (struct packethdr*)PacketData;
-    uint8_t*          Pointer = (uint8_t*)PacketData;
-    Socket_t*         TargetSocket;
-    struct sockaddr*  Address;
+    Socket_t* TargetSocket;
+    size_t    AddressLength;
     TRACE("[socket] [local] [process_packet]");
-
-    // Skip header, pointer now points to the address data.
-    Pointer += sizeof(struct packethdr);
+    
+    streambuffer_read_packet_data(Stream, Packet, sizeof(struct packethdr), State);
+    if (Packet->addresslen < 0 ||
+        (size_t)Packet->addresslen > (PacketLength - sizeof(struct packethdr))) {
+        WARNING("[socket] [local] [process_packet] invalid address length %i",
+            (int)Packet->addresslen);
+        return NULL;
+    }
+    
     if (Packet->addresslen) {
-        Address      = (struct sockaddr*)Pointer;
-        TargetSocket = GetSocketFromAddress(Address);
-        TRACE("[socket] [local] [process_packet] target address %s", &Address->sa_data[0]);
+        // Only the part of the address that fits is read, the rest is skipped
+        AddressLength = MIN((size_t)Packet->addresslen, sizeof(struct sockaddr_storage) - 1);
+        memset(Address, 0, sizeof(struct sockaddr_storage));
+        streambuffer_read_packet_data(Stream, Address, AddressLength, State);
+        *State += (unsigned int)((size_t)Packet->addresslen - AddressLength);
+        
+        TargetSocket = GetSocketFromAddress((struct sockaddr*)Address);
+        TRACE("[socket] [local] [process_packet] target address %s", &((struct sockaddr*)Address)->sa_data[0]);
     }
     else {
         TRACE("[socket] [local] [process_packet] no target address provided");
         TargetSocket = NetworkManagerSocketGet(Socket->Domain->ConnectedSocket);
-        
-        // Are we connected to a socket if no address was provided? If none is provided
-        // we must move all the data and make room for one in the buffer. The buffer was
-        // allocated with larger space if an address was required. The addresslen in the packet
-        // header must also be updated
-        memmove((void*)(Pointer + sizeof(struct sockaddr_lc)), (const void*)Pointer, PacketLength - sizeof(struct packethdr));
-        Packet->addresslen = sizeof(struct sockaddr_lc);
-    }
-    
-    // We must set the client address at this point. Replace the target address with
-    // the source address for the reciever.
-    DomainLocalGetAddress(Socket, SVC_SOCKET_GET_ADDRESS_SOURCE_THIS, (struct sockaddr*)Pointer);
-    Pointer += Packet->addresslen;
-    
-    if (Packet->controllen) {
-        // TODO handle control data
-        // ProcessControlData(Pointer);
-        Pointer += Packet->controllen;
     }
     return TargetSocket;
 }
@@ -246,63 +234,68 @@ static OsStatus_t
 HandleSocketPacketData(
     _In_ Socket_t* Socket)
 {
-    streambuffer_t* SourceStream = GetSocketSendStream(Socket);
-    Socket_t*       TargetSocket;
-    unsigned int    Base, State;
-    void*           Buffer;
-    size_t          BytesRead;
-    int             DoRead = 1;
+    streambuffer_t*         SourceStream = GetSocketSendStream(Socket);
+    streambuffer_t*         TargetStream;
+    Socket_t*               TargetSocket;
+    struct packethdr        Packet;
+    struct sockaddr_storage Address;
+    unsigned int            Base, State;
+    unsigned int            TargetBase, TargetState;
+    size_t                  BytesRead;
+    size_t                  DataLength;
+    size_t                  TargetLength;
     TRACE("[socket] [local] [send_packet]");
     
-    BytesRead = SocketGetQueuedPacket(Socket, &Buffer);
-    if (BytesRead) {
-        DoRead = 0;
-    }
-    
     while (1) {
-        if (DoRead) {
-            BytesRead = streambuffer_read_packet_start(SourceStream, 
-                STREAMBUFFER_NO_BLOCK, &Base, &State);
-            if (!BytesRead) {
-                TRACE("[socket] [local] [send_packet] no bytes read from stream");
-                break;
-            }
-
-            // Read the entire packet in one go, then process the data. Due to possible
-            // alterations in the data, like having to add an address that was not provided
-            // we would like to allocate extra space for the address
-            Buffer = malloc(BytesRead + sizeof(struct sockaddr_lc));
-            if (!Buffer) {
-                ERROR("[socket] [local] [send_packet] out of memory, failed to allocate buffer");
-                return OsOutOfMemory;
+        // Peek at the packet first, it is only consumed from the send stream once the
+        // target has room for it
+        BytesRead = streambuffer_read_packet_start(SourceStream, 
+            STREAMBUFFER_NO_BLOCK | STREAMBUFFER_PEEK, &Base, &State);
+        if (BytesRead < sizeof(struct packethdr)) {
+            TRACE("[socket] [local] [send_packet] no bytes read from stream");
+            if (BytesRead) {
+                streambuffer_read_packet_start(SourceStream, STREAMBUFFER_NO_BLOCK, &Base, &State);
+                streambuffer_read_packet_end(SourceStream, Base, BytesRead);
+                continue;
             }
-            
-            streambuffer_read_packet_data(SourceStream, Buffer, BytesRead, &State);
-            streambuffer_read_packet_end(SourceStream, Base, BytesRead);
-        }
-        else {
-            DoRead = 1;
+            break;
         }
         
-        TargetSocket = ProcessSocketPacket(Socket, Buffer, BytesRead);
-        if (TargetSocket) {
-            streambuffer_t* TargetStream = GetSocketRecvStream(TargetSocket);
-            size_t          BytesWritten = streambuffer_write_packet_start(TargetStream,
-                BytesRead, STREAMBUFFER_NO_BLOCK, &Base, &State);
-            if (!BytesWritten) {
-                WARNING("[socket] [local] [send_packet] ran out of space in target stream, requested %" PRIuIN, BytesRead);
-                SocketSetQueuedPacket(Socket, Buffer, BytesRead);
-                break;
-            }
-            
-            streambuffer_write_packet_data(TargetStream, Buffer, BytesRead, &State);
-            streambuffer_write_packet_end(TargetStream, Base, BytesRead);
-            handle_post_notification((UUId_t)TargetSocket->Header.key, IOSETIN);
-        }
-        else {
+        TargetSocket = ProcessSocketPacket(Socket, SourceStream, BytesRead, &State, &Packet, &Address);
+        if (!TargetSocket) {
             WARNING("[socket] [local] [send_packet] target was not found");
+            streambuffer_read_packet_start(SourceStream, STREAMBUFFER_NO_BLOCK, &Base, &State);
+            streambuffer_read_packet_end(SourceStream, Base, BytesRead);
+            continue;
+        }
+        
+        // The receiver always gets the address of the sender, which replaces the target
+        // address, or is inserted if none was provided
+        DataLength   = BytesRead - sizeof(struct packethdr) - (size_t)Packet.addresslen;
+        TargetLength = sizeof(struct packethdr) + sizeof(struct sockaddr_lc) + DataLength;
+        TargetStream = GetSocketRecvStream(TargetSocket);
+        if (!streambuffer_write_packet_start(TargetStream, TargetLength, STREAMBUFFER_NO_BLOCK,
+                &TargetBase, &TargetState)) {
+            WARNING("[socket] [local] [send_packet] ran out of space in target stream, requested %" PRIuIN, TargetLength);
+            break;
         }
-        free(Buffer);
+        
+        // Consume the packet, we are the only reader of the send stream so this is the
+        // packet we peeked at
+        streambuffer_read_packet_start(SourceStream, STREAMBUFFER_NO_BLOCK, &Base, &State);
+        State += (unsigned int)(sizeof(struct packethdr) + (size_t)Packet.addresslen);
+        
+        Packet.addresslen = sizeof(struct sockaddr_lc);
+        DomainLocalGetAddress(Socket, SVC_SOCKET_GET_ADDRESS_SOURCE_THIS, (struct sockaddr*)&Address);
+        streambuffer_write_packet_data(TargetStream, &Packet, sizeof(struct packethdr), &TargetState);
+        streambuffer_write_packet_data(TargetStream, &Address, sizeof(struct sockaddr_lc), &TargetState);
+        
+        // TODO handle control data
+        streambuffer_splice_packet_data(TargetStream, &TargetState, SourceStream, &State, DataLength);
+        
+        streambuffer_write_packet_end(TargetStream, TargetBase, TargetLength);
+        streambuffer_read_packet_end(SourceStream, Base, BytesRead);
+        handle_post_notification((UUId_t)TargetSocket->Header.key, IOSETIN);
     }
     return OsSuccess;
 }
@@ -356,16 +349,26 @@ DomainLocalAllocateAddress(
     // Create a new address of the form /lc/{id}
     sprintf(&AddressBuffer[0], "/lc/%u", (UUId_t)(uintptr_t)Socket->Header.key);
     TRACE("[socket] [local] address created %s", &AddressBuffer[0]);
-    if (list_find(&AddressRegister, &AddressBuffer[0]) != NULL) {
-        ERROR("[socket] [local] address %s exists in register", &AddressBuffer[0]);
+    
+    Record->Address = strdup(&AddressBuffer[0]);
+    Record->Socket  = Socket;
+    if (!Record->Address) {
+        free(Record);
+        return OsOutOfMemory;
+    }
+    
+    mtx_lock(&AddressRegisterLock);
+    if (hashtable_get(&AddressRegister, &(struct AddressIndex) { .Address = Record->Address })) {
+        mtx_unlock(&AddressRegisterLock);
+        ERROR("[socket] [local] address %s exists in register", Record->Address);
+        free(Record->Address);
         free(Record);
         return OsExists;
     }
+    hashtable_set(&AddressRegister, &(struct AddressIndex) { .Address = Record->Address, .Record = Record });
+    mtx_unlock(&AddressRegisterLock);
     
-    ELEMENT_INIT(&Record->Header, strdup(&AddressBuffer[0]), Record);
-    Record->Socket = Socket;
     Socket->Domain->Record = Record;
-    list_append(&AddressRegister, &Record->Header);
     return OsSuccess;
 }
 
@@ -374,8 +377,10 @@ DestroyAddressRecord(
     _In_ AddressRecord_t* Record)
 {
     TRACE("DestroyAddressRecord()");
-    list_remove(&AddressRegister, &Record->Header);
-    free(Record->Header.key);
+    mtx_lock(&AddressRegisterLock);
+    hashtable_remove(&AddressRegister, &(struct AddressIndex) { .Address = Record->Address });
+    mtx_unlock(&AddressRegisterLock);
+    free(Record->Address);
     free(Record);
 }
 
@@ -395,22 +400,36 @@ DomainLocalBind(
     _In_ Socket_t*              Socket,
     _In_ const struct sockaddr* Address)
 {
-    char* PreviousBuffer;
+    AddressRecord_t* Record = Socket->Domain->Record;
+    char*            PreviousBuffer;
+    char*            AddressBuffer;
     TRACE("[domain] [local] [bind] %s", &Address->sa_data[0]);
     
-    if (!Socket->Domain->Record) {
+    if (!Record) {
         ERROR("[domain] [local] [bind] no record");
         return OsError; // Should not happen tho
     }
     
-    if (list_find(&AddressRegister, (void*)&Address->sa_data[0]) != NULL) {
+    AddressBuffer = strdup(&Address->sa_data[0]);
+    if (!AddressBuffer) {
+        return OsOutOfMemory;
+    }
+    
+    mtx_lock(&AddressRegisterLock);
+    if (hashtable_get(&AddressRegister, &(struct AddressIndex) { .Address = AddressBuffer })) {
+        mtx_unlock(&AddressRegisterLock);
         ERROR("[domain] [local] [bind] address already bound");
+        free(AddressBuffer);
         return OsExists;
     }
     
-    // Update key
-    PreviousBuffer = (char*)Socket->Domain->Record->Header.key;
-    Socket->Domain->Record->Header.key = strdup(&Address->sa_data[0]);
+    // Update key, the record must be reinserted as the name is the key
+    PreviousBuffer  = Record->Address;
+    hashtable_remove(&AddressRegister, &(struct AddressIndex) { .Address = PreviousBuffer });
+    Record->Address = AddressBuffer;
+    hashtable_set(&AddressRegister, &(struct AddressIndex) { .Address = Record->Address, .Record = Record });
+    mtx_unlock(&AddressRegisterLock);
+    
     free(PreviousBuffer);
     return OsSuccess;
 }
@@ -653,6 +672,17 @@ DomainLocalDestroy(
     free(Domain);
 }
 
+OsStatus_t
+DomainLocalInitialize(void)
+{
+    if (hashtable_construct(&AddressRegister, 0, sizeof(struct AddressIndex),
+            AddressHash, AddressCompare)) {
+        return OsOutOfMemory;
+    }
+    mtx_init(&AddressRegisterLock, mtx_plain);
+    return OsSuccess;
+}
+
 OsStatus_t
 DomainLocalCreate(
     _Out_ SocketDomain_t** DomainOut)
@@ -674,6 +704,8 @@ DomainLocalCreate(
     Domain->Ops.Receive         = DomainLocalReceive;
     Domain->Ops.Pair            = DomainLocalPair;
     Domain->Ops.GetAddress      = DomainLocalGetAddress;
+    Domain->Ops.SetOption       = NULL;
+    Domain->Ops.GetOption       = NULL;
     Domain->Ops.Destroy         = DomainLocalDestroy;
     
     Domain->ConnectedSocket = UUID_INVALID;
@@ -682,3 +714,16 @@ DomainLocalCreate(
     *DomainOut = Domain;
     return OsSuccess;
 }
+
+static uint64_t AddressHash(const void* Element)
+{
+    const struct AddressIndex* Index = Element;
+    return siphash_64((const uint8_t*)Index->Address, strlen(Index->Address), &HashKey[0]);
+}
+
+static int AddressCompare(const void* Element1, const void* Element2)
+{
+    const struct AddressIndex* Index1 = Element1;
+    const struct AddressIndex* Index2 = Element2;
+    return strcmp(Index1->Address, Index2->Address);
+}
@@ -0,0 +1,1317 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Network Manager (TCP)
+ * - Contains the implementation of the transmission control protocol. Connections
+ *   are looked up by their address and port pairs, and a single timer thread drives
+ *   retransmissions, delayed acknowledgements and window probes. Segments are kept
+ *   until they have been acknowledged, and out of order segments are dropped and
+ *   recovered by retransmission. Closed connections skip the TIME-WAIT state.
+ *   All functions must be called with the InternetLock held.
+ */
+//#define __TRACE
+
+#include <ddk/handle.h>
+#include <ddk/utils.h>
+#include <ds/hash_sip.h>
+#include <ds/hashtable.h>
+#include <ds/queue.h>
+#include <inet/bits.h>
+#include "internet.h"
+#include <ioset.h>
+#include "../manager.h"
+#include "../socket.h"
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <svc_socket_protocol_server.h>
+
+#define TCP_DEFAULT_MSS       536
+#define TCP_MAX_WINDOW        0xFFFF
+#define TCP_OPTION_END        0
+#define TCP_OPTION_NOP        1
+#define TCP_OPTION_MSS        2
+#define TCP_OPTION_MSS_LENGTH 4
+
+#define TCP_TIMER_TICK_MS     10
+#define TCP_DELAYED_ACK_MS    40
+#define TCP_INITIAL_RTO_MS    200
+#define TCP_MAX_RTO_MS        60000
+#define TCP_MAX_RETRIES       8
+#define TCP_PERSIST_MS        200
+#define TCP_FIN_TIMEOUT_MS    30000
+
+#define SEQ_LT(a, b) ((int32_t)((a) - (b)) < 0)
+#define SEQ_LE(a, b) ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a, b) ((int32_t)((a) - (b)) > 0)
+#define SEQ_GE(a, b) ((int32_t)((a) - (b)) >= 0)
+
+typedef enum TcpState {
+    TcpSynSent,
+    TcpSynReceived,
+    TcpEstablished,
+    TcpFinWait1,
+    TcpFinWait2,
+    TcpCloseWait,
+    TcpClosing,
+    TcpLastAck
+} TcpState_t;
+
+typedef struct TcpSegment {
+    element_t Header;
+    uint32_t  Sequence;
+    uint8_t   Flags;  // TCP_FLAG_SYN or TCP_FLAG_FIN, they occupy a sequence number
+    size_t    Length;
+    uint8_t   Data[];
+} TcpSegment_t;
+
+#define SEGMENT_SPACE(Segment) ((Segment)->Length + (((Segment)->Flags & (TCP_FLAG_SYN | TCP_FLAG_FIN)) ? 1 : 0))
+
+typedef struct ConnectRequest {
+    struct vali_link_deferred_response Response;
+} ConnectRequest_t;
+
+typedef struct AcceptRequest {
+    element_t                          Header;
+    struct vali_link_deferred_response Response;
+} AcceptRequest_t;
+
+typedef struct TcpConnection {
+    element_t         Header;
+    TcpState_t        State;
+    SocketDomain_t*   Domain; // NULL once the socket has been closed
+    in_addr_t         LocalAddress;
+    in_addr_t         RemoteAddress;
+    in_port_t         LocalPort;
+    in_port_t         RemotePort;
+    ConnectRequest_t* ConnectRequest;
+    
+    // Send state, segments are kept in sequence order until they are acknowledged
+    list_t            Segments;
+    uint32_t          SendUnacknowledged;
+    uint32_t          SendNext;
+    uint32_t          SendMax;
+    uint32_t          SendQueued;
+    uint32_t          SendWindow;
+    size_t            LocalMss;
+    size_t            Mss;
+    int               FinQueued;
+    unsigned int      Rto;
+    int               Retries;
+    uint64_t          RetransmitAt;
+    uint64_t          PersistAt;
+    uint64_t          ExpiresAt;
+    
+    // Receive state
+    uint32_t          ReceiveNext;
+    uint32_t          ReceiveAdvertised; // Right edge of the last advertised window
+    int               PendingAcks;
+    uint64_t          AckAt;
+} TcpConnection_t;
+
+struct TcpConnectionIndex {
+    in_addr_t        LocalAddress;
+    in_addr_t        RemoteAddress;
+    in_port_t        LocalPort;
+    in_port_t        RemotePort;
+    TcpConnection_t* Connection;
+};
+
+#define TCP_INDEX_KEY_LENGTH offsetof(struct TcpConnectionIndex, Connection)
+
+typedef struct TcpInputSegment {
+    in_addr_t Source;
+    in_addr_t Destination;
+    in_port_t SourcePort;
+    in_port_t DestinationPort;
+    uint32_t  Sequence;
+    uint32_t  Acknowledge;
+    uint8_t   Flags;
+    uint16_t  Window;
+    size_t    Mss;
+    uint8_t*  Data;
+    size_t    Length;
+} TcpInputSegment_t;
+
+static uint64_t ConnectionHash(const void*);
+static int      ConnectionCompare(const void*, const void*);
+
+static hashtable_t Connections     = { 0 };
+static list_t      ConnectionList  = LIST_INIT;
+static queue_t     DeadSockets;
+static thrd_t      TimerThread;
+static uint32_t    IsnCounter      = 0;
+static uint8_t     HashKey[16]     = { 141, 7, 222, 58, 190, 33, 76, 249, 12, 167, 95, 204, 41, 118, 183, 60 };
+
+static OsStatus_t
+TcpTransmitRaw(
+    _In_ in_addr_t   Source,
+    _In_ in_port_t   SourcePort,
+    _In_ in_addr_t   Destination,
+    _In_ in_port_t   DestinationPort,
+    _In_ uint32_t    Sequence,
+    _In_ uint32_t    Acknowledge,
+    _In_ uint8_t     Flags,
+    _In_ uint16_t    Window,
+    _In_ size_t      Mss,
+    _In_ const void* Data,
+    _In_ size_t      Length)
+{
+    NetworkPacket_t* Packet;
+    TcpHeader_t*     Header;
+    uint8_t*         Options;
+    size_t           OptionsLength = Mss ? TCP_OPTION_MSS_LENGTH : 0;
+    size_t           SegmentLength = sizeof(TcpHeader_t) + OptionsLength + Length;
+    
+    Packet = InternetPacketCreate(SegmentLength, (void**)&Header);
+    if (!Packet) {
+        return OsOutOfMemory;
+    }
+    
+    Header->SourcePort        = htons(SourcePort);
+    Header->DestinationPort   = htons(DestinationPort);
+    Header->SequenceNumber    = htonl(Sequence);
+    Header->AcknowledgeNumber = htonl(Acknowledge);
+    Header->DataOffset        = (uint8_t)(((sizeof(TcpHeader_t) + OptionsLength) / 4) << 4);
+    Header->Flags             = Flags;
+    Header->Window            = htons(Window);
+    Header->Checksum          = 0;
+    Header->UrgentPointer     = 0;
+    
+    Options = (uint8_t*)Header + sizeof(TcpHeader_t);
+    if (Mss) {
+        Options[0] = TCP_OPTION_MSS;
+        Options[1] = TCP_OPTION_MSS_LENGTH;
+        Options[2] = (uint8_t)(Mss >> 8);
+        Options[3] = (uint8_t)(Mss & 0xFF);
+    }
+    
+    if (Length) {
+        memcpy(Options + OptionsLength, Data, Length);
+    }
+    
+    Header->Checksum = InternetChecksum(Source, Destination, IPPROTO_TCP, Header, SegmentLength);
+    return InternetTransmit(Packet, Source, Destination, IPPROTO_TCP);
+}
+
+/* TcpReceiveWindow
+ * The window is the free space in the receive stream of the socket. Data that arrives
+ * for a closed socket is discarded, so the window is never limited for them. */
+static uint16_t
+TcpReceiveWindow(
+    _In_ TcpConnection_t* Connection)
+{
+    size_t Window = TCP_MAX_WINDOW;
+    
+    if (Connection->Domain) {
+        streambuffer_get_bytes_available_out(GetSocketRecvStream(Connection->Domain->Socket), &Window);
+    }
+    return (uint16_t)MIN(Window, TCP_MAX_WINDOW);
+}
+
+static OsStatus_t
+TcpTransmit(
+    _In_ TcpConnection_t* Connection,
+    _In_ uint32_t         Sequence,
+    _In_ uint8_t          Flags,
+    _In_ const void*      Data,
+    _In_ size_t           Length)
+{
+    uint16_t Window = TcpReceiveWindow(Connection);
+    TRACE("[tcp] [transmit] %u => %u seq %u, flags 0x%x, %" PRIuIN " bytes",
+        Connection->LocalPort, Connection->RemotePort, Sequence, Flags, Length);
+    
+    // Everything but the initial SYN acknowledges the received data
+    if (Connection->State != TcpSynSent) {
+        Flags                  |= TCP_FLAG_ACK;
+        Connection->PendingAcks = 0;
+        Connection->AckAt       = 0;
+    }
+    
+    Connection->ReceiveAdvertised = Connection->ReceiveNext + Window;
+    return TcpTransmitRaw(Connection->LocalAddress, Connection->LocalPort,
+        Connection->RemoteAddress, Connection->RemotePort, Sequence,
+        Connection->ReceiveNext, Flags, Window,
+        (Flags & TCP_FLAG_SYN) ? Connection->LocalMss : 0, Data, Length);
+}
+
+static void
+TcpSendAck(
+    _In_ TcpConnection_t* Connection)
+{
+    (void)TcpTransmit(Connection, Connection->SendNext, 0, NULL, 0);
+}
+
+static void
+TcpSendReset(
+    _In_ TcpInputSegment_t* Segment)
+{
+    uint32_t Acknowledge;
+    
+    if (Segment->Flags & TCP_FLAG_RST) {
+        return;
+    }
+    
+    if (Segment->Flags & TCP_FLAG_ACK) {
+        (void)TcpTransmitRaw(Segment->Destination, Segment->DestinationPort, Segment->Source,
+            Segment->SourcePort, Segment->Acknowledge, 0, TCP_FLAG_RST, 0, 0, NULL, 0);
+    }
+    else {
+        Acknowledge = Segment->Sequence + (uint32_t)Segment->Length +
+            ((Segment->Flags & TCP_FLAG_SYN) ? 1 : 0) + ((Segment->Flags & TCP_FLAG_FIN) ? 1 : 0);
+        (void)TcpTransmitRaw(Segment->Destination, Segment->DestinationPort, Segment->Source,
+            Segment->SourcePort, 0, Acknowledge, TCP_FLAG_RST | TCP_FLAG_ACK, 0, 0, NULL, 0);
+    }
+}
+
+static void
+TcpDeferSocketDestroy(
+    _In_ Socket_t* Socket)
+{
+    element_t* Element = malloc(sizeof(element_t));
+    if (!Element) {
+        ERROR("[tcp] failed to allocate memory to destroy socket %u", LODWORD(Socket->Header.key));
+        return;
+    }
+    
+    ELEMENT_INIT(Element, Socket->Header.key, NULL);
+    queue_push(&DeadSockets, Element);
+}
+
+static TcpSegment_t*
+TcpSegmentCreate(
+    _In_ TcpConnection_t* Connection,
+    _In_ uint8_t          Flags,
+    _In_ size_t           Length)
+{
+    TcpSegment_t* Segment = malloc(sizeof(TcpSegment_t) + Length);
+    if (!Segment) {
+        return NULL;
+    }
+    
+    ELEMENT_INIT(&Segment->Header, 0, Segment);
+    Segment->Sequence = Connection->SendQueued;
+    Segment->Flags    = Flags;
+    Segment->Length   = Length;
+    return Segment;
+}
+
+static void
+TcpSegmentQueue(
+    _In_ TcpConnection_t* Connection,
+    _In_ TcpSegment_t*    Segment)
+{
+    Connection->SendQueued += (uint32_t)SEGMENT_SPACE(Segment);
+    list_append(&Connection->Segments, &Segment->Header);
+}
+
+static OsStatus_t
+TcpQueueControl(
+    _In_ TcpConnection_t* Connection,
+    _In_ uint8_t          Flags)
+{
+    TcpSegment_t* Segment = TcpSegmentCreate(Connection, Flags, 0);
+    if (!Segment) {
+        return OsOutOfMemory;
+    }
+    
+    if (Flags & TCP_FLAG_FIN) {
+        Connection->FinQueued = 1;
+    }
+    TcpSegmentQueue(Connection, Segment);
+    return OsSuccess;
+}
+
+/* TcpQueueData
+ * Moves data from the send stream of the socket into a new segment. The segment is
+ * only created if it can be sent right away, which is limited by the window of the
+ * peer, and by the Nagle algorithm if it is enabled. */
+static TcpSegment_t*
+TcpQueueData(
+    _In_ TcpConnection_t* Connection,
+    _In_ uint64_t         Now)
+{
+    streambuffer_t* Stream = GetSocketSendStream(Connection->Domain->Socket);
+    TcpSegment_t*   Segment;
+    uint32_t        InFlight = Connection->SendNext - Connection->SendUnacknowledged;
+    size_t          Usable   = (Connection->SendWindow > InFlight) ? (Connection->SendWindow - InFlight) : 0;
+    size_t          Available;
+    size_t          Length;
+    
+    streambuffer_get_bytes_available_in(Stream, &Available);
+    if (!Available) {
+        return NULL;
+    }
+    
+    Length = MIN(MIN(Available, Connection->Mss), Usable);
+    if (!Length) {
+        // The window of the peer is closed, probe it until it opens again
+        if (!InFlight && !Connection->PersistAt) {
+            Connection->PersistAt = Now + TCP_PERSIST_MS;
+        }
+        return NULL;
+    }
+    
+    // Nagle, only one small segment may be outstanding at any time
+    if (Length < Connection->Mss && InFlight && !Connection->Domain->NoDelay) {
+        return NULL;
+    }
+    
+    Segment = TcpSegmentCreate(Connection, 0, Length);
+    if (!Segment) {
+        return NULL;
+    }
+    
+    Segment->Length = streambuffer_stream_in(Stream, &Segment->Data[0], Length,
+        STREAMBUFFER_NO_BLOCK | STREAMBUFFER_ALLOW_PARTIAL);
+    TcpSegmentQueue(Connection, Segment);
+    return Segment;
+}
+
+static TcpSegment_t*
+TcpNextUnsent(
+    _In_ TcpConnection_t* Connection)
+{
+    foreach(Element, &Connection->Segments) {
+        TcpSegment_t* Segment = Element->value;
+        if (SEQ_GE(Segment->Sequence, Connection->SendNext)) {
+            return Segment;
+        }
+    }
+    return NULL;
+}
+
+/* TcpOutput
+ * Transmits queued segments and new data from the send stream, as far as the window
+ * of the peer allows. */
+static void
+TcpOutput(
+    _In_ TcpConnection_t* Connection)
+{
+    uint64_t      Now = InternetTimestamp();
+    TcpSegment_t* Segment;
+    uint32_t      InFlight;
+    
+    while (1) {
+        Segment = TcpNextUnsent(Connection);
+        if (!Segment) {
+            if (!Connection->Domain || (Connection->State != TcpEstablished &&
+                    Connection->State != TcpCloseWait)) {
+                break;
+            }
+            
+            Segment = TcpQueueData(Connection, Now);
+            if (!Segment) {
+                break;
+            }
+        }
+        
+        InFlight = Connection->SendNext - Connection->SendUnacknowledged;
+        if (Segment->Length && (Segment->Length + InFlight) > Connection->SendWindow) {
+            if (!InFlight && !Connection->PersistAt) {
+                Connection->PersistAt = Now + TCP_PERSIST_MS;
+            }
+            break;
+        }
+        
+        (void)TcpTransmit(Connection, Segment->Sequence, Segment->Flags,
+            &Segment->Data[0], Segment->Length);
+        Connection->SendNext  = Segment->Sequence + (uint32_t)SEGMENT_SPACE(Segment);
+        Connection->PersistAt = 0;
+        if (SEQ_GT(Connection->SendNext, Connection->SendMax)) {
+            Connection->SendMax = Connection->SendNext;
+        }
+        
+        if (!Connection->RetransmitAt) {
+            Connection->RetransmitAt = Now + Connection->Rto;
+        }
+    }
+}
+
+static TcpConnection_t*
+TcpLookup(
+    _In_ in_addr_t LocalAddress,
+    _In_ in_port_t LocalPort,
+    _In_ in_addr_t RemoteAddress,
+    _In_ in_port_t RemotePort)
+{
+    struct TcpConnectionIndex* Index = hashtable_get(&Connections, &(struct TcpConnectionIndex) {
+        .LocalAddress = LocalAddress, .RemoteAddress = RemoteAddress,
+        .LocalPort = LocalPort, .RemotePort = RemotePort });
+    return Index ? Index->Connection : NULL;
+}
+
+static TcpConnection_t*
+TcpCreateConnection(
+    _In_ SocketDomain_t* Domain,
+    _In_ TcpState_t      State)
+{
+    TcpConnection_t*  Connection;
+    NetworkAdapter_t* Adapter = NetworkAdapterRoute(Domain->RemoteAddress);
+    uint32_t          Isn;
+    
+    Connection = malloc(sizeof(TcpConnection_t));
+    if (!Connection) {
+        return NULL;
+    }
+    memset(Connection, 0, sizeof(TcpConnection_t));
+    
+    ELEMENT_INIT(&Connection->Header, 0, Connection);
+    list_construct(&Connection->Segments);
+    Connection->State         = State;
+    Connection->Domain        = Domain;
+    Connection->LocalAddress  = Domain->LocalAddress;
+    Connection->RemoteAddress = Domain->RemoteAddress;
+    Connection->LocalPort     = Domain->LocalPort;
+    Connection->RemotePort    = Domain->RemotePort;
+    Connection->LocalMss      = Adapter ? (Adapter->Mtu - sizeof(Ipv4Header_t) - sizeof(TcpHeader_t)) : TCP_DEFAULT_MSS;
+    Connection->Mss           = TCP_DEFAULT_MSS;
+    Connection->Rto           = TCP_INITIAL_RTO_MS;
+    
+    // The initial sequence number is derived from the clock like RFC 793 suggests
+    IsnCounter += 64000;
+    Isn = (uint32_t)(InternetTimestamp() * 250) + IsnCounter;
+    Connection->SendUnacknowledged = Isn;
+    Connection->SendNext           = Isn;
+    Connection->SendMax            = Isn;
+    Connection->SendQueued         = Isn;
+    
+    hashtable_set(&Connections, &(struct TcpConnectionIndex) {
+        .LocalAddress = Connection->LocalAddress, .RemoteAddress = Connection->RemoteAddress,
+        .LocalPort = Connection->LocalPort, .RemotePort = Connection->RemotePort,
+        .Connection = Connection });
+    list_append(&ConnectionList, &Connection->Header);
+    Domain->Connection = Connection;
+    return Connection;
+}
+
+static void
+TcpCompleteConnect(
+    _In_ TcpConnection_t* Connection,
+    _In_ OsStatus_t       Status)
+{
+    if (!Connection->ConnectRequest) {
+        return;
+    }
+    
+    if (Connection->Domain) {
+        Connection->Domain->Socket->Configuration.Connecting = 0;
+        Connection->Domain->Socket->Configuration.Connected  = (Status == OsSuccess);
+    }
+    
+    svc_socket_connect_response(&Connection->ConnectRequest->Response.recv_message, Status);
+    free(Connection->ConnectRequest);
+    Connection->ConnectRequest = NULL;
+}
+
+static void
+TcpDestroyConnection(
+    _In_ TcpConnection_t* Connection,
+    _In_ OsStatus_t       Status)
+{
+    SocketDomain_t* Domain = Connection->Domain;
+    element_t*      Element;
+    TRACE("[tcp] [destroy] %u => %u, status %u", Connection->LocalPort, Connection->RemotePort, Status);
+    
+    TcpCompleteConnect(Connection, Status);
+    hashtable_remove(&Connections, &(struct TcpConnectionIndex) {
+        .LocalAddress = Connection->LocalAddress, .RemoteAddress = Connection->RemoteAddress,
+        .LocalPort = Connection->LocalPort, .RemotePort = Connection->RemotePort });
+    list_remove(&ConnectionList, &Connection->Header);
+    
+    while ((Element = list_front(&Connection->Segments)) != NULL) {
+        list_remove(&Connection->Segments, Element);
+        free(Element->value);
+    }
+    
+    if (Domain) {
+        Domain->Connection = NULL;
+        
+        // A connection that never completed can not be accepted, the socket was
+        // never handed out so we have to clean it up
+        if (Domain->Listener && !Domain->Ready) {
+            list_remove(&Domain->Listener->Children, &Domain->Header);
+            Domain->Listener = NULL;
+            TcpDeferSocketDestroy(Domain->Socket);
+        }
+    }
+    free(Connection);
+}
+
+static void
+TcpAbort(
+    _In_ TcpConnection_t* Connection,
+    _In_ OsStatus_t       Status)
+{
+    if (Connection->Domain) {
+        handle_post_notification((UUId_t)(uintptr_t)Connection->Domain->Socket->Header.key, IOSETCTL);
+    }
+    TcpDestroyConnection(Connection, Status);
+}
+
+/* TcpAcknowledge
+ * Releases all segments that are covered by the acknowledgement. */
+static void
+TcpAcknowledge(
+    _In_ TcpConnection_t* Connection,
+    _In_ uint32_t         Acknowledge,
+    _In_ uint64_t         Now)
+{
+    element_t* Element;
+    
+    while ((Element = list_front(&Connection->Segments)) != NULL) {
+        TcpSegment_t* Segment = Element->value;
+        uint32_t      End     = Segment->Sequence + (uint32_t)SEGMENT_SPACE(Segment);
+        
+        if (SEQ_LE(End, Acknowledge)) {
+            list_remove(&Connection->Segments, Element);
+            free(Segment);
+            continue;
+        }
+        
+        // Partially acknowledged, only data segments can be split
+        if (SEQ_GT(Acknowledge, Segment->Sequence)) {
+            size_t Trim = (size_t)(Acknowledge - Segment->Sequence);
+            memmove(&Segment->Data[0], &Segment->Data[Trim], Segment->Length - Trim);
+            Segment->Sequence = Acknowledge;
+            Segment->Length  -= Trim;
+        }
+        break;
+    }
+    
+    Connection->SendUnacknowledged = Acknowledge;
+    if (SEQ_LT(Connection->SendNext, Acknowledge)) {
+        Connection->SendNext = Acknowledge;
+    }
+    
+    Connection->Retries      = 0;
+    Connection->Rto          = TCP_INITIAL_RTO_MS;
+    Connection->RetransmitAt = (Connection->SendMax != Acknowledge) ? (Now + Connection->Rto) : 0;
+}
+
+static void
+FillAddress(
+    _In_ struct sockaddr_in* Address,
+    _In_ SocketDomain_t*     Domain)
+{
+    memset(Address, 0, sizeof(struct sockaddr_in));
+    Address->sin_len         = sizeof(struct sockaddr_in);
+    Address->sin_family      = AF_INET;
+    Address->sin_port        = htons(Domain->RemotePort);
+    Address->sin_addr.s_addr = htonl(Domain->RemoteAddress);
+}
+
+static void
+TcpAcceptChild(
+    _In_ struct gracht_recv_message* Message,
+    _In_ SocketDomain_t*             Listener,
+    _In_ SocketDomain_t*             Child)
+{
+    struct sockaddr_in Address;
+    Socket_t*          Socket = Child->Socket;
+    TRACE("[tcp] [accept] %u", LODWORD(Socket->Header.key));
+    
+    list_remove(&Listener->Children, &Child->Header);
+    Child->Listener = NULL;
+    
+    FillAddress(&Address, Child);
+    svc_socket_accept_response(Message, OsSuccess, (struct sockaddr*)&Address,
+        (UUId_t)(uintptr_t)Socket->Header.key, Socket->Receive.DmaAttachment.handle,
+        Socket->Send.DmaAttachment.handle);
+}
+
+static void
+TcpChildEstablished(
+    _In_ TcpConnection_t* Connection)
+{
+    SocketDomain_t*  Child = Connection->Domain;
+    SocketDomain_t*  Listener;
+    AcceptRequest_t* Request;
+    element_t*       Element;
+    
+    if (!Child) {
+        return;
+    }
+    
+    Child->Ready                            = 1;
+    Child->Socket->Configuration.Connecting = 0;
+    Child->Socket->Configuration.Connected  = 1;
+    
+    Listener = Child->Listener;
+    if (!Listener) {
+        return;
+    }
+    
+    Element = queue_pop(&Listener->Socket->AcceptRequests);
+    if (Element) {
+        Request = Element->value;
+        TcpAcceptChild(&Request->Response.recv_message, Listener, Child);
+        free(Request);
+    }
+    else {
+        handle_post_notification((UUId_t)(uintptr_t)Listener->Socket->Header.key, IOSETCTL);
+    }
+}
+
+static void
+TcpInputListen(
+    _In_ TcpInputSegment_t* Segment)
+{
+    SocketDomain_t*  Listener;
+    SocketDomain_t*  Child;
+    Socket_t*        Socket;
+    TcpConnection_t* Connection;
+    UUId_t           Handle, RecvHandle, SendHandle;
+    OsStatus_t       Status;
+    
+    if ((Segment->Flags & (TCP_FLAG_SYN | TCP_FLAG_ACK | TCP_FLAG_RST)) != TCP_FLAG_SYN) {
+        TcpSendReset(Segment);
+        return;
+    }
+    
+    Listener = InternetLookupPort(IPPROTO_TCP, Segment->Destination, Segment->DestinationPort);
+    if (!Listener || !Listener->Socket->Configuration.Passive) {
+        TRACE("[tcp] [listen] no listener on port %u", Segment->DestinationPort);
+        TcpSendReset(Segment);
+        return;
+    }
+    
+    // When the backlog is full the SYN is dropped, and the peer will retry later
+    if (list_count(&Listener->Children) >= MAX(Listener->Socket->Configuration.Backlog, 1)) {
+        TRACE("[tcp] [listen] backlog of port %u is full", Segment->DestinationPort);
+        return;
+    }
+    
+    Status = NetworkManagerSocketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, &Handle,
+        &RecvHandle, &SendHandle);
+    if (Status != OsSuccess) {
+        ERROR("[tcp] [listen] failed to create socket for connection: %u", Status);
+        return;
+    }
+    
+    Socket = NetworkManagerSocketGet(Handle);
+    Child  = Socket->Domain;
+    Child->LocalAddress  = Segment->Destination;
+    Child->LocalPort     = Segment->DestinationPort;
+    Child->RemoteAddress = Segment->Source;
+    Child->RemotePort    = Segment->SourcePort;
+    Child->NoDelay       = Listener->NoDelay;
+    Child->QuickAck      = Listener->QuickAck;
+    
+    Connection = TcpCreateConnection(Child, TcpSynReceived);
+    if (!Connection) {
+        TcpDeferSocketDestroy(Socket);
+        return;
+    }
+    
+    Connection->ReceiveNext = Segment->Sequence + 1;
+    Connection->SendWindow  = Segment->Window;
+    Connection->Mss         = MIN(Connection->LocalMss, Segment->Mss ? Segment->Mss : TCP_DEFAULT_MSS);
+    
+    Socket->Configuration.Connecting = 1;
+    Child->Listener                  = Listener;
+    list_append(&Listener->Children, &Child->Header);
+    
+    if (TcpQueueControl(Connection, TCP_FLAG_SYN) != OsSuccess) {
+        TcpDestroyConnection(Connection, OsOutOfMemory);
+        return;
+    }
+    TcpOutput(Connection);
+}
+
+static void
+TcpInputSynSent(
+    _In_ TcpConnection_t*   Connection,
+    _In_ TcpInputSegment_t* Segment)
+{
+    if ((Segment->Flags & TCP_FLAG_ACK) && Segment->Acknowledge != Connection->SendMax) {
+        TcpSendReset(Segment);
+        return;
+    }
+    
+    if (Segment->Flags & TCP_FLAG_RST) {
+        if (Segment->Flags & TCP_FLAG_ACK) {
+            TcpDestroyConnection(Connection, OsConnectionRefused);
+        }
+        return;
+    }
+    
+    // Simultaneous open is not supported, we wait for the SYN-ACK
+    if ((Segment->Flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) != (TCP_FLAG_SYN | TCP_FLAG_ACK)) {
+        return;
+    }
+    
+    Connection->ReceiveNext = Segment->Sequence + 1;
+    Connection->SendWindow  = Segment->Window;
+    Connection->Mss         = MIN(Connection->LocalMss, Segment->Mss ? Segment->Mss : TCP_DEFAULT_MSS);
+    Connection->State       = TcpEstablished;
+    TcpAcknowledge(Connection, Segment->Acknowledge, InternetTimestamp());
+    
+    TcpSendAck(Connection);
+    TcpCompleteConnect(Connection, OsSuccess);
+    TcpOutput(Connection);
+}
+
+/* TcpDeliver
+ * Writes in-order data to the receive stream of the socket, and returns the number of
+ * bytes that were accepted. */
+static size_t
+TcpDeliver(
+    _In_ TcpConnection_t* Connection,
+    _In_ uint8_t*         Data,
+    _In_ size_t           Length)
+{
+    size_t BytesWritten;
+    
+    if (!Connection->Domain) {
+        return Length;
+    }
+    
+    BytesWritten = streambuffer_stream_out(GetSocketRecvStream(Connection->Domain->Socket),
+        Data, Length, STREAMBUFFER_NO_BLOCK | STREAMBUFFER_ALLOW_PARTIAL);
+    if (BytesWritten) {
+        handle_post_notification((UUId_t)(uintptr_t)Connection->Domain->Socket->Header.key, IOSETIN);
+    }
+    return BytesWritten;
+}
+
+/* TcpPeerClosed
+ * Handles the FIN of the peer, returns 1 if the connection was destroyed. */
+static int
+TcpPeerClosed(
+    _In_ TcpConnection_t* Connection)
+{
+    if (Connection->Domain) {
+        handle_post_notification((UUId_t)(uintptr_t)Connection->Domain->Socket->Header.key, IOSETCTL);
+    }
+    
+    switch (Connection->State) {
+        case TcpSynReceived:
+        case TcpEstablished: {
+            Connection->State = TcpCloseWait;
+        } break;
+        case TcpFinWait1: {
+            Connection->State = TcpClosing;
+        } break;
+        case TcpFinWait2: {
+            TcpDestroyConnection(Connection, OsSuccess);
+            return 1;
+        } break;
+        
+        default:
+            break;
+    }
+    return 0;
+}
+
+void
+TcpInput(
+    _In_ NetworkAdapter_t* Adapter,
+    _In_ Ipv4Header_t*     Ip,
+    _In_ void*             Data,
+    _In_ size_t            Length)
+{
+    TcpHeader_t*      Header = Data;
+    TcpConnection_t*  Connection;
+    TcpInputSegment_t Segment;
+    uint64_t          Now;
+    uint8_t*          Options;
+    size_t            HeaderLength;
+    size_t            Accepted;
+    size_t            i;
+    
+    if (Length < sizeof(TcpHeader_t)) {
+        return;
+    }
+    
+    HeaderLength = (size_t)(Header->DataOffset >> 4) * 4;
+    if (HeaderLength < sizeof(TcpHeader_t) || HeaderLength > Length) {
+        return;
+    }
+    
+    Segment.Source          = ntohl(Ip->SourceAddress);
+    Segment.Destination     = ntohl(Ip->DestinationAddress);
+    Segment.SourcePort      = ntohs(Header->SourcePort);
+    Segment.DestinationPort = ntohs(Header->DestinationPort);
+    Segment.Sequence        = ntohl(Header->SequenceNumber);
+    Segment.Acknowledge     = ntohl(Header->AcknowledgeNumber);
+    Segment.Flags           = Header->Flags;
+    Segment.Window          = ntohs(Header->Window);
+    Segment.Mss             = 0;
+    Segment.Data            = (uint8_t*)Data + HeaderLength;
+    Segment.Length          = Length - HeaderLength;
+    
+    if (InternetChecksum(Segment.Source, Segment.Destination, IPPROTO_TCP, Data, Length)) {
+        WARNING("[tcp] [input] checksum mismatch on %s", Adapter->Name);
+        return;
+    }
+    
+    // The only option we care about is the MSS of the peer
+    Options = (uint8_t*)Data + sizeof(TcpHeader_t);
+    for (i = 0; i < HeaderLength - sizeof(TcpHeader_t);) {
+        if (Options[i] == TCP_OPTION_END) {
+            break;
+        }
+        else if (Options[i] == TCP_OPTION_NOP) {
+            i++;
+            continue;
+        }
+        
+        if ((i + 1) >= (HeaderLength - sizeof(TcpHeader_t)) || Options[i + 1] < 2) {
+            break;
+        }
+        
+        if (Options[i] == TCP_OPTION_MSS && Options[i + 1] == TCP_OPTION_MSS_LENGTH &&
+            (i + TCP_OPTION_MSS_LENGTH) <= (HeaderLength - sizeof(TcpHeader_t))) {
+            Segment.Mss = ((size_t)Options[i + 2] << 8) | Options[i + 3];
+        }
+        i += Options[i + 1];
+    }
+    
+    Connection = TcpLookup(Segment.Destination, Segment.DestinationPort,
+        Segment.Source, Segment.SourcePort);
+    if (!Connection) {
+        TcpInputListen(&Segment);
+        return;
+    }
+    
+    TRACE("[tcp] [input] %u => %u seq %u, ack %u, flags 0x%x, %" PRIuIN " bytes",
+        Segment.SourcePort, Segment.DestinationPort, Segment.Sequence, Segment.Acknowledge,
+        Segment.Flags, Segment.Length);
+    if (Connection->State == TcpSynSent) {
+        TcpInputSynSent(Connection, &Segment);
+        return;
+    }
+    
+    if (Segment.Flags & TCP_FLAG_RST) {
+        if (SEQ_GE(Segment.Sequence, Connection->ReceiveNext) &&
+            SEQ_LE(Segment.Sequence, Connection->ReceiveAdvertised)) {
+            TcpAbort(Connection, OsConnectionAborted);
+        }
+        return;
+    }
+    
+    // A SYN on an existing connection is a retransmission, which means our SYN-ACK
+    // or the acknowledgement of the SYN-ACK was lost
+    if (Segment.Flags & TCP_FLAG_SYN) {
+        if (Connection->State == TcpSynReceived) {
+            Connection->SendNext = Connection->SendUnacknowledged;
+            TcpOutput(Connection);
+        }
+        else {
+            TcpSendAck(Connection);
+        }
+        return;
+    }
+    
+    if (!(Segment.Flags & TCP_FLAG_ACK)) {
+        return;
+    }
+    
+    Now = InternetTimestamp();
+    if (SEQ_GT(Segment.Acknowledge, Connection->SendMax)) {
+        TcpSendAck(Connection);
+        return;
+    }
+    
+    if (SEQ_GT(Segment.Acknowledge, Connection->SendUnacknowledged)) {
+        TcpAcknowledge(Connection, Segment.Acknowledge, Now);
+        if (Connection->State == TcpSynReceived) {
+            Connection->State = TcpEstablished;
+            TcpChildEstablished(Connection);
+        }
+    }
+    
+    if (Connection->State == TcpSynReceived) {
+        return;
+    }
+    Connection->SendWindow = Segment.Window;
+    
+    // Handle the acknowledgement of our FIN, the TIME-WAIT state is skipped so the
+    // connection is released as soon as both sides have closed
+    if (Connection->FinQueued && Connection->SendUnacknowledged == Connection->SendQueued) {
+        if (Connection->State == TcpFinWait1) {
+            Connection->State = TcpFinWait2;
+            if (!Connection->Domain) {
+                Connection->ExpiresAt = Now + TCP_FIN_TIMEOUT_MS;
+            }
+        }
+        else if (Connection->State == TcpClosing || Connection->State == TcpLastAck) {
+            TcpDestroyConnection(Connection, OsSuccess);
+            return;
+        }
+    }
+    
+    if (Segment.Length || (Segment.Flags & TCP_FLAG_FIN)) {
+        // Trim data we have already received
+        if (SEQ_LT(Segment.Sequence, Connection->ReceiveNext)) {
+            size_t Trim = (size_t)(Connection->ReceiveNext - Segment.Sequence);
+            if (Trim > Segment.Length) {
+                TcpSendAck(Connection);
+                goto Output;
+            }
+            
+            Segment.Data     += Trim;
+            Segment.Length   -= Trim;
+            Segment.Sequence  = Connection->ReceiveNext;
+        }
+        
+        // Out of order segments are dropped, the duplicate acknowledgement tells
+        // the peer where to continue from
+        if (Segment.Sequence != Connection->ReceiveNext) {
+            TcpSendAck(Connection);
+            goto Output;
+        }
+        
+        Accepted = Segment.Length ? TcpDeliver(Connection, Segment.Data, Segment.Length) : 0;
+        Connection->ReceiveNext += (uint32_t)Accepted;
+        
+        if ((Segment.Flags & TCP_FLAG_FIN) && Accepted == Segment.Length) {
+            Connection->ReceiveNext++;
+            TcpSendAck(Connection);
+            if (TcpPeerClosed(Connection)) {
+                return;
+            }
+        }
+        else if (Accepted < Segment.Length) {
+            TcpSendAck(Connection);
+        }
+        else if (Accepted) {
+            Connection->PendingAcks++;
+            if ((Connection->Domain && Connection->Domain->QuickAck) || Connection->PendingAcks >= 2) {
+                TcpSendAck(Connection);
+            }
+            else if (!Connection->AckAt) {
+                Connection->AckAt = Now + TCP_DELAYED_ACK_MS;
+            }
+        }
+    }
+    else if (SEQ_LT(Segment.Sequence, Connection->ReceiveNext)) {
+        // Window probe
+        TcpSendAck(Connection);
+    }
+
+Output:
+    TcpOutput(Connection);
+}
+
+OsStatus_t
+TcpConnect(
+    _In_ struct gracht_recv_message* Message,
+    _In_ SocketDomain_t*             Domain)
+{
+    TcpConnection_t* Connection;
+    OsStatus_t       Status;
+    TRACE("[tcp] [connect] port %u", Domain->RemotePort);
+    
+    if (Domain->Connection) {
+        return OsConnectionInProgress;
+    }
+    
+    if (!Domain->PortBound) {
+        Status = InternetBindPort(Domain, INADDR_ANY, 0);
+        if (Status != OsSuccess) {
+            return Status;
+        }
+    }
+    
+    if (Domain->LocalAddress == INADDR_ANY) {
+        Status = InternetSourceAddress(Domain->RemoteAddress, &Domain->LocalAddress);
+        if (Status != OsSuccess) {
+            return Status;
+        }
+    }
+    
+    if (TcpLookup(Domain->LocalAddress, Domain->LocalPort, Domain->RemoteAddress, Domain->RemotePort)) {
+        return OsExists;
+    }
+    
+    Connection = TcpCreateConnection(Domain, TcpSynSent);
+    if (!Connection) {
+        return OsOutOfMemory;
+    }
+    
+    Connection->ConnectRequest = malloc(sizeof(ConnectRequest_t) + VALI_MSG_DEFER_SIZE(Message));
+    if (!Connection->ConnectRequest || TcpQueueControl(Connection, TCP_FLAG_SYN) != OsSuccess) {
+        free(Connection->ConnectRequest);
+        Connection->ConnectRequest = NULL;
+        TcpDestroyConnection(Connection, OsOutOfMemory);
+        return OsOutOfMemory;
+    }
+    
+    // The reply is sent once the handshake has completed
+    gracht_vali_message_defer_response(&Connection->ConnectRequest->Response, Message);
+    TcpOutput(Connection);
+    return OsSuccess;
+}
+
+OsStatus_t
+TcpAccept(
+    _In_ struct gracht_recv_message* Message,
+    _In_ SocketDomain_t*             Domain)
+{
+    AcceptRequest_t* Request;
+    
+    foreach(Element, &Domain->Children) {
+        SocketDomain_t* Child = Element->value;
+        if (Child->Ready) {
+            TcpAcceptChild(Message, Domain, Child);
+            return OsSuccess;
+        }
+    }
+    
+    if (!Domain->Socket->Configuration.Blocking) {
+        return OsBusy;
+    }
+    
+    Request = malloc(sizeof(AcceptRequest_t) + VALI_MSG_DEFER_SIZE(Message));
+    if (!Request) {
+        return OsOutOfMemory;
+    }
+    
+    ELEMENT_INIT(&Request->Header, 0, Request);
+    gracht_vali_message_defer_response(&Request->Response, Message);
+    queue_push(&Domain->Socket->AcceptRequests, &Request->Header);
+    return OsSuccess;
+}
+
+OsStatus_t
+TcpSend(
+    _In_ SocketDomain_t* Domain)
+{
+    if (!Domain->Connection) {
+        return OsNotConnected;
+    }
+    
+    TcpOutput(Domain->Connection);
+    return OsSuccess;
+}
+
+OsStatus_t
+TcpReceive(
+    _In_ SocketDomain_t* Domain)
+{
+    TcpConnection_t* Connection = Domain->Connection;
+    uint32_t         Advertised;
+    uint16_t         Window;
+    
+    if (!Connection || Connection->State == TcpSynSent || Connection->State == TcpSynReceived) {
+        return OsSuccess;
+    }
+    
+    // Only announce the window once it has grown by a meaningful amount, to avoid the
+    // silly window syndrome
+    Window     = TcpReceiveWindow(Connection);
+    Advertised = Connection->ReceiveAdvertised - Connection->ReceiveNext;
+    if (Window > Advertised &&
+        (!Advertised || (Window - Advertised) >= MIN(2 * Connection->Mss, TCP_MAX_WINDOW / 2))) {
+        TcpSendAck(Connection);
+    }
+    return OsSuccess;
+}
+
+void
+TcpClose(
+    _In_ SocketDomain_t* Domain)
+{
+    TcpConnection_t* Connection = Domain->Connection;
+    streambuffer_t*  Stream     = GetSocketSendStream(Domain->Socket);
+    TcpSegment_t*    Segment;
+    size_t           Available;
+    TRACE("[tcp] [close]");
+    
+    if (Domain->Listener) {
+        list_remove(&Domain->Listener->Children, &Domain->Header);
+        Domain->Listener = NULL;
+    }
+    
+    if (!Connection) {
+        return;
+    }
+    
+    switch (Connection->State) {
+        case TcpSynSent: {
+            TcpDestroyConnection(Connection, OsConnectionAborted);
+            return;
+        } break;
+        case TcpSynReceived:
+        case TcpEstablished:
+        case TcpCloseWait: {
+            // Everything the application has written is still delivered, so the send
+            // stream is moved into segments before the socket goes away
+            streambuffer_get_bytes_available_in(Stream, &Available);
+            while (Available) {
+                Segment = TcpSegmentCreate(Connection, 0, MIN(Available, Connection->Mss));
+                if (!Segment) {
+                    break;
+                }
+                
+                Segment->Length = streambuffer_stream_in(Stream, &Segment->Data[0], Segment->Length,
+                    STREAMBUFFER_NO_BLOCK | STREAMBUFFER_ALLOW_PARTIAL);
+                if (!Segment->Length) {
+                    free(Segment);
+                    break;
+                }
+                TcpSegmentQueue(Connection, Segment);
+                Available -= Segment->Length;
+            }
+            
+            (void)TcpQueueControl(Connection, TCP_FLAG_FIN);
+            Connection->State = (Connection->State == TcpCloseWait) ? TcpLastAck : TcpFinWait1;
+        } break;
+        
+        default:
+            break;
+    }
+    
+    Connection->Domain = NULL;
+    Domain->Connection = NULL;
+    TcpOutput(Connection);
+}
+
+void
+TcpCloseListener(
+    _In_ SocketDomain_t* Domain)
+{
+    AcceptRequest_t* Request;
+    element_t*       Element;
+    
+    while ((Element = list_front(&Domain->Children)) != NULL) {
+        SocketDomain_t* Child = Element->value;
+        
+        list_remove(&Domain->Children, Element);
+        Child->Listener = NULL;
+        if (Child->Connection) {
+            (void)TcpTransmit(Child->Connection, Child->Connection->SendNext, TCP_FLAG_RST, NULL, 0);
+            TcpDestroyConnection(Child->Connection, OsConnectionAborted);
+        }
+        TcpDeferSocketDestroy(Child->Socket);
+    }
+    
+    while ((Element = queue_pop(&Domain->Socket->AcceptRequests)) != NULL) {
+        Request = Element->value;
+        svc_socket_accept_response(&Request->Response.recv_message, OsConnectionAborted,
+            NULL, UUID_INVALID, UUID_INVALID, UUID_INVALID);
+        free(Request);
+    }
+}
+
+static void
+TcpTimer(
+    _In_ TcpConnection_t* Connection,
+    _In_ uint64_t         Now)
+{
+    if (Connection->ExpiresAt && Now >= Connection->ExpiresAt) {
+        TcpDestroyConnection(Connection, OsTimeout);
+        return;
+    }
+    
+    // Go back to the first unacknowledged segment and send everything again, the
+    // timeout is doubled for every attempt
+    if (Connection->RetransmitAt && Now >= Connection->RetransmitAt) {
+        if (++Connection->Retries > TCP_MAX_RETRIES) {
+            WARNING("[tcp] [timer] connection %u => %u timed out", Connection->LocalPort, Connection->RemotePort);
+            TcpAbort(Connection, OsTimeout);
+            return;
+        }
+        
+        Connection->Rto          = MIN(Connection->Rto * 2, TCP_MAX_RTO_MS);
+        Connection->RetransmitAt = 0;
+        Connection->SendNext     = Connection->SendUnacknowledged;
+        TcpOutput(Connection);
+    }
+    
+    if (Connection->AckAt && Now >= Connection->AckAt) {
+        TcpSendAck(Connection);
+    }
+    
+    if (Connection->PersistAt && Now >= Connection->PersistAt) {
+        // The probe reuses the last sequence number, the peer answers with its window
+        Connection->PersistAt = Now + TCP_PERSIST_MS;
+        (void)TcpTransmit(Connection, Connection->SendNext - 1, 0, NULL, 0);
+    }
+    else if (Connection->Domain) {
+        // Pick up data that was written without a notification reaching us, this
+        // happens when the application blocks on a full send stream
+        TcpOutput(Connection);
+    }
+}
+
+static int
+TcpTimerThread(
+    _In_ void* Context)
+{
+    int        RunForever = 1;
+    element_t* Element;
+    element_t* Next;
+    uint64_t   Now;
+    
+    while (RunForever) {
+        thrd_sleepex(TCP_TIMER_TICK_MS);
+        
+        mtx_lock(&InternetLock);
+        Now     = InternetTimestamp();
+        Element = list_front(&ConnectionList);
+        while (Element) {
+            Next = Element->next;
+            TcpTimer((TcpConnection_t*)Element->value, Now);
+            Element = Next;
+        }
+        
+        // Sockets can't be destroyed while holding the lock, as destruction acquires
+        // the socket lock first
+        while ((Element = queue_pop(&DeadSockets)) != NULL) {
+            UUId_t Handle = (UUId_t)(uintptr_t)Element->key;
+            free(Element);
+            
+            mtx_unlock(&InternetLock);
+            (void)NetworkManagerSocketShutdown(Handle, SVC_SOCKET_CLOSE_OPTIONS_DESTROY);
+            mtx_lock(&InternetLock);
+        }
+        mtx_unlock(&InternetLock);
+    }
+    return 0;
+}
+
+OsStatus_t
+TcpInitialize(void)
+{
+    if (hashtable_construct(&Connections, 0, sizeof(struct TcpConnectionIndex),
+            ConnectionHash, ConnectionCompare)) {
+        return OsOutOfMemory;
+    }
+    queue_construct(&DeadSockets);
+    
+    if (thrd_create(&TimerThread, TcpTimerThread, NULL) != thrd_success) {
+        ERROR("[tcp] failed to create the timer thread");
+        return OsError;
+    }
+    return OsSuccess;
+}
+
+static uint64_t ConnectionHash(const void* Element)
+{
+    return siphash_64((const uint8_t*)Element, TCP_INDEX_KEY_LENGTH, &HashKey[0]);
+}
+
+static int ConnectionCompare(const void* Element1, const void* Element2)
+{
+    return memcmp(Element1, Element2, TCP_INDEX_KEY_LENGTH);
+}
@@ -0,0 +1,112 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Network Manager (Loopback adapter)
+ * - Contains the implementation of the loopback adapter. Transmitted packets are
+ *   queued and received again by the adapter thread, so the network stack sees
+ *   exactly the same sequence of events as it would for a network card.
+ */
+//#define __TRACE
+
+#include "adapter.h"
+#include <ddk/utils.h>
+#include <ds/queue.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#define LOOPBACK_MTU (64 * 1024 - 1)
+
+typedef struct LoopbackAdapter {
+    NetworkAdapter_t Adapter;
+    thrd_t           Thread;
+    mtx_t            QueueLock;
+    cnd_t            QueueSignal;
+    queue_t          Queue;
+} LoopbackAdapter_t;
+
+static OsStatus_t
+LoopbackTransmit(
+    _In_ NetworkAdapter_t* Adapter,
+    _In_ NetworkPacket_t*  Packet)
+{
+    LoopbackAdapter_t* Loopback = (LoopbackAdapter_t*)Adapter;
+    TRACE("[loopback] [transmit] %" PRIuIN " bytes", Packet->Length);
+    
+    mtx_lock(&Loopback->QueueLock);
+    queue_push(&Loopback->Queue, &Packet->Header);
+    cnd_signal(&Loopback->QueueSignal);
+    mtx_unlock(&Loopback->QueueLock);
+    return OsSuccess;
+}
+
+static int
+LoopbackReceiveThread(
+    _In_ void* Context)
+{
+    LoopbackAdapter_t* Loopback   = Context;
+    int                RunForever = 1;
+    element_t*         Element;
+    
+    while (RunForever) {
+        mtx_lock(&Loopback->QueueLock);
+        Element = queue_pop(&Loopback->Queue);
+        while (!Element) {
+            cnd_wait(&Loopback->QueueSignal, &Loopback->QueueLock);
+            Element = queue_pop(&Loopback->Queue);
+        }
+        mtx_unlock(&Loopback->QueueLock);
+        
+        NetworkAdapterReceive(&Loopback->Adapter, (NetworkPacket_t*)Element->value);
+    }
+    return 0;
+}
+
+OsStatus_t
+LoopbackAdapterCreate(
+    _Out_ NetworkAdapter_t** AdapterOut)
+{
+    LoopbackAdapter_t* Loopback;
+    
+    Loopback = malloc(sizeof(LoopbackAdapter_t));
+    if (!Loopback) {
+        return OsOutOfMemory;
+    }
+    memset(Loopback, 0, sizeof(LoopbackAdapter_t));
+    
+    Loopback->Adapter.Name     = "lo";
+    Loopback->Adapter.Address  = INADDR_LOOPBACK;
+    Loopback->Adapter.Netmask  = IN_CLASSA_NET;
+    Loopback->Adapter.Mtu      = LOOPBACK_MTU;
+    Loopback->Adapter.Transmit = LoopbackTransmit;
+    Loopback->Adapter.Context  = Loopback;
+    
+    mtx_init(&Loopback->QueueLock, mtx_plain);
+    cnd_init(&Loopback->QueueSignal);
+    queue_construct(&Loopback->Queue);
+    
+    if (thrd_create(&Loopback->Thread, LoopbackReceiveThread, Loopback) != thrd_success) {
+        ERROR("[loopback] failed to create the receive thread");
+        free(Loopback);
+        return OsError;
+    }
+    
+    *AdapterOut = &Loopback->Adapter;
+    return OsSuccess;
+}
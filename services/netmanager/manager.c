@@ -28,8 +28,11 @@
 #include <ddk/handle.h>
 #include <ddk/utils.h>
 #include "domains/domains.h"
+#include <ds/hash_sip.h>
+#include <ds/hashtable.h>
 #include <inet/local.h>
 #include "manager.h"
+#include <os/mollenos.h>
 #include "socket.h"
 #include <stdlib.h>
 #include <string.h>
@@ -37,11 +40,38 @@
 
 #include "svc_socket_protocol_server.h"
 
-// This socket tree contains all the local system sockets that were created by
-// this machine. All remote sockets are maintained by the domains
-static rb_tree_t Sockets;
-static UUId_t    SocketSet;
-static thrd_t    SocketMonitorHandle;
+typedef struct SocketMonitor {
+    thrd_t        Handle;
+    int           Index;
+    UUId_t        SocketSet;
+    unsigned long EventCount;
+} SocketMonitor_t;
+
+struct SocketIndex {
+    UUId_t    Handle;
+    Socket_t* Socket;
+};
+
+static uint64_t SocketHash(const void*);
+static int      SocketCompare(const void*, const void*);
+
+// This socket table contains all the local system sockets that were created by
+// this machine, indexed by their handle. All remote sockets are maintained by the domains
+static hashtable_t      Sockets     = { 0 };
+static mtx_t            SocketsLock;
+static SocketMonitor_t* SocketMonitors;
+static int              SocketMonitorCount;
+static uint8_t          HashKey[16] = { 88, 213, 4, 161, 39, 250, 117, 62, 198, 13, 145, 82, 227, 50, 176, 109 };
+
+/* GetSocketMonitor
+ * Sockets are distributed between the monitors by their handle, so all events for
+ * a socket are always handled by the same monitor thread. */
+static SocketMonitor_t*
+GetSocketMonitor(
+    _In_ UUId_t Handle)
+{
+    return &SocketMonitors[Handle % (UUId_t)SocketMonitorCount];
+}
 
 /////////////////////////////////////////////////////
 // APPLICATIONS => NetworkService
@@ -90,6 +120,11 @@ HandleSocketEvent(
         }
     }
     
+    // Data has been consumed from the receive stream by the application
+    if (Event->events & IOSETSYN) {
+        (void)DomainReceive(Socket);
+    }
+    
 Exit:
     mtx_unlock(&Socket->SyncObject);
 }
@@ -104,14 +139,14 @@ static int
 SocketMonitor(
     _In_ void* Context)
 {
+    SocketMonitor_t*    Monitor    = Context;
     int                 RunForever = 1;
-    struct ioset_event * Events;
+    struct ioset_event* Events;
     int                 EventCount;
     int                 i;
     OsStatus_t          Status;
     
-    _CRT_UNUSED(Context);
-    TRACE("[socket monitor] starting");
+    TRACE("[socket monitor] [%i] starting", Monitor->Index);
     
     Events = malloc(sizeof(struct ioset_event) * NETWORK_MANAGER_MONITOR_MAX_EVENTS);
     if (!Events) {
@@ -119,15 +154,21 @@ SocketMonitor(
     }
     
     while (RunForever) {
-        Status = notification_queue_wait(SocketSet, Events,
+        Status = notification_queue_wait(Monitor->SocketSet, Events,
             NETWORK_MANAGER_MONITOR_MAX_EVENTS, 0, 0, &EventCount);
         if (Status != OsSuccess && Status != OsInterrupted) {
-            ERROR("[socket_monitor] notification_queue_wait FAILED: %u", Status);
+            ERROR("[socket_monitor] [%i] notification_queue_wait FAILED: %u", Monitor->Index, Status);
             continue;
         }
         
         for (i = 0; i < EventCount; i++) {
             HandleSocketEvent(&Events[i]);
+            
+            // Diagnostics only, the distribution between monitors is visible in trace builds
+            Monitor->EventCount++;
+            if (!(Monitor->EventCount % NETWORK_MANAGER_MONITOR_REPORT_INTERVAL)) {
+                TRACE("[socket_monitor] [%i] handled %lu events", Monitor->Index, Monitor->EventCount);
+            }
         }
     }
     return 0;
@@ -162,27 +203,49 @@ NetworkMonitor(
 OsStatus_t
 NetworkManagerInitialize(void)
 {
-    OsStatus_t Status;
-    int        Code;
+    SystemDescriptor_t Descriptor;
+    OsStatus_t         Status;
+    int                Code;
+    int                i;
     TRACE("[net_manager] initialize");
     
-    rb_tree_construct(&Sockets);
-    Status = notification_queue_create(0, &SocketSet);
-    if (Status != OsSuccess) {
-        ERROR("[net_manager] failed to create socket handle set");
-        return Status;
+    if (hashtable_construct(&Sockets, 0, sizeof(struct SocketIndex),
+            SocketHash, SocketCompare)) {
+        return OsOutOfMemory;
     }
+    mtx_init(&SocketsLock, mtx_plain);
     
-    // Spawn the socket monitor thread, the network monitor threads are
+    // Spawn a socket monitor for each core, the network monitor threads are
     // only spawned once a network card is registered.
-    TRACE("[net_manager] creating thread");
-    Code = thrd_create(&SocketMonitorHandle, SocketMonitor, NULL);
-    if (Code != thrd_success) {
-        ERROR("[net_manager] thrd_create failed %i", Code);
-        return OsError;
+    SocketMonitorCount = 1;
+    if (SystemQuery(&Descriptor) == OsSuccess && Descriptor.NumberOfActiveCores > 1) {
+        SocketMonitorCount = (int)MIN(Descriptor.NumberOfActiveCores,
+            NETWORK_MANAGER_MONITOR_MAX_THREADS);
     }
-    TRACE("[net_manager] done");
-    return Status;
+    
+    SocketMonitors = malloc(sizeof(SocketMonitor_t) * SocketMonitorCount);
+    if (!SocketMonitors) {
+        return OsOutOfMemory;
+    }
+    memset(SocketMonitors, 0, sizeof(SocketMonitor_t) * SocketMonitorCount);
+    
+    for (i = 0; i < SocketMonitorCount; i++) {
+        SocketMonitors[i].Index = i;
+        Status = notification_queue_create(0, &SocketMonitors[i].SocketSet);
+        if (Status != OsSuccess) {
+            ERROR("[net_manager] failed to create socket handle set");
+            return Status;
+        }
+        
+        TRACE("[net_manager] creating thread %i", i);
+        Code = thrd_create(&SocketMonitors[i].Handle, SocketMonitor, &SocketMonitors[i]);
+        if (Code != thrd_success) {
+            ERROR("[net_manager] thrd_create failed %i", Code);
+            return OsError;
+        }
+    }
+    TRACE("[net_manager] done, %i socket monitors", SocketMonitorCount);
+    return DomainInitialize();
 }
 
 OsStatus_t
@@ -212,17 +275,19 @@ NetworkManagerSocketCreate(
     }
     
     // Add it to the handle set
-    event.events = IOSETOUT;
+    event.events = IOSETOUT | IOSETSYN;
     event.data.handle = (UUId_t)(uintptr_t)Socket->Header.key;
-    Status = notification_queue_ctrl(SocketSet, IOSET_ADD,
+    Status = notification_queue_ctrl(GetSocketMonitor(event.data.handle)->SocketSet, IOSET_ADD,
                                      (UUId_t)(uintptr_t)Socket->Header.key, &event);
     if (Status != OsSuccess) {
         // what the fuck TODO
         assert(0);
     }
     
-    rb_tree_append(&Sockets, &Socket->Header);
     *HandleOut           = (UUId_t)(uintptr_t)Socket->Header.key;
+    mtx_lock(&SocketsLock);
+    hashtable_set(&Sockets, &(struct SocketIndex) { .Handle = *HandleOut, .Socket = Socket });
+    mtx_unlock(&SocketsLock);
     *SendBufferHandleOut = Socket->Send.DmaAttachment.handle;
     *RecvBufferHandleOut = Socket->Receive.DmaAttachment.handle;
     TRACE("[net_manager] [create] => %u", *HandleOut);
@@ -257,11 +322,14 @@ NetworkManagerSocketShutdown(
     if (Options & SVC_SOCKET_CLOSE_OPTIONS_DESTROY) {
         // If removing it failed, then assume that it was already destroyed, and we just
         // encountered a race condition
-        if (!rb_tree_remove(&Sockets, (void*)(uintptr_t)Handle)) {
+        mtx_lock(&SocketsLock);
+        if (!hashtable_remove(&Sockets, &(struct SocketIndex) { .Handle = Handle })) {
+            mtx_unlock(&SocketsLock);
             return OsDoesNotExist;
         }
+        mtx_unlock(&SocketsLock);
         
-        Status = notification_queue_ctrl(SocketSet, IOSET_DEL, Handle, NULL);
+        Status = notification_queue_ctrl(GetSocketMonitor(Handle)->SocketSet, IOSET_DEL, Handle, NULL);
         if (Status != OsSuccess) {
             ERROR("[net_manager] [shutdown] failed to remove handle %u from socket set", Handle);
         }
@@ -346,8 +414,13 @@ NetworkManagerSocketConnect(
         }
     }
     else {
-        // TODO
-        return OsNotSupported;
+        // Connectionless sockets only change the address they are associated with, which
+        // is done at once
+        status = DomainConnect(message, socket, address);
+        if (status == OsSuccess) {
+            svc_socket_connect_response(message, OsSuccess);
+        }
+        return status;
     }
 
     socket->Configuration.Connecting = 1;
@@ -555,5 +628,27 @@ Socket_t*
 NetworkManagerSocketGet(
     _In_ UUId_t Handle)
 {
-    return (Socket_t*)rb_tree_lookup_value(&Sockets, (void*)(uintptr_t)Handle);
+    struct SocketIndex* Index;
+    Socket_t*           Socket = NULL;
+    
+    mtx_lock(&SocketsLock);
+    Index = hashtable_get(&Sockets, &(struct SocketIndex) { .Handle = Handle });
+    if (Index) {
+        Socket = Index->Socket;
+    }
+    mtx_unlock(&SocketsLock);
+    return Socket;
+}
+
+static uint64_t SocketHash(const void* Element)
+{
+    const struct SocketIndex* Index = Element;
+    return siphash_64((const uint8_t*)&Index->Handle, sizeof(UUId_t), &HashKey[0]);
+}
+
+static int SocketCompare(const void* Element1, const void* Element2)
+{
+    const struct SocketIndex* Index1 = Element1;
+    const struct SocketIndex* Index2 = Element2;
+    return Index1->Handle == Index2->Handle ? 0 : 1;
 }
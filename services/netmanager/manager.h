@@ -33,7 +33,9 @@
 typedef struct Socket Socket_t;
 typedef struct SocketDescriptor SocketDescriptor_t;
 
-#define NETWORK_MANAGER_MONITOR_MAX_EVENTS 32
+#define NETWORK_MANAGER_MONITOR_MAX_EVENTS      32
+#define NETWORK_MANAGER_MONITOR_MAX_THREADS     16
+#define NETWORK_MANAGER_MONITOR_REPORT_INTERVAL 100000
 
 OsStatus_t
 NetworkManagerInitialize(void);
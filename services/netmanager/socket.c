@@ -117,7 +117,7 @@ SocketCreateImpl(
         ERROR("Failed to create socket handle");
         return Status;
     }
-    RB_LEAF_INIT(&Socket->Header, Handle, Socket);
+    ELEMENT_INIT(&Socket->Header, (uintptr_t)Handle, Socket);
     
     Status = DomainCreate(Domain, &Socket->Domain);
     if (Status != OsSuccess) {
@@ -215,7 +215,7 @@ SetSocketOptionImpl(
     _In_ const void*      Data,
     _In_ socklen_t        DataLength)
 {
-    return OsNotSupported;
+    return DomainSetOption(Socket, Protocol, Option, Data, DataLength);
 }
     
 OsStatus_t
@@ -226,7 +226,7 @@ GetSocketOptionImpl(
     _In_  void*            Data,
     _Out_ socklen_t*       DataLengthOut)
 {
-    return OsNotSupported;
+    return DomainGetOption(Socket, Protocol, Option, Data, DataLengthOut);
 }
 
 streambuffer_t*
@@ -242,28 +242,3 @@ GetSocketRecvStream(
 {
     return (streambuffer_t*)Socket->Receive.Stream;
 }
-
-OsStatus_t
-SocketSetQueuedPacket(
-    _In_ Socket_t*   Socket,
-    _In_ const void* Payload,
-    _In_ size_t      Length)
-{
-    Socket->QueuedPacket.Length = Length;
-    Socket->QueuedPacket.Data   = (void*)Payload;
-    return OsSuccess;
-}
-
-size_t
-SocketGetQueuedPacket(
-    _In_ Socket_t* Socket,
-    _In_ void**    Buffer)
-{
-    size_t Length = Socket->QueuedPacket.Length;
-    if (Length) {
-        *Buffer = (void*)Socket->QueuedPacket.Data;
-        Socket->QueuedPacket.Data   = NULL;
-        Socket->QueuedPacket.Length = 0;
-    }
-    return Length;
-}
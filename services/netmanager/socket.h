@@ -27,7 +27,7 @@
 #define __NETMANAGER_SOCKET_H__
 
 #include <ds/streambuffer.h>
-#include <ds/rbtree.h>
+#include <ds/list.h>
 #include <ds/queue.h>
 #include <inet/socket.h>
 #include <os/dmabuf.h>
@@ -46,18 +46,13 @@ typedef struct SocketConfiguration {
     int          Backlog;
 } SocketConfiguration_t;
 
-typedef struct QueuedPacket {
-    size_t Length;
-    void*  Data;
-} QueuedPacket_t;
-
 typedef struct SocketPipe {
     struct dma_attachment DmaAttachment;
     streambuffer_t*       Stream;
 } SocketPipe_t;
 
 typedef struct Socket {
-    rb_leaf_t             Header;
+    element_t             Header;
     _Atomic(int)          PendingPackets;
     int                   DomainType;
     int                   Type;
@@ -69,7 +64,6 @@ typedef struct Socket {
     SocketDomain_t*       Domain;
     SocketPipe_t          Send;
     SocketPipe_t          Receive;
-    QueuedPacket_t        QueuedPacket;
     queue_t               ConnectionRequests;
     queue_t               AcceptRequests;
 } Socket_t;
@@ -131,15 +125,4 @@ streambuffer_t*
 GetSocketRecvStream(
     _In_ Socket_t* Socket);
 
-OsStatus_t
-SocketSetQueuedPacket(
-    _In_ Socket_t*   Socket,
-    _In_ const void* Payload,
-    _In_ size_t      Length);
-
-size_t
-SocketGetQueuedPacket(
-    _In_ Socket_t* Socket,
-    _In_ void**    Buffer);
-
 #endif //!__NETMANAGER_SOCKET_H__
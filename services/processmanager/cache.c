@@ -0,0 +1,296 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Process Manager
+ * - Executable image cache. The contents of executables and libraries are kept in
+ *   memory after they have been loaded, keyed by their path and validated against the
+ *   size and modification time of the file. Images that are not in use are evicted
+ *   in least recently used order when the cache grows beyond its budget.
+ */
+
+//#define __TRACE
+
+#include <ddk/utils.h>
+#include <ds/hash_sip.h>
+#include <ds/hashtable.h>
+#include <ds/list.h>
+#include <ds/mstring.h>
+#include "../../librt/libds/pe/pe.h"
+#include <internal/_ipc.h>
+#include <os/mollenos.h>
+#include "process.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct ImageCacheEntry {
+    element_t       Header;
+    MString_t*      Path;
+    struct timespec ModifiedAt;
+    uint64_t        Size;
+    void*           Buffer;
+    size_t          Length;
+    int             References;
+    int             Stale;
+} ImageCacheEntry_t;
+
+struct ImageCacheIndex {
+    const char*        Path;
+    ImageCacheEntry_t* Entry;
+};
+
+static uint64_t ImageHash(const void*);
+static int      ImageCompare(const void*, const void*);
+
+static hashtable_t Images      = { 0 };
+static list_t      ImagesLru   = LIST_INIT;
+static list_t      StaleImages = LIST_INIT;
+static size_t      CachedBytes = 0;
+static mtx_t       CacheLock;
+static uint8_t     HashKey[16] = { 23, 189, 74, 240, 5, 158, 97, 212, 46, 131, 8, 177, 66, 219, 102, 35 };
+
+OsStatus_t
+ImageCacheInitialize(void)
+{
+    if (hashtable_construct(&Images, 0, sizeof(struct ImageCacheIndex),
+            ImageHash, ImageCompare)) {
+        return OsOutOfMemory;
+    }
+    mtx_init(&CacheLock, mtx_plain);
+    return OsSuccess;
+}
+
+static void
+ImageDestroy(
+    _In_ ImageCacheEntry_t* Entry)
+{
+    TRACE("[image_cache] [destroy] %s", MStringRaw(Entry->Path));
+    MStringDestroy(Entry->Path);
+    free(Entry->Buffer);
+    free(Entry);
+}
+
+/* ImageDetach
+ * Removes the image from the cache so new loads no longer find it. The image is
+ * destroyed once the last reference to it has been released. */
+static void
+ImageDetach(
+    _In_ ImageCacheEntry_t* Entry)
+{
+    hashtable_remove(&Images, &(struct ImageCacheIndex) { .Path = MStringRaw(Entry->Path) });
+    list_remove(&ImagesLru, &Entry->Header);
+    CachedBytes -= Entry->Length;
+
+    if (Entry->References) {
+        Entry->Stale = 1;
+        list_append(&StaleImages, &Entry->Header);
+    }
+    else {
+        ImageDestroy(Entry);
+    }
+}
+
+/* ImageCacheTrim
+ * Evicts unused images, oldest first, until the cache is within its budget. */
+static void
+ImageCacheTrim(void)
+{
+    element_t* Element = list_front(&ImagesLru);
+    while (Element && CachedBytes > IMAGE_CACHE_BUDGET) {
+        ImageCacheEntry_t* Entry = (ImageCacheEntry_t*)Element;
+        Element = Element->next;
+        if (!Entry->References) {
+            ImageDetach(Entry);
+        }
+    }
+}
+
+static OsStatus_t
+ReadFile(
+    _In_  MString_t* FullPath,
+    _In_  size_t     Length,
+    _Out_ void**     BufferOut)
+{
+    FILE*  file;
+    void*  fileBuffer;
+    size_t bytesRead;
+
+    file = fopen(MStringRaw(FullPath), "rb");
+    if (!file) {
+        ERROR("[load_file] [open_file] failed: %i", errno);
+        return OsError;
+    }
+
+    TRACE("[load_file] size %" PRIuIN, Length);
+    fileBuffer = malloc(Length);
+    if (!fileBuffer) {
+        ERROR("[load_file] [malloc] null");
+        fclose(file);
+        return OsOutOfMemory;
+    }
+
+    bytesRead = fread(fileBuffer, 1, Length, file);
+    fclose(file);
+
+    TRACE("[load_file] [transfer_file] read %" PRIuIN " bytes from file", bytesRead);
+    if (bytesRead != Length) {
+        ERROR("[load_file] [transfer_file] short read %" PRIuIN "/%" PRIuIN, bytesRead, Length);
+        free(fileBuffer);
+        return OsError;
+    }
+
+    *BufferOut = fileBuffer;
+    return OsSuccess;
+}
+
+OsStatus_t
+LoadFile(
+    _In_  MString_t* FullPath,
+    _Out_ void**     BufferOut,
+    _Out_ size_t*    LengthOut)
+{
+    struct ImageCacheIndex* Index;
+    OsFileDescriptor_t      Information;
+    ImageCacheEntry_t*      Entry;
+    void*                   Buffer;
+    OsStatus_t              Status;
+
+    TRACE("[load_file] %s", MStringRaw(FullPath));
+
+    Status = GetFileInformationFromPath(MStringRaw(FullPath), &Information);
+    if (Status != OsSuccess) {
+        ERROR("[load_file] [get_information] failed: %u", Status);
+        return Status;
+    }
+
+    mtx_lock(&CacheLock);
+    Index = hashtable_get(&Images, &(struct ImageCacheIndex) { .Path = MStringRaw(FullPath) });
+    if (Index) {
+        Entry = Index->Entry;
+        if (Entry->Size == Information.Size.QuadPart &&
+            Entry->ModifiedAt.tv_sec == Information.ModifiedAt.tv_sec &&
+            Entry->ModifiedAt.tv_nsec == Information.ModifiedAt.tv_nsec) {
+            TRACE("[load_file] cache hit");
+            Entry->References++;
+            list_remove(&ImagesLru, &Entry->Header);
+            list_append(&ImagesLru, &Entry->Header);
+            *BufferOut = Entry->Buffer;
+            *LengthOut = Entry->Length;
+            mtx_unlock(&CacheLock);
+            return OsSuccess;
+        }
+
+        // The file has changed since it was cached
+        ImageDetach(Entry);
+    }
+    mtx_unlock(&CacheLock);
+
+    Status = ReadFile(FullPath, (size_t)Information.Size.QuadPart, &Buffer);
+    if (Status != OsSuccess) {
+        return Status;
+    }
+
+    Entry = (ImageCacheEntry_t*)malloc(sizeof(ImageCacheEntry_t));
+    if (!Entry) {
+        free(Buffer);
+        return OsOutOfMemory;
+    }
+
+    ELEMENT_INIT(&Entry->Header, 0, Entry);
+    Entry->Path       = MStringClone(FullPath);
+    Entry->ModifiedAt = Information.ModifiedAt;
+    Entry->Size       = Information.Size.QuadPart;
+    Entry->Buffer     = Buffer;
+    Entry->Length     = (size_t)Information.Size.QuadPart;
+    Entry->References = 1;
+    Entry->Stale      = 0;
+
+    // Another thread may have loaded the same file while we were reading it, in
+    // that case the older copy is replaced, and it lives on until it is released
+    mtx_lock(&CacheLock);
+    Index = hashtable_get(&Images, &(struct ImageCacheIndex) { .Path = MStringRaw(FullPath) });
+    if (Index) {
+        ImageDetach(Index->Entry);
+    }
+
+    list_append(&ImagesLru, &Entry->Header);
+    hashtable_set(&Images, &(struct ImageCacheIndex) {
+        .Path = MStringRaw(Entry->Path), .Entry = Entry });
+    CachedBytes += Entry->Length;
+    ImageCacheTrim();
+    mtx_unlock(&CacheLock);
+
+    *BufferOut = Entry->Buffer;
+    *LengthOut = Entry->Length;
+    return OsSuccess;
+}
+
+void
+UnloadFile(
+    _In_ MString_t* FullPath,
+    _In_ void*      Buffer)
+{
+    struct ImageCacheIndex* Index;
+    ImageCacheEntry_t*      Entry = NULL;
+
+    mtx_lock(&CacheLock);
+    Index = hashtable_get(&Images, &(struct ImageCacheIndex) { .Path = MStringRaw(FullPath) });
+    if (Index && Index->Entry->Buffer == Buffer) {
+        Entry = Index->Entry;
+    }
+    else {
+        foreach(Element, &StaleImages) {
+            if (((ImageCacheEntry_t*)Element)->Buffer == Buffer) {
+                Entry = (ImageCacheEntry_t*)Element;
+                break;
+            }
+        }
+    }
+
+    if (!Entry) {
+        ERROR("[unload_file] %s was not loaded", MStringRaw(FullPath));
+        mtx_unlock(&CacheLock);
+        return;
+    }
+
+    Entry->References--;
+    if (!Entry->References) {
+        if (Entry->Stale) {
+            list_remove(&StaleImages, &Entry->Header);
+            ImageDestroy(Entry);
+        }
+        else {
+            ImageCacheTrim();
+        }
+    }
+    mtx_unlock(&CacheLock);
+}
+
+static uint64_t ImageHash(const void* Element)
+{
+    const struct ImageCacheIndex* Index = Element;
+    return siphash_64((const uint8_t*)Index->Path, strlen(Index->Path), &HashKey[0]);
+}
+
+static int ImageCompare(const void* Element1, const void* Element2)
+{
+    const struct ImageCacheIndex* Index1 = Element1;
+    const struct ImageCacheIndex* Index2 = Element2;
+    return strcmp(Index1->Path, Index2->Path);
+}
@@ -244,63 +244,11 @@ ResolveFilePath(
     return Status;
 }
 
-OsStatus_t
-LoadFile(
-    _In_  MString_t* FullPath,
-    _Out_ void**     BufferOut,
-    _Out_ size_t*    LengthOut)
-{
-    FILE*  file;
-    long   fileSize;
-    void*  fileBuffer;
-    size_t bytesRead;
-    
-    TRACE("[load_file] %s", MStringRaw(FullPath));
-    
-    file = fopen(MStringRaw(FullPath), "rb");
-    if (!file) {
-        ERROR("[load_file] [open_file] failed: %i", errno);
-        return OsError;
-    }
-    
-    fseek(file, 0, SEEK_END);
-    fileSize = ftell(file);
-    rewind(file);
-    
-    TRACE("[load_file] size %" PRIuIN, fileSize);
-    fileBuffer = malloc(fileSize);
-    if (!fileBuffer) {
-        ERROR("[load_file] [malloc] null");
-        fclose(file);
-        return OsOutOfMemory;
-    }
-    
-    bytesRead = fread(fileBuffer, 1, fileSize, file);
-    fclose(file);
-    
-    TRACE("[load_file] [transfer_file] read %" PRIuIN " bytes from file", bytesRead);
-    
-    *BufferOut = fileBuffer;
-    *LengthOut = fileSize;
-    return OsSuccess;
-}
-
-void
-UnloadFile(
-    _In_ MString_t* FullPath,
-    _In_ void*      Buffer)
-{
-    // So right now we will simply free the buffer, 
-    // but when we implement caching we will check if it should stay cached
-    _CRT_UNUSED(FullPath);
-    free(Buffer);
-}
-
 OsStatus_t
 InitializeProcessManager(void)
 {
     CreateEventQueue(&EventQueue);
-    return OsSuccess;
+    return ImageCacheInitialize();
 }
 
 OsStatus_t
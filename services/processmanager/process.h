@@ -38,6 +38,8 @@ DECL_STRUCT(MString);
 #define PROCESS_RUNNING     0
 #define PROCESS_TERMINATING 1
 
+#define IMAGE_CACHE_BUDGET  (32 * 1024 * 1024)
+
 typedef struct Process {
     element_t              Header;
     UUId_t                 PrimaryThreadId;
@@ -72,6 +74,12 @@ typedef struct ProcessJoiner {
 __EXTERN OsStatus_t
 InitializeProcessManager(void);
 
+/* ImageCacheInitialize
+ * Initializes the cache that keeps the contents of loaded executables and libraries
+ * in memory, so they can be loaded again without reading them from disk. */
+__EXTERN OsStatus_t
+ImageCacheInitialize(void);
+
 /* AcquireProcess
  * Acquires a reference to a process and allows safe access to the structure. */
 __EXTERN Process_t*
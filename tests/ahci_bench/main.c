@@ -0,0 +1,553 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * AHCI benchmark
+ *  - Runs the ahci transaction layer against an emulated port and disk. The disk
+ *    services one command at a time and picks the closest queued command next, so
+ *    deeper queues mean shorter seeks. Random reads are issued at queue depths from
+ *    1 to 32 with and without native command queuing, and every request is verified
+ *    to complete exactly once. Sequential requests that wait for a slot must be
+ *    merged into fewer commands. A queued command error must only fail the command
+ *    named by the error log, and retry the others once the log has been read.
+ */
+
+#include <ddk/utils.h>
+#include "manager.h"
+#include <os/dmabuf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ctt_storage_protocol_server.h"
+
+#define BENCH_REQUESTS        2000
+#define BENCH_REQUEST_SECTORS 8
+#define BENCH_MAX_OUTSTANDING 64
+#define BENCH_DISK_SECTORS    (64ULL * 1024 * 1024)
+#define BENCH_ERROR_REQUESTS  8
+
+// Emulated disk timings in microseconds
+#define DISK_COMMAND_TIME     20.0
+#define DISK_SEEK_TIME        500.0
+#define DISK_STROKE_TIME      8000.0
+#define DISK_SECTOR_TIME      3.4
+
+struct bench_request {
+    int        completions;
+    OsStatus_t status;
+    size_t     sectors;
+};
+
+struct bench_command {
+    int      active;
+    int      queued;
+    int      command;
+    uint64_t sector;
+    size_t   count;
+};
+
+static reg32_t               mmio[(AHCI_REGISTER_PORTBASE(AHCI_MAX_PORTS)) / sizeof(reg32_t)];
+static AhciController_t      controller;
+static AhciDevice_t          device;
+static AhciPort_t*           port;
+static struct dma_attachment buffer;
+static struct ipmsg          messageStorage;
+
+static struct bench_request  requests[BENCH_REQUESTS];
+static struct bench_command  commands[AHCI_MAX_COMMAND_SLOTS];
+static int                   outstanding;
+static int                   failures;
+
+static uint64_t              diskHead;
+static double                diskTime;
+static int                   diskActive;
+static int                   diskMaxActive;
+static int                   diskCommands;
+static int                   diskErrorTag;
+
+static double
+bench_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static uint64_t
+disk_fis_sector(
+    _In_ FISRegisterH2D_t* fis)
+{
+    return (uint64_t)fis->SectorNo | ((uint64_t)fis->CylinderLow << 8) |
+        ((uint64_t)fis->CylinderHigh << 16) | ((uint64_t)fis->SectorNoExtended << 24) |
+        ((uint64_t)fis->CylinderLowExtended << 32) | ((uint64_t)fis->CylinderHighExtended << 40);
+}
+
+// Picks up newly issued commands the way the port would, and validates them. The
+// emulated registers are plain memory, so issuing a command replaces the bits of the
+// others, and the slots held by the driver tell which commands have been issued
+static void
+disk_fetch_commands(void)
+{
+    AHCICommandList_t* commandList  = (AHCICommandList_t*)port->CommandListDMA.buffer;
+    reg32_t            issued       = (reg32_t)atomic_load(&port->Slots);
+    reg32_t            commandIssue = 0;
+    reg32_t            ataActive    = 0;
+    int                slot;
+    int                i;
+
+    for (slot = 0; slot < AHCI_MAX_COMMAND_SLOTS; slot++) {
+        AHCICommandTable_t* table;
+        FISRegisterH2D_t*   fis;
+        size_t              bytes = 0;
+
+        if (!(issued & (1 << slot)) || commands[slot].active) {
+            continue;
+        }
+
+        table = (AHCICommandTable_t*)((uint8_t*)port->CommandTableDMA.buffer + (slot * AHCI_COMMAND_TABLE_SIZE));
+        fis   = (FISRegisterH2D_t*)&table->FISCommand[0];
+        commands[slot].active  = 1;
+        commands[slot].command = fis->Command;
+        commands[slot].sector  = disk_fis_sector(fis);
+        commands[slot].queued  = fis->Command == AtaFPDMAReadQueued || fis->Command == AtaFPDMAWriteQueued;
+        if (commands[slot].queued) {
+            commands[slot].count = (size_t)fis->FeaturesLow | ((size_t)fis->FeaturesHigh << 8);
+            if ((fis->Count >> 3) != slot || !(port->QueuedSlots & (1 << slot))) {
+                printf("slot %i: queued command has the wrong tag\n", slot);
+                failures++;
+            }
+            if (diskErrorTag != -1) {
+                printf("slot %i: queued command issued before the error log was read\n", slot);
+                failures++;
+            }
+        }
+        else {
+            commands[slot].count = fis->Count;
+            if (fis->Command == AtaPIOReadLogExt && commands[slot].sector != AHCI_LOG_NCQ_ERROR) {
+                printf("slot %i: read log 0x%x\n", slot, (unsigned int)commands[slot].sector);
+                failures++;
+            }
+        }
+
+        for (i = 0; i < commandList->Headers[slot].TableLength; i++) {
+            bytes += (table->PrdtEntry[i].Descriptor & 0x3FFFFF) + 1;
+        }
+        if (bytes != commands[slot].count * device.SectorSize) {
+            printf("slot %i: %u sectors but %u bytes described\n", slot,
+                (unsigned int)commands[slot].count, (unsigned int)bytes);
+            failures++;
+        }
+
+        diskActive++;
+        diskCommands++;
+        if (diskActive > diskMaxActive) {
+            diskMaxActive = diskActive;
+        }
+    }
+
+    // Queued commands have been transmitted, only their tag stays active
+    for (slot = 0; slot < AHCI_MAX_COMMAND_SLOTS; slot++) {
+        if (commands[slot].active && commands[slot].queued) {
+            ataActive |= (1 << slot);
+        }
+        else if (commands[slot].active) {
+            commandIssue |= (1 << slot);
+        }
+    }
+    port->Registers->CommandIssue = commandIssue;
+    port->Registers->AtaActive    = ataActive;
+}
+
+// Completes the command closest to the head and raises the port interrupt
+static void
+disk_complete_command(void)
+{
+    uint64_t distance;
+    uint64_t closest = 0;
+    int      slot    = -1;
+    int      i;
+
+    for (i = 0; i < AHCI_MAX_COMMAND_SLOTS; i++) {
+        if (!commands[i].active) {
+            continue;
+        }
+
+        distance = (commands[i].sector > diskHead) ? (commands[i].sector - diskHead) : (diskHead - commands[i].sector);
+        if (slot == -1 || distance < closest) {
+            closest = distance;
+            slot    = i;
+        }
+    }
+
+    if (slot == -1) {
+        printf("port is idle with %i requests outstanding\n", outstanding);
+        failures++;
+        outstanding = 0;
+        return;
+    }
+
+    diskTime += DISK_COMMAND_TIME + ((double)commands[slot].count * DISK_SECTOR_TIME);
+    if (closest) {
+        diskTime += DISK_SEEK_TIME + ((DISK_STROKE_TIME * (double)closest) / (double)BENCH_DISK_SECTORS);
+    }
+    diskHead = commands[slot].sector + commands[slot].count;
+
+    commands[slot].active = 0;
+    diskActive--;
+    if (commands[slot].queued) {
+        port->Registers->AtaActive &= ~(1 << slot);
+        controller.InterruptResource.PortInterruptStatus[port->Index] |= AHCI_PORT_IE_SDBE;
+    }
+    else {
+        if (commands[slot].command == AtaPIOReadLogExt) {
+            AhciNcqErrorLog_t* log = (AhciNcqErrorLog_t*)port->InternalBuffer.buffer;
+            log->Tag     = (uint8_t)diskErrorTag;
+            log->Status  = ATA_STS_DEV_READY | ATA_STS_DEV_ERROR;
+            log->Error   = ATA_ERR_DEV_UNC;
+            diskErrorTag = -1;
+        }
+        ((AHCIFis_t*)port->RecievedFisDMA.buffer)->RegisterD2H.Status = ATA_STS_DEV_READY;
+        port->Registers->CommandIssue &= ~(1 << slot);
+        controller.InterruptResource.PortInterruptStatus[port->Index] |= AHCI_PORT_IE_DHRE;
+    }
+    AhciPortInterruptHandler(&controller, port);
+}
+
+static void
+bench_submit(
+    _In_ int      index,
+    _In_ uint64_t sector)
+{
+    struct gracht_recv_message message = { 0 };
+    OsStatus_t                 status;
+
+    message.storage = &messageStorage;
+    message.client  = index;
+
+    outstanding++;
+    status = AhciTransactionStorageCreate(&device, &message, __STORAGE_OPERATION_READ, sector,
+        buffer.handle, (index % BENCH_MAX_OUTSTANDING) * BENCH_REQUEST_SECTORS * device.SectorSize,
+        BENCH_REQUEST_SECTORS);
+    if (status != OsSuccess) {
+        printf("request %i: failed to queue: %u\n", index, status);
+        outstanding--;
+        failures++;
+    }
+    disk_fetch_commands();
+}
+
+static void
+bench_reset(
+    _In_ int ncq)
+{
+    memset(&requests[0], 0, sizeof(requests));
+    memset(&commands[0], 0, sizeof(commands));
+    device.HasNCQ    = ncq;
+    port->QueueDepth = ncq ? AHCI_MAX_COMMAND_SLOTS : 1;
+    port->NextSector = 0;
+    diskHead         = 0;
+    diskTime         = 0.0;
+    diskActive       = 0;
+    diskMaxActive    = 0;
+    diskCommands     = 0;
+    diskErrorTag     = -1;
+}
+
+static int
+bench_verify(
+    _In_ int         count,
+    _In_ const char* name)
+{
+    int result = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (requests[i].completions != 1 || requests[i].status != OsSuccess ||
+            requests[i].sectors != BENCH_REQUEST_SECTORS) {
+            printf("%s: request %i completed %i times, status %u, %u sectors\n", name, i,
+                requests[i].completions, requests[i].status, (unsigned int)requests[i].sectors);
+            result++;
+        }
+    }
+    return result;
+}
+
+static int
+bench_random(
+    _In_ int ncq,
+    _In_ int depth)
+{
+    struct timespec start;
+    const char*     name = ncq ? "ncq" : "dma";
+    double          elapsed;
+    int             submitted = 0;
+    int             result;
+
+    bench_reset(ncq);
+    srand(1);
+    timespec_get(&start, TIME_MONOTONIC);
+    while (submitted < BENCH_REQUESTS || outstanding) {
+        while (submitted < BENCH_REQUESTS && outstanding < depth) {
+            uint64_t sector = ((uint64_t)rand() * (RAND_MAX + 1ULL) + (uint64_t)rand()) %
+                (BENCH_DISK_SECTORS / BENCH_REQUEST_SECTORS);
+            bench_submit(submitted++, sector * BENCH_REQUEST_SECTORS);
+        }
+        disk_complete_command();
+        disk_fetch_commands();
+    }
+    elapsed = bench_elapsed(&start);
+
+    result = bench_verify(BENCH_REQUESTS, name);
+    if (ncq && diskMaxActive != depth) {
+        printf("%s: %i commands were outstanding at queue depth %i\n", name, diskMaxActive, depth);
+        result++;
+    }
+
+    printf("%s queue depth %2i: %6.0f IOPS, %5.2f us driver time per request\n", name, depth,
+        ((double)BENCH_REQUESTS * 1000000.0) / diskTime, (elapsed * 1000000.0) / (double)BENCH_REQUESTS);
+    return result;
+}
+
+static int
+bench_merge(
+    _In_ int ncq)
+{
+    const char* name = ncq ? "ncq merge" : "dma merge";
+    int         result;
+    int         i;
+
+    // Only the requests that have to wait for a slot can be merged
+    bench_reset(ncq);
+    for (i = 0; i < BENCH_MAX_OUTSTANDING; i++) {
+        bench_submit(i, (uint64_t)i * BENCH_REQUEST_SECTORS);
+    }
+    while (outstanding) {
+        disk_complete_command();
+        disk_fetch_commands();
+    }
+
+    result = bench_verify(BENCH_MAX_OUTSTANDING, name);
+    if (diskCommands >= BENCH_MAX_OUTSTANDING) {
+        printf("%s: sequential requests were not merged\n", name);
+        result++;
+    }
+    printf("%s: %i sequential requests in %i commands\n", name, BENCH_MAX_OUTSTANDING, diskCommands);
+    return result;
+}
+
+static int
+bench_find_slot(
+    _In_ uint64_t sector)
+{
+    int i;
+
+    for (i = 0; i < AHCI_MAX_COMMAND_SLOTS; i++) {
+        if (commands[i].active && commands[i].sector == sector) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int
+bench_error(void)
+{
+    const char* name = "ncq error";
+    int         finished;
+    int         failed;
+    int         result = 0;
+    int         i;
+
+    // Requests are spread out so none of them are merged
+    bench_reset(1);
+    for (i = 0; i < BENCH_ERROR_REQUESTS; i++) {
+        bench_submit(i, (uint64_t)i * 2 * BENCH_REQUEST_SECTORS);
+    }
+
+    // One command finishes and another fails in the same interrupt, the device aborts
+    // the rest of them
+    finished = bench_find_slot(2 * BENCH_REQUEST_SECTORS);
+    failed   = bench_find_slot(4 * BENCH_REQUEST_SECTORS);
+    if (finished == -1 || failed == -1) {
+        printf("%s: requests were not issued\n", name);
+        return 1;
+    }
+
+    port->Registers->AtaActive   &= ~(1 << finished);
+    port->Registers->TaskFileData = (ATA_ERR_DEV_ABORT << 8) | ATA_STS_DEV_READY | ATA_STS_DEV_ERROR;
+    memset(&commands[0], 0, sizeof(commands));
+    diskActive   = 0;
+    diskErrorTag = failed;
+    controller.InterruptResource.PortInterruptStatus[port->Index] |= AHCI_PORT_IE_SDBE | AHCI_PORT_IE_TFEE;
+    AhciPortInterruptHandler(&controller, port);
+    port->Registers->TaskFileData = ATA_STS_DEV_READY;
+
+    disk_fetch_commands();
+    while (outstanding) {
+        disk_complete_command();
+        disk_fetch_commands();
+    }
+
+    for (i = 0; i < BENCH_ERROR_REQUESTS; i++) {
+        // The failed command was the one of the third request
+        if (i == 2) {
+            if (requests[i].completions != 1 || requests[i].status == OsSuccess || requests[i].sectors != 0) {
+                printf("%s: failed request completed %i times, status %u, %u sectors\n", name,
+                    requests[i].completions, requests[i].status, (unsigned int)requests[i].sectors);
+                result++;
+            }
+        }
+        else if (requests[i].completions != 1 || requests[i].status != OsSuccess ||
+            requests[i].sectors != BENCH_REQUEST_SECTORS) {
+            printf("%s: request %i completed %i times, status %u, %u sectors\n", name, i,
+                requests[i].completions, requests[i].status, (unsigned int)requests[i].sectors);
+            result++;
+        }
+    }
+    if (diskErrorTag != -1) {
+        printf("%s: the error log was not read\n", name);
+        result++;
+    }
+    printf("%s: %i requests in %i commands\n", name, BENCH_ERROR_REQUESTS, diskCommands);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    struct dma_buffer_info bufferInfo;
+    AHCIGenericRegisters_t* registers = (AHCIGenericRegisters_t*)&mmio[0];
+    int                     depth;
+
+    registers->Capabilities = AHCI_CAPABILITIES_SNCQ | ((AHCI_MAX_COMMAND_SLOTS - 1) << 8);
+    controller.Registers    = registers;
+
+    port = AhciPortCreate(&controller, 0, 0);
+    if (!port || AhciPortRebase(&controller, port) != OsSuccess) {
+        printf("failed to create emulated port\n");
+        return -1;
+    }
+    controller.Ports[0] = port;
+
+    bufferInfo.length   = BENCH_MAX_OUTSTANDING * BENCH_REQUEST_SECTORS * 512;
+    bufferInfo.capacity = bufferInfo.length;
+    bufferInfo.flags    = 0;
+    if (dma_create(&bufferInfo, &buffer) != OsSuccess) {
+        printf("failed to create transfer buffer\n");
+        return -1;
+    }
+
+    device.Controller     = &controller;
+    device.Port           = port;
+    device.Type           = DeviceATA;
+    device.HasDMAEngine   = 1;
+    device.QueueDepth     = AHCI_MAX_COMMAND_SLOTS;
+    device.SectorSize     = 512;
+    device.SectorCount    = BENCH_DISK_SECTORS;
+    device.AddressingMode = AHCI_DEVICE_MODE_LBA48;
+
+    printf("ahci benchmark: %i random reads of %i sectors per run\n", BENCH_REQUESTS, BENCH_REQUEST_SECTORS);
+    for (depth = 1; depth <= AHCI_MAX_COMMAND_SLOTS; depth *= 2) {
+        failures += bench_random(1, depth);
+    }
+    failures += bench_random(0, 1);
+    failures += bench_random(0, AHCI_MAX_COMMAND_SLOTS);
+    failures += bench_merge(1);
+    failures += bench_merge(0);
+    failures += bench_error();
+
+    dma_attachment_unmap(&buffer);
+    dma_detach(&buffer);
+    AhciPortCleanup(&controller, port);
+
+    printf("%i failures\n", failures);
+    return failures ? -1 : 0;
+}
+
+// The transaction layer reports back through the manager and the storage protocol
+size_t
+AhciManagerGetFrameSize(void)
+{
+    return 0x1000;
+}
+
+AhciDevice_t*
+AhciManagerGetDevice(
+    _In_ UUId_t deviceId)
+{
+    return &device;
+}
+
+OsStatus_t
+AhciManagerRegisterDevice(
+    _In_ AhciController_t* Controller,
+    _In_ AhciPort_t*       Port,
+    _In_ uint32_t          Signature)
+{
+    return OsSuccess;
+}
+
+void
+AhciManagerUnregisterDevice(
+    _In_ AhciController_t* Controller,
+    _In_ AhciPort_t*       Port)
+{
+}
+
+void
+AhciManagerHandleControlResponse(
+    _In_ AhciPort_t*        Port,
+    _In_ AhciTransaction_t* Transaction)
+{
+    if (Transaction->Command == AtaPIOReadLogExt) {
+        AhciTransactionHandleErrorLog(Port, Transaction);
+    }
+}
+
+void
+AhciManagerHandleQueuedError(
+    _In_ AhciController_t* Controller,
+    _In_ AhciPort_t*       Port)
+{
+    if (diskErrorTag == -1) {
+        printf("unexpected queued command error\n");
+        failures++;
+    }
+
+    if (AhciTransactionControlCreate(&device, AtaPIOReadLogExt, AHCI_LOG_NCQ_ERROR,
+            device.SectorSize, AHCI_XACTION_IN) != OsSuccess) {
+        printf("failed to queue the error log read\n");
+        failures++;
+    }
+}
+
+int ctt_storage_transfer_response(struct gracht_recv_message* message, OsStatus_t status, size_t sectorsTransferred)
+{
+    struct bench_request* request = &requests[message->client];
+
+    request->completions++;
+    request->status  = status;
+    request->sectors = sectorsTransferred;
+    outstanding--;
+    return 0;
+}
@@ -0,0 +1,260 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * DMA pool test
+ *  - Verifies that objects from the dma slab pool are aligned to their size class,
+ *    never cross a page, are physically contiguous and never overlap. Then measures
+ *    allocation and free throughput of the slab pool against the general dma pool.
+ */
+
+#include <ddk/bufferpool.h>
+#include <ddk/slabpool.h>
+#include <os/dmabuf.h>
+#include <os/mollenos.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TEST_BUFFER_SIZE  (1024 * 1024)
+#define TEST_OBJECTS      2048
+#define TEST_ITERATIONS   1000000
+#define TEST_BATCH        256
+
+static const size_t testSizes[] = { 16, 24, 64, 100, 128, 256, 512, 1024, 4096 };
+
+static struct dma_sg_table sgTable;
+static size_t              pageSize;
+static void*               objects[TEST_OBJECTS];
+static size_t              objectSizes[TEST_OBJECTS];
+
+static double
+test_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static size_t
+test_class_size(
+    _In_ size_t length)
+{
+    size_t size = DMA_SLAB_MIN_SIZE;
+    while (size < length) {
+        size <<= 1;
+    }
+    return size;
+}
+
+static int
+test_verify_object(
+    _In_ struct dma_slab_pool* pool,
+    _In_ void*                 object,
+    _In_ uintptr_t             dma,
+    _In_ size_t                length)
+{
+    size_t offset    = dma_slab_pool_offset(pool, object);
+    size_t classSize = test_class_size(length);
+    int    firstIndex, lastIndex;
+    size_t sgOffset, lastOffset;
+
+    if (offset & (classSize - 1)) {
+        printf("object at 0x%x is not aligned to %u\n", (unsigned int)offset, (unsigned int)classSize);
+        return 1;
+    }
+
+    if ((offset % pageSize) + classSize > pageSize) {
+        printf("object at 0x%x crosses a page\n", (unsigned int)offset);
+        return 1;
+    }
+
+    if (dma_sg_table_offset(&sgTable, offset, &firstIndex, &sgOffset) != OsSuccess ||
+        dma_sg_table_offset(&sgTable, offset + classSize - 1, &lastIndex, &lastOffset) != OsSuccess ||
+        firstIndex != lastIndex) {
+        printf("object at 0x%x is not physically contiguous\n", (unsigned int)offset);
+        return 1;
+    }
+
+    if (dma != sgTable.entries[firstIndex].address + sgOffset) {
+        printf("object at 0x%x has the wrong dma address\n", (unsigned int)offset);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+test_invariants(
+    _In_ struct dma_slab_pool* pool)
+{
+    uintptr_t dma;
+    int       failures = 0;
+    int       count;
+    int       i;
+
+    for (count = 0; count < TEST_OBJECTS; count++) {
+        objectSizes[count] = testSizes[count % (sizeof(testSizes) / sizeof(testSizes[0]))];
+        if (dma_slab_pool_allocate(pool, objectSizes[count], &objects[count], &dma) != OsSuccess) {
+            break;
+        }
+        failures += test_verify_object(pool, objects[count], dma, objectSizes[count]);
+        memset(objects[count], count & 0xFF, objectSizes[count]);
+    }
+
+    // Objects that overlap would have overwritten each others pattern
+    for (i = 0; i < count; i++) {
+        unsigned char* bytes = (unsigned char*)objects[i];
+        size_t         j;
+        for (j = 0; j < objectSizes[i]; j++) {
+            if (bytes[j] != (unsigned char)(i & 0xFF)) {
+                printf("object %i was overwritten\n", i);
+                failures++;
+                break;
+            }
+        }
+        dma_slab_pool_free(pool, objects[i]);
+    }
+
+    printf("invariants: %i objects verified, %i failures\n", count, failures);
+    return failures;
+}
+
+static void
+test_report(
+    _In_ const char*      name,
+    _In_ struct timespec* start)
+{
+    double elapsed = test_elapsed(start);
+    printf("%-18s: %.1f ns per allocation and free\n", name,
+        (elapsed * 1000000000.0) / (double)TEST_ITERATIONS);
+}
+
+static int
+test_throughput(
+    _In_ struct dma_slab_pool* slabPool,
+    _In_ struct dma_pool*      dmaPool)
+{
+    struct timespec start;
+    int             i, j;
+
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < TEST_ITERATIONS; i++) {
+        if (dma_slab_pool_allocate(slabPool, 64, &objects[0], NULL) != OsSuccess) {
+            return 1;
+        }
+        dma_slab_pool_free(slabPool, objects[0]);
+    }
+    test_report("slab pool", &start);
+
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < TEST_ITERATIONS; i++) {
+        if (dma_pool_allocate(dmaPool, 64, &objects[0]) != OsSuccess) {
+            return 1;
+        }
+        dma_pool_free(dmaPool, objects[0]);
+    }
+    test_report("dma pool", &start);
+
+    // Batches exhaust the thread cache, so the shared free lists are used as well
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < TEST_ITERATIONS; i += TEST_BATCH) {
+        for (j = 0; j < TEST_BATCH; j++) {
+            if (dma_slab_pool_allocate(slabPool, 64, &objects[j], NULL) != OsSuccess) {
+                return 1;
+            }
+        }
+        for (j = 0; j < TEST_BATCH; j++) {
+            dma_slab_pool_free(slabPool, objects[j]);
+        }
+    }
+    test_report("slab pool batched", &start);
+
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < TEST_ITERATIONS; i += TEST_BATCH) {
+        for (j = 0; j < TEST_BATCH; j++) {
+            if (dma_pool_allocate(dmaPool, 64, &objects[j]) != OsSuccess) {
+                return 1;
+            }
+        }
+        for (j = 0; j < TEST_BATCH; j++) {
+            dma_pool_free(dmaPool, objects[j]);
+        }
+    }
+    test_report("dma pool batched", &start);
+    return 0;
+}
+
+static OsStatus_t
+test_create_buffer(
+    _In_ struct dma_attachment* attachment)
+{
+    struct dma_buffer_info info;
+
+    info.name     = "dmapool_test";
+    info.length   = TEST_BUFFER_SIZE;
+    info.capacity = TEST_BUFFER_SIZE;
+    info.flags    = DMA_UNCACHEABLE | DMA_CLEAN;
+    return dma_create(&info, attachment);
+}
+
+int main(int argc, char **argv)
+{
+    struct dma_attachment slabAttachment;
+    struct dma_attachment dmaAttachment;
+    struct dma_slab_pool* slabPool;
+    struct dma_pool*      dmaPool;
+    SystemDescriptor_t    descriptor;
+    int                   failures;
+
+    if (SystemQuery(&descriptor) != OsSuccess) {
+        return -1;
+    }
+    pageSize = descriptor.PageSizeBytes;
+
+    if (test_create_buffer(&slabAttachment) != OsSuccess ||
+        test_create_buffer(&dmaAttachment) != OsSuccess) {
+        printf("failed to create dma buffers\n");
+        return -1;
+    }
+
+    if (dma_get_sg_table(&slabAttachment, &sgTable, -1) != OsSuccess ||
+        dma_slab_pool_create(&slabAttachment, &slabPool) != OsSuccess ||
+        dma_pool_create(&dmaAttachment, &dmaPool) != OsSuccess) {
+        printf("failed to create the pools\n");
+        return -1;
+    }
+
+    printf("dma pool test: %i KiB buffers, %u byte pages, %i sg entries\n",
+        TEST_BUFFER_SIZE / 1024, (unsigned int)pageSize, sgTable.count);
+    failures  = test_invariants(slabPool);
+    failures += test_throughput(slabPool, dmaPool);
+
+    dma_slab_pool_destroy(slabPool);
+    dma_pool_destroy(dmaPool);
+    dma_attachment_unmap(&slabAttachment);
+    dma_attachment_unmap(&dmaAttachment);
+    dma_detach(&slabAttachment);
+    dma_detach(&dmaAttachment);
+    free(sgTable.entries);
+    return failures ? -1 : 0;
+}
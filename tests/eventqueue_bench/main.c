@@ -0,0 +1,169 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Event queue benchmark
+ *  - Measures the cost of queueing and cancelling timers while 100k timers are
+ *    pending, and how late timers fire when many of them expire close to each other
+ *    while those timers are still pending.
+ */
+
+#include <ddk/eventqueue.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+
+#define BENCH_PENDING_TIMERS 100000
+#define BENCH_FIRING_TIMERS  10000
+#define BENCH_FIRING_SPREAD  250
+
+static UUId_t         handles[BENCH_PENDING_TIMERS];
+static struct timespec queuedAt;
+static _Atomic(int)   timersFired;
+static _Atomic(long)  totalLatenessUs;
+static _Atomic(long)  maxLatenessUs;
+
+static double
+bench_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static void
+bench_never(
+    _In_ void* context)
+{
+    printf("pending timer fired unexpectedly\n");
+}
+
+static void
+bench_fired(
+    _In_ void* context)
+{
+    long expectedUs = (long)(intptr_t)context * 1000;
+    long latenessUs = (long)(bench_elapsed(&queuedAt) * 1000000.0) - expectedUs;
+    long currentMax = atomic_load(&maxLatenessUs);
+
+    if (latenessUs < 0) {
+        latenessUs = 0;
+    }
+
+    atomic_fetch_add(&totalLatenessUs, latenessUs);
+    while (latenessUs > currentMax &&
+        !atomic_compare_exchange_weak(&maxLatenessUs, &currentMax, latenessUs));
+    atomic_fetch_add(&timersFired, 1);
+}
+
+static void
+bench_queue(
+    _In_ EventQueue_t* queue)
+{
+    struct timespec start;
+    double          elapsed;
+    int             i;
+
+    // The timers expire far in the future, so they stay pending during the benchmark
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_PENDING_TIMERS; i++) {
+        handles[i] = QueueDelayedEvent(queue, bench_never, NULL, 600000 + (rand() % 600000));
+    }
+    elapsed = bench_elapsed(&start);
+    printf("queue:  %.2f us per timer\n", (elapsed * 1000000.0) / (double)BENCH_PENDING_TIMERS);
+}
+
+static int
+bench_cancel(
+    _In_ EventQueue_t* queue)
+{
+    struct timespec start;
+    double          elapsed;
+    int             failures = 0;
+    int             i;
+
+    // Cancel in random order
+    for (i = BENCH_PENDING_TIMERS - 1; i > 0; i--) {
+        int    j      = rand() % (i + 1);
+        UUId_t handle = handles[i];
+        handles[i]    = handles[j];
+        handles[j]    = handle;
+    }
+
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_PENDING_TIMERS; i++) {
+        if (CancelEvent(queue, handles[i]) != OsSuccess) {
+            failures++;
+        }
+    }
+    elapsed = bench_elapsed(&start);
+    printf("cancel: %.2f us per timer, %i failures\n",
+        (elapsed * 1000000.0) / (double)BENCH_PENDING_TIMERS, failures);
+    return failures;
+}
+
+static int
+bench_firing(
+    _In_ EventQueue_t* queue)
+{
+    int i;
+
+    timespec_get(&queuedAt, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_FIRING_TIMERS; i++) {
+        intptr_t delay = rand() % BENCH_FIRING_SPREAD;
+        QueueDelayedEvent(queue, bench_fired, (void*)delay, (size_t)delay);
+    }
+
+    while (atomic_load(&timersFired) < BENCH_FIRING_TIMERS && bench_elapsed(&queuedAt) < 10.0) {
+        thrd_sleepex(10);
+    }
+
+    printf("fired:  %i/%i timers, average lateness %.1f us, max %li us\n",
+        atomic_load(&timersFired), BENCH_FIRING_TIMERS,
+        (double)atomic_load(&totalLatenessUs) / (double)BENCH_FIRING_TIMERS,
+        atomic_load(&maxLatenessUs));
+    return atomic_load(&timersFired) != BENCH_FIRING_TIMERS;
+}
+
+int main(int argc, char **argv)
+{
+    EventQueue_t* queue = NULL;
+    int           failures;
+
+    printf("event queue benchmark: %i pending timers, %i firing timers\n",
+        BENCH_PENDING_TIMERS, BENCH_FIRING_TIMERS);
+
+    CreateEventQueue(&queue);
+    if (!queue) {
+        printf("failed to create event queue\n");
+        return -1;
+    }
+
+    srand(1);
+    bench_queue(queue);
+    failures  = bench_firing(queue);
+    failures += bench_cancel(queue);
+    DestroyEventQueue(queue);
+    return failures ? -1 : 0;
+}
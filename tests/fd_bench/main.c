@@ -0,0 +1,103 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * File descriptor benchmark
+ *  - Measures the per-call overhead of write(fd, buf, 1) on a pipe, including the
+ *    amortized cost of draining it, with a small and a large number of open
+ *    descriptors. The pipe is opened last, so it has the highest descriptor.
+ */
+
+#include <event.h>
+#include <io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_PIPE_SIZE  0x1000
+#define BENCH_DRAIN      256
+#define BENCH_ITERATIONS 1000000
+
+static int fillers[10000];
+
+static double
+bench_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static void
+bench_run(
+    _In_ int descriptors)
+{
+    struct timespec start;
+    char            buffer[BENCH_DRAIN] = { 'a' };
+    double          elapsed;
+    int             opened;
+    int             fd;
+    int             i;
+
+    // Open the filler descriptors with cheap event objects
+    for (opened = 0; opened < descriptors; opened++) {
+        fillers[opened] = eventd(0, EVT_RESET_EVENT);
+        if (fillers[opened] < 0) {
+            printf("failed to open descriptor %i\n", opened);
+            break;
+        }
+    }
+
+    fd = pipe(BENCH_PIPE_SIZE, 0);
+    if (fd < 0) {
+        printf("failed to create pipe\n");
+        goto cleanup;
+    }
+
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        write(fd, &buffer[0], 1);
+
+        // Drain the pipe before it fills up
+        if ((i % BENCH_DRAIN) == (BENCH_DRAIN - 1)) {
+            read(fd, &buffer[0], BENCH_DRAIN);
+        }
+    }
+    elapsed = bench_elapsed(&start);
+
+    printf("%5i descriptors (pipe fd %i): %.1f ns per write\n", opened, fd,
+        (elapsed * 1000000000.0) / (double)BENCH_ITERATIONS);
+    close(fd);
+
+cleanup:
+    for (i = 0; i < opened; i++) {
+        close(fillers[i]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    printf("descriptor benchmark: %i writes per run\n", BENCH_ITERATIONS);
+    bench_run(10);
+    bench_run(10000);
+    return 0;
+}
@@ -0,0 +1,241 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Malloc stress benchmark
+ *  - Measures the number of malloc/free operations per second for an increasing
+ *    number of threads, both for thread-local allocation patterns and for memory
+ *    that is allocated by one thread and freed by another
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#define BENCH_MAX_THREADS 8
+#define BENCH_SLOTS       256
+#define BENCH_ITERATIONS  200000
+
+struct bench_thread {
+    thrd_t        id;
+    unsigned int  seed;
+    void*         slots[BENCH_SLOTS];
+    unsigned long operations;
+};
+
+static struct bench_thread threads[BENCH_MAX_THREADS];
+static int                 threadCount;
+static mtx_t               barrierLock;
+static cnd_t               barrierSignal;
+static int                 barrierCount;
+static int                 barrierGeneration;
+
+static void
+bench_barrier(void)
+{
+    int generation;
+
+    mtx_lock(&barrierLock);
+    generation = barrierGeneration;
+    if (++barrierCount == threadCount) {
+        barrierCount = 0;
+        barrierGeneration++;
+        cnd_broadcast(&barrierSignal);
+    }
+    else {
+        while (generation == barrierGeneration) {
+            cnd_wait(&barrierSignal, &barrierLock);
+        }
+    }
+    mtx_unlock(&barrierLock);
+}
+
+static unsigned int
+bench_random(
+    _In_ unsigned int* seed)
+{
+    *seed = (*seed * 1103515245) + 12345;
+    return (*seed >> 16) & 0x7FFF;
+}
+
+static size_t
+bench_size(
+    _In_ unsigned int* seed)
+{
+    // Mostly small allocations with the occasional larger buffer
+    unsigned int value = bench_random(seed);
+    if ((value & 0xF) == 0) {
+        return 1024 + (value % 4096);
+    }
+    return 8 + (value % 256);
+}
+
+static int
+bench_local(
+    _In_ void* context)
+{
+    struct bench_thread* thread = context;
+    int                  i;
+
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        unsigned int slot = bench_random(&thread->seed) % BENCH_SLOTS;
+        if (thread->slots[slot]) {
+            free(thread->slots[slot]);
+            thread->slots[slot] = NULL;
+        }
+        else {
+            thread->slots[slot] = malloc(bench_size(&thread->seed));
+        }
+        thread->operations++;
+    }
+    return 0;
+}
+
+static void
+bench_fill(
+    _In_ struct bench_thread* thread)
+{
+    int i;
+
+    for (i = 0; i < BENCH_SLOTS; i++) {
+        if (!thread->slots[i]) {
+            thread->slots[i] = malloc(bench_size(&thread->seed));
+            thread->operations++;
+        }
+    }
+}
+
+static void
+bench_free_peer(
+    _In_ struct bench_thread* thread)
+{
+    struct bench_thread* peer = &threads[((thread - &threads[0]) + 1) % threadCount];
+    int                  i;
+
+    // Free everything the neighbouring thread allocated
+    for (i = 0; i < BENCH_SLOTS; i++) {
+        if (peer->slots[i]) {
+            free(peer->slots[i]);
+            peer->slots[i] = NULL;
+            thread->operations++;
+        }
+    }
+}
+
+static int
+bench_remote(
+    _In_ void* context)
+{
+    struct bench_thread* thread = context;
+    int                  round;
+
+    for (round = 0; round < (BENCH_ITERATIONS / BENCH_SLOTS); round++) {
+        bench_fill(thread);
+        bench_barrier();
+        bench_free_peer(thread);
+        bench_barrier();
+    }
+    return 0;
+}
+
+static int
+bench_release(
+    _In_ void* context)
+{
+    struct bench_thread* thread = context;
+    int                  i;
+
+    for (i = 0; i < BENCH_SLOTS; i++) {
+        free(thread->slots[i]);
+        thread->slots[i] = NULL;
+    }
+    return 0;
+}
+
+static void
+bench_run_threads(
+    _In_ thrd_start_t function)
+{
+    int i;
+
+    for (i = 0; i < threadCount; i++) {
+        thrd_create(&threads[i].id, function, &threads[i]);
+    }
+    for (i = 0; i < threadCount; i++) {
+        thrd_join(threads[i].id, NULL);
+    }
+}
+
+static double
+bench_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static unsigned long
+bench_operations(void)
+{
+    unsigned long operations = 0;
+    int           i;
+
+    for (i = 0; i < threadCount; i++) {
+        operations += threads[i].operations;
+        threads[i].operations = 0;
+    }
+    return operations;
+}
+
+int main(int argc, char **argv)
+{
+    struct timespec start;
+    double          elapsed;
+    int             i;
+
+    mtx_init(&barrierLock, mtx_plain);
+    cnd_init(&barrierSignal);
+
+    printf("malloc benchmark: %i iterations per thread\n", BENCH_ITERATIONS);
+    for (threadCount = 1; threadCount <= BENCH_MAX_THREADS; threadCount *= 2) {
+        memset(&threads[0], 0, sizeof(threads));
+        for (i = 0; i < threadCount; i++) {
+            threads[i].seed = 1 + i;
+        }
+
+        timespec_get(&start, TIME_MONOTONIC);
+        bench_run_threads(bench_local);
+        elapsed = bench_elapsed(&start);
+        printf("local  %i threads: %.0f ops/sec\n", threadCount, (double)bench_operations() / elapsed);
+
+        // Release the slots left over by the local run
+        bench_run_threads(bench_release);
+
+        timespec_get(&start, TIME_MONOTONIC);
+        bench_run_threads(bench_remote);
+        elapsed = bench_elapsed(&start);
+        printf("remote %i threads: %.0f ops/sec\n", threadCount, (double)bench_operations() / elapsed);
+    }
+    return 0;
+}
@@ -0,0 +1,179 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * File mapping test
+ *  - Maps a large file and reads it at random offsets, verifying the contents and
+ *    measuring the cost of faulting pages in compared to already mapped pages. Then
+ *    modifies a writable mapping and verifies the changes are written back.
+ */
+
+#include <io.h>
+#include <os/mollenos.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TEST_PATH        "mmap_test.dat"
+#define TEST_FILE_SIZE   (16 * 1024 * 1024)
+#define TEST_BLOCK_SIZE  0x10000
+#define TEST_READS       100000
+
+static unsigned int block[TEST_BLOCK_SIZE / sizeof(unsigned int)];
+
+// Every word of the file contains its own offset
+static unsigned int
+test_value(
+    _In_ size_t offset)
+{
+    return (unsigned int)(offset * 2654435761U);
+}
+
+static double
+test_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static int
+test_create_file(void)
+{
+    size_t offset;
+    size_t i;
+    int    fd;
+
+    fd = open(TEST_PATH, O_CREAT | O_TRUNC | O_RDWR | O_BINARY);
+    if (fd < 0) {
+        printf("failed to create %s\n", TEST_PATH);
+        return -1;
+    }
+
+    for (offset = 0; offset < TEST_FILE_SIZE; offset += TEST_BLOCK_SIZE) {
+        for (i = 0; i < TEST_BLOCK_SIZE / sizeof(unsigned int); i++) {
+            block[i] = test_value(offset + (i * sizeof(unsigned int)));
+        }
+
+        if (write(fd, &block[0], TEST_BLOCK_SIZE) != TEST_BLOCK_SIZE) {
+            printf("failed to write %s\n", TEST_PATH);
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static int
+test_random_reads(
+    _In_ int fd)
+{
+    struct timespec start;
+    unsigned int*   memory;
+    UUId_t          handle;
+    double          elapsed;
+    int             failures = 0;
+    int             pass;
+    int             i;
+
+    if (CreateFileMapping(fd, FILE_MAPPING_READ, 0, TEST_FILE_SIZE, (void**)&memory, &handle) != OsSuccess) {
+        printf("failed to create read-only mapping\n");
+        return 1;
+    }
+
+    // The first pass faults the chunks in, the second pass reads mapped pages only
+    for (pass = 0; pass < 2; pass++) {
+        srand(1);
+        timespec_get(&start, TIME_MONOTONIC);
+        for (i = 0; i < TEST_READS; i++) {
+            size_t index = ((size_t)rand() * (RAND_MAX + 1UL) + (size_t)rand()) %
+                (TEST_FILE_SIZE / sizeof(unsigned int));
+            if (memory[index] != test_value(index * sizeof(unsigned int))) {
+                failures++;
+            }
+        }
+        elapsed = test_elapsed(&start);
+        printf("%s pass: %.1f ns per read, %i mismatches\n", pass ? "mapped" : "faulting",
+            (elapsed * 1000000000.0) / (double)TEST_READS, failures);
+    }
+
+    DestroyFileMapping(handle);
+    return failures;
+}
+
+static int
+test_write_back(
+    _In_ int fd)
+{
+    unsigned int* memory;
+    unsigned int  value;
+    UUId_t        handle;
+    size_t        offset = (TEST_FILE_SIZE / 2) + 0x3000;
+    int           failures = 0;
+
+    if (CreateFileMapping(fd, FILE_MAPPING_READ | FILE_MAPPING_WRITE, 0x1000,
+            TEST_FILE_SIZE - 0x1000, (void**)&memory, &handle) != OsSuccess) {
+        printf("failed to create writable mapping\n");
+        return 1;
+    }
+
+    memory[(offset - 0x1000) / sizeof(unsigned int)] = 0xDEADBEEF;
+    if (FlushFileMapping(handle) != OsSuccess) {
+        printf("failed to flush writable mapping\n");
+        failures++;
+    }
+
+    if (pread(fd, &value, sizeof(value), offset) != sizeof(value) || value != 0xDEADBEEF) {
+        printf("write back mismatch at 0x%x\n", (unsigned int)offset);
+        failures++;
+    }
+
+    // The neighbouring words must be untouched
+    if (pread(fd, &value, sizeof(value), offset + sizeof(value)) != sizeof(value) ||
+        value != test_value(offset + sizeof(value))) {
+        printf("write back corrupted neighbour at 0x%x\n", (unsigned int)(offset + sizeof(value)));
+        failures++;
+    }
+
+    DestroyFileMapping(handle);
+    printf("write back: %s\n", failures ? "failed" : "ok");
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    int failures;
+    int fd;
+
+    printf("file mapping test: %i MiB file, %i random reads\n", TEST_FILE_SIZE / (1024 * 1024), TEST_READS);
+    fd = test_create_file();
+    if (fd < 0) {
+        return -1;
+    }
+
+    failures  = test_random_reads(fd);
+    failures += test_write_back(fd);
+
+    close(fd);
+    unlink(TEST_PATH);
+    return failures ? -1 : 0;
+}
@@ -0,0 +1,150 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * File open benchmark
+ *  - Measures the latency of opening and closing a file, and of a small positional
+ *    read, while an increasing number of other files are kept open. Both paths look
+ *    up open files and handles in the file manager, so neither may grow with the
+ *    number of open files.
+ */
+
+#include <io.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_PATH       "open_bench.dat"
+#define BENCH_ITERATIONS 1000
+#define BENCH_MAX_FILES  4096
+
+static int  fillers[BENCH_MAX_FILES];
+static char buffer[512];
+
+static double
+bench_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static int
+bench_create_target(void)
+{
+    int fd;
+
+    memset(&buffer[0], 0xA5, sizeof(buffer));
+    fd = open(BENCH_PATH, O_CREAT | O_TRUNC | O_RDWR | O_BINARY);
+    if (fd < 0) {
+        printf("failed to create %s\n", BENCH_PATH);
+        return -1;
+    }
+
+    if (write(fd, &buffer[0], sizeof(buffer)) != sizeof(buffer)) {
+        printf("failed to write %s\n", BENCH_PATH);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+static int
+bench_latency(
+    _In_ int fillerCount)
+{
+    struct timespec start;
+    double          openTime;
+    double          readTime;
+    int             fd;
+    int             i;
+
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        fd = open(BENCH_PATH, O_RDONLY | O_BINARY);
+        if (fd < 0) {
+            printf("%i files: failed to open %s\n", fillerCount, BENCH_PATH);
+            return -1;
+        }
+        close(fd);
+    }
+    openTime = bench_elapsed(&start);
+
+    fd = open(BENCH_PATH, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        printf("%i files: failed to open %s\n", fillerCount, BENCH_PATH);
+        return -1;
+    }
+
+    // Positional reads bypass the stdio buffers, so every read validates the handle
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        if (pread(fd, &buffer[0], 64, (i * 64) % sizeof(buffer)) != 64) {
+            printf("%i files: read failed\n", fillerCount);
+            close(fd);
+            return -1;
+        }
+    }
+    readTime = bench_elapsed(&start);
+    close(fd);
+
+    printf("%5i open files: open/close %.1f us, read %.1f us\n", fillerCount,
+        (openTime * 1000000.0) / (double)BENCH_ITERATIONS,
+        (readTime * 1000000.0) / (double)BENCH_ITERATIONS);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char name[32];
+    int  fillerCount = 0;
+    int  failures    = 0;
+    int  target;
+
+    printf("file open benchmark: %i iterations per run\n", BENCH_ITERATIONS);
+    if (bench_create_target()) {
+        return -1;
+    }
+
+    for (target = 16; target <= BENCH_MAX_FILES; target *= 4) {
+        while (fillerCount < target) {
+            sprintf(&name[0], "open_bench_%i.dat", fillerCount);
+            fillers[fillerCount] = open(&name[0], O_CREAT | O_TRUNC | O_RDWR | O_BINARY);
+            if (fillers[fillerCount] < 0) {
+                printf("stopped at %i open files\n", fillerCount);
+                target = BENCH_MAX_FILES;
+                break;
+            }
+            fillerCount++;
+        }
+        failures += bench_latency(fillerCount) ? 1 : 0;
+    }
+
+    while (fillerCount--) {
+        close(fillers[fillerCount]);
+        sprintf(&name[0], "open_bench_%i.dat", fillerCount);
+        unlink(&name[0]);
+    }
+    unlink(BENCH_PATH);
+    return failures ? -1 : 0;
+}
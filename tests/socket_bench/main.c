@@ -0,0 +1,268 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Local socket benchmark
+ *  - Measures the throughput and round trip latency of connected local sockets, for
+ *    both stream and datagram sockets. Data is sent in bursts that fit the receive
+ *    buffer of the peer, including the per-message headers, and the burst is drained
+ *    before the next one is sent. Connect and sendto latency is then measured while
+ *    an increasing number of bound sockets exist, to verify address lookups scale.
+ */
+
+#include <inet/local.h>
+#include <inet/socket.h>
+#include <io.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_BURST_BYTES   (16 * 1024)
+#define BENCH_TOTAL_BYTES   (32 * 1024 * 1024)
+#define BENCH_ROUND_TRIPS   10000
+#define BENCH_LOOKUPS       1000
+#define BENCH_MAX_SOCKETS   4096
+
+static char sendBuffer[BENCH_BURST_BYTES];
+static char recvBuffer[BENCH_BURST_BYTES];
+static int  fillerSockets[BENCH_MAX_SOCKETS];
+
+static double
+bench_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static int
+bench_receive(
+    _In_ int    fd,
+    _In_ int    type,
+    _In_ size_t length,
+    _In_ size_t messageSize)
+{
+    size_t bytesReceived = 0;
+
+    // Stream sockets may return less than requested, datagram sockets return exactly
+    // one message per call
+    while (bytesReceived < length) {
+        intmax_t result = recv(fd, &recvBuffer[0],
+            (type == SOCK_STREAM) ? (length - bytesReceived) : messageSize, 0);
+        if (result <= 0) {
+            return -1;
+        }
+        bytesReceived += (size_t)result;
+    }
+    return 0;
+}
+
+static int
+bench_throughput(
+    _In_ int         fds[2],
+    _In_ int         type,
+    _In_ size_t      messageSize,
+    _In_ const char* name)
+{
+    struct timespec start;
+    double          elapsed;
+    size_t          bytesSent = 0;
+    size_t          burst     = (BENCH_BURST_BYTES / messageSize) * messageSize;
+    size_t          i;
+
+    timespec_get(&start, TIME_MONOTONIC);
+    while (bytesSent < BENCH_TOTAL_BYTES) {
+        for (i = 0; i < burst; i += messageSize) {
+            if (send(fds[0], &sendBuffer[i], messageSize, 0) != (intmax_t)messageSize) {
+                printf("%s: send failed\n", name);
+                return -1;
+            }
+        }
+
+        if (bench_receive(fds[1], type, burst, messageSize)) {
+            printf("%s: receive failed\n", name);
+            return -1;
+        }
+        bytesSent += burst;
+    }
+    elapsed = bench_elapsed(&start);
+
+    printf("%s throughput (%u byte messages): %.1f MiB/s\n", name, (unsigned int)messageSize,
+        ((double)bytesSent / (1024.0 * 1024.0)) / elapsed);
+    return 0;
+}
+
+static int
+bench_latency(
+    _In_ int         fds[2],
+    _In_ int         type,
+    _In_ const char* name)
+{
+    struct timespec start;
+    double          elapsed;
+    int             i;
+
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+        if (send(fds[0], &sendBuffer[0], 1, 0) != 1 || bench_receive(fds[1], type, 1, 1) ||
+            send(fds[1], &sendBuffer[0], 1, 0) != 1 || bench_receive(fds[0], type, 1, 1)) {
+            printf("%s: round trip failed\n", name);
+            return -1;
+        }
+    }
+    elapsed = bench_elapsed(&start);
+
+    printf("%s round trip: %.1f us\n", name, (elapsed * 1000000.0) / (double)BENCH_ROUND_TRIPS);
+    return 0;
+}
+
+static int
+bench_socket_type(
+    _In_ int         type,
+    _In_ const char* name)
+{
+    int fds[2];
+    int failures = 0;
+
+    if (socketpair(AF_LOCAL, type, 0, &fds[0])) {
+        printf("%s: failed to create socket pair\n", name);
+        return 1;
+    }
+
+    failures += bench_throughput(fds, type, 64, name) ? 1 : 0;
+    failures += bench_throughput(fds, type, 1024, name) ? 1 : 0;
+    failures += bench_latency(fds, type, name) ? 1 : 0;
+
+    close(fds[0]);
+    close(fds[1]);
+    return failures;
+}
+
+static int
+bench_bind(
+    _In_ int         fd,
+    _In_ const char* name)
+{
+    struct sockaddr_lc address;
+
+    memset(&address, 0, sizeof(address));
+    address.slc_len    = sizeof(address);
+    address.slc_family = AF_LOCAL;
+    strncpy(&address.slc_addr[0], name, sizeof(address.slc_addr) - 1);
+    return bind(fd, (struct sockaddr*)&address, sizeof(address));
+}
+
+static int
+bench_lookups(
+    _In_ int fillerCount)
+{
+    struct sockaddr_lc target;
+    struct timespec    start;
+    double             connectTime;
+    double             sendtoTime;
+    int                fds[2];
+    int                i;
+
+    fds[0] = socket(AF_LOCAL, SOCK_DGRAM, 0);
+    fds[1] = socket(AF_LOCAL, SOCK_DGRAM, 0);
+    if (fds[0] < 0 || fds[1] < 0 || bench_bind(fds[1], "/bench/target")) {
+        printf("lookups: failed to create target socket\n");
+        return -1;
+    }
+
+    memset(&target, 0, sizeof(target));
+    target.slc_len    = sizeof(target);
+    target.slc_family = AF_LOCAL;
+    strcpy(&target.slc_addr[0], "/bench/target");
+
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        if (connect(fds[0], (struct sockaddr*)&target, sizeof(target))) {
+            printf("lookups: connect failed\n");
+            return -1;
+        }
+    }
+    connectTime = bench_elapsed(&start);
+
+    // Every datagram is routed by its destination address in the network service
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        if (sendto(fds[0], &sendBuffer[0], 1, 0, (struct sockaddr*)&target, sizeof(target)) != 1 ||
+            bench_receive(fds[1], SOCK_DGRAM, 1, 1)) {
+            printf("lookups: sendto failed\n");
+            return -1;
+        }
+    }
+    sendtoTime = bench_elapsed(&start);
+
+    printf("%5i sockets: connect %.1f us, sendto %.1f us\n", fillerCount,
+        (connectTime * 1000000.0) / (double)BENCH_LOOKUPS,
+        (sendtoTime * 1000000.0) / (double)BENCH_LOOKUPS);
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
+
+static int
+bench_scaling(void)
+{
+    char name[32];
+    int  fillerCount = 0;
+    int  failures    = 0;
+    int  target;
+
+    for (target = 16; target <= BENCH_MAX_SOCKETS; target *= 4) {
+        while (fillerCount < target) {
+            fillerSockets[fillerCount] = socket(AF_LOCAL, SOCK_DGRAM, 0);
+            sprintf(&name[0], "/bench/filler/%i", fillerCount);
+            if (fillerSockets[fillerCount] < 0 || bench_bind(fillerSockets[fillerCount], &name[0])) {
+                if (fillerSockets[fillerCount] >= 0) {
+                    close(fillerSockets[fillerCount]);
+                }
+                printf("scaling: stopped at %i sockets\n", fillerCount);
+                target = BENCH_MAX_SOCKETS;
+                break;
+            }
+            fillerCount++;
+        }
+        failures += bench_lookups(fillerCount) ? 1 : 0;
+    }
+
+    while (fillerCount--) {
+        close(fillerSockets[fillerCount]);
+    }
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    int failures;
+
+    memset(&sendBuffer[0], 0xA5, sizeof(sendBuffer));
+    printf("local socket benchmark: %i MiB per run, %i round trips\n",
+        BENCH_TOTAL_BYTES / (1024 * 1024), BENCH_ROUND_TRIPS);
+
+    failures  = bench_socket_type(SOCK_STREAM, "stream");
+    failures += bench_socket_type(SOCK_DGRAM, "datagram");
+    failures += bench_scaling();
+    return failures ? -1 : 0;
+}
@@ -0,0 +1,114 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Process spawn benchmark
+ *  - Measures the time from spawning a process until it has exited. The benchmark
+ *    spawns itself, and the child references a large part of the C library so the
+ *    loader has to bind a lot of imports before the child can run.
+ */
+
+#include <ctype.h>
+#include <io.h>
+#include <os/process.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+
+#define BENCH_PATH       "$bin/spawnbench.app"
+#define BENCH_ITERATIONS 100
+
+// Every function in this table must be bound when the image is loaded
+static void* imports[] = {
+    (void*)memchr, (void*)memcmp, (void*)memcpy, (void*)memmove, (void*)memset,
+    (void*)strcat, (void*)strchr, (void*)strcmp, (void*)strcoll, (void*)strcpy,
+    (void*)strcspn, (void*)strerror, (void*)strlen, (void*)strncat, (void*)strncmp,
+    (void*)strncpy, (void*)strpbrk, (void*)strrchr, (void*)strspn, (void*)strstr,
+    (void*)strtok, (void*)strxfrm, (void*)strdup, (void*)strndup, (void*)strnlen,
+    (void*)atof, (void*)atoi, (void*)atol, (void*)strtod, (void*)strtol,
+    (void*)strtoul, (void*)strtoll, (void*)strtoull, (void*)rand, (void*)srand,
+    (void*)calloc, (void*)free, (void*)malloc, (void*)realloc, (void*)abort,
+    (void*)atexit, (void*)exit, (void*)getenv, (void*)system, (void*)bsearch,
+    (void*)qsort, (void*)abs, (void*)labs, (void*)div, (void*)ldiv,
+    (void*)mblen, (void*)mbtowc, (void*)wctomb, (void*)mbstowcs, (void*)wcstombs,
+    (void*)fclose, (void*)fflush, (void*)fopen, (void*)freopen, (void*)setbuf,
+    (void*)setvbuf, (void*)fprintf, (void*)fscanf, (void*)printf, (void*)scanf,
+    (void*)sprintf, (void*)sscanf, (void*)snprintf, (void*)vfprintf, (void*)vprintf,
+    (void*)vsprintf, (void*)vsnprintf, (void*)fgetc, (void*)fgets, (void*)fputc,
+    (void*)fputs, (void*)getc, (void*)getchar, (void*)putc, (void*)putchar,
+    (void*)puts, (void*)ungetc, (void*)fread, (void*)fwrite, (void*)fgetpos,
+    (void*)fseek, (void*)fsetpos, (void*)ftell, (void*)rewind, (void*)clearerr,
+    (void*)feof, (void*)ferror, (void*)perror, (void*)remove, (void*)rename,
+    (void*)tmpfile, (void*)tmpnam, (void*)isalnum, (void*)isalpha, (void*)iscntrl,
+    (void*)isdigit, (void*)isgraph, (void*)islower, (void*)isprint, (void*)ispunct,
+    (void*)isspace, (void*)isupper, (void*)isxdigit, (void*)tolower, (void*)toupper,
+    (void*)clock, (void*)difftime, (void*)mktime, (void*)time, (void*)asctime,
+    (void*)ctime, (void*)gmtime, (void*)localtime, (void*)strftime, (void*)timespec_get,
+    (void*)wcslen, (void*)wcscpy, (void*)wcsncpy, (void*)wcscat, (void*)wcscmp,
+    (void*)wcsncmp, (void*)wcschr, (void*)wcsrchr, (void*)wcsstr, (void*)wcstol,
+    (void*)open, (void*)close, (void*)read, (void*)write, (void*)lseek
+};
+
+static double
+bench_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+int main(int argc, char **argv)
+{
+    struct timespec start;
+    double          elapsed;
+    UUId_t          handle;
+    int             exitCode;
+    int             failures = 0;
+    int             i;
+
+    // The child exits immediately, it only has to be loaded
+    if (argc > 1 && !strcmp(argv[1], "--child")) {
+        return (imports[0] != NULL) ? 0 : -1;
+    }
+
+    printf("spawn benchmark: %i spawns, %i imports per child\n", BENCH_ITERATIONS,
+        (int)(sizeof(imports) / sizeof(imports[0])));
+
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        if (ProcessSpawn(BENCH_PATH, "--child", &handle) != OsSuccess) {
+            printf("failed to spawn %s\n", BENCH_PATH);
+            return -1;
+        }
+
+        if (ProcessJoin(handle, 0, &exitCode) != OsSuccess || exitCode != 0) {
+            failures++;
+        }
+    }
+    elapsed = bench_elapsed(&start);
+
+    printf("%.2f ms per spawn, %i failures\n",
+        (elapsed * 1000.0) / (double)BENCH_ITERATIONS, failures);
+    return failures ? -1 : 0;
+}
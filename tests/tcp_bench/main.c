@@ -0,0 +1,206 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * TCP loopback benchmark
+ *  - Measures the throughput and round trip latency of a TCP connection over the
+ *    loopback adapter, with and without TCP_NODELAY. Data is sent in bursts that fit
+ *    the receive buffer of the peer, and the burst is drained before the next one.
+ */
+
+#include <inet/bits.h>
+#include <inet/socket.h>
+#include <inet/tcp.h>
+#include <io.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_PORT          7913
+#define BENCH_BURST_BYTES   (16 * 1024)
+#define BENCH_TOTAL_BYTES   (32 * 1024 * 1024)
+#define BENCH_ROUND_TRIPS   10000
+
+static char sendBuffer[BENCH_BURST_BYTES];
+static char recvBuffer[BENCH_BURST_BYTES];
+
+static double
+bench_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static int
+bench_receive(
+    _In_ int    fd,
+    _In_ size_t length)
+{
+    size_t bytesReceived = 0;
+
+    while (bytesReceived < length) {
+        intmax_t result = recv(fd, &recvBuffer[0], length - bytesReceived, 0);
+        if (result <= 0) {
+            return -1;
+        }
+        bytesReceived += (size_t)result;
+    }
+    return 0;
+}
+
+static int
+bench_throughput(
+    _In_ int         fds[2],
+    _In_ size_t      messageSize,
+    _In_ const char* name)
+{
+    struct timespec start;
+    double          elapsed;
+    size_t          bytesSent = 0;
+    size_t          burst     = (BENCH_BURST_BYTES / messageSize) * messageSize;
+    size_t          i;
+
+    timespec_get(&start, TIME_MONOTONIC);
+    while (bytesSent < BENCH_TOTAL_BYTES) {
+        for (i = 0; i < burst; i += messageSize) {
+            if (send(fds[0], &sendBuffer[i], messageSize, 0) != (intmax_t)messageSize) {
+                printf("%s: send failed\n", name);
+                return -1;
+            }
+        }
+
+        if (bench_receive(fds[1], burst)) {
+            printf("%s: receive failed\n", name);
+            return -1;
+        }
+        bytesSent += burst;
+    }
+    elapsed = bench_elapsed(&start);
+
+    printf("%s throughput (%u byte messages): %.1f MiB/s\n", name, (unsigned int)messageSize,
+        ((double)bytesSent / (1024.0 * 1024.0)) / elapsed);
+    return 0;
+}
+
+static int
+bench_latency(
+    _In_ int         fds[2],
+    _In_ const char* name)
+{
+    struct timespec start;
+    double          elapsed;
+    int             i;
+
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+        if (send(fds[0], &sendBuffer[0], 1, 0) != 1 || bench_receive(fds[1], 1) ||
+            send(fds[1], &sendBuffer[0], 1, 0) != 1 || bench_receive(fds[0], 1)) {
+            printf("%s: round trip failed\n", name);
+            return -1;
+        }
+    }
+    elapsed = bench_elapsed(&start);
+
+    printf("%s round trip: %.1f us\n", name, (elapsed * 1000000.0) / (double)BENCH_ROUND_TRIPS);
+    return 0;
+}
+
+// The handshake completes without accept being called, so the connection can be set
+// up from a single thread
+static int
+bench_connect(
+    _In_ int fds[2],
+    _In_ int noDelay)
+{
+    struct sockaddr_in address;
+    int                listener;
+
+    memset(&address, 0, sizeof(address));
+    address.sin_len         = sizeof(address);
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(BENCH_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return -1;
+    }
+
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) || listen(listener, 1)) {
+        close(listener);
+        return -1;
+    }
+
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (fds[0] < 0 || connect(fds[0], (struct sockaddr*)&address, sizeof(address))) {
+        close(listener);
+        return -1;
+    }
+
+    fds[1] = accept(listener, NULL, NULL);
+    close(listener);
+    if (fds[1] < 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return 0;
+}
+
+static int
+bench_connection(
+    _In_ int         noDelay,
+    _In_ const char* name)
+{
+    int fds[2];
+    int failures = 0;
+
+    if (bench_connect(fds, noDelay)) {
+        printf("%s: failed to connect\n", name);
+        return 1;
+    }
+
+    failures += bench_throughput(fds, 64, name) ? 1 : 0;
+    failures += bench_throughput(fds, 1024, name) ? 1 : 0;
+    failures += bench_throughput(fds, BENCH_BURST_BYTES, name) ? 1 : 0;
+    failures += bench_latency(fds, name) ? 1 : 0;
+
+    close(fds[0]);
+    close(fds[1]);
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    int failures;
+
+    memset(&sendBuffer[0], 0xA5, sizeof(sendBuffer));
+    printf("tcp loopback benchmark: %i MiB per run, %i round trips\n",
+        BENCH_TOTAL_BYTES / (1024 * 1024), BENCH_ROUND_TRIPS);
+
+    failures  = bench_connection(0, "nagle");
+    failures += bench_connection(1, "nodelay");
+    return failures ? -1 : 0;
+}
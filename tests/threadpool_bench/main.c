@@ -0,0 +1,137 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Thread pool benchmark
+ *  - Measures the throughput of small jobs through the driver thread pool for an
+ *    increasing number of workers. Jobs are queued one at the time from outside the
+ *    pool, as a batch, and recursively from jobs running inside the pool.
+ */
+
+#include <ddk/threadpool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_JOBS        100000
+#define BENCH_FANOUT      16
+#define BENCH_MAX_WORKERS 16
+
+static ThreadPool_t*  pool;
+static _Atomic(int)   jobsCompleted;
+static void*          arguments[BENCH_JOBS];
+
+static double
+bench_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static int
+bench_job(
+    _In_ void* argument)
+{
+    atomic_fetch_add(&jobsCompleted, 1);
+    return 0;
+}
+
+// Each job spawns more jobs until the requested number has been reached, so most of
+// the jobs are queued by the workers themselves
+static int
+bench_spawning_job(
+    _In_ void* argument)
+{
+    int depth = (int)(intptr_t)argument;
+    int i;
+
+    atomic_fetch_add(&jobsCompleted, 1);
+    if (depth) {
+        for (i = 0; i < BENCH_FANOUT; i++) {
+            ThreadPoolAddWork(pool, bench_spawning_job, (void*)(intptr_t)(depth - 1));
+        }
+    }
+    return 0;
+}
+
+static void
+bench_report(
+    _In_ const char*      name,
+    _In_ int              workers,
+    _In_ struct timespec* start)
+{
+    double elapsed = bench_elapsed(start);
+    int    jobs    = atomic_load(&jobsCompleted);
+
+    printf("%2i workers, %-9s: %.2f Mjobs/s (%i jobs)\n", workers, name,
+        ((double)jobs / 1000000.0) / elapsed, jobs);
+}
+
+static int
+bench_workers(
+    _In_ int workers)
+{
+    struct timespec start;
+    int             i;
+
+    if (ThreadPoolInitialize(workers, &pool) != OsSuccess) {
+        printf("failed to create a pool with %i workers\n", workers);
+        return -1;
+    }
+
+    atomic_store(&jobsCompleted, 0);
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_JOBS; i++) {
+        ThreadPoolAddWork(pool, bench_job, NULL);
+    }
+    ThreadPoolWait(pool);
+    bench_report("single", workers, &start);
+
+    atomic_store(&jobsCompleted, 0);
+    timespec_get(&start, TIME_MONOTONIC);
+    ThreadPoolAddWorkBatch(pool, bench_job, &arguments[0], BENCH_JOBS);
+    ThreadPoolWait(pool);
+    bench_report("batch", workers, &start);
+
+    // 1 + 16 + 256 + 4096 + 65536 jobs
+    atomic_store(&jobsCompleted, 0);
+    timespec_get(&start, TIME_MONOTONIC);
+    ThreadPoolAddWork(pool, bench_spawning_job, (void*)(intptr_t)4);
+    ThreadPoolWait(pool);
+    bench_report("recursive", workers, &start);
+
+    ThreadPoolDestroy(pool);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int failures = 0;
+    int workers;
+
+    printf("thread pool benchmark: %i jobs per run\n", BENCH_JOBS);
+    for (workers = 1; workers <= BENCH_MAX_WORKERS; workers *= 2) {
+        failures += bench_workers(workers) ? 1 : 0;
+    }
+    return failures ? -1 : 0;
+}
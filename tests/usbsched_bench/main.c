@@ -0,0 +1,243 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * USB scheduler benchmark
+ *  - Creates schedulers with the pool layouts of the UHCI, OHCI and EHCI drivers and
+ *    verifies that every element of a pool can be allocated exactly once, that freed
+ *    elements are reused and that physical addresses match the scatter-gather table.
+ *    Then measures element allocation and address translation throughput.
+ */
+
+#include <os/mollenos.h>
+#include "scheduler.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_ITERATIONS   100000
+#define BENCH_BATCH        8
+#define BENCH_MAX_ELEMENTS 400
+
+typedef struct BenchPool {
+    const char* Name;
+    size_t      Size;
+    size_t      Alignment;
+    size_t      Count;
+    size_t      Reserved;
+} BenchPool_t;
+
+typedef struct BenchController {
+    const char* Name;
+    size_t      SubframeCount;
+    int         PoolCount;
+    BenchPool_t Pools[4];
+} BenchController_t;
+
+// Descriptor sizes and pool settings as used by the 32 bit drivers
+static const BenchController_t controllers[] = {
+    { "uhci", 1, 2, {
+        { "qh", 36, 16, 50, 13 }, { "td", 44, 16, 400, 1 } } },
+    { "ohci", 1, 3, {
+        { "qh", 36, 16, 50, 1 }, { "td", 44, 16, 400, 1 }, { "itd", 80, 32, 50, 1 } } },
+    { "ehci", 8, 4, {
+        { "qh", 88, 32, 50, 2 }, { "td", 76, 32, 400, 1 }, { "itd", 148, 32, 50, 1 },
+        { "sitd", 56, 32, 50, 1 } } }
+};
+
+static uint8_t* elements[BENCH_MAX_ELEMENTS];
+
+static double
+bench_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static int
+bench_verify_physical(
+    _In_ UsbSchedulerPool_t* pool,
+    _In_ uint8_t*            element)
+{
+    size_t offset = (size_t)(element - pool->ElementPool);
+    size_t sgOffset;
+    int    sgIndex;
+
+    if (dma_sg_table_offset(&pool->ElementPoolDMATable, offset, &sgIndex, &sgOffset) != OsSuccess) {
+        return 1;
+    }
+    return (UsbSchedulerGetDma(pool, element) !=
+        pool->ElementPoolDMATable.entries[sgIndex].address + sgOffset) ? 1 : 0;
+}
+
+static int
+bench_verify_pool(
+    _In_ UsbScheduler_t* scheduler,
+    _In_ int             poolIndex)
+{
+    UsbSchedulerPool_t* pool     = &scheduler->Settings.Pools[poolIndex];
+    size_t              expected = pool->ElementCount - pool->ElementCountReserved;
+    size_t              count    = 0;
+    uint8_t*            element;
+    int                 failures = 0;
+    size_t              i, j;
+
+    // Every free element must be handed out exactly once
+    while (UsbSchedulerAllocateElement(scheduler, poolIndex, &elements[count]) == OsSuccess) {
+        UsbSchedulerObject_t* object = USB_ELEMENT_OBJECT(pool, elements[count]);
+        size_t                index  = (size_t)(elements[count] - pool->ElementPool) / pool->ElementAlignedSize;
+        if (index < pool->ElementCountReserved ||
+            (object->Index & USB_ELEMENT_INDEX_MASK) != index ||
+            bench_verify_physical(pool, elements[count])) {
+            failures++;
+        }
+
+        for (j = 0; j < count; j++) {
+            if (elements[j] == elements[count]) {
+                failures++;
+            }
+        }
+
+        if (++count > expected) {
+            break;
+        }
+    }
+
+    if (count != expected) {
+        printf("pool %i: allocated %u of %u elements\n", poolIndex, (unsigned int)count, (unsigned int)expected);
+        failures++;
+    }
+
+    // A double free must not make the element available twice
+    for (i = 0; i < count; i++) {
+        UsbSchedulerFreeElement(scheduler, elements[i]);
+    }
+    UsbSchedulerFreeElement(scheduler, elements[0]);
+
+    for (i = 0; i < expected; i++) {
+        if (UsbSchedulerAllocateElement(scheduler, poolIndex, &elements[i]) != OsSuccess) {
+            printf("pool %i: freed elements were not reused\n", poolIndex);
+            failures++;
+            break;
+        }
+    }
+
+    if (UsbSchedulerAllocateElement(scheduler, poolIndex, &element) == OsSuccess) {
+        printf("pool %i: element handed out twice\n", poolIndex);
+        UsbSchedulerFreeElement(scheduler, element);
+        failures++;
+    }
+
+    while (i--) {
+        UsbSchedulerFreeElement(scheduler, elements[i]);
+    }
+    return failures;
+}
+
+static int
+bench_pool(
+    _In_ UsbScheduler_t*    scheduler,
+    _In_ int                poolIndex,
+    _In_ const BenchPool_t* layout,
+    _In_ const char*        controllerName)
+{
+    UsbSchedulerPool_t* pool = &scheduler->Settings.Pools[poolIndex];
+    struct timespec     start;
+    double              allocTime;
+    double              dmaTime;
+    uintptr_t           checksum = 0;
+    int                 i, j;
+
+    // Transfers allocate a handful of descriptors at a time, and free them on completion
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        for (j = 0; j < BENCH_BATCH; j++) {
+            if (UsbSchedulerAllocateElement(scheduler, poolIndex, &elements[j]) != OsSuccess) {
+                printf("%s %s: allocation failed\n", controllerName, layout->Name);
+                return 1;
+            }
+        }
+        for (j = 0; j < BENCH_BATCH; j++) {
+            UsbSchedulerFreeElement(scheduler, elements[j]);
+        }
+    }
+    allocTime = bench_elapsed(&start);
+
+    timespec_get(&start, TIME_MONOTONIC);
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        uint8_t* element = USB_ELEMENT_INDEX(pool, pool->ElementCount - 1 - (i % pool->ElementCount));
+        checksum += UsbSchedulerGetDma(pool, element);
+    }
+    dmaTime = bench_elapsed(&start);
+
+    printf("%s %-4s (%3u x %3u bytes): %.1f ns per allocation, %.1f ns per translation (%x)\n",
+        controllerName, layout->Name, (unsigned int)pool->ElementCount,
+        (unsigned int)pool->ElementAlignedSize,
+        (allocTime * 1000000000.0) / (double)(BENCH_ITERATIONS * BENCH_BATCH),
+        (dmaTime * 1000000000.0) / (double)BENCH_ITERATIONS, (unsigned int)(checksum & 0xF));
+    return 0;
+}
+
+static int
+bench_controller(
+    _In_ const BenchController_t* controller)
+{
+    UsbSchedulerSettings_t settings;
+    UsbScheduler_t*        scheduler;
+    int                    failures = 0;
+    int                    i;
+
+    UsbSchedulerSettingsCreate(&settings, 1024, controller->SubframeCount, 900,
+        USB_SCHEDULER_FRAMELIST | USB_SCHEDULER_LINK_BIT_EOL);
+    for (i = 0; i < controller->PoolCount; i++) {
+        const BenchPool_t* layout = &controller->Pools[i];
+        UsbSchedulerSettingsAddPool(&settings, layout->Size, layout->Alignment, layout->Count,
+            layout->Reserved, 0, 0, layout->Size - sizeof(UsbSchedulerObject_t));
+    }
+
+    if (UsbSchedulerInitialize(&settings, &scheduler) != OsSuccess) {
+        printf("%s: failed to create scheduler\n", controller->Name);
+        return 1;
+    }
+
+    for (i = 0; i < controller->PoolCount; i++) {
+        failures += bench_verify_pool(scheduler, i);
+        failures += bench_pool(scheduler, i, &controller->Pools[i], controller->Name);
+    }
+
+    UsbSchedulerDestroy(scheduler);
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    int failures = 0;
+    int i;
+
+    printf("usb scheduler benchmark: %i iterations of %i allocations\n", BENCH_ITERATIONS, BENCH_BATCH);
+    for (i = 0; i < (int)(sizeof(controllers) / sizeof(controllers[0])); i++) {
+        failures += bench_controller(&controllers[i]);
+    }
+    printf("%i failures\n", failures);
+    return failures ? -1 : 0;
+}
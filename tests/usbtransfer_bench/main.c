@@ -0,0 +1,360 @@
+/**
+ * MollenOS
+ *
+ * Copyright 2020, Philip Meulengracht
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ? , either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * USB transfer benchmark
+ *  - Runs the usb manager against a simulated controller with thousands of bulk
+ *    transfers queued on a few endpoints. The simulated hardware retires the oldest
+ *    transfer of one endpoint at a time, and the benchmark verifies that only that
+ *    transfer is scanned and completed, and that it is completed exactly once. The
+ *    transfer is retired both like a controller with a done queue does it, and by
+ *    probing like controllers without one, which must only probe the first transfer
+ *    of each endpoint. Interrupt processing time is then compared against a controller
+ *    that reports every transfer as retired, which scans them all.
+ */
+
+#include <ddk/busdevice.h>
+#include "hci.h"
+#include "manager.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ctt_usbhost_protocol_server.h"
+
+#define BENCH_TRANSFERS 4096
+#define BENCH_ENDPOINTS 16
+#define BENCH_DEPTH     (BENCH_TRANSFERS / BENCH_ENDPOINTS)
+#define BENCH_ROUNDS    1000
+#define BENCH_MAX_IDS   (BENCH_TRANSFERS + (3 * BENCH_ROUNDS) + 1)
+
+#define BENCH_MODE_DONE_QUEUE 0
+#define BENCH_MODE_PROBE      1
+#define BENCH_MODE_SCAN_ALL   2
+
+// The simulated queue head only carries the bit that the controller clears once
+// the transfer has been retired
+typedef struct SimQueueHead {
+    reg32_t              Link;
+    reg32_t              Active;
+    UsbSchedulerObject_t Object;
+} SimQueueHead_t;
+
+// Every endpoint is a ring of transfers in queue order, the head is the oldest
+static UsbManagerTransfer_t* transfers[BENCH_ENDPOINTS][BENCH_DEPTH];
+static int                   heads[BENCH_ENDPOINTS];
+static unsigned char         notifications[BENCH_MAX_IDS];
+static UUId_t                nextTransferId = 1;
+static int                   reportAllRetired = 0;
+static size_t                scanCount;
+static size_t                probeCount;
+
+static double
+bench_elapsed(
+    _In_ struct timespec* start)
+{
+    struct timespec end;
+    struct timespec result;
+
+    timespec_get(&end, TIME_MONOTONIC);
+    timespec_diff(start, &end, &result);
+    return (double)result.tv_sec + ((double)result.tv_nsec / 1000000000.0);
+}
+
+static UsbManagerTransfer_t*
+bench_queue_transfer(
+    _In_ UsbManagerController_t* controller,
+    _In_ int                     endpoint)
+{
+    UsbManagerTransfer_t* transfer;
+    SimQueueHead_t*       qh;
+
+    if (UsbSchedulerAllocateElement(controller->Scheduler, 0, (uint8_t**)&qh) != OsSuccess) {
+        return NULL;
+    }
+
+    transfer = (UsbManagerTransfer_t*)malloc(sizeof(UsbManagerTransfer_t));
+    if (!transfer) {
+        UsbSchedulerFreeElement(controller->Scheduler, (uint8_t*)qh);
+        return NULL;
+    }
+
+    memset(transfer, 0, sizeof(UsbManagerTransfer_t));
+    transfer->Id                 = nextTransferId++;
+    transfer->DeviceId           = controller->Device.Base.Id;
+    transfer->Transfer.Type      = USB_TRANSFER_BULK;
+    transfer->Status             = TransferQueued;
+    transfer->EndpointDescriptor = qh;
+    transfer->Transfer.Address.DeviceAddress   = 1;
+    transfer->Transfer.Address.EndpointAddress = (uint8_t)(endpoint + 1);
+    ELEMENT_INIT(&transfer->header, (uintptr_t)transfer->Id, transfer);
+
+    qh->Active = 1;
+    UsbManagerRegisterTransfer(controller, transfer);
+    UsbManagerActivateTransfer(controller, transfer);
+    return transfer;
+}
+
+static int
+bench_verify_round(
+    _In_ UsbManagerController_t* controller,
+    _In_ UUId_t                  completedId,
+    _In_ UUId_t                  queuedId)
+{
+    if (notifications[completedId] != 1) {
+        printf("transfer %u was completed %u times\n", completedId, notifications[completedId]);
+        return 1;
+    }
+
+    if (UsbManagerGetTransfer(controller, completedId) != NULL ||
+        UsbManagerGetTransfer(controller, queuedId) == NULL) {
+        printf("transfer index is out of sync\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int
+bench_rounds(
+    _In_ UsbManagerController_t* controller,
+    _In_ const char*             name,
+    _In_ int                     mode)
+{
+    struct timespec start;
+    double          elapsed  = 0.0;
+    size_t          scans    = 0;
+    size_t          probes   = 0;
+    int             failures = 0;
+    int             i;
+
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+        int                    endpoint    = rand() % BENCH_ENDPOINTS;
+        int                    slot        = heads[endpoint];
+        UsbManagerTransfer_t** transfer    = &transfers[endpoint][slot];
+        UUId_t                 completedId = (*transfer)->Id;
+
+        // Let the hardware retire the oldest transfer of the endpoint and raise an interrupt
+        ((SimQueueHead_t*)(*transfer)->EndpointDescriptor)->Active = 0;
+
+        scanCount        = 0;
+        probeCount       = 0;
+        reportAllRetired = mode == BENCH_MODE_SCAN_ALL;
+        timespec_get(&start, TIME_MONOTONIC);
+        if (mode == BENCH_MODE_DONE_QUEUE) {
+            UsbManagerRetireTransfer(controller, *transfer);
+        }
+        else {
+            UsbManagerProbeTransfers(controller);
+        }
+        UsbManagerProcessTransfers(controller);
+        elapsed += bench_elapsed(&start);
+        scans   += scanCount;
+        probes  += probeCount;
+
+        // The transfer has been destroyed by now, keep the queue full. The new transfer
+        // is the last one on the endpoint.
+        *transfer = bench_queue_transfer(controller, endpoint);
+        if (!*transfer) {
+            printf("%s: failed to queue transfer\n", name);
+            return failures + 1;
+        }
+        heads[endpoint] = (slot + 1) % BENCH_DEPTH;
+
+        failures += bench_verify_round(controller, completedId, (*transfer)->Id);
+        if (mode != BENCH_MODE_SCAN_ALL && scanCount != 1) {
+            printf("%s: %u transfers scanned for a single completion\n", name, (unsigned int)scanCount);
+            failures++;
+        }
+
+        // The first transfer of every endpoint, and the one after the completed transfer
+        if (mode == BENCH_MODE_PROBE && probeCount > (BENCH_ENDPOINTS + 1)) {
+            printf("%s: %u transfers probed for a single completion\n", name, (unsigned int)probeCount);
+            failures++;
+        }
+    }
+
+    printf("%s: %.1f us per interrupt, %.1f transfers probed and %.1f scanned per interrupt\n", name,
+        (elapsed * 1000000.0) / (double)BENCH_ROUNDS, (double)probes / (double)BENCH_ROUNDS,
+        (double)scans / (double)BENCH_ROUNDS);
+    return failures;
+}
+
+static UsbManagerController_t*
+bench_create_controller(void)
+{
+    UsbSchedulerSettings_t  settings;
+    UsbManagerController_t* controller;
+    BusDevice_t             device;
+
+    memset(&device, 0, sizeof(BusDevice_t));
+    device.Base.Id     = 0x5B;
+    device.Base.Length = sizeof(BusDevice_t);
+
+    controller = UsbManagerCreateController(&device, UsbOHCI, sizeof(UsbManagerController_t));
+    if (!controller) {
+        return NULL;
+    }
+
+    UsbSchedulerSettingsCreate(&settings, 1024, 1, 900, USB_SCHEDULER_FRAMELIST | USB_SCHEDULER_LINK_BIT_EOL);
+    UsbSchedulerSettingsAddPool(&settings, sizeof(SimQueueHead_t), 16, BENCH_TRANSFERS + 1, 0,
+        offsetof(SimQueueHead_t, Link), offsetof(SimQueueHead_t, Link), offsetof(SimQueueHead_t, Object));
+    if (UsbSchedulerInitialize(&settings, &controller->Scheduler) != OsSuccess) {
+        UsbManagerDestroyController(controller);
+        return NULL;
+    }
+    return controller;
+}
+
+int main(int argc, char **argv)
+{
+    UsbManagerController_t* controller;
+    int                     failures = 0;
+    int                     i;
+
+    if (UsbManagerInitialize() != OsSuccess) {
+        printf("usb service is not available\n");
+        return -1;
+    }
+
+    controller = bench_create_controller();
+    if (!controller) {
+        printf("failed to create simulated controller\n");
+        return -1;
+    }
+
+    printf("usb transfer benchmark: %i queued transfers on %i endpoints, %i interrupts\n",
+        BENCH_TRANSFERS, BENCH_ENDPOINTS, BENCH_ROUNDS);
+    for (i = 0; i < BENCH_TRANSFERS; i++) {
+        int endpoint = i % BENCH_ENDPOINTS;
+        int slot     = i / BENCH_ENDPOINTS;
+
+        transfers[endpoint][slot] = bench_queue_transfer(controller, endpoint);
+        if (!transfers[endpoint][slot]) {
+            printf("failed to queue transfer %i\n", i);
+            return -1;
+        }
+    }
+
+    srand(1);
+    failures += bench_rounds(controller, "done queue", BENCH_MODE_DONE_QUEUE);
+    failures += bench_rounds(controller, "probe", BENCH_MODE_PROBE);
+    failures += bench_rounds(controller, "scan all", BENCH_MODE_SCAN_ALL);
+
+    UsbManagerClearTransfers(controller);
+    UsbSchedulerDestroy(controller->Scheduler);
+    (void)UsbManagerDestroyController(controller);
+    UsbManagerDestroy();
+    free(controller);
+
+    printf("%i failures\n", failures);
+    return failures ? -1 : 0;
+}
+
+// Simulated controller, every transfer consists of a single queue head
+int
+HciTransferRetired(
+    _In_ UsbManagerController_t* Controller,
+    _In_ UsbManagerTransfer_t*   Transfer)
+{
+    probeCount++;
+    if (reportAllRetired) {
+        return 1;
+    }
+    return ((SimQueueHead_t*)Transfer->EndpointDescriptor)->Active ? 0 : 1;
+}
+
+int
+HciProcessElement(
+    _In_ UsbManagerController_t* Controller,
+    _In_ uint8_t*                Element,
+    _In_ int                     Reason,
+    _In_ void*                   Context)
+{
+    UsbManagerTransfer_t* transfer = (UsbManagerTransfer_t*)Context;
+    SimQueueHead_t*       qh       = (SimQueueHead_t*)Element;
+
+    if (Reason == USB_REASON_SCAN) {
+        scanCount++;
+        if (!qh->Active) {
+            transfer->Status = TransferFinished;
+        }
+    }
+    return ITERATOR_CONTINUE;
+}
+
+void
+HciProcessEvent(
+    _In_ UsbManagerController_t* Controller,
+    _In_ int                     Event,
+    _In_ void*                   Context)
+{
+}
+
+OsStatus_t
+HciTransactionFinalize(
+    _In_ UsbManagerController_t* Controller,
+    _In_ UsbManagerTransfer_t*   Transfer,
+    _In_ int                     Reset)
+{
+    if (Transfer->EndpointDescriptor != NULL) {
+        UsbSchedulerFreeElement(Controller->Scheduler, (uint8_t*)Transfer->EndpointDescriptor);
+    }
+    return OsSuccess;
+}
+
+UsbTransferStatus_t
+HciQueueTransferGeneric(
+    _In_ UsbManagerTransfer_t* Transfer)
+{
+    return TransferQueued;
+}
+
+UsbTransferStatus_t
+HciQueueTransferIsochronous(
+    _In_ UsbManagerTransfer_t* Transfer)
+{
+    return TransferQueued;
+}
+
+void
+HciTimerCallback(
+    _In_ UsbManagerController_t* baseController)
+{
+}
+
+void
+UsbManagerSendNotification(
+    _In_ UsbManagerTransfer_t* Transfer)
+{
+    if (Transfer->Id < BENCH_MAX_IDS && notifications[Transfer->Id] < 0xFF) {
+        notifications[Transfer->Id]++;
+    }
+}
+
+void
+UsbManagerDestroyTransfer(
+    _In_ UsbManagerTransfer_t* Transfer)
+{
+    free(Transfer);
+}
+
+int ctt_usbhost_reset_endpoint_response(struct gracht_recv_message* message, OsStatus_t status)
+{
+    return 0;
+}
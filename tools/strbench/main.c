@@ -0,0 +1,242 @@
+/* String Benchmark Utility
+ * Author: Philip Meulengracht
+ * Date: 18-10-20
+ * Verifies the SSE2/AVX2 memory and string routines of the C library against the
+ * portable implementations for all alignment and length combinations, and measures
+ * their throughput. The library sources are compiled directly into this program. */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <emmintrin.h>
+#include <internal/_string.h>
+
+#define ALIGNMENTS    64
+#define MAX_LENGTH    512
+#define BUFFER_LENGTH (MAX_LENGTH + (2 * ALIGNMENTS) + 64)
+
+typedef struct StringVariant {
+    const char* Name;
+    int         (*IsSupported)(void);
+    void*       (*MemCpy)(void*, const void*, size_t);
+    void*       (*MemSet)(void*, int, size_t);
+    void*       (*MemChr)(const void*, int, size_t);
+    int         (*MemCmp)(const void*, const void*, size_t);
+    size_t      (*StrLen)(const char*);
+    char*       (*StrChr)(const char*, int);
+    int         (*StrCmp)(const char*, const char*);
+} StringVariant_t;
+
+static int AlwaysSupported(void) { return 1; }
+static int Sse2Supported(void) { return __builtin_cpu_supports("sse2"); }
+static int Avx2Supported(void) { return __builtin_cpu_supports("avx2"); }
+
+static StringVariant_t Variants[] = {
+    { "base", AlwaysSupported, memcpy_base, memset_base, memchr_base, memcmp_base, strlen_base, strchr_base, strcmp_base },
+    { "sse2", Sse2Supported, memcpy_sse2, memset_sse2, memchr_sse2, memcmp_sse2, strlen_sse2, strchr_sse2, strcmp_sse2 },
+    { "avx2", Avx2Supported, memcpy_avx2, memset_avx2, memchr_avx2, memcmp_avx2, strlen_avx2, strchr_avx2, strcmp_avx2 }
+};
+
+static unsigned char Source[BUFFER_LENGTH];
+static unsigned char Destination[BUFFER_LENGTH];
+static unsigned char Reference[BUFFER_LENGTH];
+static int           Failures = 0;
+
+// Stand-in for the library's non-temporal assembler copy, which uses the ms abi
+void asm_memcpy_sse2(void* Dest, const void* Source, int Loops, int RemainingBytes)
+{
+    const __m128i* src = (const __m128i*)Source;
+    __m128i*       dst = (__m128i*)Dest;
+    int            i;
+
+    for (i = 0; i < Loops * 8; i++) {
+        _mm_storeu_si128(dst++, _mm_loadu_si128(src++));
+    }
+    memcpy_base(dst, src, (size_t)RemainingBytes);
+}
+
+static int Sign(int Value)
+{
+    return (Value > 0) - (Value < 0);
+}
+
+static void Fail(const StringVariant_t* Variant, const char* Function, size_t Alignment1,
+    size_t Alignment2, size_t Length)
+{
+    if (Failures++ < 20) {
+        printf("  %s %s failed: alignment %u/%u, length %u\n", Variant->Name, Function,
+            (unsigned int)Alignment1, (unsigned int)Alignment2, (unsigned int)Length);
+    }
+}
+
+static void FillRandom(unsigned char* Buffer, size_t Length)
+{
+    size_t i;
+    for (i = 0; i < Length; i++) {
+        Buffer[i] = (unsigned char)(rand() | 1);
+    }
+}
+
+// Validates a single alignment/length combination against the portable implementations
+static void VerifyCombination(const StringVariant_t* Variant, size_t Alignment1,
+    size_t Alignment2, size_t Length)
+{
+    unsigned char* s1 = &Source[Alignment1];
+    unsigned char* s2 = &Destination[Alignment2];
+    size_t         Position;
+    int            Value;
+
+    FillRandom(Source, BUFFER_LENGTH);
+    FillRandom(Destination, BUFFER_LENGTH);
+    memcpy_base(Reference, Destination, BUFFER_LENGTH);
+
+    Variant->MemCpy(s2, s1, Length);
+    memcpy_base(&Reference[Alignment2], s1, Length);
+    if (memcmp_base(Destination, Reference, BUFFER_LENGTH)) {
+        Fail(Variant, "memcpy", Alignment1, Alignment2, Length);
+    }
+
+    Value = (int)Alignment1 + 0x100;
+    Variant->MemSet(s2, Value, Length);
+    memset_base(&Reference[Alignment2], Value, Length);
+    if (memcmp_base(Destination, Reference, BUFFER_LENGTH)) {
+        Fail(Variant, "memset", Alignment1, Alignment2, Length);
+    }
+
+    // Search for a byte that only exists at a random position, or not at all
+    Position = Length ? (size_t)rand() % Length : 0;
+    Value    = Length ? s1[Position] : 0;
+    if (Variant->MemChr(s1, Value, Length) != memchr_base(s1, Value, Length) ||
+        Variant->MemChr(s1, 0, Length) != memchr_base(s1, 0, Length)) {
+        Fail(Variant, "memchr", Alignment1, Alignment2, Length);
+    }
+
+    memcpy_base(s2, s1, Length);
+    if (Length && (rand() & 1)) {
+        s2[(size_t)rand() % Length] ^= 0x80;
+    }
+    if (Sign(Variant->MemCmp(s1, s2, Length)) != Sign(memcmp_base(s1, s2, Length))) {
+        Fail(Variant, "memcmp", Alignment1, Alignment2, Length);
+    }
+
+    // Terminate the strings, all other bytes are non-zero
+    s1[Length] = '\0';
+    memcpy_base(s2, s1, Length + 1);
+    if (Length && (rand() & 1)) {
+        s2[(size_t)rand() % Length] ^= 0x80;
+    }
+
+    if (Variant->StrLen((char*)s1) != strlen_base((char*)s1)) {
+        Fail(Variant, "strlen", Alignment1, Alignment2, Length);
+    }
+
+    if (Variant->StrChr((char*)s1, Value) != strchr_base((char*)s1, Value) ||
+        Variant->StrChr((char*)s1, 0) != strchr_base((char*)s1, 0) ||
+        Variant->StrChr((char*)s1, 0x100) != strchr_base((char*)s1, 0x100)) {
+        Fail(Variant, "strchr", Alignment1, Alignment2, Length);
+    }
+
+    if (Sign(Variant->StrCmp((char*)s1, (char*)s2)) != Sign(strcmp_base((char*)s1, (char*)s2))) {
+        Fail(Variant, "strcmp", Alignment1, Alignment2, Length);
+    }
+}
+
+static void Verify(const StringVariant_t* Variant)
+{
+    size_t Alignment1, Alignment2, Length;
+    int    FailuresBefore = Failures;
+
+    for (Alignment1 = 0; Alignment1 < ALIGNMENTS; Alignment1++) {
+        for (Alignment2 = 0; Alignment2 < ALIGNMENTS; Alignment2++) {
+            for (Length = 0; Length <= MAX_LENGTH; Length += (Length < 160) ? 1 : 23) {
+                VerifyCombination(Variant, Alignment1, Alignment2, Length);
+            }
+        }
+    }
+    printf("%s: %s\n", Variant->Name, (Failures == FailuresBefore) ? "ok" : "FAILED");
+}
+
+static double Now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+}
+
+// Keeps the compiler from optimizing away the benchmarked calls
+static volatile size_t Sink;
+
+static void Measure(const StringVariant_t* Variant, size_t Length, unsigned char* Buffer1,
+    unsigned char* Buffer2)
+{
+    size_t Iterations = (256 * 1024 * 1024) / (Length + 16);
+    double Rates[5];
+    double Start;
+    size_t i;
+
+    memset_base(Buffer1, 'a', Length + 64);
+    memset_base(Buffer2, 'a', Length + 64);
+    Buffer1[Length + 1] = '\0';
+    Buffer2[Length + 1] = '\0';
+
+#define MEASURE(Index, Expression) \
+    Start = Now(); \
+    for (i = 0; i < Iterations; i++) { Sink += (size_t)(Expression); } \
+    Rates[Index] = ((double)Length * (double)Iterations) / ((Now() - Start) * 1000000000.0);
+
+    MEASURE(0, Variant->MemCpy(Buffer2 + 1, Buffer1 + 3, Length));
+    MEASURE(1, Variant->MemSet(Buffer2 + 1, (int)i, Length));
+
+    // Restore the contents of the destination buffer for the comparisons
+    memset_base(Buffer2, 'a', Length + 64);
+    Buffer2[Length + 1] = '\0';
+
+    MEASURE(2, Variant->MemChr(Buffer1 + 1, 'z', Length));
+    MEASURE(3, Variant->StrLen((char*)Buffer1 + 1));
+    MEASURE(4, Variant->StrCmp((char*)Buffer1 + 1, (char*)Buffer2 + 1));
+#undef MEASURE
+
+    printf("  %-4s %8u %8.2f %8.2f %8.2f %8.2f %8.2f\n", Variant->Name, (unsigned int)Length,
+        Rates[0], Rates[1], Rates[2], Rates[3], Rates[4]);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t Lengths[] = { 16, 32, 64, 128, 256, 1024, 4096, 65536, 1024 * 1024 };
+    unsigned char*      Buffer1;
+    unsigned char*      Buffer2;
+    size_t              i, j;
+
+    printf("verifying alignments 0-%u and lengths 0-%u\n", ALIGNMENTS - 1, MAX_LENGTH);
+    for (i = 1; i < sizeof(Variants) / sizeof(Variants[0]); i++) {
+        if (Variants[i].IsSupported()) {
+            Verify(&Variants[i]);
+        }
+    }
+
+    if (argc > 1 && !strcmp(argv[1], "verify")) {
+        return Failures ? -1 : 0;
+    }
+
+    Buffer1 = malloc((1024 * 1024) + 128);
+    Buffer2 = malloc((1024 * 1024) + 128);
+    if (!Buffer1 || !Buffer2) {
+        return -1;
+    }
+
+    printf("throughput in GB/s\n");
+    printf("  %-4s %8s %8s %8s %8s %8s %8s\n", "", "length", "memcpy", "memset", "memchr", "strlen", "strcmp");
+    for (j = 0; j < sizeof(Lengths) / sizeof(Lengths[0]); j++) {
+        for (i = 0; i < sizeof(Variants) / sizeof(Variants[0]); i++) {
+            if (Variants[i].IsSupported()) {
+                Measure(&Variants[i], Lengths[j], Buffer1, Buffer2);
+            }
+        }
+    }
+
+    free(Buffer1);
+    free(Buffer2);
+    return Failures ? -1 : 0;
+}